@@ -1,606 +1,5078 @@
-﻿#include <cstdio>
-#include <bit>
-#include <thread>
-
-#define Release 1
-#define Debug 0
-
-inline static auto swap_endian(auto x) {
-	if constexpr (std::endian::native == std::endian::little) return std::byteswap(x);
-	else return x;
-}
-inline static void FRead(auto& v, FILE* pFile) {
-	fread(&v, sizeof(v), 1, pFile); v = swap_endian(v);
-}
-
-using Byte = uint8_t;
-using Index = uint64_t;
-using Size = uint64_t;
-using B1 = uint8_t;
-using B2 = uint16_t;
-using B4 = uint32_t;
-using B8 = uint64_t;
-using B8I = int64_t;
-
-const B4 Magic = 0x1BF52;
-B1 version[3] = { 1, 0, 0 };
-#if !Release
-B1 argOp = 0, infoOp = 0, memOp = 0;
-#endif
-B8 Vp[256] = {};
-enum VpTag : B1 {
-	_Space = 0x00, _Len = 0x01, _CodeSp = 0x02, _DataSp = 0x03, _StackSp = 0x04,
-	_ip = 0x10, _go_to = 0x11,
-	_stack_base = 0x20, _stack_top = 0x21,
-	_count = 0x30,
-	_exp_res = 0x50, _exp_arg = 0x51, _exp_last = 0x5f,
-	_error = 0xfe, _ExitWith = 0xff
-};
-
-#if !Release
-void printMem(const char* str);
-#endif
-
-struct SpaceT {
-	Byte* array;
-	B8 size;
-	SpaceT() :array(nullptr), size(0) {}
-	inline bool malloc(B8 size_) {
-		if (size_ == 0) return false;
-		array = (Byte*)::malloc(size_);
-		size = size_;
-		return array != nullptr;
-	}
-	inline ~SpaceT() {
-		if (array) {
-			#if !Release
-			if (memOp) printMem("Space end");
-			#endif
-			::free(array);
-		}
-		array = nullptr;
-		size = 0;
-	}
-	inline Byte* operator+(Index index) {
-		if constexpr (std::endian::native == std::endian::little) return array + (size - 1 - index);
-		else return array + index;
-	}
-	inline Byte* pIndex(Index index, B8 size_) {
-		Byte* l = *this + index;
-		Byte* r = *this + (index + size_ - 1);
-		return l < r ? l : r;
-	}
-	inline void memset(Index index, B8 size_, B1 var_ = 0) {
-		::memset(pIndex(index, size_), var_, size_);
-	}
-	inline size_t fread(Index index, B8 size_, FILE* pFile) {
-		Byte* p = pIndex(index, size_);
-		size_t r = ::fread(p, 1, size_, pFile);
-		if constexpr (std::endian::native == std::endian::little) {
-			Byte* left = p; Byte* right = p + size_ - 1;
-			while (left < right) {
-				Byte temp = *left;
-				*left = *right;
-				*right = temp;
-
-				++left; --right;
-			}
-		}
-		return r;
-	}
-	inline B1& operator[] (Index index) { return *(*this + index); }
-} Space;
-
-template<typename Bn> inline Bn& GetN(Index index) {
-	return * ( (Bn*) ( Space.pIndex(index, sizeof(Bn) ) ) );
-}
-template<> inline B1& GetN(Index index) { return Space[index]; }
-
-inline void CheckStack(Index p, Size size) {
-	if (p < Vp[_StackSp]) {
-		#if !Release
-		fprintf(stderr, "\033[31m[E]\033[0m Stack Space underflow.\n");
-		#endif
-		exit(0xb2);
-	}
-	if (p < Vp[_stack_base]) {
-		#if !Release
-		fprintf(stderr, "\033[31m[E]\033[0m Stack Ptr underflow.\n");
-		#endif
-		exit(0xb3);
-	}
-	if ((p + size) >= Space.size) {
-		#if !Release
-		fprintf(stderr, "\033[31m[E]\033[0m Stack Space overflow.\n");
-		#endif
-		exit(0xb4);
-	}
-}
-inline void CheckData(Index p, Size size) {
-	if ((p + size) < Space.size)return;
-
-	#if !Release
-	fprintf(stderr, "\033[31m[E]\033[0m Memory access error: Index={\033[35m%llu(0x%llx)\033[0m}\n", p, p);
-	#endif
-	exit(0xb1);
-	
-}
-inline Index CheckIp(B1 add) {
-	if (Vp[_ip] + add < Space.size) {
-		Vp[_ip] += add;
-		return Vp[_ip] - add;
-	};
-	#if !Release
-	fprintf(stderr, "\033[31m[E]\033[0m Malformed instruction & Memory access error.\n");
-	#endif
-	exit(0xb5);
-}
-inline Index CheckSafe(Index p) {
-	if ((p) < Space.size)return p;
-	return 0;
-}
-
-int Main();
-int Init(int argc, char** argv) {
-	if (argc <= 1) {
-		#if !Release
-		fprintf(stderr, "\033[31m[E]\033[0m Missing input file.\n");
-		#endif
-		return 0xa1;
-	}
-	FILE* pFile = fopen(argv[1], "rb");
-	if (pFile == NULL) { 
-		#if !Release
-		fprintf(stderr, "\033[31m[E]\033[0m File not opened: \033[36m`%s`\033[0m. ", argv[1]); perror("With"); 
-		#endif
-		return 0xa2; 
-	}
-	B4 magic; FRead(magic, pFile);
-	if (Magic != magic) {
-		fclose(pFile); 
-		#if !Release
-		fprintf(stderr, "\033[31m[E]\033[0m Invalid file format: Not a FnH file. \033[35mMagic: %u\033[0m.\n", magic);
-		#endif
-		return 0xa3;
-	}
-	fread(version, sizeof(B1), (sizeof version / sizeof B1), pFile);
-	#if Release
-	B1 temp1; fread(&temp1, sizeof(B1), 1, pFile);
-	#else
-	fread(&argOp, sizeof(B1), 1, pFile);
-	infoOp = B1(argOp & B1(0b00000001)); memOp = B1(argOp & B1(0b00000010));
-	if (infoOp) fprintf(stderr, "\033[32m[I]\033[0m Version: \033[33m[%u.%u.%u]\033[0m.\n\033[32m[I]\033[0m FnH file: \033[36m`%s`\033[0m.\n\033[32m[I]\033[0m Option: INFO{\033[36m%c\033[0m}.\n", version[0], version[1], version[2], argv[1], infoOp ? 'T' : 'F');
-	#endif
-	B8 PreSize = 16;
-	B8 CodeSize; FRead(CodeSize, pFile);
-	B8 DataSize; FRead(DataSize, pFile);
-	B8 StackSize; FRead(StackSize, pFile);
-	#if !Release
-	if (infoOp) fprintf(stderr, "\033[32m[I]\033[0m Space: Pre{\033[35m%llu\033[0m+\033[36m%llu\033[0m} Code{\033[35m%llu\033[0m+\033[36m%llu\033[0m} Data{\033[35m%llu\033[0m+\033[36m%llu\033[0m} Stack{\033[35m%llu\033[0m+\033[36m%llu\033[0m}.\n", 0LL, PreSize, PreSize, CodeSize, PreSize + CodeSize, DataSize, PreSize + CodeSize + DataSize, StackSize);
-	#endif
-	if (!Space.malloc(PreSize + CodeSize + DataSize + StackSize)) { 
-		fclose(pFile); 
-		#if !Release
-		fprintf(stderr, "\033[31m[E]\033[0m Memory error: malloc{%llu}. ", PreSize + CodeSize + DataSize + StackSize); perror("With"); 
-		#endif
-		return 0xa4;
-	}
-	size_t read_size = Space.fread(PreSize, CodeSize, pFile);
-	fclose(pFile);
-	if (read_size != CodeSize) { 
-		#if !Release
-		fprintf(stderr, "\033[31m[E]\033[0m Read error in \033[36m`%s`\033[0m to read {32 + \033[36m%llu\033[0m} but get {32 + \033[31m%zu\033[0m}. ", argv[1], CodeSize, read_size); if (feof(pFile))perror("With"); 
-		#endif
-		return 0xa5;
-	}
-	Space.memset(0, PreSize);
-	Vp[_Space] = 0; Vp[_Len] = Space.size;
-	Vp[_CodeSp] = PreSize; Vp[_DataSp] = PreSize + CodeSize;
-	Vp[_StackSp] = PreSize + CodeSize + DataSize;
-	Vp[_stack_base] = Vp[_StackSp]; Vp[_stack_top] = Vp[_stack_base];
-	Vp[_ip] = Vp[_CodeSp];
-	Vp[_ExitWith] = EXIT_SUCCESS;
-	Vp[_error] = 0;
-	#if !Release
-	if (memOp) printMem("Space begin");
-	#endif
-
-	return 0;
-}
-int main(int argc, char** argv) {
-	if (int r = Init(argc, argv)) return r;
-	return Main();
-}
-
-using Func = void(*)(Index&);
-
-using bcd64_t = uint64_t;
-bcd64_t uint64_to_bcd64(uint64_t num) {
-	bcd64_t result = 0;
-	int shift = 0;
-
-	while (num > 0 && shift < 64) {
-		uint8_t digit = num % 10;
-		result |= (static_cast<bcd64_t>(digit) << shift);
-		num /= 10;
-		shift += 4;
-	}
-	return result;
-}
-uint64_t bcd64_to_uint64(bcd64_t bcd) {
-	uint64_t result = 0;
-	uint64_t multiplier = 1;
-	for (int i = 0; i < 16; ++i) {
-		uint8_t digit = (bcd >> (i * 4)) & 0xF;
-		result += digit * multiplier;
-		multiplier *= 10;
-	}
-	return result;
-}
-inline void Div_(B8& r1, B8& r2, B8 a, B8 b) {
-	if (b == 0) {
-		#if !Release
-		fprintf(stderr, "\033[31m[E]\033[0m Division by zero.\n");
-		#endif
-		exit(0xc2);
-	}
-	else r1 = a / b; r2 = a % b;
-}
-inline void Div_I(B8I& r1, B8I& r2, B8I a, B8I b) {
-	if (b == 0) {
-		#if !Release
-		fprintf(stderr, "\033[31m[E]\033[0m Division by zero.\n");
-		#endif
-		exit(0xc2);
-	}
-	else r1 = a / b; r2 = a % b;
-}
-inline B8I& ToB8I(B8& p) {
-	return (*(B8I*)&(p));
-}
-inline B8I uint64_to_int64(B8 val, B8 sign) {
-	return (sign>0) ? B8I(val) : -B8I(val);
-}
-inline void int64_to_uint64(B8I x, B8& val, B8& sign) {
-	if (x >= 0) {
-		val = B8(x); sign = 1U;
-	}
-	else {
-		val = B8(-x); sign = 0U;
-	}
-}
-#if !Release
-void printMem(const char* str) {
-	fprintf(stderr, "\033[32m[I]\033[0m %s:\n\033[44m", str);
-	for (size_t i = 0; i != Space.size; i++) {
-		if (i == Vp[_CodeSp]) {
-			fprintf(stderr, "\033[42m");
-		}
-		if (i == Vp[_DataSp]) {
-			fprintf(stderr, "\033[41m");
-		}
-		if (i == Vp[_StackSp]) {
-			fprintf(stderr, "\033[45m");
-		}
-		fprintf(stderr, "%02x ", Space[i]);
-	}
-	fprintf(stderr, "\033[0m\n");
-}
-#endif
-#if Debug
-void printMemEX(const char* str, Index last, Index to) {
-	fprintf(stderr, "\033[32m[I]\033[0m %s:\n\033[44m", str);
-	B8 sign = 0;
-	for (size_t i = 0; i != Space.size; i++) {
-		if (i == Vp[_CodeSp]) {
-			sign = 42;
-			fprintf(stderr, "\033[""%llu""m", sign);
-		}
-		if (i == Vp[_DataSp]) {
-			sign = 41;
-			fprintf(stderr, "\033[""%llu""m", sign);
-		}
-		if (i == Vp[_StackSp]) {
-			sign = 45;
-			fprintf(stderr, "\033[""%llu""m", sign);
-		}
-		if (i == last) {
-			fprintf(stderr, "\033[46m");
-			fprintf(stderr, "%02x ", Space[i]);
-			fprintf(stderr, "\033[""%llu""m", sign);
-			continue;
-		}
-		if (i == to) {
-			fprintf(stderr, "\033[43m");
-			fprintf(stderr, "%02x ", Space[i]);
-			fprintf(stderr, "\033[""%llu""m", sign);
-			continue;
-		}
-		fprintf(stderr, "%02x ", Space[i]);
-	}
-	if (last >= Space.size) {
-		fprintf(stderr, "\033[46m");
-		fprintf(stderr, "[%llu]", last);
-		fprintf(stderr, "\033[""%llu""m ", sign);
-	}
-	if (to >= Space.size) {
-		fprintf(stderr, "\033[43m");
-		fprintf(stderr, "[%llu]", to);
-		fprintf(stderr, "\033[""%llu""m ", sign);
-	}
-	fprintf(stderr, "\033[0m\nVp:\n");
-	for (Index i = 0; i != 256; i++) {
-		if(!(i&0xf))fprintf(stderr, "\033[41m[%llx0]", i>>4);
-		fprintf(stderr, "%llu ", Vp[i]);
-		fprintf(stderr, "\033[0m");
-	}
-	fprintf(stderr, "\033[0m\n");
-}
-#endif
-
-template<typename Bn> inline void Mov() {
-	Index ip = CheckIp(2); 
-	B8& v = Vp[Space[ip]];
-	v = Bn(Vp[Space[ip+1]]);
-}
-template<typename Bn> inline void Set() {
-	Index ip = CheckIp(1 + sizeof (Bn));
-	B8& r = Vp[Space[ip]];
-	r = GetN<Bn>(ip+1);
-}
-template<typename Bn> inline void Get() {
-	Index ip = CheckIp(2);
-	B8& r = Vp[Space[ip]];
-	r = (CheckData(Space[ip+1], sizeof(Bn)), GetN<Bn>(Space[ip+1]));
-}
-template<typename Bn> inline void Wrt() {
-	Index ip = CheckIp(2);
-	CheckData(Vp[Space[ip]], sizeof(Bn));
-	GetN<Bn>(Vp[Space[ip]]) = (Bn)(Vp[Space[ip+1]]);
-}
-template<typename Bn> inline void Psh(B8 val) {
-	CheckStack(Vp[_stack_top], sizeof (Bn));
-	GetN<Bn>(Vp[_stack_top]) = Bn(val);
-	Vp[_stack_top] += sizeof(Bn);
-}
-template<typename Bn> inline void Pop(B8& var) {
-	Vp[_stack_top] -= sizeof (Bn);
-	CheckStack(Vp[_stack_top], sizeof (Bn));
-	(var) = GetN<Bn>(Vp[_stack_top]);
-}
-template<typename Bn> inline void XCHG(B8 ym = 0xff) {
-	Index ip = CheckIp(2);
-	B8& p = Vp[Space[ip]];
-	Bn& x = (CheckData(Space[ip+1], sizeof(Bn)), GetN<Bn>(Space[ip+1]));
-	B8 temp = x;
-	x = Bn(p & ym);
-	p = p & (~ym) | temp;
-}
-template<typename Bn> inline void SCAS() {
-	Index ip = CheckIp(4);
-	B8& r = Vp[Space[ip]];
-	Bn x = Bn(Vp[Space[ip+1]]);
-	Index a = Vp[Space[ip+2]];
-	Size si = Vp[Space[ip+3]];
-	for (Index i = 0; i != si; i++) {
-		if (Space[a + i] == x) {
-			r = i; return;
-		}
-	}
-	r = B8(-1);
-}
-
-inline B8 Than_(B8 a, B8 b) {
-	return a > b ? 1 : (a < b ? B8(-1) : 0);
-}
-inline B8I Than_I(B8I a, B8I b) {
-	return a > b ? 1 : (a < b ? -1 : 0);
-}
-inline void MOVS_() {
-	Index ip = CheckIp(3);
-	Index f = Vp[Space[ip]];
-	Index t = Vp[Space[ip+1]];
-	Size si = Vp[Space[ip+2]];
-	for (Index i = 0; i != si; i++) {
-		Space[t + i] = Space[f + i];
-	}
-}
-inline void CMPS_() {
-	Index ip = CheckIp(4);
-	B8& r = Vp[Space[ip]];
-	Index a = Vp[Space[ip+1]];
-	Index b = Vp[Space[ip+2]];
-	Size si = Vp[Space[ip+3]];
-	for (Index i = 0; i != si; i++) {
-		if(Space[a + i] == Space[b + i])continue;
-		r = Space[a + i] < Space[b + i] ? B8(-1) : 1U; return;
-	}
-	r = 0;
-}
-inline void fopen_(B8& file, Index path, Size pathLen, Index mod, Size modLen) {
-	CheckData(path, pathLen);
-	char* pathStr = (char*)Space.pIndex(path, pathLen);
-	CheckData(mod, modLen);
-	char* modStr = (char*)Space.pIndex(mod, modLen);
-	Vp[_error] = B8(fopen_s((FILE**) & file, pathStr, modStr));
-}
-inline void fin_(B8 file, Index sp, Size spLen, Size once, Size cnt, B8& r) {
-	CheckData(sp, spLen);
-	char* pStr = new char[spLen] {};
-	FILE* pFile;
-	switch (file) {
-		case 0: pFile = stderr; break;
-		case 1: pFile = stdin; break;
-		case 2: pFile = stdout; break;
-		default:pFile = *(FILE**)&file;
-	}
-	r = fread_s(pStr, spLen, once, cnt, pFile);
-	for (Index i = 0; i != spLen; i++)Space[sp + i] = B1(pStr[i]);
-}
-inline void fout_(B8 file, Index sp, Size spLen, Size once, Size cnt, B8& r) {
-	CheckData(sp, spLen);
-	if (once * cnt > spLen) { 
-		r = 0; 
-		//fprintf(stderr, "[E] out: \"%s\"(%llu) [%llu] {%llu*%llu} -> ?(%llx) Ret %llu.\n", spLen, once, cnt, file, r);
-		return; 
-	}
-	char* pStr = new char[spLen] {};
-	for (Index i = 0; i != spLen; i++)pStr[i] = char(Space[sp + i]);
-	FILE* pFile;
-	switch (file) {
-		case 0: pFile = stderr; break;
-		case 1: pFile = stdin; break;
-		case 2: pFile = stdout; break;
-		default:pFile = *(FILE**)&file;
-	}
-	r = fwrite(pStr, once, cnt, pFile);
-	//fprintf(stderr, "[I] out: %s [%llu] {%llu*%llu} -> %llx(%llx) Ret %llu.\n", pStr, spLen, once, cnt, (B8)pFile, file, r);
-	delete[] pStr;
-}
-
-enum FuncTag {
-	NOP = 0x00, Exit = 0x01, Goto = 0x02, IfGo = 0x03, IfNG = 0x04, SvIp = 0x05, Loop = 0x06,
-	Call = 0x08, Ret = 0x09, 
-
-	Add = 0x10, Sub = 0x11, Mul = 0x12, Div = 0x13, Inc = 0x14, Dec = 0x15, 
-	Than = 0x16, Less = 0x17, More = 0x18, Not = 0x19, And = 0x1a, Or = 0x1b, Xor = 0x1c, ToBool = 0x1d,
-
-	Mov1 = 0x20, Mov2 = 0x21, Mov4 = 0x22, Mov8 = 0x23,
-	Set1 = 0x28, Set2 = 0x29, Set4 = 0x2a, Set8 = 0x2b,
-	Get1 = 0x30, Get2 = 0x31, Get4 = 0x32, Get8 = 0x33, LEA = 0x37,
-	Wrt1 = 0x38, Wrt2 = 0x39, Wrt4 = 0x3a, Wrt8 = 0x3b,
-	Psh1 = 0x40, Psh2 = 0x41, Psh4 = 0x42, Psh8 = 0x43,
-	Pop1 = 0x48, Pop2 = 0x49, Pop4 = 0x4a, Pop8 = 0x4b,
-
-	XCHG1 = 0x50, XCHG2 = 0x51, XCHG4 = 0x52, XCHG8 = 0x53, Swap = 0x57,
-
-	BcdT = 0x60, BcdF = 0x61, SignT = 0x62, SignF = 0x63, LMov = 0x64, RMov = 0x65, ROL = 0x66, ROR = 0x67,
-	Complement = 0x68, IMul = 0x69, IDiv = 0x6a, IThan = 0x6b, ILess = 0x6c, IMore = 0x6d, ILMov = 0x6e, IRMov = 0x6f,
-
-	‌MOVS = 0x70, CMPS = 0x71, Data = 0x72,
-	‌SCAS‌1 = 0x78, SCAS‌2 = 0x79, SCAS‌4 = 0x7a, SCAS8 = 0x7b,
-
-	FOPEN = 0x80, FIN = 0x81, FOUT = 0x82,
-
-	HTL = 0xe0,
-};
-
-int Main() {
-	auto& ip__ = Vp[_ip];
-	#if !Release
-	FuncTag lastFuncID = FuncTag(0); B8 lastIp = 0;
-	#endif
-	while (ip__ < Vp[_Len]) {
-		#if !Release
-		lastIp = ip__;
-		#endif
-		Index ip = CheckIp(1); FuncTag func_id = FuncTag(Space[ip]);
-		#if !Release
-		lastFuncID = func_id;
-		#endif
-		switch (func_id) {
-			case NOP:break;
-			case Exit:return int(Vp[_ExitWith]);
-			case Goto:ip = CheckIp(1); Vp[_ip] = Vp[Space[ip+1]]; break;
-			case IfGo:ip = CheckIp(2); if(Vp[Space[ip]]) Vp[_ip] = Vp[Space[ip+1]]; break;
-			case IfNG:ip = CheckIp(2); if(!(Vp[Space[ip]])) Vp[_ip] = Vp[Space[ip+1]]; break;
-			case SvIp:ip = CheckIp(1); Vp[Space[ip]] = Vp[_ip]; break;
-			case Loop:ip = CheckIp(2); if (--(Vp[Space[ip]])) Vp[_ip] = Vp[Space[ip+1]]; break;
-			case Call:ip = CheckIp(1); Psh<B8>(Vp[_ip]); Vp[_ip] = Vp[Space[ip + 1]]; break;
-			case Ret:ip = CheckIp(0); Pop<B8>(Vp[_ip]); break;
-			case Add:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip + 1]] + Vp[Space[ip + 2]]; ip += 3; break;
-			case Sub:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] - Vp[Space[ip+2]]; break;
-			case Mul:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] * Vp[Space[ip+2]]; break;
-			case Div:ip = CheckIp(4); Div_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
-			case IMul:ip = CheckIp(3); ToB8I(Vp[Space[ip]]) = ToB8I(Vp[Space[ip+1]]) * ToB8I(Vp[Space[ip+2]]); break;
-			case IDiv:ip = CheckIp(4); Div_I(ToB8I(Vp[Space[ip]]), ToB8I(Vp[Space[ip+1]]), ToB8I(Vp[Space[ip+2]]), ToB8I(Vp[Space[ip+3]])); break;
-			case Inc:ip = CheckIp(1); ++Vp[Space[ip]]; break;
-			case Dec:ip = CheckIp(1); --Vp[Space[ip]]; break;
-			case Than:ip = CheckIp(3); Vp[Space[ip]] = Than_(Vp[Space[ip+1]] , Vp[Space[ip+2]]); break;
-			case Less:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] < Vp[Space[ip+2]]; break;
-			case More:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] > Vp[Space[ip+2]]; break;
-			case IThan:ip = CheckIp(3); ToB8I(Vp[Space[ip+1]]) = Than_I(ToB8I(Vp[Space[ip+2]]), ToB8I(Vp[Space[ip+3]])); break;
-			case ILess:ip = CheckIp(3); ToB8I(Vp[Space[ip+1]]) = ToB8I(Vp[Space[ip+2]]) < ToB8I(Vp[Space[ip+3]]); break;
-			case IMore:ip = CheckIp(3); ToB8I(Vp[Space[ip+1]]) = ToB8I(Vp[Space[ip+2]]) > ToB8I(Vp[Space[ip+3]]); break;
-			case Not:ip = CheckIp(2); if (Vp[Space[ip + 1]]) Vp[Space[ip]] = 0U; else Vp[Space[ip]] = 1U; break;
-			case And:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] & Vp[Space[ip+2]]; break;
-			case Or:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] | Vp[Space[ip+2]]; break;
-			case Xor:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] ^ Vp[Space[ip+2]]; break;
-			case LMov:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] << Vp[Space[ip+2]]; break;
-			case RMov:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] >> Vp[Space[ip+2]]; break;
-			case ILMov:ip = CheckIp(3); ToB8I(Vp[Space[ip]]) = ToB8I(Vp[Space[ip+1]]) << ToB8I(Vp[Space[ip+2]]); break;
-			case IRMov:ip = CheckIp(3); ToB8I(Vp[Space[ip]]) = ToB8I(Vp[Space[ip+1]]) >> ToB8I(Vp[Space[ip+2]]); break;
-			case ROL:ip = CheckIp(3); Vp[Space[ip]] = std::rotl(Vp[Space[ip+1]], (int)ToB8I(Vp[Space[ip+2]])); break;
-			case ROR:ip = CheckIp(3); Vp[Space[ip]] = std::rotr(Vp[Space[ip+1]], (int)ToB8I(Vp[Space[ip+2]])); break;
-			case ToBool:ip = CheckIp(2); if (Vp[Space[ip + 1]]) Vp[Space[ip]] = 1U; else Vp[Space[ip]] = 0U; break;
-			case Complement: ip = CheckIp(2); Vp[Space[ip]] = ~(Vp[Space[ip+1]]); break;
-			case HTL:std::this_thread::sleep_for(std::chrono::hours(1)); break;
-			case Swap:ip = CheckIp(2); std::swap(Vp[Space[ip]],Vp[Space[ip+1]]); break;
-			case Mov1:Mov<B1>(); break;
-			case Mov2:Mov<B2>(); break;
-			case Mov4:Mov<B4>(); break;
-			case Mov8:Mov<B8>(); break;
-			case Set1:Set<B1>(); break;
-			case Set2:Set<B2>(); break;
-			case Set4:Set<B4>(); break;
-			case Set8:Set<B8>(); break;
-			case Get1:Get<B1>(); break;
-			case Get2:Get<B2>(); break;
-			case Get4:Get<B4>(); break;
-			case Get8:Get<B8>(); break;
-			case Wrt1:Wrt<B1>(); break;
-			case Wrt2:Wrt<B2>(); break;
-			case Wrt4:Wrt<B4>(); break;
-			case Wrt8:Wrt<B8>(); break;
-			case Psh1:ip = CheckIp(1); Psh<B1>(Vp[Space[ip]]); break;
-			case Psh2:ip = CheckIp(1); Psh<B2>(Vp[Space[ip]]); break;
-			case Psh4:ip = CheckIp(1); Psh<B4>(Vp[Space[ip]]); break;
-			case Psh8:ip = CheckIp(1); Psh<B8>(Vp[Space[ip]]); break;
-			case Pop1:ip = CheckIp(1); Pop<B1>(Vp[Space[ip]]); break;
-			case Pop2:ip = CheckIp(1); Pop<B2>(Vp[Space[ip]]); break;
-			case Pop4:ip = CheckIp(1); Pop<B4>(Vp[Space[ip]]); break;
-			case Pop8:ip = CheckIp(1); Pop<B8>(Vp[Space[ip]]); break;
-			case BcdF:ip = CheckIp(2); Vp[Space[ip]] = uint64_to_bcd64(Vp[Space[ip+1]]); break;
-			case BcdT:ip = CheckIp(2); Vp[Space[ip]] = bcd64_to_uint64(Vp[Space[ip+1]]); break;
-			case SignF:ip = CheckIp(3); ToB8I(Vp[Space[ip]]) = uint64_to_int64(Vp[Space[ip+1]], Vp[Space[ip+2]]); break;
-			case SignT:ip = CheckIp(3); int64_to_uint64(ToB8I(Vp[Space[ip]]), Vp[Space[ip+1]], Vp[Space[ip+2]]); break;
-			case LEA:ip = CheckIp(4); Vp[Space[ip]] = CheckSafe(Vp[Space[ip+1]] + (Vp[Space[ip+2]] * Vp[Space[ip+3]])); break;
-			case XCHG1:XCHG<B1>(0xff); break;
-			case XCHG2:XCHG<B2>(0xffff); break;
-			case XCHG4:XCHG<B4>(0xffffffff); break;
-			case XCHG8:XCHG<B8>(0xffffffffffffffff); break;
-			case ‌MOVS: MOVS_(); break;
-			case CMPS: CMPS_(); break;
-			case ‌SCAS‌1: SCAS<B1>(); break;
-			case SCAS‌2: SCAS<B2>(); break;
-			case SCAS‌4: SCAS<B4>(); break;
-			case SCAS8: SCAS<B8>(); break;
-			case FOPEN: ip = CheckIp(5); fopen_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]], Vp[Space[ip+4]]); break;
-			case FIN: ip = CheckIp(6); fin_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]], Vp[Space[ip+4]], Vp[Space[ip+5]]); break;
-			case FOUT: ip = CheckIp(6); fout_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]], Vp[Space[ip+4]], Vp[Space[ip+5]]); break;
-			case Data: { ip = CheckIp(1); B8& vpi = Vp[Space[ip]]; Vp[_ip]--; Set<B8>(); B8 at = Vp[_ip]; Vp[_ip]--/*Why??*/; Vp[_ip] += vpi; vpi = at; }break;
-			default:
-			{
-				#if !Release
-				fprintf(stderr, "\033[31m[E]\033[0m No instruction: id={\033[33m0x%02x\033[0m} at={\033[35m%llu(0x%llx)\033[0m}.\n", func_id, Vp[_ip], ip);
-				#endif
-				#if !Release
-				if (infoOp) fprintf(stderr, "\033[32m[I]\033[0m Last instruction: id={\033[33m0x%02x\033[0m} at={\033[35m%llu(0x%llx)\033[0m}.\n", lastFuncID, lastIp, lastIp);
-				#endif
-				return 0xc1;
-			}
-		}
-		
-		#if Debug
-		if (infoOp) fprintf(stderr, "\033[32m[I]\033[0m When: %llu 0x%llx.\n", lastIp, (B8)lastFuncID);
-		if (memOp) printMemEX("Space Now", lastIp, Vp[_ip]);
-		system("pause");
-		#endif
-	}
-
-	#if !Release
-	if (infoOp) fprintf(stderr, "\033[32m[I]\033[0m Exit: %llu (0x%llx).\n", Vp[_ExitWith], Vp[_ExitWith]);
-	#endif
-
-	return int(Vp[_ExitWith]);
-}
\ No newline at end of file
+﻿#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <new>
+#include <bit>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <algorithm>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <setjmp.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "simd.h"
+#include "bcd.h"
+#include "lz4.h"
+#include "fnh.h"
+#if SIMD_X86 && !defined(_MSC_VER)
+#include <x86intrin.h>
+#endif
+
+#define Release 1
+#define Debug 0
+// 0 compiles the -perf profiler out entirely.
+#define Profiler 1
+
+inline static auto swap_endian(auto x) {
+	if constexpr (std::endian::native == std::endian::little) return std::byteswap(x);
+	else return x;
+}
+inline static void FRead(auto& v, FILE* pFile) {
+	fread(&v, sizeof(v), 1, pFile); v = swap_endian(v);
+}
+inline static void FWrite(auto v, FILE* pFile) {
+	v = swap_endian(v); fwrite(&v, sizeof(v), 1, pFile);
+}
+#ifndef _WIN32
+// The bounds-checked stdio calls the loader and FOPEN/FIN are written against.
+inline static int fopen_s(FILE** ppFile, const char* path, const char* mode) {
+	*ppFile = fopen(path, mode);
+	return *ppFile ? 0 : errno;
+}
+inline static size_t fread_s(void* buf, size_t bufSize, size_t once, size_t cnt, FILE* pFile) {
+	if (once == 0 || cnt == 0) return 0;
+	if (cnt > bufSize / once) { errno = ERANGE; return 0; }
+	return fread(buf, once, cnt, pFile);
+}
+#endif
+
+using Byte = uint8_t;
+using Index = uint64_t;
+using Size = uint64_t;
+using B1 = uint8_t;
+using B2 = uint16_t;
+using B4 = uint32_t;
+using B8 = uint64_t;
+using B8I = int64_t;
+
+const B4 Magic = 0x1BF52;
+// Snapshots (SNAP, SIGUSR1): a header of SnapHead bytes, then the host bytes of Space,
+// so the file maps straight back as the space of the restored context.
+const B4 SnapMagic = 0x1BF53;
+const B1 SnapVersion[3] = { 1, 0, 0 };
+const B8 SnapHead = 1 << 16;
+// Raised by the signal handler, taken at the next dispatch boundary.
+inline volatile std::sig_atomic_t snapRequest = 0;
+enum EngineTag : B1 { Threaded = 0, Switch = 1 };
+enum LoadTag : B1 { Heap = 0, Mapped = 1, Huge = 2 };
+enum VpTag : B1 {
+	_Space = 0x00, _Len = 0x01, _CodeSp = 0x02, _DataSp = 0x03, _StackSp = 0x04, _HeapSp = 0x05,
+	_ip = 0x10, _go_to = 0x11,
+	_stack_base = 0x20, _stack_top = 0x21, _thread = 0x22, _thread_stack = 0x23, _stack_limit = 0x24,
+	_count = 0x30, _fuel = 0x31,
+	_io_size = 0x40, _io_flush = 0x41,
+	_exp_res = 0x50, _exp_arg = 0x51, _exp_last = 0x5f,
+	_error = 0xfe, _ExitWith = 0xff
+};
+
+// Reads len bytes of a file on a thread of its own, a Piece at a time into a ring of
+// Ring pieces, so that what has arrived can be used while the rest is on its way and no
+// more than the ring is held at once. The reader waits for the user to Free() a piece
+// before it fills it again. Up to a Piece is read in place, without a thread.
+struct ReadAheadT {
+	static constexpr B8 Piece = 1 << 20, Ring = 4;
+	Byte* buf = nullptr;
+	Byte* scratch = nullptr;
+	B8 len = 0, size = 0, have = 0, done = 0;
+	bool failed = false, stop = false;
+	std::mutex m;
+	std::condition_variable cv;
+	std::thread t;
+	bool Start(FILE* pFile, B8 len_) {
+		len = len_;
+		if (len > Piece) {
+			size = Ring * Piece;
+			buf = new (std::nothrow) Byte[size_t(size)];
+			if (buf == nullptr) return false;
+			try { t = std::thread(&ReadAheadT::Read, this, pFile); return true; }
+			catch (...) {}
+			delete[] buf;
+		}
+		// No thread to be had: all of it in place.
+		size = len ? len : 1;
+		buf = new (std::nothrow) Byte[size_t(size)];
+		if (buf == nullptr) return false;
+		have = ::fread(buf, 1, size_t(len), pFile);
+		return true;
+	}
+	void Read(FILE* pFile) {
+		for (B8 got = 0; got != len;) {
+			size_t want = size_t(len - got < Piece ? len - got : Piece);
+			{
+				std::unique_lock<std::mutex> l(m);
+				cv.wait(l, [&] { return got + want <= done + size || stop; });
+				if (stop) return;
+			}
+			size_t n = ::fread(buf + got % size, 1, want, pFile);
+			std::lock_guard<std::mutex> l(m);
+			got += n; have = got;
+			if (n != want) failed = true;
+			cv.notify_all();
+			if (failed) return;
+		}
+	}
+	// Waits until [from, upTo) has arrived and returns it in one piece of memory, or
+	// nullptr if the file ends first. At most a Piece, and nothing released.
+	const Byte* At(B8 from, B8 upTo) {
+		if (upTo > len || upTo - from > Piece) return nullptr;
+		if (!t.joinable()) return upTo <= have ? buf + from : nullptr;
+		{
+			std::unique_lock<std::mutex> l(m);
+			cv.wait(l, [&] { return have >= upTo || failed; });
+			if (have < upTo) return nullptr;
+		}
+		B8 at = from % size, n = upTo - from;
+		if (at + n <= size) return buf + at;
+		// Runs past the end of the ring.
+		if (scratch == nullptr) scratch = new Byte[size_t(Piece)];
+		::memcpy(scratch, buf + at, size_t(size - at));
+		::memcpy(scratch + (size - at), buf, size_t(n - (size - at)));
+		return scratch;
+	}
+	// Hands the bytes before upTo back to the reader.
+	void Free(B8 upTo) {
+		if (!t.joinable()) return;
+		std::lock_guard<std::mutex> l(m);
+		done = upTo;
+		cv.notify_all();
+	}
+	~ReadAheadT() {
+		if (t.joinable()) {
+			{ std::lock_guard<std::mutex> l(m); stop = true; }
+			cv.notify_all();
+			t.join();
+		}
+		delete[] buf;
+		delete[] scratch;
+	}
+};
+
+// Guest memory. Images before version 2 keep the whole space stored backwards on
+// little-endian hosts, so multi-byte values load without a swap; `linear` images
+// store it in guest order and only GetN/PutN swap bytes.
+struct SpaceT {
+	Byte* array;
+	B8 size;
+	bool linear;
+	// Set by map(): `array` lives inside [base, base + mapLen) instead of the heap.
+	Byte* base;
+	B8 mapLen;
+	// Set by mapShared() and mapFile() on Windows, where views are released differently.
+	bool view;
+	// [base, base + fileLen) is mapped from a file rather than anonymous memory.
+	B8 fileLen;
+	// Set by map() and mapShared() when asked for: `guard` bytes at guardAt that fault on
+	// any access, right past the guest's last byte (below `base` on reversed layouts).
+	B8 guard;
+	Byte* guardAt;
+	SpaceT() :array(nullptr), size(0), linear(false), base(nullptr), mapLen(0), view(false), fileLen(0), guard(0), guardAt(nullptr) {}
+	inline bool malloc(B8 size_) {
+		if (size_ == 0) return false;
+		array = (Byte*)::malloc(size_);
+		size = size_;
+		return array != nullptr;
+	}
+	static inline B8 PageSize() {
+		#ifdef _WIN32
+		SYSTEM_INFO si; GetSystemInfo(&si); return si.dwAllocationGranularity;
+		#else
+		return B8(sysconf(_SC_PAGESIZE));
+		#endif
+	}
+	// Reserves the space as demand-zero pages, so untouched Data/Stack costs nothing.
+	// `array` starts `pad` bytes into the first page; mapCode() relies on that to line
+	// the image file up with the page boundary. With `guard_` a page with no access
+	// follows the mapping (precedes it on reversed layouts); it only touches the guest's
+	// last byte when pad + size_ is a whole number of pages. Not on Windows.
+	inline bool map(B8 size_, B8 pad, bool huge, bool guard_ = false) {
+		if (size_ == 0 || size_ > ~B8(0) - pad - 2 * PageSize()) return false;
+		B8 page = PageSize();
+		mapLen = (pad + size_ + page - 1) / page * page;
+		#ifdef _WIN32
+		(void)huge; (void)guard_;
+		base = (Byte*)VirtualAlloc(nullptr, mapLen, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		if (base == nullptr) return false;
+		#else
+		B8 g = guard_ ? page : 0;
+		void* p = mmap(nullptr, mapLen + g, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED) return false;
+		base = (Byte*)p;
+		if (g) {
+			guardAt = Reversed() ? base : base + mapLen;
+			if (Reversed()) base += g;
+			if (mprotect(guardAt, g, PROT_NONE) != 0) { munmap(p, mapLen + g); base = guardAt = nullptr; return false; }
+			guard = g;
+		}
+		#ifdef MADV_HUGEPAGE
+		if (huge) madvise(base, mapLen, MADV_HUGEPAGE);
+		#else
+		(void)huge;
+		#endif
+		#endif
+		array = base + pad;
+		size = size_;
+		return true;
+	}
+	// Loads size_ bytes of code at `index` from file offset `offset`. A linear image is
+	// mapped copy-on-write straight from the file when its bytes line up with the pages
+	// of `array`; everything else is read and, on reversed layouts, flipped by fread().
+	inline size_t mapCode(Index index, B8 size_, FILE* pFile, B8 offset) {
+		#ifndef _WIN32
+		B8 page = PageSize();
+		Byte* at = array + index - offset;
+		struct stat st;
+		if (linear && base && at == base && fstat(fileno(pFile), &st) == 0) {
+			B8 have = B8(st.st_size) > offset ? B8(st.st_size) - offset : 0;
+			if (have < size_) return size_t(have);
+			B8 len = (offset + size_ + page - 1) / page * page;
+			if (size_ && mmap(at, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileno(pFile), 0) == MAP_FAILED) {
+				// MAP_FIXED may have already dropped the old pages; put demand-zero ones back.
+				if (mmap(at, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) == MAP_FAILED) return 0;
+				return fread(index, size_, pFile);
+			}
+			// The last page also holds whatever follows the code in the file.
+			::memset(array + index + size_, 0, size_t(at + len - (array + index + size_)));
+			fileLen = len;
+			return size_t(size_);
+		}
+		#else
+		(void)offset;
+		#endif
+		return fread(index, size_, pFile);
+	}
+	// Maps size_ bytes of pFile at `offset`, a multiple of the allocation granularity,
+	// copy-on-write as the whole space.
+	inline bool mapFile(FILE* pFile, B8 offset, B8 size_) {
+		if (size_ == 0) return false;
+		B8 page = PageSize();
+		B8 len = (size_ + page - 1) / page * page;
+		#ifdef _WIN32
+		HANDLE m = CreateFileMappingW((HANDLE)_get_osfhandle(_fileno(pFile)), nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		if (m == nullptr) return false;
+		base = (Byte*)MapViewOfFile(m, FILE_MAP_COPY, DWORD(offset >> 32), DWORD(offset), SIZE_T(size_));
+		CloseHandle(m);
+		view = true;
+		#else
+		void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fileno(pFile), off_t(offset));
+		base = p == MAP_FAILED ? nullptr : (Byte*)p;
+		#endif
+		if (base == nullptr) return false;
+		array = base; size = size_; mapLen = len; fileLen = len;
+		return true;
+	}
+	static inline bool Zero(const Byte* p, B8 n) {
+		static const Byte zeros[4096] = {};
+		for (B8 k = 0; k < n; k += sizeof zeros)
+			if (::memcmp(p + k, zeros, size_t(n - k < sizeof zeros ? n - k : sizeof zeros))) return false;
+		return true;
+	}
+	// Calls f(index, n) for the runs of `array`, in host order, that may hold nonzero
+	// bytes. On Linux, anonymous pages that were never touched (neither present nor
+	// swapped in /proc/self/pagemap) are skipped without reading them; the rest are read
+	// and skipped when all zero.
+	template<typename F> void ForUsed(F f) {
+		B8 page = PageSize();
+		Byte* first = array - reinterpret_cast<uintptr_t>(array) % page;
+		B8 runAt = 0, runLen = 0;
+		auto Flush = [&]() { if (runLen) f(runAt, runLen); runLen = 0; };
+		#ifdef __linux__
+		const B8 Window = 1 << 13;
+		int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+		B8* map = fd < 0 ? nullptr : new (std::nothrow) B8[Window];
+		B8 mapAt = ~B8(0), mapLen = 0;
+		#endif
+		for (Byte* p = first; p < array + size; p += page) {
+			Byte* lo = p < array ? array : p;
+			Byte* hi = p + page > array + size ? array + size : p + page;
+			bool used = true;
+			#ifdef __linux__
+			B8 k = B8(p - first) / page;
+			bool anon = !(base && p >= base && p < base + fileLen);
+			if (map && anon) {
+				if (k - mapAt >= mapLen) {
+					mapAt = k;
+					mapLen = (B8(array + size - p) + page - 1) / page;
+					if (mapLen > Window) mapLen = Window;
+					ssize_t r = pread(fd, map, size_t(mapLen * sizeof(B8)), off_t(reinterpret_cast<uintptr_t>(p) / page * sizeof(B8)));
+					mapLen = r > 0 ? B8(r) / sizeof(B8) : 0;
+				}
+				// Bit 63: present, bit 62: swapped.
+				if (k - mapAt < mapLen && !(map[k - mapAt] >> 62)) used = false;
+			}
+			#endif
+			if (!used || Zero(lo, B8(hi - lo))) { Flush(); continue; }
+			if (runLen == 0) runAt = B8(lo - array);
+			runLen += B8(hi - lo);
+		}
+		Flush();
+		#ifdef __linux__
+		delete[] map;
+		if (fd >= 0) close(fd);
+		#endif
+	}
+	#ifdef _WIN32
+	using SharedT = HANDLE;
+	#else
+	using SharedT = int;
+	#endif
+	// Maps len bytes of the shared memory object `from` copy-on-write, with `array` pad
+	// bytes in: pages stay shared until the guest writes them. Called again, it replaces
+	// the mapping in place and so gives up exactly the pages written since.
+	// With `guard_` the first call sets a guard page next to the mapping as map() does.
+	inline bool mapShared(SharedT from, B8 len, B8 pad, B8 size_, bool guard_ = false) {
+		#ifdef _WIN32
+		(void)guard_;
+		Byte* at = base;
+		if (base) UnmapViewOfFile(base);
+		base = (Byte*)MapViewOfFileEx(from, FILE_MAP_COPY, 0, 0, SIZE_T(len), at);
+		if (base == nullptr && at) base = (Byte*)MapViewOfFile(from, FILE_MAP_COPY, 0, 0, SIZE_T(len));
+		view = true;
+		#else
+		if (base == nullptr && guard_) {
+			// The mapping replaces all but one page of a reservation with no access.
+			B8 g = PageSize();
+			void* r = mmap(nullptr, len + g, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if (r == MAP_FAILED) { array = nullptr; return false; }
+			base = Reversed() ? (Byte*)r + g : (Byte*)r;
+			guardAt = Reversed() ? (Byte*)r : base + len;
+			guard = g;
+		}
+		void* p = mmap(base, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE | (base ? MAP_FIXED : 0), from, 0);
+		base = p == MAP_FAILED ? nullptr : (Byte*)p;
+		#endif
+		if (base == nullptr) { array = nullptr; return false; }
+		array = base + pad;
+		mapLen = len; fileLen = len;
+		size = size_;
+		return true;
+	}
+	inline ~SpaceT() {
+		if (array) {
+			if (base) {
+				#ifdef _WIN32
+				if (view) UnmapViewOfFile(base);
+				else VirtualFree(base, 0, MEM_RELEASE);
+				#else
+				munmap(guard && guardAt < base ? guardAt : base, mapLen + guard);
+				#endif
+			}
+			else ::free(array);
+		}
+		array = nullptr;
+		base = nullptr;
+		size = 0;
+	}
+	inline Byte* operator+(Index index) {
+		if constexpr (std::endian::native == std::endian::little) return linear ? array + index : array + (size - 1 - index);
+		else return array + index;
+	}
+	inline bool Has(Index index, B8 size_) {
+		return index <= size && size_ <= size - index;
+	}
+	// Guest order runs backwards through `array`.
+	inline bool Reversed() {
+		return std::endian::native == std::endian::little && !linear;
+	}
+	inline Byte* pIndex(Index index, B8 size_) {
+		Byte* l = *this + index;
+		Byte* r = *this + (index + size_ - 1);
+		return l < r ? l : r;
+	}
+	inline void memset(Index index, B8 size_, B1 var_ = 0) {
+		::memset(pIndex(index, size_), var_, size_);
+	}
+	inline size_t fread(Index index, B8 size_, FILE* pFile) {
+		Byte* p = pIndex(index, size_);
+		size_t r = ::fread(p, 1, size_, pFile);
+		if (Reversed()) Flip(p, size_);
+		return r;
+	}
+	// Unpacks a section of `stored` bytes at the file position into size_ bytes at `index`
+	// of a linear space, each chunk as soon as it has been read. Returns how many bytes
+	// came out, size_ only when the section held exactly them.
+	inline size_t unpack(Index index, B8 size_, FILE* pFile, B8 stored) {
+		ReadAheadT r;
+		if (!r.Start(pFile, stored)) return 0;
+		Byte* p = array + index;
+		B8 out = 0, at = 0;
+		while (out != size_) {
+			const Byte* h = r.At(at, at + 4);
+			if (h == nullptr) break;
+			B8 n = Lz4ChunkStored(h), want = size_ - out < PackChunk ? size_ - out : B8(PackChunk);
+			if ((h = r.At(at, at + 4 + n)) == nullptr || !Lz4UnpackChunk(h, p + out, size_t(want))) break;
+			at += 4 + n; out += want;
+			r.Free(at);
+		}
+		return out == size_ && at != stored ? 0 : size_t(out);
+	}
+	// Turns n host bytes read in file order into guest order on a reversed layout.
+	static inline void Flip(Byte* p, B8 n) {
+		if (n == 0) return;
+		Byte* left = p; Byte* right = p + n - 1;
+		while (left < right) {
+			Byte temp = *left;
+			*left = *right;
+			*right = temp;
+
+			++left; --right;
+		}
+	}
+	inline B1& operator[] (Index index) { return *(*this + index); }
+	template<typename Bn> inline Bn GetN(Index index) {
+		if constexpr (sizeof(Bn) == 1) return (*this)[index];
+		else {
+			Bn v; ::memcpy(&v, pIndex(index, sizeof(Bn)), sizeof(Bn));
+			return linear ? swap_endian(v) : v;
+		}
+	}
+	template<typename Bn> inline void PutN(Index index, Bn v) {
+		if constexpr (sizeof(Bn) == 1) (*this)[index] = v;
+		else {
+			if (linear) v = swap_endian(v);
+			::memcpy(pIndex(index, sizeof(Bn)), &v, sizeof(Bn));
+		}
+	}
+};
+
+enum FuncTag {
+	NOP = 0x00, Exit = 0x01, Goto = 0x02, IfGo = 0x03, IfNG = 0x04, SvIp = 0x05, Loop = 0x06,
+	Call = 0x08, Ret = 0x09, 
+
+	Add = 0x10, Sub = 0x11, Mul = 0x12, Div = 0x13, Inc = 0x14, Dec = 0x15, 
+	Than = 0x16, Less = 0x17, More = 0x18, Not = 0x19, And = 0x1a, Or = 0x1b, Xor = 0x1c, ToBool = 0x1d,
+
+	Mov1 = 0x20, Mov2 = 0x21, Mov4 = 0x22, Mov8 = 0x23,
+	Set1 = 0x28, Set2 = 0x29, Set4 = 0x2a, Set8 = 0x2b,
+	Get1 = 0x30, Get2 = 0x31, Get4 = 0x32, Get8 = 0x33, LEA = 0x37,
+	Wrt1 = 0x38, Wrt2 = 0x39, Wrt4 = 0x3a, Wrt8 = 0x3b,
+	Psh1 = 0x40, Psh2 = 0x41, Psh4 = 0x42, Psh8 = 0x43, PshM = 0x44,
+	Pop1 = 0x48, Pop2 = 0x49, Pop4 = 0x4a, Pop8 = 0x4b, PopM = 0x4c,
+
+	XCHG1 = 0x50, XCHG2 = 0x51, XCHG4 = 0x52, XCHG8 = 0x53, Swap = 0x57,
+
+	BcdT = 0x60, BcdF = 0x61, SignT = 0x62, SignF = 0x63, LMov = 0x64, RMov = 0x65, ROL = 0x66, ROR = 0x67,
+	Complement = 0x68, IMul = 0x69, IDiv = 0x6a, IThan = 0x6b, ILess = 0x6c, IMore = 0x6d, ILMov = 0x6e, IRMov = 0x6f,
+
+	‌MOVS = 0x70, CMPS = 0x71, Data = 0x72,
+	‌SCAS‌1 = 0x78, SCAS‌2 = 0x79, SCAS‌4 = 0x7a, SCAS8 = 0x7b,
+
+	FOPEN = 0x80, FIN = 0x81, FOUT = 0x82, SNAP = 0x83, AIN = 0x84, AOUT = 0x85, AWAIT = 0x86, APOLL = 0x87,
+
+	SPAWN = 0x90, YIELD = 0x91, JOIN = 0x92, WAKE = 0x93, AADD = 0x94, ACAS = 0x95,
+
+	VADD = 0xa0, VSUB = 0xa1, VMUL = 0xa2, VAND = 0xa3, VOR = 0xa4, VXOR = 0xa5,
+	VSUM = 0xa8, VMIN = 0xa9, VMAX = 0xaa, VFILL = 0xab, VSCAN = 0xac,
+
+	BcdAdd = 0xb0, BcdSub = 0xb1, BcdCmp = 0xb2, BcdFS = 0xb3, BcdTS = 0xb4,
+
+	ALLOC = 0xc0, FREE = 0xc1, REALLOC = 0xc2,
+
+	HTL = 0xe0,
+};
+
+// User-space buffering for FIN/FOUT. While Vp[_io_size] is 0 every handle goes through
+// stdio as before; otherwise each handle gets a buffer of that many bytes and talks to
+// its descriptor directly, batching buffer and guest memory into one writev/readv.
+// Vp[_io_flush] picks when output leaves the buffer.
+enum FlushTag : B1 { FlushFull = 0, FlushLine = 1, FlushEach = 2 };
+#ifdef _WIN32
+struct iovec { void* iov_base; size_t iov_len; };
+inline long long writev(int fd, const iovec* v, int n) {
+	long long r = 0;
+	for (int k = 0; k != n; k++) {
+		if (v[k].iov_len == 0) continue;
+		int w = _write(fd, v[k].iov_base, unsigned(v[k].iov_len < 0x40000000 ? v[k].iov_len : 0x40000000));
+		if (w < 0) return r ? r : -1;
+		r += w;
+		if (size_t(w) != v[k].iov_len) break;
+	}
+	return r;
+}
+inline long long readv(int fd, const iovec* v, int n) {
+	long long r = 0;
+	for (int k = 0; k != n; k++) {
+		if (v[k].iov_len == 0) continue;
+		int w = _read(fd, v[k].iov_base, unsigned(v[k].iov_len < 0x40000000 ? v[k].iov_len : 0x40000000));
+		if (w < 0) return r ? r : -1;
+		r += w;
+		if (size_t(w) != v[k].iov_len) break;
+	}
+	return r;
+}
+inline int FileNo(FILE* pFile) { return _fileno(pFile); }
+inline int Seek(FILE* pFile, B8 at) { return _fseeki64(pFile, (long long)at, SEEK_SET); }
+inline B8 Tell(FILE* pFile) { return B8(_ftelli64(pFile)); }
+inline B8 Tell(int fd) { return B8(_lseeki64(fd, 0, SEEK_CUR)); }
+inline B8 FileSize(FILE* pFile) { return B8(_filelengthi64(_fileno(pFile))); }
+#else
+inline int FileNo(FILE* pFile) { return fileno(pFile); }
+inline int Seek(FILE* pFile, B8 at) { return fseeko(pFile, off_t(at), SEEK_SET); }
+inline B8 Tell(FILE* pFile) { return B8(ftello(pFile)); }
+inline B8 Tell(int fd) { return B8(lseek(fd, 0, SEEK_CUR)); }
+inline B8 FileSize(FILE* pFile) { struct stat st; return fstat(fileno(pFile), &st) == 0 ? B8(st.st_size) : 0; }
+#endif
+// Input stdio has read ahead on pFile, or ~0 where the layout of FILE is not known.
+inline Size Buffered(FILE* pFile) {
+	#if defined(__GLIBC__)
+	return pFile->_IO_read_end > pFile->_IO_read_ptr ? Size(pFile->_IO_read_end - pFile->_IO_read_ptr) : 0;
+	#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+	return pFile->_r > 0 ? Size(pFile->_r) : 0;
+	#else
+	(void)pFile;
+	return ~Size(0);
+	#endif
+}
+struct StreamT {
+	Byte* buf = nullptr;
+	Size cap = 0;
+	// Output pending in [0, len), or input read ahead in [pos, len).
+	Size len = 0, pos = 0;
+	bool out = false;
+};
+struct StreamsT {
+	StreamT* table = nullptr;
+	Size cnt = 0;
+	// Finds the stream of descriptor fd, growing the table on first use.
+	inline StreamT* operator[](int fd) {
+		if (fd < 0) return nullptr;
+		if (Size(fd) >= cnt) {
+			Size n = cnt ? cnt : 16;
+			while (n <= Size(fd)) n *= 2;
+			StreamT* t = (StreamT*)::realloc(table, n * sizeof(StreamT));
+			if (t == nullptr) return nullptr;
+			for (Size k = cnt; k != n; k++) new (t + k) StreamT();
+			table = t; cnt = n;
+		}
+		return table + fd;
+	}
+	// Sends [buf, len) and then extra[0, n) to fd in as few writev calls as it takes.
+	// Returns how many of the extra bytes went out, or -1 if the buffer itself did not.
+	static long long Write(int fd, StreamT& s, const Byte* extra, Size n) {
+		iovec v[2] = { { s.buf, size_t(s.len) }, { (void*)extra, size_t(n) } };
+		Size left = s.len + n;
+		while (left) {
+			int k = v[0].iov_len ? 0 : 1;
+			long long w = writev(fd, v + k, 2 - k);
+			if (w < 0 && errno == EINTR) continue;
+			if (w <= 0) break;
+			left -= Size(w);
+			for (; k != 2 && w; k++) {
+				size_t d = size_t(w) < v[k].iov_len ? size_t(w) : v[k].iov_len;
+				v[k].iov_base = (Byte*)v[k].iov_base + d; v[k].iov_len -= d; w -= d;
+			}
+		}
+		bool bufDone = v[0].iov_len == 0;
+		if (!bufDone) ::memmove(s.buf, v[0].iov_base, v[0].iov_len);
+		s.len = v[0].iov_len;
+		return bufDone ? (long long)(n - v[1].iov_len) : -1;
+	}
+	static inline bool Flush(int fd, StreamT& s) {
+		if (!s.out) return true;
+		return Write(fd, s, nullptr, 0) == 0;
+	}
+	// Gives up read-ahead, moving the file position back where the guest thinks it is.
+	static inline void Drop(int fd, StreamT& s) {
+		if (s.out) return;
+		#ifdef _WIN32
+		if (s.pos != s.len) _lseeki64(fd, -(long long)(s.len - s.pos), SEEK_CUR);
+		#else
+		if (s.pos != s.len) lseek(fd, -off_t(s.len - s.pos), SEEK_CUR);
+		#endif
+		s.len = s.pos = 0;
+	}
+	inline void FlushAll() {
+		for (Size k = 0; k != cnt; k++) Flush(int(k), table[k]);
+	}
+	// Throws read-ahead away without seeking back, for descriptors that may be closed or
+	// belong to someone else by now.
+	inline void Forget() {
+		for (Size k = 0; k != cnt; k++) if (!table[k].out) table[k].len = table[k].pos = 0;
+	}
+	// Brings the stream of pFile in line with the buffer size `want` (Vp[_io_size]) and
+	// the direction of the transfer; nullptr means the transfer goes through stdio.
+	// Read-ahead that stdio already holds is not recovered, so guests set the size
+	// before their first FIN.
+	inline StreamT* Open(FILE* pFile, bool out, Size want) {
+		int fd = FileNo(pFile);
+		StreamT* s = (*this)[fd];
+		if (s == nullptr) return nullptr;
+		if (s->cap != want) {
+			if (s->out) { if (!Flush(fd, *s)) return s; }
+			else Drop(fd, *s);
+			if (want == 0) { ::free(s->buf); s->buf = nullptr; s->cap = 0; return nullptr; }
+			Byte* b = (Byte*)::realloc(s->buf, want);
+			if (b == nullptr) return s->cap ? s : nullptr;
+			if (s->cap == 0) fflush(pFile);
+			s->buf = b; s->cap = want;
+		}
+		if (s->cap == 0) return nullptr;
+		if (s->out != out) {
+			if (s->out) { if (!Flush(fd, *s)) return s; }
+			else Drop(fd, *s);
+			s->out = out;
+		}
+		return s;
+	}
+	inline ~StreamsT() {
+		for (Size k = 0; k != cnt; k++) ::free(table[k].buf);
+		::free(table);
+	}
+};
+
+// Asynchronous transfers (AIN/AOUT). A transfer is one read or write of up to `len`
+// bytes at the file's current position, like read(2)/write(2), and is named by a
+// ticket. AWAIT blocks until the ticket is done and APOLL looks without blocking; both
+// put the byte count, Failed or Pending into a register and only then free the ticket.
+// The guest must leave the buffer alone until then. Transfers go through io_uring where
+// the kernel has it (5.6+), otherwise, or under -aio=pool, through worker threads.
+#ifdef __linux__
+struct UringT {
+	int fd = -1;
+	unsigned entries = 0;
+	unsigned* sqHead = nullptr; unsigned* sqTail = nullptr; unsigned* sqMask = nullptr; unsigned* sqArray = nullptr;
+	unsigned* cqHead = nullptr; unsigned* cqTail = nullptr; unsigned* cqMask = nullptr;
+	io_uring_sqe* sqes = nullptr; io_uring_cqe* cqes = nullptr;
+	void* sqMap = MAP_FAILED; void* cqMap = MAP_FAILED;
+	size_t sqLen = 0, cqLen = 0;
+	bool Init(unsigned n) {
+		io_uring_params p = {};
+		fd = int(syscall(__NR_io_uring_setup, n, &p));
+		if (fd < 0) return false;
+		// Reads and writes at the current position, which is what pipes need.
+		if (!(p.features & IORING_FEAT_RW_CUR_POS)) return false;
+		entries = p.sq_entries;
+		sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cqLen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+		if (single) sqLen = cqLen = sqLen > cqLen ? sqLen : cqLen;
+		sqMap = mmap(nullptr, sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sqMap == MAP_FAILED) return false;
+		cqMap = single ? sqMap : mmap(nullptr, cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cqMap == MAP_FAILED) return false;
+		void* s = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (s == MAP_FAILED) return false;
+		sqes = (io_uring_sqe*)s;
+		Byte* sq = (Byte*)sqMap; Byte* cq = (Byte*)cqMap;
+		sqHead = (unsigned*)(sq + p.sq_off.head); sqTail = (unsigned*)(sq + p.sq_off.tail);
+		sqMask = (unsigned*)(sq + p.sq_off.ring_mask); sqArray = (unsigned*)(sq + p.sq_off.array);
+		cqHead = (unsigned*)(cq + p.cq_off.head); cqTail = (unsigned*)(cq + p.cq_off.tail);
+		cqMask = (unsigned*)(cq + p.cq_off.ring_mask); cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+		return true;
+	}
+	// Queues one read or write and enters the kernel; returns 0 or an errno value.
+	int Submit(bool out, int file, Byte* buf, Size len, B8 data) {
+		unsigned tail = *sqTail;
+		if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == entries) return EBUSY;
+		unsigned k = tail & *sqMask;
+		io_uring_sqe& e = sqes[k];
+		::memset(&e, 0, sizeof e);
+		e.opcode = out ? IORING_OP_WRITE : IORING_OP_READ;
+		e.fd = file; e.addr = B8(buf); e.len = unsigned(len); e.off = B8(-1); e.user_data = data;
+		sqArray[k] = k;
+		__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+		while (syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0) < 0) {
+			if (errno == EINTR) continue;
+			// Not consumed: take it back so the ring stays in step.
+			if (__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == tail) { __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE); return errno; }
+			break;
+		}
+		return 0;
+	}
+	// Takes one completion, waiting for it if `wait`.
+	bool Reap(B8& data, long long& res, bool wait) {
+		for (;;) {
+			unsigned head = *cqHead;
+			if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+				const io_uring_cqe& c = cqes[head & *cqMask];
+				data = c.user_data; res = c.res;
+				__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+				return true;
+			}
+			if (!wait) return false;
+			if (syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) return false;
+		}
+	}
+	~UringT() {
+		if (sqes) munmap(sqes, entries * sizeof(io_uring_sqe));
+		if (cqMap != MAP_FAILED && cqMap != sqMap) munmap(cqMap, cqLen);
+		if (sqMap != MAP_FAILED) munmap(sqMap, sqLen);
+		if (fd >= 0) close(fd);
+	}
+};
+#endif
+struct AioT {
+	static constexpr Size Slots = 64, Workers = 2;
+	// The kernel moves at most this much in one read or write.
+	static constexpr Size MaxLen = 0x7ffff000;
+	static constexpr B8 Failed = B8(-1), Pending = B8(-2);
+	// `scratch` holds the guest-order bytes of a reversed layout; `res` is the byte count
+	// or a negative errno value once `done`.
+	struct OpT { B8 ticket; int fd; bool out, done; Byte* buf; Size len; Index sp; Byte* scratch; long long res; };
+	OpT ops[Slots] = {};
+	B8 last = 0;
+	Size busy = 0;
+	#ifdef __linux__
+	UringT* ring = nullptr;
+	#endif
+	// The pool: queued slots, guarded with `done` of every op by `m`.
+	std::mutex m;
+	std::condition_variable wake, finished;
+	B1 queue[Slots] = {};
+	Size qHead = 0, qLen = 0;
+	std::thread* workers = nullptr;
+	bool stop = false;
+	bool Init(bool pool) {
+		#ifdef __linux__
+		if (!pool) {
+			ring = new (std::nothrow) UringT();
+			if (ring && ring->Init(unsigned(Slots))) return true;
+			delete ring; ring = nullptr;
+		}
+		#endif
+		workers = new (std::nothrow) std::thread[Workers];
+		if (workers == nullptr) return false;
+		for (Size k = 0; k != Workers; k++) workers[k] = std::thread([this] { Work(); });
+		return true;
+	}
+	void Work() {
+		std::unique_lock<std::mutex> lock(m);
+		for (;;) {
+			wake.wait(lock, [this] { return stop || qLen; });
+			if (qLen == 0) return;
+			OpT& o = ops[queue[qHead]];
+			qHead = (qHead + 1) % Slots; qLen--;
+			lock.unlock();
+			long long r;
+			#ifdef _WIN32
+			unsigned n = unsigned(o.len < 0x40000000 ? o.len : 0x40000000);
+			r = o.out ? _write(o.fd, o.buf, n) : _read(o.fd, o.buf, n);
+			#else
+			do r = o.out ? write(o.fd, o.buf, size_t(o.len)) : read(o.fd, o.buf, size_t(o.len));
+			while (r < 0 && errno == EINTR);
+			#endif
+			if (r < 0) r = -(long long)errno;
+			lock.lock();
+			o.res = r; o.done = true;
+			finished.notify_all();
+		}
+	}
+	// Starts a transfer and returns its ticket, or 0 with `error` set.
+	B8 Submit(bool out, int fd, Byte* buf, Size len, Index sp, Byte* scratch, int& error) {
+		Size k = 0;
+		while (k != Slots && ops[k].ticket) k++;
+		if (k == Slots) { error = EBUSY; return 0; }
+		OpT& o = ops[k];
+		o = { ++last, fd, out, false, buf, len < MaxLen ? len : MaxLen, sp, scratch, 0 };
+		#ifdef __linux__
+		if (ring) {
+			if ((error = ring->Submit(out, fd, buf, o.len, k)) != 0) { o.ticket = 0; return 0; }
+			busy++;
+			return o.ticket;
+		}
+		#endif
+		std::lock_guard<std::mutex> lock(m);
+		queue[(qHead + qLen) % Slots] = B1(k); qLen++;
+		busy++;
+		wake.notify_one();
+		return o.ticket;
+	}
+	// A transfer that was over before it started: input a stream already held.
+	B8 Ready(long long res, int& error) {
+		Size k = 0;
+		while (k != Slots && ops[k].ticket) k++;
+		if (k == Slots) { error = EBUSY; return 0; }
+		ops[k] = { ++last, -1, false, true, nullptr, 0, 0, nullptr, res };
+		busy++;
+		return ops[k].ticket;
+	}
+	OpT* Find(B8 ticket) {
+		if (ticket == 0) return nullptr;
+		for (OpT& o : ops) if (o.ticket == ticket) return &o;
+		return nullptr;
+	}
+	// True once `o` is done; waits for it if `block`.
+	bool Wait(OpT& o, bool block) {
+		#ifdef __linux__
+		if (ring) {
+			B8 k; long long res;
+			while (!o.done && ring->Reap(k, res, block)) { ops[k].res = res; ops[k].done = true; }
+			return o.done;
+		}
+		#endif
+		std::unique_lock<std::mutex> lock(m);
+		if (block) finished.wait(lock, [&] { return o.done; });
+		return o.done;
+	}
+	void Free(OpT& o) {
+		::free(o.scratch);
+		o.ticket = 0; o.scratch = nullptr;
+		busy--;
+	}
+	// Waits for every transfer in flight, keeping the results for AWAIT.
+	void Drain() {
+		for (OpT& o : ops) if (o.ticket) Wait(o, true);
+	}
+	~AioT() {
+		Drain();
+		for (OpT& o : ops) ::free(o.scratch);
+		#ifdef __linux__
+		delete ring;
+		#endif
+		if (workers) {
+			{ std::lock_guard<std::mutex> lock(m); stop = true; }
+			wake.notify_all();
+			for (Size k = 0; k != Workers; k++) workers[k].join();
+			delete[] workers;
+		}
+	}
+};
+
+// Threaded dispatch: the code section is decoded on first use into one InstT per code
+// address, holding the handler plus pre-resolved Vp operands and immediates. Handlers
+// chain straight to the next record, so straight-line code skips CheckIp, the Space
+// fetch and the switch; anything unusual is handed back to Step().
+struct InstT;
+struct VmContext;
+using Handler = InstT* (*)(VmContext&, InstT*);
+InstT* T_Translate(VmContext& vm, InstT* i);
+InstT* T_Step(VmContext& vm, InstT* i);
+InstT* T_Dispatch(VmContext& vm, InstT* i);
+InstT* T_Halt(VmContext& vm, InstT* i);
+struct InstT {
+	Handler h = T_Translate;
+	InstT* next = nullptr;
+	B8 at = 0, imm = 0;
+	B8* a = nullptr; B8* b = nullptr; B8* c = nullptr; B8* d = nullptr;
+	// Branches: the record Dispatch() last gave for the target `imm`.
+	InstT* to = nullptr;
+};
+
+// Baseline JIT (-jit). Dispatch() counts entries per block head, and a head that gets
+// hot has its run of register-only instructions compiled to x86-64 working on Vp through
+// a pinned base pointer in r11. Anything that can fault, touches Space or the stack, or
+// reads Vp[_ip]/Vp[_Len] ends the block, so every error exit is still raised by the
+// interpreter with the same state. A block ending in a branch back to its own head loops
+// natively; any other exit stores Vp[_ip] and returns to Dispatch().
+#if defined(__x86_64__) || defined(_M_X64)
+#define JIT_X64 1
+#else
+#define JIT_X64 0
+#endif
+struct JitT {
+	static constexpr B4 Hot = 50;
+	static constexpr Size ArenaSize = Size(1) << 22, MaxInst = 256, MaxBlockBytes = MaxInst * 48 + 128;
+	Byte* arena = nullptr;
+	Size used = 0;
+	B4* heat = nullptr;
+	// Code ranges behind each compiled head, for invalidation by guest writes.
+	struct BlockT { Index begin, end; };
+	BlockT* blocks = nullptr;
+	Size blockCnt = 0, blockCap = 0;
+	Size compiled = 0, code = 0;
+	bool Init(Size codeSize) {
+		heat = new (std::nothrow) B4[codeSize]{};
+		if (!heat) return false;
+		#if JIT_X64
+		#ifdef _WIN32
+		arena = (Byte*)VirtualAlloc(nullptr, ArenaSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		#else
+		void* m = mmap(nullptr, ArenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		arena = m == MAP_FAILED ? nullptr : (Byte*)m;
+		#endif
+		#endif
+		return arena != nullptr;
+	}
+	// The arena is writable only while a block is being emitted.
+	void Protect(bool write) {
+		#ifdef _WIN32
+		DWORD old; VirtualProtect(arena, ArenaSize, write ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old);
+		#else
+		mprotect(arena, ArenaSize, write ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+		#endif
+	}
+	void Compile(VmContext& vm, Index head);
+	// Hands every block overlapping [p, p+size_) back to the interpreter.
+	void Touch(InstT* table, Index begin, Index p, Size size_) {
+		for (Size k = 0; k != blockCnt; k++) {
+			BlockT& b = blocks[k];
+			if (b.end <= p || p + size_ <= b.begin) continue;
+			table[b.begin - begin].h = T_Translate;
+			heat[b.begin - begin] = 0;
+			b = blocks[--blockCnt]; k--;
+		}
+	}
+	inline ~JitT() {
+		delete[] heat; ::free(blocks);
+		#if JIT_X64
+		#ifdef _WIN32
+		if (arena) VirtualFree(arena, 0, MEM_RELEASE);
+		#else
+		if (arena) munmap(arena, ArenaSize);
+		#endif
+		#endif
+	}
+};
+
+struct CodeT {
+	static constexpr Size MaxLen = 10;
+	// Verifier results per code address.
+	enum InfoTag : B1 { Boundary = 0x01, Leader = 0x02, Known = 0x04, Guard = 0x08, Fused = 0x10 };
+	static constexpr Size FuseTop = 32;
+	InstT* table = nullptr;
+	B1* info = nullptr;
+	// False while `info` is borrowed from the image an instance was spawned from.
+	bool ownInfo = true;
+	// Set by the first guest write that reaches the code.
+	bool dirty = false;
+	Index begin = 0; Size size = 0;
+	Index limit = 0;
+	B8 lenAt = 0;
+	InstT step{ T_Step }, dispatch{ T_Dispatch }, halt{ T_Halt };
+	int ret = 0;
+	Size verified = 0, dataChecks = 0;
+	Size fusedSites = 0, saved = 0;
+	Size branchHits = 0, branchMisses = 0;
+	// Set when -jit compiles blocks out of this code.
+	JitT* jit = nullptr;
+	// Under -trace, each record's own handler, while the record runs T_Traced.
+	Handler* traced = nullptr;
+	// With green threads, every context running the code counts its writes to it here;
+	// `seen` is the count this table was last brought up to date with.
+	std::atomic<B8>* shared = nullptr;
+	B8 seen = 0;
+	void Verify(VmContext& vm);
+	void Fuse(VmContext& vm);
+	// Copies the records of `from`, the same code decoded against the registers fromVp,
+	// over to this table and toVp. Fused handlers come along as they are.
+	void Rebase(const CodeT& from, const B8* fromVp, B8* toVp) {
+		auto R = [&](B8* r) { return r ? toVp + (r - fromVp) : nullptr; };
+		for (Index k = 0; k != size; k++) {
+			InstT i = from.table[k];
+			if (i.next == &from.dispatch) i.next = &dispatch;
+			else if (i.next) i.next = table + (i.next - from.table);
+			if (i.to) i.to = table + (i.to - from.table);
+			i.a = R(i.a); i.b = R(i.b); i.c = R(i.c); i.d = R(i.d);
+			table[k] = i;
+		}
+	}
+	// Drops every record whose bytes may overlap the guest write [p, p+size_). The
+	// verifier's facts came from the old bytes, so the first such write discards them.
+	inline void Touch(Index p, Size size_) {
+		if (p >= limit || (p < begin && begin - p >= size_)) return;
+		if (shared) {
+			B8 e = shared->fetch_add(1, std::memory_order_acq_rel);
+			if (e == seen) seen = e + 1;
+		}
+		Drop(p, size_);
+	}
+	// Another context wrote the code: nothing decoded from it can be trusted.
+	inline void Resync() {
+		seen = shared->load(std::memory_order_acquire);
+		Drop(begin, size);
+	}
+	inline void Drop(Index p, Size size_) {
+		if (jit) jit->Touch(table, begin, p, size_);
+		dirty = true;
+		Index end = begin + size;
+		Index from = p < begin + MaxLen - 1 ? 0 : p - (MaxLen - 1) - begin;
+		Index to = (p >= end || size_ >= end - p) ? size : p + size_ - begin;
+		if (info) { if (ownInfo) delete[] info; info = nullptr; from = 0; to = size; }
+		for (Index k = from; k < to; k++) table[k].h = T_Translate;
+	}
+	inline ~CodeT() { delete[] table; delete[] traced; if (ownInfo) delete[] info; }
+};
+
+// Opcode pairs and triples along fall-through paths, gathered under -profile and
+// written next to the image as `<image>.ngram`, where -fuse picks them up.
+struct NGramT {
+	static constexpr Size Slots = 4096;
+	B8 pair[256][256] = {};
+	struct { B4 key; B8 cnt; } tri[Slots] = {};
+	B4 last = 0; B1 run = 0;
+	void Note(FuncTag f);
+	void Save(const char* path);
+	bool Load(const char* path);
+	B8 Count(const B1* ops, int n);
+};
+
+#if Profiler
+// Execution profile (-perf), taken by either engine; the threaded one runs without
+// fusion and the JIT. Every instruction bumps the count of its code address and
+// Vp[_count], which reads as instructions executed; opcode counts are derived from those
+// when the profile is saved. About one in Period instructions, at jittered intervals so
+// loops cannot alias with it, is timed and its cycles charged to its opcode family
+// (opcode >> 4) and to the call-tree node it ran in. Call and Ret only move through the
+// tree; the inclusive time of a call target is summed from its subtrees on saving.
+// Taken branches are counted per site, with the misses of the threaded engine's
+// one-entry branch cache there: the ones it had, or under the switch engine the ones it
+// would have had for the targets alone.
+inline B8 Ticks() {
+	#if SIMD_X86
+	return __rdtsc();
+	#else
+	return B8(std::chrono::steady_clock::now().time_since_epoch().count());
+	#endif
+}
+struct PerfT {
+	static constexpr B4 Magic = 0x1BF54, Period = 64, RunPeriod = 4096;
+	static constexpr Size MaxNodes = 1 << 16;
+	Index begin = 0; Size size = 0;
+	B8 op[256] = {};
+	B8* at = nullptr;
+	B8 famSamples[16] = {}, famCycles[16] = {};
+	B4 period = Period, countdown = Period;
+	B8 seed = 0x2545F4914F6CDD1DULL;
+	// Node 0 is the entry and has no target. Children are found through `slots`, after
+	// a look at the child entered last. `nested` marks a target already on the path.
+	// Nodes link by pointer so that Call and Ret move through them without indexing.
+	struct NodeT { NodeT* parent, * last; Index addr; B8 calls, samples, cycles; bool nested; };
+	NodeT* nodes = nullptr; Size nodeCnt = 0;
+	B4* slots = nullptr;
+	NodeT* node = nullptr;
+	// Calls made once the tree is full stay in the caller's node.
+	Size lost = 0;
+	// `hits` and `cached`: the threaded engine's branch cache hits not yet added to
+	// `taken` and to the count of the target they went to.
+	struct SiteT { Index last; B8 taken, misses, hits; Size cached; };
+	SiteT* sites = nullptr;
+	// The threaded engine counts in `at` only the entries into runs of linked records,
+	// and Derive() adds what fell through. Samples are taken at branches instead, about
+	// RunPeriod of them apart: Charge() already counts those, and Meter() hands the one
+	// that is `due` to Tick(). It and every branch after it miss the branch cache until a
+	// run has been entered through Dispatch(), which is then timed up to its next branch,
+	// its cycles shared out among the instructions it went through. Vp[_count] is brought
+	// up to date for the instructions that name it.
+	static constexpr Size MaxRun = 1 << 12;
+	enum PhaseTag : B1 { Idle, Due, Timing, Done };
+	bool threaded = false;
+	PhaseTag phase = Idle;
+	B8 due = 0;
+	// The timed run starts at t0.
+	Index head = 0; NodeT* headNode = nullptr; B8 t0 = 0;
+	// The record a runtime error stopped a run in.
+	Size stop = ~Size(0);
+	B8* scratch = nullptr;
+	bool Init(Index begin_, Size size_);
+	// After a Call landed on `addr`; most calls go where the last one from the same node did.
+	inline void Enter(Index addr) {
+		NodeT* c = node->last;
+		if (c && c->addr == addr) { node = c; c->calls++; }
+		else Child(addr);
+	}
+	void Child(Index addr);
+	inline void Leave() {
+		if (lost == 0) node = node->parent;
+		else lost--;
+	}
+	inline void Rearm() {
+		seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+		countdown = B4(period / 2 + seed % period);
+	}
+	inline void Sampled(B1 f, B8 dt) {
+		famSamples[f >> 4]++; famCycles[f >> 4] += dt;
+		node->samples++; node->cycles += dt;
+		Rearm();
+	}
+	// The branch at code offset k went to `to`.
+	inline void Branched(Size k, Index to) {
+		SiteT& s = sites[k];
+		s.taken++;
+		if (s.last != to) { s.misses++; s.last = to; }
+	}
+	// Instruction f at `at` ran and left Vp[_ip] at `to`: all of MainPerf()'s bookkeeping
+	// but the count and the timing.
+	inline void Ran(B1 f, Index at, Index to) {
+		if (at - begin >= size) { op[f]++; return; }
+		switch (f) {
+			case Goto: case Call: case Ret: Branched(at - begin, to); break;
+			// Not taken, they fall through to at + 3.
+			case IfGo: case IfNG: case Loop: if (to != at + 3) Branched(at - begin, to); break;
+			default: break;
+		}
+		if (f == Call) Enter(to);
+		else if (f == Ret) Leave();
+	}
+	inline void Hit(const InstT* i);
+	inline void Missed(VmContext& vm, const InstT* i);
+	inline void Entered(VmContext& vm, Size k);
+	// The fuel at which Charge() next calls Meter() for a sample, from `fuel` now.
+	inline B8 DueAt(B8 fuel) {
+		B8 gap = phase == Idle ? countdown : 1;
+		return due = fuel > gap ? fuel - gap : 0;
+	}
+	void Tick(VmContext& vm, Index at);
+	void Cached(Size k, Size to);
+	void Boundary(VmContext& vm, Size k);
+	void Timed(VmContext& vm, const InstT* through);
+	void Flush();
+	void Failed(VmContext& vm, int code);
+	void Derive(VmContext& vm, B8* c) const;
+	B8 Total(VmContext& vm);
+	void Save(VmContext& vm);
+	~PerfT() { delete[] at; delete[] nodes; delete[] slots; delete[] sites; delete[] scratch; }
+};
+#endif
+
+// Execution trace (-trace[=entries]), taken by either engine; the threaded one runs
+// without fusion and the JIT, so each instruction has a record. Before each instruction
+// runs, its address, opcode and the registers it is about to write, with their old
+// values, go into a ring holding the last mask + 1 entries. There is one writer and
+// `head` only grows, so the ring can be read while the guest runs. A runtime error
+// writes the ring, Vp and the code to `<image>.trace`; tools/fnh_trace.cpp walks it
+// back from the final Vp to show the last instructions with their register values.
+struct TraceT {
+	static constexpr B4 Magic = 0x1BF55;
+	static constexpr Size DefaultSize = 1 << 16;
+	struct EntryT { Index ip; B8 old[2]; B1 op, n, reg[2]; B4 pad; };
+	EntryT* ring = nullptr;
+	B8 mask = 0;
+	std::atomic<B8> head = 0;
+	Index begin = 0; Size size = 0;
+	// Up to two registers written per opcode, taken from the 8 bytes at the opcode as
+	// (bytes >> shift & keep) | fixed: an operand byte, or a register every instance writes.
+	struct OutT { B1 shift[2], keep[2], fixed[2], n; };
+	OutT out[256] = {};
+	bool Init(Size entries, Index begin_, Size size_);
+	inline void Note(VmContext& vm, Index ip);
+	void NoteMask(VmContext& vm, Index ip);
+	void Save(VmContext& vm, int code);
+	~TraceT() { delete[] ring; }
+};
+
+// Runtime errors unwind to VmContext::Main() carrying the exit code.
+struct VmExit { int code; };
+
+// Green threads (SPAWN/YIELD/JOIN, HTL/WAKE). A guest thread is a register file and a
+// stack carved from the top of the Stack region; the first SPAWN or WAKE makes the
+// running code thread 1. Threads run M:N on host workers, each of which owns a context
+// with its own decoded code that a thread's registers are copied into for a slice.
+// Workers take from the front of their own queue and steal from the back of the
+// others'. A slice ends on YIELD, on a JOIN or HTL that has to wait, or after Slice
+// dispatches when other threads are queued. FOPEN, FIN, FOUT, AIN, AOUT, AWAIT, APOLL
+// and SNAP only run on the context Main() was called on, so a thread that reaches one
+// elsewhere is handed over to it. Every thread shares Space; code one thread writes is
+// decoded again by the others at their next branch.
+struct ThreadT {
+	B8 Vp[256];
+	B8 id = 0, result = 0;
+	// The thread a JOIN is waiting for.
+	B8 waitFor = 0;
+	Index stack = 0; Size stackLen = 0;
+	enum StateTag : B1 { Runnable, Running, Blocked, Done } state = Runnable;
+	// `block`: the slice ended on a JOIN or HTL that waits; `woken`: woken before that
+	// slice was over, so it runs again; `permit`: a WAKE that the next HTL takes; `io`:
+	// bound for the main worker.
+	bool block = false, woken = false, permit = false, io = false;
+};
+struct ThreadsT {
+	static constexpr Size MaxThreads = 4096, DefaultStack = Size(1) << 14, MaxWorkers = 256;
+	static constexpr B4 Slice = 1 << 14;
+	// Spawned threads start with this return address on their stack; returning to it
+	// ends the thread.
+	static constexpr Index End = ~Index(0);
+	struct QueueT {
+		std::mutex m;
+		ThreadT* ring[MaxThreads];
+		Size head = 0, len = 0;
+		void Push(ThreadT* t) { std::lock_guard<std::mutex> l(m); ring[(head + len++) % MaxThreads] = t; }
+		ThreadT* Front() {
+			std::lock_guard<std::mutex> l(m);
+			if (len == 0) return nullptr;
+			ThreadT* t = ring[head]; head = (head + 1) % MaxThreads; len--;
+			return t;
+		}
+		ThreadT* Back() {
+			std::lock_guard<std::mutex> l(m);
+			return len ? ring[(head + --len) % MaxThreads] : nullptr;
+		}
+	};
+	VmContext* root = nullptr;
+	// Worker w runs threads in carriers[w]; worker 0 is the caller of Main() in root.
+	VmContext** carriers = nullptr;
+	unsigned workers = 0;
+	std::thread* pool = nullptr;
+	QueueT* queues = nullptr;
+	// Threads waiting for worker 0 to do their I/O; never stolen.
+	QueueT pinned;
+	// Guards the thread states, `slots`, the counts and the stacks. Taken before a queue.
+	std::mutex m;
+	// Guards the heap (ALLOC/FREE/REALLOC) once threads share it.
+	std::mutex heap;
+	std::condition_variable idle;
+	ThreadT* slots[MaxThreads] = {};
+	B8 last = 0;
+	// Threads not yet joined; those Runnable or Running.
+	Size live = 0, active = 0;
+	// Threads in a queue; those of them in `pinned`, which only worker 0 takes.
+	std::atomic<Size> queued = 0, held = 0;
+	std::atomic<bool> over = false;
+	int code = 0;
+	std::atomic<B8> epoch = 0;
+	// Under -fuel, what the workers have not taken yet; a slice gives back what it kept.
+	std::atomic<B8> fuel = 0;
+	// Stacks are carved downwards from `low`, never below `floor`, the limit of thread 1's
+	// stack, which grows up towards `low` as it needs; `spare` holds the stacks of
+	// finished threads.
+	Index low = 0, floor = 0;
+	struct SpareT { Index at; Size len; };
+	SpareT spare[MaxThreads] = {};
+	Size spareCnt = 0;
+	bool Init(VmContext& vm, unsigned n);
+	ThreadT* Find(B8 id) {
+		ThreadT* t = id ? slots[id % MaxThreads] : nullptr;
+		return t && t->id == id ? t : nullptr;
+	}
+	ThreadT* Add(const B8* vp, Index entry, B8 arg, Size stackLen, int& error);
+	void Push(ThreadT& t, unsigned w);
+	void Wake(ThreadT& t, unsigned w);
+	void Finish(int r);
+	ThreadT* Take(unsigned w);
+	void Run(unsigned w, ThreadT& t);
+	void Settle(VmContext& c, int r, bool error);
+	void Loop(unsigned w);
+	// Whether a running slice should end: someone is waiting, or the guest is over.
+	inline bool Due() { return queued.load(std::memory_order_relaxed) || over.load(std::memory_order_relaxed); }
+	~ThreadsT();
+};
+
+// The guest heap (ALLOC/FREE/REALLOC): size classes over the Heap region, between Data
+// and Stack at Vp[_HeapSp]. Its state lives in the region itself, in guest order, so
+// snapshots and spawned contexts carry it along with the blocks:
+//   +0 top: where the next slab starts; +8 end of the region;
+//   +16 + 24 * c: for class c the free list, then the cursor and limit of its slab.
+// A block of class c is Bytes(c) bytes, a header word (Tag, class, in use) followed by
+// the payload the guest gets. Blocks up to Slab bytes are cut from slabs of Slab bytes,
+// larger ones get a slab each; a freed block goes to the front of its class's list.
+struct HeapT {
+	static constexpr Size Classes = 48, Slab = Size(1) << 16;
+	static constexpr Size Head = 16 + 24 * Classes;
+	static constexpr B8 Tag = B8(0x48454150) << 32;
+	static constexpr Size Bytes(Size c) { return Size(16) << c; }
+	// Largest payload; longer requests fail.
+	static constexpr Size Max = (Size(16) << (Classes - 1)) - sizeof(B8);
+	// The smallest class with room for n payload bytes, n <= Max.
+	static inline Size Class(Size n) {
+		Size len = n + sizeof(B8);
+		return len <= 16 ? 0 : Size(std::bit_width(len - 1)) - 4;
+	}
+};
+
+// Everything one run of a guest owns. Contexts share no state, so any number of them can
+// run side by side on different threads.
+struct VmContext {
+	B1 version[3] = { 1, 0, 0 };
+	#if !Release
+	B1 argOp = 0, infoOp = 0, memOp = 0;
+	B8 lastIp = 0;
+	#endif
+	#if !Release || Profiler
+	FuncTag lastFuncID = FuncTag(0);
+	#endif
+	B8 Vp[256] = {};
+	#if Debug
+	EngineTag engine = Switch;
+	#else
+	EngineTag engine = Threaded;
+	#endif
+	B1 statsOp = 0, profOp = 0, fuseOp = 0, jitOp = 0;
+	const char* imagePath = nullptr;
+	LoadTag loadOp = Heap;
+	// -heap=N: the Heap region's size, in place of the one in the header.
+	B8 heapOp = 0;
+	// -guard: a page past the end of Space catches stack overflows, and the threaded
+	// engine pushes without checking until the first SPAWN.
+	B1 guardOp = 0;
+	// -fuel=N: each Goto, IfGo, IfNG, Loop, Call and Ret, the branch that ends a basic
+	// block, costs one unit, and a branch that finds none left stops the guest with 0xc4.
+	// -deadline=MS: the guest stops with 0xc5 once that many milliseconds have passed
+	// since Main(), looked at every ClockEvery branches. Either way it stops before the
+	// branch runs, so a later Main() goes on from there with a fresh budget. With green
+	// threads a stop ends the guest instead: the other threads are not kept, and there
+	// is no snapshot of them.
+	B8 fuelOp = 0, deadlineOp = 0;
+	static constexpr B8 ClockEvery = 1 << 16;
+	// Fuel left, stored through fuelAt: Vp[_fuel] under -fuel, otherwise a sink. Meter()
+	// runs when it comes down to `check`; `deadline` is on the steady clock, in ns.
+	B8 fuel = ~B8(0), check = 0, deadline = 0, fuelSink = 0;
+	B8* fuelAt = &fuelSink;
+	// Set when the budget stopped this context with no threads running.
+	bool stopped = false;
+	SpaceT Space;
+	CodeT Code;
+	JitT Jit;
+	StreamsT Streams;
+	// Started on the first AIN/AOUT; -aio=pool skips io_uring.
+	B1 aioOp = 0;
+	AioT* Aio = nullptr;
+	NGramT* NGram = nullptr;
+	Size traceOp = 0;
+	TraceT* Trace = nullptr;
+	// Started on the first SPAWN or WAKE with -threads=N host workers (default: one per
+	// core). `thread` is the guest thread in Vp, `worker` the one running this context,
+	// and `carrier` marks the contexts of workers other than 0.
+	unsigned threadOp = 0;
+	ThreadsT* Threads = nullptr;
+	ThreadT* thread = nullptr;
+	unsigned worker = 0;
+	bool carrier = false;
+	// Set when the slice ends with the thread still alive; `slice` counts down to a check.
+	B1 yielded = 0;
+	B4 slice = ThreadsT::Slice;
+	#if Profiler
+	B1 perfOp = 0;
+	PerfT* Perf = nullptr;
+	#endif
+	// What guest handles 0, 1 and 2 stand for.
+	FILE* stdErr = stderr;
+	FILE* stdIn = stdin;
+	FILE* stdOut = stdout;
+	// Where FOPEN looks for a relative path, when not in the process's directory: under
+	// `app -serve`, the client's.
+	const char* cwd = nullptr;
+	// Files opened by FOPEN, closed with the context. `handle` is the value the guest
+	// holds; `pos` is where a restored file was reopened.
+	struct FileT { B8 handle; FILE* pFile; char* path; char* mode; B8 pos; };
+	FileT* files = nullptr;
+	Size fileCnt = 0, fileCap = 0;
+	// Set once the guest resumed from a snapshot: its handles no longer are FILE pointers.
+	bool restored = false;
+	// The image this context was spawned from, if any.
+	const VmImage* image = nullptr;
+
+	VmContext() = default;
+	VmContext(const VmContext&) = delete;
+	VmContext& operator=(const VmContext&) = delete;
+	~VmContext();
+
+	// Loads argv[1] with the options in argv[2..]; 0 on success, otherwise the exit code.
+	int Init(int argc, char** argv);
+	// Runs the loaded guest to the end and returns its exit code.
+	int Main();
+	void PrintStats();
+	// Sets up a context that shares the loaded image's pages; see fnh.h.
+	bool Spawn(const VmImage& img);
+	// Returns a spawned context to the state Spawn() left it in.
+	bool Reset();
+	// Writes Space, Vp and the open files to `path`; 0 or an errno value.
+	int Snapshot(const char* path);
+	// Init() for a snapshot file, read up to its magic.
+	int Restore(FILE* pFile);
+
+	#if !Release
+	void printMem(const char* str);
+	#endif
+	#if Debug
+	void printMemEX(const char* str, Index last, Index to);
+	#endif
+	[[noreturn]] void StackError(int code);
+	void CheckStack(Index p, Size size);
+	void StackGrow(Index end);
+	void CheckFrame();
+	// Whether pushes and pops leave overflow to the -guard page. Guest threads have
+	// limits below Space.size, so they always check.
+	bool Unchecked() const { return Space.guard && Threads == nullptr; }
+	void CheckData(Index p, Size size);
+	Index CheckIp(B1 add);
+	void CheckRange(Index p, Size cnt, Size width = 1);
+	Index CheckSafe(Index p);
+	template<typename Bn> void Set(B8& r, Index p);
+	template<typename Bn> void Get(B8& r, Index p);
+	template<typename Bn> void Wrt(Index p, B8 x);
+	template<typename Bn> void Psh(B8 val);
+	template<typename Bn> void Pop(B8& var);
+	// Psh and Pop under -guard, while Unchecked().
+	template<typename Bn> void PshU(B8 val);
+	template<typename Bn> void PopU(B8& var);
+	template<bool Checked> void PshM_(B1 r, B1 m, Size n);
+	template<bool Checked> void PopM_(B1 r, B1 m, Size n);
+	bool MovesStack(FuncTag f, Index p);
+	template<typename Bn> void XCHG(B8& p, Index at, B8 ym = 0xff);
+	template<typename Bn> void SCAS(B8& r, B8 x_, Index a, Size si);
+	void MOVS_(Index f, Index t, Size si);
+	void CMPS_(B8& r, Index a, Index b, Size si);
+	void VMAP_(FuncTag f, B1 kind, Index d, Index a, Index b, Size n);
+	void VRED_(FuncTag f, B1 kind, B8& r, Index a, Size n);
+	void VFILL_(B1 kind, Index d, B8 x, Size n);
+	void VSCAN_(B1 kind, Index d, Index a, Size n);
+	template<bool To> void BcdS_(Index d, Index a, Size n);
+	void HeapInit(Index at, Size len);
+	B8 HeapGet(Index p);
+	void HeapPut(Index p, B8 v);
+	[[noreturn]] void HeapError(Index p);
+	Size HeapBlock(Index p);
+	Index HeapTake(Size n);
+	void HeapGive(Index p);
+	void ALLOC_(B8& r, Size n);
+	void FREE_(Index p);
+	void REALLOC_(B8& r, Index p, Size n);
+	void fopen_(B8& file, Index path, Size pathLen, Index mod, Size modLen);
+	FILE* Handle(B8 file);
+	void CopyOut(Byte* to, Index sp, Size n);
+	void fin_(B8 file, Index sp, Size spLen, Size once, Size cnt, B8& r);
+	void fout_(B8 file, Index sp, Size spLen, Size once, Size cnt, B8& r);
+	void aio_(bool out, B8 file, Index sp, Size len, B8& ticket);
+	void await_(B8 ticket, B8& r, bool block);
+	void spawn_(Index entry, B8 arg, B8& tid);
+	bool join_(Index at, B8 tid, B8& r);
+	bool park_(Index at);
+	void wake_(B8 tid);
+	template<typename F> B8 Atomic(Index p, F f);
+	bool Away(Index at, int& ret);
+	bool Preempt();
+	bool Carry(const VmContext& from, ThreadsT& threads, unsigned w);
+	void Arm(B8 f);
+	// Pays for the branch at `at` before it runs.
+	inline void Charge(Index at) { if (fuel == check) Meter(at); *fuelAt = --fuel; }
+	void Meter(Index at);
+	bool Refuel();
+	bool Step(int& ret);
+	#if Profiler
+	int MainPerf();
+	#endif
+	int MainSwitch();
+	int Run();
+	char* SidePath(const char* ext);
+	void SnapNow();
+	bool AddFile(const FileT& f);
+	bool Reopen(FileT& f);
+	void CloseFiles();
+	bool CopyFiles(const VmContext& from);
+	InstT* Decode(InstT* i);
+	InstT* Dispatch();
+	// Inline cache of a branch record: a target seen last time skips Dispatch() while
+	// nothing it checks can have changed. Only plain records are cached, and under -jit
+	// only once they are hot, so guarded records and the JIT's heat counts are untouched.
+	inline InstT* Branch(InstT* i, B8 target) {
+		Vp[_ip] = target;
+		if (target == i->imm && target < Code.lenAt && Vp[_Len] == Code.lenAt && !snapRequest && !Threads
+			&& (!Jit.heat || Jit.heat[i->to - Code.table] >= JitT::Hot)) {
+			Code.branchHits++;
+			#if Profiler
+			if (Perf) Perf->Hit(i);
+			#endif
+			return i->to;
+		}
+		return Rebranch(i, target);
+	}
+	// Branch() for a target the cache does not hold, out of line so that the rest inlines
+	// into every branch handler.
+	InstT* Rebranch(InstT* i, B8 target);
+	// -perf's call tree, moved by the Call and Ret records.
+	inline void Called([[maybe_unused]] B8 to) {
+		#if Profiler
+		if (Perf) Perf->Enter(to);
+		#endif
+	}
+	inline void Returned() {
+		#if Profiler
+		if (Perf) Perf->Leave();
+		#endif
+	}
+	bool Prepare();
+	int MainThreaded();
+};
+
+#if Profiler
+// The branch record i went where the branch cache said.
+inline void PerfT::Hit(const InstT* i) {
+	++*i->d;
+}
+// The branch record i missed the branch cache and goes through Dispatch().
+inline void PerfT::Missed(VmContext& vm, const InstT* i) {
+	SiteT& s = sites[i - vm.Code.table];
+	s.taken++; s.misses++;
+}
+// Dispatch() entered the record at code offset k.
+inline void PerfT::Entered(VmContext& vm, Size k) {
+	at[k]++;
+	if (phase != Idle) Boundary(vm, k);
+}
+#endif
+InstT* VmContext::Rebranch(InstT* i, B8 target) {
+	Code.branchMisses++;
+	#if Profiler
+	if (Perf) Perf->Missed(*this, i);
+	#endif
+	InstT* to = Dispatch();
+	if (to != &Code.step && to != &Code.halt && !Threads && (!Jit.heat || Jit.heat[to - Code.table] >= JitT::Hot)) {
+		i->imm = target; i->to = to;
+		#if Profiler
+		if (Perf) Perf->Cached(i - Code.table, to - Code.table);
+		#endif
+	}
+	return to;
+}
+inline void VmContext::StackError(int code) {
+	#if !Release
+	const char* what = code == 0xb2 ? "Stack Space underflow" : code == 0xb3 ? "Stack Ptr underflow" : "Stack Space overflow";
+	fprintf(stdErr, "\033[31m[E]\033[0m %s.\n", what);
+	#endif
+	throw VmExit{ code };
+}
+inline void VmContext::CheckStack(Index p, Size size) {
+	if (p < Vp[_StackSp]) StackError(0xb2);
+	if (p < Vp[_stack_base]) StackError(0xb3);
+	if ((p + size) >= Space.size || (p + size) >= Vp[_stack_limit]) StackGrow(p + size);
+}
+// Past Vp[_stack_limit]: thread 1 takes another DefaultStack of the room left above the
+// carved stacks; anything else is an overflow.
+void VmContext::StackGrow(Index end) {
+	if (end < Space.size && Threads && thread && thread->id == 1) {
+		std::lock_guard<std::mutex> l(Threads->m);
+		if (end < Threads->low) {
+			Threads->floor = std::max(Threads->floor, std::min(Threads->low, (end + ThreadsT::DefaultStack + 15) & ~Index(15)));
+			Vp[_stack_limit] = Threads->floor;
+			return;
+		}
+	}
+	StackError(0xb4);
+}
+// With -guard, after anything that may have moved the stack registers: the unchecked
+// handlers rely on StackSp <= base <= top <= Space.size.
+inline void VmContext::CheckFrame() {
+	if (Vp[_stack_base] < Vp[_StackSp] || Vp[_stack_top] < Vp[_StackSp]) StackError(0xb2);
+	if (Vp[_stack_top] < Vp[_stack_base]) StackError(0xb3);
+	if (Vp[_stack_top] > Space.size || Vp[_stack_top] > Vp[_stack_limit]) StackError(0xb4);
+}
+inline void VmContext::CheckData(Index p, Size size) {
+	if ((p + size) < Space.size)return;
+
+	#if !Release
+	fprintf(stdErr, "\033[31m[E]\033[0m Memory access error: Index={\033[35m%llu(0x%llx)\033[0m}\n", p, p);
+	#endif
+	throw VmExit{ 0xb1 };
+	
+}
+inline Index VmContext::CheckIp(B1 add) {
+	if (Vp[_ip] + add < Space.size) {
+		Vp[_ip] += add;
+		return Vp[_ip] - add;
+	};
+	#if !Release
+	fprintf(stdErr, "\033[31m[E]\033[0m Malformed instruction & Memory access error.\n");
+	#endif
+	throw VmExit{ 0xb5 };
+}
+// Whole-range check for the string instructions: cnt elements of `width` bytes at p.
+inline void VmContext::CheckRange(Index p, Size cnt, Size width) {
+	if (cnt <= Space.size / width && Space.Has(p, cnt * width)) return;
+
+	#if !Release
+	fprintf(stdErr, "\033[31m[E]\033[0m Memory access error: Index={\033[35m%llu(0x%llx)\033[0m}\n", p, p);
+	#endif
+	throw VmExit{ 0xb1 };
+}
+inline Index VmContext::CheckSafe(Index p) {
+	if ((p) < Space.size)return p;
+	return 0;
+}
+
+int Batch(int argc, char** argv);
+int Serve(int argc, char** argv);
+int VmContext::Init(int argc, char** argv) {
+	if (argc <= 1) {
+		#if !Release
+		fprintf(stdErr, "\033[31m[E]\033[0m Missing input file.\n");
+		#endif
+		return 0xa1;
+	}
+	for (int k = 2; k < argc; k++) {
+		if (!strcmp(argv[k], "-ref")) engine = Switch;
+		else if (!strcmp(argv[k], "-stats")) statsOp = 1;
+		else if (!strcmp(argv[k], "-mmap")) loadOp = Mapped;
+		else if (!strcmp(argv[k], "-huge")) loadOp = Huge;
+		else if (!strcmp(argv[k], "-guard")) guardOp = 1;
+		else if (!strcmp(argv[k], "-profile")) { profOp = 1; engine = Switch; }
+		else if (!strcmp(argv[k], "-fuse")) fuseOp = 1;
+		else if (!strcmp(argv[k], "-jit")) jitOp = 1;
+		else if (!strcmp(argv[k], "-aio=pool")) aioOp = 1;
+		else if (!strncmp(argv[k], "-fuel=", 6) && strtoull(argv[k] + 6, nullptr, 10)) fuelOp = strtoull(argv[k] + 6, nullptr, 10);
+		else if (!strncmp(argv[k], "-deadline=", 10) && strtoull(argv[k] + 10, nullptr, 10)) deadlineOp = strtoull(argv[k] + 10, nullptr, 10);
+		else if (!strncmp(argv[k], "-heap=", 6) && strtoull(argv[k] + 6, nullptr, 10)) heapOp = strtoull(argv[k] + 6, nullptr, 10);
+		else if (!strncmp(argv[k], "-threads=", 9) && strtoul(argv[k] + 9, nullptr, 10)) threadOp = unsigned(strtoul(argv[k] + 9, nullptr, 10));
+		else if (!strcmp(argv[k], "-trace")) traceOp = TraceT::DefaultSize;
+		else if (!strncmp(argv[k], "-trace=", 7) && strtoull(argv[k] + 7, nullptr, 10)) traceOp = strtoull(argv[k] + 7, nullptr, 10);
+		#if Profiler
+		else if (!strcmp(argv[k], "-perf")) perfOp = 1;
+		#endif
+		else {
+			#if !Release
+			fprintf(stdErr, "\033[31m[E]\033[0m Unknown option: \033[36m`%s`\033[0m.\n", argv[k]);
+			#endif
+			return 0xa6;
+		}
+	}
+	imagePath = argv[1];
+	FILE* pFile = fopen(argv[1], "rb");
+	if (pFile == NULL) { 
+		#if !Release
+		fprintf(stdErr, "\033[31m[E]\033[0m File not opened: \033[36m`%s`\033[0m. ", argv[1]); fprintf(stdErr, "With: %s\n", strerror(errno)); 
+		#endif
+		return 0xa2; 
+	}
+	B4 magic; FRead(magic, pFile);
+	if (magic == SnapMagic) return Restore(pFile);
+	if (Magic != magic) {
+		fclose(pFile); 
+		#if !Release
+		fprintf(stdErr, "\033[31m[E]\033[0m Invalid file format: Not a FnH file. \033[35mMagic: %u\033[0m.\n", magic);
+		#endif
+		return 0xa3;
+	}
+	fread(version, sizeof(B1), (sizeof version / sizeof(B1)), pFile);
+	Space.linear = version[0] >= 2;
+	#if Release
+	B1 temp1; fread(&temp1, sizeof(B1), 1, pFile);
+	#else
+	fread(&argOp, sizeof(B1), 1, pFile);
+	infoOp = B1(argOp & B1(0b00000001)); memOp = B1(argOp & B1(0b00000010));
+	if (infoOp) fprintf(stdErr, "\033[32m[I]\033[0m Version: \033[33m[%u.%u.%u]\033[0m.\n\033[32m[I]\033[0m FnH file: \033[36m`%s`\033[0m.\n\033[32m[I]\033[0m Option: INFO{\033[36m%c\033[0m}.\n", version[0], version[1], version[2], argv[1], infoOp ? 'T' : 'F');
+	#endif
+	B8 PreSize = 16;
+	B8 CodeSize; FRead(CodeSize, pFile);
+	B8 DataSize; FRead(DataSize, pFile);
+	B8 StackSize; FRead(StackSize, pFile);
+	// Version 3 adds the size of the Heap region, which sits between Data and Stack.
+	B8 HeapSize = 0;
+	if (version[0] >= 3) FRead(HeapSize, pFile);
+	if (heapOp) HeapSize = heapOp;
+	// Version 4 adds initialized Data and packed sections: how many bytes at the start of
+	// Data the file gives (the rest starts as zeros), the bytes Code and those take in the
+	// file, how each is stored (0 as it is, 1 packed, see SpaceT::unpack()), and 6
+	// reserved bytes. Data follows Code in the file.
+	B8 InitSize = 0, CodeStored = CodeSize, InitStored = 0;
+	B1 CodePack = 0, InitPack = 0;
+	if (version[0] >= 4) {
+		FRead(InitSize, pFile); FRead(CodeStored, pFile); FRead(InitStored, pFile);
+		FRead(CodePack, pFile); FRead(InitPack, pFile);
+		B1 reserved[6]; fread(reserved, sizeof(B1), 6, pFile);
+		if (InitSize > DataSize || CodePack > 1 || InitPack > 1 || (!CodePack && CodeStored != CodeSize) || (!InitPack && InitStored != InitSize)) {
+			fclose(pFile);
+			#if !Release
+			fprintf(stdErr, "\033[31m[E]\033[0m Invalid file format: Bad section sizes.\n");
+			#endif
+			return 0xa3;
+		}
+		// Sections longer than the file are never allocated for.
+		B8 fileSize = FileSize(pFile), body = fileSize > 72 ? fileSize - 72 : 0;
+		if (CodeStored > body || InitStored > body - CodeStored) {
+			fclose(pFile);
+			#if !Release
+			fprintf(stdErr, "\033[31m[E]\033[0m Read error in \033[36m`%s`\033[0m: sections of {\033[36m%llu\033[0m} bytes in {\033[31m%llu\033[0m}.\n", argv[1], CodeStored + InitStored, body);
+			#endif
+			return 0xa5;
+		}
+		#if !Release
+		if (infoOp) fprintf(stdErr, "\033[32m[I]\033[0m Sections: Code{\033[35m%llu\033[0m in \033[36m%llu\033[0m} Data{\033[35m%llu\033[0m in \033[36m%llu\033[0m}.\n", CodeSize, CodeStored, InitSize, InitStored);
+		#endif
+	}
+	#if !Release
+	if (infoOp) fprintf(stdErr, "\033[32m[I]\033[0m Space: Pre{\033[35m%llu\033[0m+\033[36m%llu\033[0m} Code{\033[35m%llu\033[0m+\033[36m%llu\033[0m} Data{\033[35m%llu\033[0m+\033[36m%llu\033[0m} Heap{\033[35m%llu\033[0m+\033[36m%llu\033[0m} Stack{\033[35m%llu\033[0m+\033[36m%llu\033[0m}.\n", 0LL, PreSize, PreSize, CodeSize, PreSize + CodeSize, DataSize, PreSize + CodeSize + DataSize, HeapSize, PreSize + CodeSize + DataSize + HeapSize, StackSize);
+	#endif
+	const B8 HeadSize = version[0] >= 4 ? 72 : version[0] >= 3 ? 40 : 32;
+	// The guard page needs a mapping, and Stack to run up to it: a linear layout gets
+	// the rest of its last page added to Stack.
+	if (guardOp && loadOp == Heap) loadOp = Mapped;
+	if (guardOp && Space.linear) {
+		B8 page = SpaceT::PageSize(), used = (HeadSize + CodeSize + DataSize + HeapSize + StackSize) % page;
+		if (used) StackSize += page - used;
+	}
+	bool got = loadOp == Heap ? Space.malloc(PreSize + CodeSize + DataSize + HeapSize + StackSize)
+		: Space.map(PreSize + CodeSize + DataSize + HeapSize + StackSize, Space.linear ? HeadSize - PreSize : 0, loadOp == Huge, guardOp);
+	if (!got) { 
+		fclose(pFile); 
+		#if !Release
+		fprintf(stdErr, "\033[31m[E]\033[0m Memory error: malloc{%llu}. ", PreSize + CodeSize + DataSize + HeapSize + StackSize); fprintf(stdErr, "With: %s\n", strerror(errno)); 
+		#endif
+		return 0xa4;
+	}
+	// Data stored as it is right behind Code stored as it is comes in with Code.
+	B8 joined = CodePack || InitPack ? 0 : InitSize, want = CodeSize + joined;
+	size_t read_size = CodePack ? Space.unpack(PreSize, CodeSize, pFile, CodeStored)
+		: loadOp == Heap ? Space.fread(PreSize, want, pFile) : Space.mapCode(PreSize, want, pFile, HeadSize);
+	if (read_size == want && InitSize != joined) {
+		want += InitSize;
+		if (Seek(pFile, HeadSize + CodeStored) == 0)
+			read_size += InitPack ? Space.unpack(PreSize + CodeSize, InitSize, pFile, InitStored) : Space.fread(PreSize + CodeSize, InitSize, pFile);
+	}
+	fclose(pFile);
+	if (read_size != want) { 
+		#if !Release
+		fprintf(stdErr, "\033[31m[E]\033[0m Read error in \033[36m`%s`\033[0m to read {32 + \033[36m%llu\033[0m} but get {32 + \033[31m%zu\033[0m}. ", argv[1], want, read_size); if (feof(pFile))fprintf(stdErr, "With: %s\n", strerror(errno)); 
+		#endif
+		return 0xa5;
+	}
+	Space.memset(0, PreSize);
+	Vp[_Space] = 0; Vp[_Len] = Space.size;
+	Vp[_CodeSp] = PreSize; Vp[_DataSp] = PreSize + CodeSize;
+	HeapInit(PreSize + CodeSize + DataSize, HeapSize);
+	Vp[_StackSp] = PreSize + CodeSize + DataSize + HeapSize;
+	Vp[_stack_base] = Vp[_StackSp]; Vp[_stack_top] = Vp[_stack_base]; Vp[_stack_limit] = Space.size;
+	Vp[_ip] = Vp[_CodeSp];
+	Vp[_ExitWith] = EXIT_SUCCESS;
+	Vp[_error] = 0;
+	#if !Release
+	if (memOp) printMem("Space begin");
+	#endif
+	if (engine == Threaded && !Prepare()) engine = Switch;
+
+	return 0;
+}
+#ifndef FNH_LIBRARY
+static void SnapSignal(int) { snapRequest = 1; }
+int main(int argc, char** argv) {
+	if (argc > 1 && !strcmp(argv[1], "-batch")) return Batch(argc, argv);
+	if (argc > 1 && !strcmp(argv[1], "-serve")) return Serve(argc, argv);
+	#ifdef SIGUSR1
+	signal(SIGUSR1, SnapSignal);
+	#endif
+	return FnhExec(argc, argv);
+}
+#endif
+
+using Func = void(*)(Index&);
+
+// BcdCmp compares from the most significant word down: r only changes while it is 0.
+inline void BcdCmp_(B8& r, B8 a, B8 b) {
+	if (r == 0) r = a > b ? 1 : (a < b ? B8(-1) : 0);
+}
+inline void Div_([[maybe_unused]] FILE* err, B8& r1, B8& r2, B8 a, B8 b) {
+	if (b == 0) {
+		#if !Release
+		fprintf(err, "\033[31m[E]\033[0m Division by zero.\n");
+		#endif
+		throw VmExit{ 0xc2 };
+	}
+	else r1 = a / b; r2 = a % b;
+}
+inline void Div_I([[maybe_unused]] FILE* err, B8I& r1, B8I& r2, B8I a, B8I b) {
+	if (b == 0) {
+		#if !Release
+		fprintf(err, "\033[31m[E]\033[0m Division by zero.\n");
+		#endif
+		throw VmExit{ 0xc2 };
+	}
+	else r1 = a / b; r2 = a % b;
+}
+inline B8I& ToB8I(B8& p) {
+	return (*(B8I*)&(p));
+}
+inline B8I uint64_to_int64(B8 val, B8 sign) {
+	return (sign>0) ? B8I(val) : -B8I(val);
+}
+inline void int64_to_uint64(B8I x, B8& val, B8& sign) {
+	if (x >= 0) {
+		val = B8(x); sign = 1U;
+	}
+	else {
+		val = B8(-x); sign = 0U;
+	}
+}
+#if !Release
+void VmContext::printMem(const char* str) {
+	fprintf(stdErr, "\033[32m[I]\033[0m %s:\n\033[44m", str);
+	for (size_t i = 0; i != Space.size; i++) {
+		if (i == Vp[_CodeSp]) {
+			fprintf(stdErr, "\033[42m");
+		}
+		if (i == Vp[_DataSp]) {
+			fprintf(stdErr, "\033[41m");
+		}
+		if (i == Vp[_StackSp]) {
+			fprintf(stdErr, "\033[45m");
+		}
+		fprintf(stdErr, "%02x ", Space[i]);
+	}
+	fprintf(stdErr, "\033[0m\n");
+}
+#endif
+#if Debug
+void VmContext::printMemEX(const char* str, Index last, Index to) {
+	fprintf(stdErr, "\033[32m[I]\033[0m %s:\n\033[44m", str);
+	B8 sign = 0;
+	for (size_t i = 0; i != Space.size; i++) {
+		if (i == Vp[_CodeSp]) {
+			sign = 42;
+			fprintf(stdErr, "\033[""%llu""m", sign);
+		}
+		if (i == Vp[_DataSp]) {
+			sign = 41;
+			fprintf(stdErr, "\033[""%llu""m", sign);
+		}
+		if (i == Vp[_StackSp]) {
+			sign = 45;
+			fprintf(stdErr, "\033[""%llu""m", sign);
+		}
+		if (i == last) {
+			fprintf(stdErr, "\033[46m");
+			fprintf(stdErr, "%02x ", Space[i]);
+			fprintf(stdErr, "\033[""%llu""m", sign);
+			continue;
+		}
+		if (i == to) {
+			fprintf(stdErr, "\033[43m");
+			fprintf(stdErr, "%02x ", Space[i]);
+			fprintf(stdErr, "\033[""%llu""m", sign);
+			continue;
+		}
+		fprintf(stdErr, "%02x ", Space[i]);
+	}
+	if (last >= Space.size) {
+		fprintf(stdErr, "\033[46m");
+		fprintf(stdErr, "[%llu]", last);
+		fprintf(stdErr, "\033[""%llu""m ", sign);
+	}
+	if (to >= Space.size) {
+		fprintf(stdErr, "\033[43m");
+		fprintf(stdErr, "[%llu]", to);
+		fprintf(stdErr, "\033[""%llu""m ", sign);
+	}
+	fprintf(stdErr, "\033[0m\nVp:\n");
+	for (Index i = 0; i != 256; i++) {
+		if(!(i&0xf))fprintf(stdErr, "\033[41m[%llx0]", i>>4);
+		fprintf(stdErr, "%llu ", Vp[i]);
+		fprintf(stdErr, "\033[0m");
+	}
+	fprintf(stdErr, "\033[0m\n");
+}
+#endif
+
+template<typename Bn> inline void Mov(B8& v, B8 x) {
+	v = Bn(x);
+}
+template<typename Bn> inline void VmContext::Set(B8& r, Index p) {
+	r = Space.GetN<Bn>(p);
+}
+template<typename Bn> inline void VmContext::Get(B8& r, Index p) {
+	r = (CheckData(p, sizeof(Bn)), Space.GetN<Bn>(p));
+}
+template<typename Bn> inline void VmContext::Wrt(Index p, B8 x) {
+	CheckData(p, sizeof(Bn));
+	Code.Touch(p, sizeof(Bn));
+	Space.PutN<Bn>(p, (Bn)(x));
+}
+template<typename Bn> inline void VmContext::Psh(B8 val) {
+	CheckStack(Vp[_stack_top], sizeof (Bn));
+	Code.Touch(Vp[_stack_top], sizeof(Bn));
+	Space.PutN<Bn>(Vp[_stack_top], Bn(val));
+	Vp[_stack_top] += sizeof(Bn);
+}
+template<typename Bn> inline void VmContext::Pop(B8& var) {
+	Vp[_stack_top] -= sizeof (Bn);
+	CheckStack(Vp[_stack_top], sizeof (Bn));
+	(var) = Space.GetN<Bn>(Vp[_stack_top]);
+}
+// Under -guard the guard page stands in for the overflow check. T_Step keeps StackSp <=
+// base <= top <= Space.size, so a push passes the others, and a pop that would go below
+// base goes through Pop() for its error.
+template<typename Bn> inline void VmContext::PshU(B8 val) {
+	Code.Touch(Vp[_stack_top], sizeof(Bn));
+	Space.PutN<Bn>(Vp[_stack_top], Bn(val));
+	Vp[_stack_top] += sizeof(Bn);
+}
+template<typename Bn> inline void VmContext::PopU(B8& var) {
+	if (Vp[_stack_top] - Vp[_stack_base] < sizeof(Bn)) return Pop<Bn>(var);
+	Vp[_stack_top] -= sizeof(Bn);
+	(var) = Space.GetN<Bn>(Vp[_stack_top]);
+}
+// PshM/PopM: the registers that bit k of m picks as r + k (wrapping past 0xff), in
+// ascending order on the stack as 8-byte values; n is 8 times the bits set in m. One check
+// covers them all, and Vp[_stack_top] moves before PopM writes a register, so a popped
+// _stack_top is what remains.
+template<bool Checked> inline void VmContext::PshM_(B1 r, B1 m, Size n) {
+	if (m == 0) return;
+	Index at = Vp[_stack_top];
+	if (Checked) CheckStack(at, n);
+	Code.Touch(at, n);
+	for (Index p = at; m; m &= B1(m - 1), p += 8) Space.PutN<B8>(p, Vp[B1(r + std::countr_zero(m))]);
+	Vp[_stack_top] = at + n;
+}
+template<bool Checked> inline void VmContext::PopM_(B1 r, B1 m, Size n) {
+	if (m == 0) return;
+	if (!Checked && Vp[_stack_top] - Vp[_stack_base] < n) return PopM_<true>(r, m, n);
+	Index at = Vp[_stack_top] -= n;
+	if (Checked) CheckStack(at, n);
+	for (Index p = at; m; m &= B1(m - 1), p += 8) Vp[B1(r + std::countr_zero(m))] = Space.GetN<B8>(p);
+}
+template<typename Bn> inline void VmContext::XCHG(B8& p, Index at, B8 ym) {
+	B8 temp = (CheckData(at, sizeof(Bn)), Space.GetN<Bn>(at));
+	Code.Touch(at, sizeof(Bn));
+	Space.PutN<Bn>(at, Bn(p & ym));
+	p = p & (~ym) | temp;
+}
+template<typename Bn> inline void VmContext::SCAS(B8& r, B8 x_, Index a, Size si) {
+	Bn x = Bn(x_);
+	r = B8(-1);
+	if (si == 0) return;
+	CheckRange(a, si, sizeof(Bn));
+	Byte* p = Space.pIndex(a, si * sizeof(Bn));
+	if (Space.Reversed()) {
+		Size k = FindLast<Bn>(p, si, x);
+		if (k != si) r = si - 1 - k;
+	}
+	else {
+		Size k = FindFirst<Bn>(p, si, Space.linear ? swap_endian(x) : x);
+		if (k != si) r = k;
+	}
+}
+
+inline B8 Than_(B8 a, B8 b) {
+	return a > b ? 1 : (a < b ? B8(-1) : 0);
+}
+inline B8I Than_I(B8I a, B8I b) {
+	return a > b ? 1 : (a < b ? -1 : 0);
+}
+inline void VmContext::MOVS_(Index f, Index t, Size si) {
+	if (si == 0) return;
+	CheckRange(f, si); CheckRange(t, si);
+	Code.Touch(t, si);
+	::memmove(Space.pIndex(t, si), Space.pIndex(f, si), si);
+}
+inline void VmContext::CMPS_(B8& r, Index a, Index b, Size si) {
+	r = 0;
+	if (si == 0) return;
+	CheckRange(a, si); CheckRange(b, si);
+	Byte* pa = Space.pIndex(a, si);
+	Byte* pb = Space.pIndex(b, si);
+	Size i = Space.Reversed() ? MismatchLast(pa, pb, si) : MismatchFirst(pa, pb, si);
+	if (i != si) r = pa[i] < pb[i] ? B8(-1) : 1U;
+}
+// Element opcodes. The first operand byte is a kind, not a register: bits 0-1 give the
+// element width (1 << bits bytes) and bit 2 makes VSUM/VMIN/VMAX read elements as signed.
+// n counts elements, and the whole range is checked before anything is read or written.
+template<typename F> inline void ByWidth(B1 kind, F f) {
+	switch (kind & 3) {
+		case 0: f.template operator()<B1>(); break;
+		case 1: f.template operator()<B2>(); break;
+		case 2: f.template operator()<B4>(); break;
+		default: f.template operator()<B8>(); break;
+	}
+}
+inline void VmContext::VMAP_(FuncTag f, B1 kind, Index d, Index a, Index b, Size n) {
+	if (n == 0) return;
+	ByWidth(kind, [&]<typename Bn>() {
+		CheckRange(d, n, sizeof(Bn)); CheckRange(a, n, sizeof(Bn)); CheckRange(b, n, sizeof(Bn));
+		Code.Touch(d, n * sizeof(Bn));
+		Size len = n * sizeof(Bn);
+		VecMap<Bn>(VecTag(f - VADD), Space.pIndex(d, len), Space.pIndex(a, len), Space.pIndex(b, len), n, Space.linear);
+	});
+}
+// r is the sum, modulo 2^64, or the extreme of the elements widened to 64 bits. VMIN and
+// VMAX of no elements give the largest and smallest value an element can hold.
+inline void VmContext::VRED_(FuncTag f, B1 kind, B8& r, Index a, Size n) {
+	bool sign = kind & 4;
+	ByWidth(kind, [&]<typename Bn>() {
+		const Byte* p = nullptr;
+		if (n) { CheckRange(a, n, sizeof(Bn)); p = Space.pIndex(a, n * sizeof(Bn)); }
+		bool swap = Space.linear;
+		if (f == VSUM) r = sign ? VecSum<Bn, true>(p, n, swap) : VecSum<Bn, false>(p, n, swap);
+		else if (f == VMIN) r = sign ? VecBest<Bn, true, false>(p, n, swap) : VecBest<Bn, false, false>(p, n, swap);
+		else r = sign ? VecBest<Bn, true, true>(p, n, swap) : VecBest<Bn, false, true>(p, n, swap);
+	});
+}
+inline void VmContext::VFILL_(B1 kind, Index d, B8 x, Size n) {
+	if (n == 0) return;
+	ByWidth(kind, [&]<typename Bn>() {
+		CheckRange(d, n, sizeof(Bn));
+		Code.Touch(d, n * sizeof(Bn));
+		VecFill<Bn>(Space.pIndex(d, n * sizeof(Bn)), n, Space.linear ? ByteSwap(Bn(x)) : Bn(x));
+	});
+}
+// Inclusive prefix sums in guest order: d[k] = a[0] + ... + a[k]. d may be a itself.
+inline void VmContext::VSCAN_(B1 kind, Index d, Index a, Size n) {
+	if (n == 0) return;
+	ByWidth(kind, [&]<typename Bn>() {
+		CheckRange(d, n, sizeof(Bn)); CheckRange(a, n, sizeof(Bn));
+		Code.Touch(d, n * sizeof(Bn));
+		Size len = n * sizeof(Bn);
+		VecScan<Bn>(Space.pIndex(d, len), Space.pIndex(a, len), n, Space.linear, Space.Reversed());
+	});
+}
+// BcdFS/BcdTS: BcdF/BcdT over n 8-byte words at a, into d (which may be a).
+template<bool To> inline void VmContext::BcdS_(Index d, Index a, Size n) {
+	if (n == 0) return;
+	CheckRange(d, n, sizeof(B8)); CheckRange(a, n, sizeof(B8));
+	Code.Touch(d, n * sizeof(B8));
+	Byte* pd = Space.pIndex(d, n * sizeof(B8));
+	const Byte* pa = Space.pIndex(a, n * sizeof(B8));
+	bool swap = Space.linear;
+	for (Size k = 0; k != n; k++) {
+		B8 v = LoadRaw<B8>(pa + k * sizeof(B8));
+		if (swap) v = swap_endian(v);
+		v = To ? bcd64_to_uint64(v) : uint64_to_bcd64(v);
+		if (swap) v = swap_endian(v);
+		::memcpy(pd + k * sizeof(B8), &v, sizeof(B8));
+	}
+}
+// An empty heap of len bytes at `at`; none when it has no room for a block.
+inline void VmContext::HeapInit(Index at, Size len) {
+	if (len < HeapT::Head + HeapT::Bytes(0)) { Vp[_HeapSp] = 0; return; }
+	Vp[_HeapSp] = at;
+	Space.memset(at, HeapT::Head);
+	Space.PutN<B8>(at, at + HeapT::Head);
+	Space.PutN<B8>(at + 8, at + len);
+}
+inline void VmContext::HeapError([[maybe_unused]] Index p) {
+	#if !Release
+	fprintf(stdErr, "\033[31m[E]\033[0m Heap error: Index={\033[35m%llu(0x%llx)\033[0m}\n", p, p);
+	#endif
+	throw VmExit{ 0xb1 };
+}
+// The heap's words are guest memory like any other: the guest can overwrite them, so
+// every access is bounds-checked and what they point to is checked before it is used.
+// Any failed check exits with 0xb1, as CheckData() does.
+inline B8 VmContext::HeapGet(Index p) {
+	if (!Space.Has(p, sizeof(B8))) HeapError(p);
+	return Space.GetN<B8>(p);
+}
+inline void VmContext::HeapPut(Index p, B8 v) {
+	if (!Space.Has(p, sizeof(B8))) HeapError(p);
+	Code.Touch(p, sizeof(B8));
+	Space.PutN<B8>(p, v);
+}
+// The class of the block in use whose payload is at p; exits with 0xb1 for anything else.
+inline Size VmContext::HeapBlock(Index p) {
+	Index h = Vp[_HeapSp];
+	if (h == 0 || p < h + HeapT::Head + sizeof(B8) || (p - h) % 16 != sizeof(B8)) HeapError(p);
+	B8 w = HeapGet(p - sizeof(B8));
+	Size c = Size(w & 0xffffffff) >> 1;
+	if ((w & ~B8(0xffffffff)) != HeapT::Tag || !(w & 1) || c >= HeapT::Classes) HeapError(p);
+	if (!Space.Has(p - sizeof(B8), HeapT::Bytes(c))) HeapError(p);
+	return c;
+}
+// The payload of a new block for n bytes, or 0 when the heap is full.
+inline Index VmContext::HeapTake(Size n) {
+	Index h = Vp[_HeapSp];
+	if (h == 0 || n > HeapT::Max) return 0;
+	Size c = HeapT::Class(n), len = HeapT::Bytes(c);
+	Index list = h + 16 + 24 * c, b = HeapGet(list);
+	if (b != 0) {
+		if (b < h + HeapT::Head || (b - h) % 16 || HeapGet(b) != (HeapT::Tag | c << 1)) HeapError(b + sizeof(B8));
+		HeapPut(list, HeapGet(b + sizeof(B8)));
+	}
+	else {
+		Index cur = HeapGet(list + 8), lim = HeapGet(list + 16);
+		if (cur > lim || lim - cur < len) {
+			Index top = HeapGet(h), end = HeapGet(h + 8);
+			Size room = top < end ? end - top : 0, slab = len < HeapT::Slab ? HeapT::Slab : len;
+			if (room < slab) slab = len;
+			if (room < slab) return 0;
+			cur = top; lim = top + slab;
+			HeapPut(h, lim); HeapPut(list + 16, lim);
+		}
+		b = cur;
+		HeapPut(list + 8, cur + len);
+	}
+	if (!Space.Has(b, len)) HeapError(b + sizeof(B8));
+	HeapPut(b, HeapT::Tag | c << 1 | 1);
+	return b + sizeof(B8);
+}
+inline void VmContext::HeapGive(Index p) {
+	Size c = HeapBlock(p);
+	Index list = Vp[_HeapSp] + 16 + 24 * c;
+	HeapPut(p, HeapGet(list));
+	HeapPut(p - sizeof(B8), HeapT::Tag | c << 1);
+	HeapPut(list, p - sizeof(B8));
+}
+// ALLOC: r is the payload of a block for n bytes, or 0 with _error set to ENOMEM. Threads
+// share one heap, so with threads about it is taken under a lock.
+inline void VmContext::ALLOC_(B8& r, Size n) {
+	std::unique_lock<std::mutex> l;
+	if (Threads) l = std::unique_lock<std::mutex>(Threads->heap);
+	Index p = HeapTake(n);
+	Vp[_error] = p ? 0 : ENOMEM;
+	r = p;
+}
+// FREE: p is 0 or a block from ALLOC/REALLOC that is still in use.
+inline void VmContext::FREE_(Index p) {
+	if (p == 0) return;
+	std::unique_lock<std::mutex> l;
+	if (Threads) l = std::unique_lock<std::mutex>(Threads->heap);
+	HeapGive(p);
+}
+// REALLOC: r holds n bytes with the start of the block at p, which is freed; p itself
+// when it is big enough already. On failure r is 0, _error is ENOMEM and p is kept.
+inline void VmContext::REALLOC_(B8& r, Index p, Size n) {
+	std::unique_lock<std::mutex> l;
+	if (Threads) l = std::unique_lock<std::mutex>(Threads->heap);
+	if (p == 0) { p = HeapTake(n); Vp[_error] = p ? 0 : ENOMEM; r = p; return; }
+	Size have = HeapT::Bytes(HeapBlock(p)) - sizeof(B8);
+	if (n <= have) { Vp[_error] = 0; r = p; return; }
+	Index q = HeapTake(n);
+	if (q == 0) { Vp[_error] = ENOMEM; r = 0; return; }
+	Code.Touch(q, have);
+	::memmove(Space.pIndex(q, have), Space.pIndex(p, have), size_t(have));
+	HeapGive(p);
+	Vp[_error] = 0;
+	r = q;
+}
+// `dir`/`name` in a new[] array.
+inline char* JoinPath(const char* dir, const char* name) {
+	size_t n = strlen(dir), m = strlen(name);
+	char* path = new char[n + m + 2];
+	::memcpy(path, dir, n); path[n] = '/'; ::memcpy(path + n + 1, name, m + 1);
+	return path;
+}
+inline void VmContext::fopen_(B8& file, Index path, Size pathLen, Index mod, Size modLen) {
+	CheckData(path, pathLen);
+	char* pathStr = (char*)Space.pIndex(path, pathLen);
+	CheckData(mod, modLen);
+	char* modStr = (char*)Space.pIndex(mod, modLen);
+	char* full = cwd && pathStr[0] != '/' ? JoinPath(cwd, pathStr) : nullptr;
+	if (full) pathStr = full;
+	Vp[_error] = B8(fopen_s((FILE**) & file, pathStr, modStr));
+	FILE* pFile = *(FILE**)&file;
+	if (Vp[_error] || pFile == nullptr) { delete[] full; return; }
+	// After a restore, new handles are tagged odd so they cannot equal a saved pointer.
+	if (restored) file |= 1;
+	size_t n = strlen(pathStr), m = strlen(modStr);
+	FileT f{ file, pFile, new char[n + 1], new char[m + 1], 0 };
+	::memcpy(f.path, pathStr, n + 1); ::memcpy(f.mode, modStr, m + 1);
+	delete[] full;
+	if (!AddFile(f)) { delete[] f.path; delete[] f.mode; }
+}
+inline FILE* VmContext::Handle(B8 file) {
+	switch (file) {
+		case 0: return stdErr;
+		case 1: return stdIn;
+		case 2: return stdOut;
+		default:
+			if (restored) {
+				for (Size k = 0; k != fileCnt; k++) if (files[k].handle == file) return files[k].pFile;
+			}
+			return *(FILE**)&file;
+	}
+}
+
+// Copies guest bytes [sp, sp + n) to host memory in guest order.
+inline void VmContext::CopyOut(Byte* to, Index sp, Size n) {
+	Byte* p = Space.pIndex(sp, n);
+	if (!Space.Reversed()) { ::memcpy(to, p, n); return; }
+	for (Size i = 0; i != n; i++) to[i] = p[n - 1 - i];
+}
+
+inline void VmContext::fin_(B8 file, Index sp, Size spLen, Size once, Size cnt, B8& r) {
+	CheckRange(sp, spLen);
+	FILE* pFile = Handle(file);
+	Code.Touch(sp, spLen);
+	Byte* p = Space.pIndex(sp, spLen);
+	::memset(p, 0, spLen);
+	StreamT* s = Streams.Open(pFile, false, Vp[_io_size]);
+	if (s == nullptr || s->out) r = fread_s(p, spLen, once, cnt, pFile);
+	else if (once == 0 || cnt > spLen / once) r = 0;
+	else {
+		Size need = once * cnt, got = s->len - s->pos < need ? s->len - s->pos : need;
+		::memcpy(p, s->buf + s->pos, got);
+		s->pos += got;
+		int fd = FileNo(pFile);
+		while (got < need) {
+			// Whatever the guest did not ask for lands in the buffer for the next FIN.
+			s->pos = s->len = 0;
+			iovec v[2] = { { p + got, size_t(need - got) }, { s->buf, size_t(s->cap) } };
+			long long w = readv(fd, v, 2);
+			if (w < 0 && errno == EINTR) continue;
+			if (w <= 0) break;
+			if (Size(w) > need - got) { s->len = Size(w) - (need - got); w = (long long)(need - got); }
+			got += Size(w);
+		}
+		r = got / once;
+	}
+	if (Space.Reversed()) SpaceT::Flip(p, spLen);
+}
+// AIN/AOUT: the transfer starts at the file position FIN/FOUT left, after their
+// buffers are flushed or given back. Reversed layouts move through a scratch copy that
+// AWAIT puts in place.
+inline void VmContext::aio_(bool out, B8 file, Index sp, Size len, B8& ticket) {
+	CheckRange(sp, len);
+	FILE* pFile = Handle(file);
+	ticket = 0;
+	if (Aio == nullptr) {
+		Aio = new (std::nothrow) AioT();
+		if (Aio == nullptr || !Aio->Init(aioOp)) { delete Aio; Aio = nullptr; Vp[_error] = ENOMEM; return; }
+	}
+	int fd = FileNo(pFile);
+	int e = 0;
+	if (StreamT* s = Streams[fd]) {
+		if (s->out) StreamsT::Flush(fd, *s);
+		else if (!out && s->pos != s->len) {
+			// Read-ahead cannot go back into a pipe, so it answers this transfer.
+			Size n = s->len - s->pos < len ? s->len - s->pos : len;
+			Code.Touch(sp, n);
+			Byte* p = Space.pIndex(sp, n);
+			::memcpy(p, s->buf + s->pos, n);
+			if (Space.Reversed()) SpaceT::Flip(p, n);
+			s->pos += n;
+			ticket = Aio->Ready((long long)n, e);
+			Vp[_error] = B8(e);
+			return;
+		}
+		else StreamsT::Drop(fd, *s);
+	}
+	// An earlier FIN through stdio may have read past what the guest took; those bytes
+	// answer this transfer. Where stdio does not show them, a seekable file is put back
+	// at the guest's position, and a pipe loses them.
+	if (Size held = out ? 0 : Buffered(pFile)) {
+		if (held != ~Size(0)) {
+			Size n = held < len ? held : len;
+			Code.Touch(sp, n);
+			Byte* p = Space.pIndex(sp, n);
+			n = fread(p, 1, n, pFile);
+			if (Space.Reversed()) SpaceT::Flip(p, n);
+			ticket = Aio->Ready((long long)n, e);
+			Vp[_error] = B8(e);
+			return;
+		}
+		B8 at = Tell(pFile);
+		if (at != ~B8(0)) { fflush(pFile); Seek(pFile, at); }
+	}
+	if (out) fflush(pFile);
+	else Code.Touch(sp, len);
+	Byte* p = Space.pIndex(sp, len);
+	Byte* scratch = nullptr;
+	if (Space.Reversed() && len) {
+		scratch = (Byte*)::malloc(len);
+		if (scratch == nullptr) { Vp[_error] = ENOMEM; return; }
+		if (out) CopyOut(scratch, sp, len);
+	}
+	ticket = Aio->Submit(out, fd, scratch ? scratch : p, len, sp, scratch, e);
+	if (ticket == 0) ::free(scratch);
+	Vp[_error] = B8(e);
+}
+inline void VmContext::await_(B8 ticket, B8& r, bool block) {
+	AioT::OpT* o = Aio ? Aio->Find(ticket) : nullptr;
+	if (o == nullptr) { Vp[_error] = EINVAL; r = AioT::Failed; return; }
+	if (!Aio->Wait(*o, block)) { Vp[_error] = 0; r = AioT::Pending; return; }
+	long long res = o->res;
+	if (!o->out && o->scratch && res > 0) {
+		Byte* p = Space.pIndex(o->sp, Size(res));
+		for (Size i = 0; i != Size(res); i++) p[res - 1 - i] = o->scratch[i];
+	}
+	Aio->Free(*o);
+	Vp[_error] = res < 0 ? B8(-res) : 0;
+	r = res < 0 ? AioT::Failed : B8(res);
+}
+// SPAWN: the new thread starts at `entry` with a copy of these registers, its own stack,
+// Vp[_exp_arg] = arg and Vp[_thread] = its id; tid is that id, or 0 with _error set.
+inline void VmContext::spawn_(Index entry, B8 arg, B8& tid) {
+	int e = 0;
+	if (Threads == nullptr) {
+		Threads = new (std::nothrow) ThreadsT();
+		if (Threads == nullptr || !Threads->Init(*this, threadOp)) { delete Threads; Threads = nullptr; tid = 0; Vp[_error] = ENOMEM; return; }
+	}
+	std::lock_guard<std::mutex> l(Threads->m);
+	ThreadT* t = Threads->Add(Vp, entry, arg, Vp[_thread_stack], e);
+	if (t) Threads->Push(*t, worker);
+	tid = t ? t->id : 0;
+	Vp[_error] = B8(e);
+}
+// JOIN: r is the Vp[_exp_res] the thread ended with, after which its id is gone; Failed
+// with EINVAL for an unknown id or the caller's own. Waiting ends the slice with the
+// JOIN about to run again.
+inline bool VmContext::join_(Index at, B8 tid, B8& r) {
+	if (Threads == nullptr) { r = AioT::Failed; Vp[_error] = EINVAL; return false; }
+	std::lock_guard<std::mutex> l(Threads->m);
+	ThreadT* t = Threads->Find(tid);
+	if (t == nullptr || t == thread) { r = AioT::Failed; Vp[_error] = EINVAL; return false; }
+	if (t->state != ThreadT::Done) {
+		thread->waitFor = tid; thread->block = true;
+		Vp[_ip] = at; yielded = 1;
+		return true;
+	}
+	r = t->result; Vp[_error] = 0;
+	thread->waitFor = 0;
+	Threads->slots[tid % ThreadsT::MaxThreads] = nullptr;
+	Threads->live--;
+	delete t;
+	return false;
+}
+// HTL: parks the thread until a WAKE, unless one came first. With no other thread
+// nothing can wake it.
+inline bool VmContext::park_(Index at) {
+	if (Threads == nullptr) {
+		#if !Release
+		fprintf(stdErr, "\033[31m[E]\033[0m Deadlock: HTL with no thread to wake it.\n");
+		#endif
+		throw VmExit{ 0xc3 };
+	}
+	std::lock_guard<std::mutex> l(Threads->m);
+	if (thread->permit) { thread->permit = false; return false; }
+	thread->block = true;
+	Vp[_ip] = at; yielded = 1;
+	return true;
+}
+inline void VmContext::wake_(B8 tid) {
+	if (Threads == nullptr) {
+		Threads = new (std::nothrow) ThreadsT();
+		if (Threads == nullptr || !Threads->Init(*this, threadOp)) { delete Threads; Threads = nullptr; Vp[_error] = ENOMEM; return; }
+	}
+	std::lock_guard<std::mutex> l(Threads->m);
+	ThreadT* t = Threads->Find(tid);
+	if (t == nullptr || t->state == ThreadT::Done) { Vp[_error] = EINVAL; return; }
+	t->permit = true;
+	Threads->Wake(*t, worker);
+	Vp[_error] = 0;
+}
+// AADD/ACAS: f(old, want) decides the new value of the 8 bytes at p and whether to store
+// it; the old value is returned. Words the host can address atomically are updated with
+// a compare-and-swap, the rest under a lock picked by address.
+template<typename F> inline B8 VmContext::Atomic(Index p, F f) {
+	CheckData(p, sizeof(B8));
+	Code.Touch(p, sizeof(B8));
+	Byte* h = Space.pIndex(p, sizeof(B8));
+	bool linear = Space.linear;
+	auto Order = [linear](B8 v) { return linear ? swap_endian(v) : v; };
+	B8 want;
+	if (reinterpret_cast<uintptr_t>(h) % std::atomic_ref<B8>::required_alignment == 0) {
+		std::atomic_ref<B8> a(*reinterpret_cast<B8*>(h));
+		B8 raw = a.load();
+		do { if (!f(Order(raw), want)) break; } while (!a.compare_exchange_weak(raw, Order(want)));
+		return Order(raw);
+	}
+	static std::mutex locks[64];
+	std::lock_guard<std::mutex> l(locks[reinterpret_cast<uintptr_t>(h) / 8 % 64]);
+	B8 raw; ::memcpy(&raw, h, sizeof raw);
+	if (f(Order(raw), want)) { B8 v = Order(want); ::memcpy(h, &v, sizeof v); }
+	return Order(raw);
+}
+// I/O on a worker other than 0: the thread stops before the instruction and moves there.
+inline bool VmContext::Away(Index at, int& ret) {
+	Vp[_ip] = at;
+	thread->io = true;
+	yielded = 1; ret = 0;
+	return true;
+}
+inline bool VmContext::Preempt() {
+	slice = ThreadsT::Slice;
+	if (!Threads->Due()) return false;
+	yielded = 1;
+	return true;
+}
+inline B8 SteadyNs() {
+	return B8(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+// Gives the context f units of fuel. Without -fuel it has ~0, which no run gets through.
+void VmContext::Arm(B8 f) {
+	fuel = f;
+	check = deadline && f > ClockEvery ? f - ClockEvery : 0;
+	#if Profiler
+	if (Perf && Perf->threaded) check = std::max(check, Perf->DueAt(f));
+	#endif
+	fuelAt = fuelOp ? &Vp[_fuel] : &fuelSink;
+	*fuelAt = f;
+}
+// Charge() came down to `check`: time to look at the clock, or the fuel is gone. With
+// green threads the fuel is in ThreadsT::fuel, taken Slice units at a time.
+void VmContext::Meter(Index at) {
+	int code = 0;
+	if (deadline && SteadyNs() >= deadline) code = 0xc5;
+	else if (fuel == 0 && !(Threads && Refuel())) code = 0xc4;
+	if (code == 0) {
+		#if Profiler
+		if (Perf && Perf->threaded) Perf->Tick(*this, at);
+		#endif
+		Arm(fuel);
+		return;
+	}
+	Vp[_ip] = at;
+	stopped = Threads == nullptr;
+	#if !Release
+	fprintf(stdErr, "\033[31m[E]\033[0m %s before the branch at %llu.\n", code == 0xc4 ? "Out of fuel" : "Deadline passed", at);
+	#endif
+	throw VmExit{ code };
+}
+bool VmContext::Refuel() {
+	B8 have = Threads->fuel.load(std::memory_order_relaxed), take;
+	do {
+		take = have < ThreadsT::Slice ? have : ThreadsT::Slice;
+		if (take == 0) return false;
+	} while (!Threads->fuel.compare_exchange_weak(have, have - take, std::memory_order_relaxed));
+	fuel = take;
+	return true;
+}
+inline void VmContext::fout_(B8 file, Index sp, Size spLen, Size once, Size cnt, B8& r) {
+	CheckRange(sp, spLen);
+	if (once && cnt > spLen / once) { 
+		r = 0; 
+		//fprintf(stdErr, "[E] out: \"%s\"(%llu) [%llu] {%llu*%llu} -> ?(%llx) Ret %llu.\n", spLen, once, cnt, file, r);
+		return; 
+	}
+	FILE* pFile = Handle(file);
+	Size n = once * cnt, done = 0;
+	StreamT* s = Streams.Open(pFile, true, Vp[_io_size]);
+	if (s == nullptr || !s->out) {
+		if (!Space.Reversed()) { r = fwrite(Space.pIndex(sp, spLen), once, cnt, pFile); return; }
+		// Reversed layouts go out in guest order through a fixed scratch buffer.
+		Byte scratch[4096];
+		while (done < n) {
+			Size m = n - done < sizeof scratch ? n - done : sizeof scratch;
+			CopyOut(scratch, sp + done, m);
+			Size w = fwrite(scratch, 1, m, pFile);
+			done += w;
+			if (w != m) break;
+		}
+		r = once ? done / once : 0;
+		return;
+	}
+	int fd = FileNo(pFile);
+	if (!Space.Reversed() && s->len + n > s->cap) {
+		long long w = StreamsT::Write(fd, *s, Space.pIndex(sp, n), n);
+		done = w > 0 ? Size(w) : 0;
+	}
+	else while (done < n) {
+		if (s->len == s->cap && !StreamsT::Flush(fd, *s)) break;
+		Size m = s->cap - s->len < n - done ? s->cap - s->len : n - done;
+		CopyOut(s->buf + s->len, sp + done, m);
+		s->len += m; done += m;
+	}
+	if (Vp[_io_flush] == FlushEach || (Vp[_io_flush] == FlushLine && n && ::memchr(Space.pIndex(sp, n), '\n', n)))
+		StreamsT::Flush(fd, *s);
+	r = once ? done / once : 0;
+}
+
+// Executes the instruction at Vp[_ip]; returns true with `ret` set once the program stops.
+inline bool VmContext::Step(int& ret) {
+	Index ip = CheckIp(1); FuncTag func_id = FuncTag(Space[ip]);
+	#if !Release || Profiler
+	lastFuncID = func_id;
+	#endif
+	switch (func_id) {
+		case NOP:break;
+		case Exit:ret = int(Vp[_ExitWith]); return true;
+		case Goto:Charge(ip); ip = CheckIp(1); Vp[_ip] = Vp[Space[ip+1]]; break;
+		case IfGo:Charge(ip); ip = CheckIp(2); if(Vp[Space[ip]]) Vp[_ip] = Vp[Space[ip+1]]; break;
+		case IfNG:Charge(ip); ip = CheckIp(2); if(!(Vp[Space[ip]])) Vp[_ip] = Vp[Space[ip+1]]; break;
+		case SvIp:ip = CheckIp(1); Vp[Space[ip]] = Vp[_ip]; break;
+		case Loop:Charge(ip); ip = CheckIp(2); if (--(Vp[Space[ip]])) Vp[_ip] = Vp[Space[ip+1]]; break;
+		case Call:Charge(ip); ip = CheckIp(1); Psh<B8>(Vp[_ip]); Vp[_ip] = Vp[Space[ip + 1]]; break;
+		case Ret:Charge(ip); ip = CheckIp(0); Pop<B8>(Vp[_ip]); break;
+		case Add:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip + 1]] + Vp[Space[ip + 2]]; ip += 3; break;
+		case Sub:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] - Vp[Space[ip+2]]; break;
+		case Mul:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] * Vp[Space[ip+2]]; break;
+		case Div:ip = CheckIp(4); Div_(stdErr, Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case IMul:ip = CheckIp(3); ToB8I(Vp[Space[ip]]) = ToB8I(Vp[Space[ip+1]]) * ToB8I(Vp[Space[ip+2]]); break;
+		case IDiv:ip = CheckIp(4); Div_I(stdErr, ToB8I(Vp[Space[ip]]), ToB8I(Vp[Space[ip+1]]), ToB8I(Vp[Space[ip+2]]), ToB8I(Vp[Space[ip+3]])); break;
+		case Inc:ip = CheckIp(1); ++Vp[Space[ip]]; break;
+		case Dec:ip = CheckIp(1); --Vp[Space[ip]]; break;
+		case Than:ip = CheckIp(3); Vp[Space[ip]] = Than_(Vp[Space[ip+1]] , Vp[Space[ip+2]]); break;
+		case Less:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] < Vp[Space[ip+2]]; break;
+		case More:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] > Vp[Space[ip+2]]; break;
+		case IThan:ip = CheckIp(3); ToB8I(Vp[Space[ip+1]]) = Than_I(ToB8I(Vp[Space[ip+2]]), ToB8I(Vp[Space[ip+3]])); break;
+		case ILess:ip = CheckIp(3); ToB8I(Vp[Space[ip+1]]) = ToB8I(Vp[Space[ip+2]]) < ToB8I(Vp[Space[ip+3]]); break;
+		case IMore:ip = CheckIp(3); ToB8I(Vp[Space[ip+1]]) = ToB8I(Vp[Space[ip+2]]) > ToB8I(Vp[Space[ip+3]]); break;
+		case Not:ip = CheckIp(2); if (Vp[Space[ip + 1]]) Vp[Space[ip]] = 0U; else Vp[Space[ip]] = 1U; break;
+		case And:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] & Vp[Space[ip+2]]; break;
+		case Or:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] | Vp[Space[ip+2]]; break;
+		case Xor:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] ^ Vp[Space[ip+2]]; break;
+		case LMov:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] << Vp[Space[ip+2]]; break;
+		case RMov:ip = CheckIp(3); Vp[Space[ip]] = Vp[Space[ip+1]] >> Vp[Space[ip+2]]; break;
+		case ILMov:ip = CheckIp(3); ToB8I(Vp[Space[ip]]) = ToB8I(Vp[Space[ip+1]]) << ToB8I(Vp[Space[ip+2]]); break;
+		case IRMov:ip = CheckIp(3); ToB8I(Vp[Space[ip]]) = ToB8I(Vp[Space[ip+1]]) >> ToB8I(Vp[Space[ip+2]]); break;
+		case ROL:ip = CheckIp(3); Vp[Space[ip]] = std::rotl(Vp[Space[ip+1]], (int)ToB8I(Vp[Space[ip+2]])); break;
+		case ROR:ip = CheckIp(3); Vp[Space[ip]] = std::rotr(Vp[Space[ip+1]], (int)ToB8I(Vp[Space[ip+2]])); break;
+		case ToBool:ip = CheckIp(2); if (Vp[Space[ip + 1]]) Vp[Space[ip]] = 1U; else Vp[Space[ip]] = 0U; break;
+		case Complement: ip = CheckIp(2); Vp[Space[ip]] = ~(Vp[Space[ip+1]]); break;
+		case HTL:if (park_(ip)) { ret = 0; return true; } break;
+		case Swap:ip = CheckIp(2); std::swap(Vp[Space[ip]],Vp[Space[ip+1]]); break;
+		case Mov1:ip = CheckIp(2); Mov<B1>(Vp[Space[ip]], Vp[Space[ip+1]]); break;
+		case Mov2:ip = CheckIp(2); Mov<B2>(Vp[Space[ip]], Vp[Space[ip+1]]); break;
+		case Mov4:ip = CheckIp(2); Mov<B4>(Vp[Space[ip]], Vp[Space[ip+1]]); break;
+		case Mov8:ip = CheckIp(2); Mov<B8>(Vp[Space[ip]], Vp[Space[ip+1]]); break;
+		case Set1:ip = CheckIp(1 + sizeof(B1)); Set<B1>(Vp[Space[ip]], ip+1); break;
+		case Set2:ip = CheckIp(1 + sizeof(B2)); Set<B2>(Vp[Space[ip]], ip+1); break;
+		case Set4:ip = CheckIp(1 + sizeof(B4)); Set<B4>(Vp[Space[ip]], ip+1); break;
+		case Set8:ip = CheckIp(1 + sizeof(B8)); Set<B8>(Vp[Space[ip]], ip+1); break;
+		case Get1:ip = CheckIp(2); Get<B1>(Vp[Space[ip]], Space[ip+1]); break;
+		case Get2:ip = CheckIp(2); Get<B2>(Vp[Space[ip]], Space[ip+1]); break;
+		case Get4:ip = CheckIp(2); Get<B4>(Vp[Space[ip]], Space[ip+1]); break;
+		case Get8:ip = CheckIp(2); Get<B8>(Vp[Space[ip]], Space[ip+1]); break;
+		case Wrt1:ip = CheckIp(2); Wrt<B1>(Vp[Space[ip]], Vp[Space[ip+1]]); break;
+		case Wrt2:ip = CheckIp(2); Wrt<B2>(Vp[Space[ip]], Vp[Space[ip+1]]); break;
+		case Wrt4:ip = CheckIp(2); Wrt<B4>(Vp[Space[ip]], Vp[Space[ip+1]]); break;
+		case Wrt8:ip = CheckIp(2); Wrt<B8>(Vp[Space[ip]], Vp[Space[ip+1]]); break;
+		case Psh1:ip = CheckIp(1); Psh<B1>(Vp[Space[ip]]); break;
+		case Psh2:ip = CheckIp(1); Psh<B2>(Vp[Space[ip]]); break;
+		case Psh4:ip = CheckIp(1); Psh<B4>(Vp[Space[ip]]); break;
+		case Psh8:ip = CheckIp(1); Psh<B8>(Vp[Space[ip]]); break;
+		case Pop1:ip = CheckIp(1); Pop<B1>(Vp[Space[ip]]); break;
+		case Pop2:ip = CheckIp(1); Pop<B2>(Vp[Space[ip]]); break;
+		case Pop4:ip = CheckIp(1); Pop<B4>(Vp[Space[ip]]); break;
+		case Pop8:ip = CheckIp(1); Pop<B8>(Vp[Space[ip]]); break;
+		case PshM:ip = CheckIp(2); PshM_<true>(Space[ip], Space[ip+1], 8 * std::popcount(Space[ip+1])); break;
+		case PopM:ip = CheckIp(2); PopM_<true>(Space[ip], Space[ip+1], 8 * std::popcount(Space[ip+1])); break;
+		case BcdF:ip = CheckIp(2); Vp[Space[ip]] = uint64_to_bcd64(Vp[Space[ip+1]]); break;
+		case BcdT:ip = CheckIp(2); Vp[Space[ip]] = bcd64_to_uint64(Vp[Space[ip+1]]); break;
+		case BcdAdd: { ip = CheckIp(4); B8 c = Vp[Space[ip+1]]; B8 r = bcd64_add(Vp[Space[ip+2]], Vp[Space[ip+3]], c); Vp[Space[ip]] = r; Vp[Space[ip+1]] = c; }break;
+		case BcdSub: { ip = CheckIp(4); B8 c = Vp[Space[ip+1]]; B8 r = bcd64_sub(Vp[Space[ip+2]], Vp[Space[ip+3]], c); Vp[Space[ip]] = r; Vp[Space[ip+1]] = c; }break;
+		case BcdCmp: ip = CheckIp(3); BcdCmp_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]]); break;
+		case BcdFS: ip = CheckIp(3); BcdS_<false>(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]]); break;
+		case BcdTS: ip = CheckIp(3); BcdS_<true>(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]]); break;
+		case ALLOC: ip = CheckIp(2); ALLOC_(Vp[Space[ip]], Vp[Space[ip+1]]); break;
+		case FREE: ip = CheckIp(1); FREE_(Vp[Space[ip]]); break;
+		case REALLOC: ip = CheckIp(3); REALLOC_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]]); break;
+		case SignF:ip = CheckIp(3); ToB8I(Vp[Space[ip]]) = uint64_to_int64(Vp[Space[ip+1]], Vp[Space[ip+2]]); break;
+		case SignT:ip = CheckIp(3); int64_to_uint64(ToB8I(Vp[Space[ip]]), Vp[Space[ip+1]], Vp[Space[ip+2]]); break;
+		case LEA:ip = CheckIp(4); Vp[Space[ip]] = CheckSafe(Vp[Space[ip+1]] + (Vp[Space[ip+2]] * Vp[Space[ip+3]])); break;
+		case XCHG1:ip = CheckIp(2); XCHG<B1>(Vp[Space[ip]], Space[ip+1], 0xff); break;
+		case XCHG2:ip = CheckIp(2); XCHG<B2>(Vp[Space[ip]], Space[ip+1], 0xffff); break;
+		case XCHG4:ip = CheckIp(2); XCHG<B4>(Vp[Space[ip]], Space[ip+1], 0xffffffff); break;
+		case XCHG8:ip = CheckIp(2); XCHG<B8>(Vp[Space[ip]], Space[ip+1], 0xffffffffffffffff); break;
+		case ‌MOVS: ip = CheckIp(3); MOVS_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]]); break;
+		case CMPS: ip = CheckIp(4); CMPS_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case ‌SCAS‌1: ip = CheckIp(4); SCAS<B1>(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case SCAS‌2: ip = CheckIp(4); SCAS<B2>(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case SCAS‌4: ip = CheckIp(4); SCAS<B4>(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case SCAS8: ip = CheckIp(4); SCAS<B8>(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case VADD: case VSUB: case VMUL: case VAND: case VOR: case VXOR:
+			ip = CheckIp(5); VMAP_(func_id, Space[ip], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]], Vp[Space[ip+4]]); break;
+		case VSUM: case VMIN: case VMAX: ip = CheckIp(4); VRED_(func_id, Space[ip], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case VFILL: ip = CheckIp(4); VFILL_(Space[ip], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case VSCAN: ip = CheckIp(4); VSCAN_(Space[ip], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case FOPEN: if (carrier) return Away(ip, ret); ip = CheckIp(5); fopen_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]], Vp[Space[ip+4]]); break;
+		case FIN: if (carrier) return Away(ip, ret); ip = CheckIp(6); fin_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]], Vp[Space[ip+4]], Vp[Space[ip+5]]); break;
+		case FOUT: if (carrier) return Away(ip, ret); ip = CheckIp(6); fout_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]], Vp[Space[ip+4]], Vp[Space[ip+5]]); break;
+		case AIN: if (carrier) return Away(ip, ret); ip = CheckIp(4); aio_(false, Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case AOUT: if (carrier) return Away(ip, ret); ip = CheckIp(4); aio_(true, Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]], Vp[Space[ip+3]]); break;
+		case AWAIT: if (carrier) return Away(ip, ret); ip = CheckIp(2); await_(Vp[Space[ip]], Vp[Space[ip+1]], true); break;
+		case APOLL: if (carrier) return Away(ip, ret); ip = CheckIp(2); await_(Vp[Space[ip]], Vp[Space[ip+1]], false); break;
+		case SNAP: {
+			if (carrier) return Away(ip, ret);
+			ip = CheckIp(0); Vp[_error] = 0;
+			// The other threads' registers are not in Vp.
+			int e = ENOTSUP;
+			if (Threads == nullptr) { char* path = SidePath(".snap"); e = Snapshot(path); delete[] path; }
+			Vp[_error] = B8(e);
+		}break;
+		case SPAWN: ip = CheckIp(3); spawn_(Vp[Space[ip]], Vp[Space[ip+1]], Vp[Space[ip+2]]); break;
+		case YIELD: ip = CheckIp(0); if (Threads && Threads->queued.load(std::memory_order_relaxed)) { yielded = 1; ret = 0; return true; } break;
+		case JOIN: ip = CheckIp(2); if (join_(ip - 1, Vp[Space[ip]], Vp[Space[ip+1]])) { ret = 0; return true; } break;
+		case WAKE: ip = CheckIp(1); wake_(Vp[Space[ip]]); break;
+		case AADD: { ip = CheckIp(3); B8 x = Vp[Space[ip+2]]; Vp[Space[ip]] = Atomic(Vp[Space[ip+1]], [x](B8 o, B8& w) { w = o + x; return true; }); }break;
+		case ACAS: { ip = CheckIp(4); B8 x = Vp[Space[ip+2]], y = Vp[Space[ip+3]]; Vp[Space[ip]] = Atomic(Vp[Space[ip+1]], [x, y](B8 o, B8& w) { w = y; return o == x; }); }break;
+		case Data: { ip = CheckIp(1); B8& vpi = Vp[Space[ip]]; Vp[_ip]--; ip = CheckIp(1 + sizeof(B8)); Set<B8>(Vp[Space[ip]], ip+1); B8 at = Vp[_ip]; Vp[_ip]--/*Why??*/; Vp[_ip] += vpi; vpi = at; }break;
+		default:
+		{
+			#if !Release
+			fprintf(stdErr, "\033[31m[E]\033[0m No instruction: id={\033[33m0x%02x\033[0m} at={\033[35m%llu(0x%llx)\033[0m}.\n", func_id, Vp[_ip], ip);
+			#endif
+			#if !Release
+			if (infoOp) fprintf(stdErr, "\033[32m[I]\033[0m Last instruction: id={\033[33m0x%02x\033[0m} at={\033[35m%llu(0x%llx)\033[0m}.\n", lastFuncID, lastIp, lastIp);
+			#endif
+			ret = 0xc1; return true;
+		}
+	}
+	return false;
+}
+
+inline void TraceT::Note(VmContext& vm, Index ip) {
+	B8 h = head.load(std::memory_order_relaxed);
+	EntryT& e = ring[h & mask];
+	e.ip = ip;
+	// Near the end of Space Step() raises the error; the entry keeps just the address.
+	if (ip + CodeT::MaxLen < vm.Space.size) {
+		// One load covers the opcode and every operand a slot can name, and both slots are
+		// always filled, so nothing here branches but the test for PopM.
+		B8 w = vm.Space.GetN<B8>(ip);
+		B1 op = B1(w >> 56);
+		const OutT& o = out[op];
+		B1 r0 = B1(((w >> o.shift[0]) & o.keep[0]) | o.fixed[0]), r1 = B1(((w >> o.shift[1]) & o.keep[1]) | o.fixed[1]);
+		e.op = op; e.n = o.n; e.reg[0] = r0; e.reg[1] = r1;
+		e.old[0] = vm.Vp[r0]; e.old[1] = vm.Vp[r1];
+	}
+	else { e.op = ip < vm.Space.size ? vm.Space[ip] : 0; e.n = 0; }
+	head.store(h + 1, std::memory_order_release);
+	if (e.op == PopM && e.n) NoteMask(vm, ip);
+}
+// The registers PopM writes besides _stack_top follow its entry in entries of their own,
+// two to each, marked with n | 0x80.
+void TraceT::NoteMask(VmContext& vm, Index ip) {
+	B1 r = vm.Space[ip + 1], m = vm.Space[ip + 2];
+	B8 h = head.load(std::memory_order_relaxed);
+	EntryT* e = nullptr;
+	for (int k = 0; k != 8; k++) {
+		if (!(m >> k & 1)) continue;
+		if (e == nullptr || e->n == (0x80 | 2)) { e = &ring[h++ & mask]; e->ip = ip; e->op = PopM; e->n = 0x80; }
+		B1 reg = B1(r + k), j = e->n & 0x7f;
+		e->reg[j] = reg; e->old[j] = vm.Vp[reg]; e->n++;
+	}
+	head.store(h, std::memory_order_release);
+}
+#if Profiler
+// MainSwitch() with the bookkeeping of -perf around each Step(). What changes on every
+// instruction is kept in locals, out of reach of the guest's stores to Vp.
+int VmContext::MainPerf() {
+	PerfT& p = *Perf;
+	B8* counts = p.at;
+	const Index begin = p.begin;
+	const Size size = p.size;
+	B4 countdown = p.countdown;
+	B8 count = Vp[_count];
+	int ret;
+	while (Vp[_ip] < Vp[_Len]) {
+		#if !Release
+		lastIp = Vp[_ip];
+		#endif
+		if (snapRequest) SnapNow();
+		if (Threads && --slice == 0 && Preempt()) { p.countdown = countdown; return 0; }
+		Index at = Vp[_ip];
+		if (NGram) NGram->Note(at < Space.size ? FuncTag(Space[at]) : NOP);
+		if (Trace) Trace->Note(*this, at);
+		// Stored, not incremented in place: the guest sees the count but cannot move it.
+		Vp[_count] = ++count;
+		bool inCode = at - begin < size;
+		if (inCode) counts[at - begin]++;
+		// One inlined Step() only: a second copy for timed steps costs more than the branch.
+		bool timed = --countdown == 0;
+		B8 t0 = timed ? Ticks() : 0;
+		if (Step(ret)) { if (!inCode) p.op[lastFuncID]++; return ret; }
+		if (timed) { p.Sampled(lastFuncID, Ticks() - t0); countdown = p.countdown; }
+		// Step() names the opcode it ran, so Space is not read twice.
+		p.Ran(lastFuncID, at, Vp[_ip]);
+	}
+	#if !Release
+	if (infoOp) fprintf(stdErr, "\033[32m[I]\033[0m Exit: %llu (0x%llx).\n", Vp[_ExitWith], Vp[_ExitWith]);
+	#endif
+	return int(Vp[_ExitWith]);
+}
+#endif
+int VmContext::MainSwitch() {
+	auto& ip__ = Vp[_ip];
+	int ret;
+	if (profOp && NGram == nullptr) NGram = new (std::nothrow) NGramT();
+	#if Profiler
+	if (Perf) return MainPerf();
+	#endif
+	while (ip__ < Vp[_Len]) {
+		#if !Release
+		lastIp = ip__;
+		#endif
+		if (snapRequest) SnapNow();
+		if (Threads && --slice == 0 && Preempt()) return 0;
+		if (NGram) NGram->Note(ip__ < Space.size ? FuncTag(Space[ip__]) : NOP);
+		if (Trace) Trace->Note(*this, ip__);
+		if (Step(ret)) return ret;
+		
+		#if Debug
+		if (infoOp) fprintf(stdErr, "\033[32m[I]\033[0m When: %llu 0x%llx.\n", lastIp, (B8)lastFuncID);
+		if (memOp) printMemEX("Space Now", lastIp, Vp[_ip]);
+		system("pause");
+		#endif
+	}
+
+	#if !Release
+	if (infoOp) fprintf(stdErr, "\033[32m[I]\033[0m Exit: %llu (0x%llx).\n", Vp[_ExitWith], Vp[_ExitWith]);
+	#endif
+
+	return int(Vp[_ExitWith]);
+}
+
+// Operand bytes after the opcode (-1 when Step() runs it), the operand offsets the
+// instruction writes, and whether it ends a straight-line run.
+struct ShapeT { int n; B1 out; bool ctl; };
+inline ShapeT Shape(FuncTag f) {
+	switch (f) {
+		case NOP: return { 0, 0, false };
+		case Exit: case Ret: return { 0, 0, true };
+		case Goto: case Call: return { 1, 0, true };
+		case IfGo: case IfNG: return { 2, 0, true };
+		case Loop: return { 2, 0b1, true };
+		case SvIp: case Inc: case Dec: case Pop1: case Pop2: case Pop4: case Pop8: return { 1, 0b1, false };
+		case Psh1: case Psh2: case Psh4: case Psh8: return { 1, 0, false };
+		// A first register and a mask; what PopM writes is not an operand.
+		case PshM: case PopM: return { 2, 0, false };
+		case Set1: return { 1 + sizeof(B1), 0b1, false };
+		case Set2: return { 1 + sizeof(B2), 0b1, false };
+		case Set4: return { 1 + sizeof(B4), 0b1, false };
+		case Set8: return { 1 + sizeof(B8), 0b1, false };
+		case Mov1: case Mov2: case Mov4: case Mov8: case Get1: case Get2: case Get4: case Get8:
+		case XCHG1: case XCHG2: case XCHG4: case XCHG8:
+		case Not: case ToBool: case Complement: case BcdF: case BcdT: return { 2, 0b1, false };
+		case Swap: return { 2, 0b11, false };
+		case Wrt1: case Wrt2: case Wrt4: case Wrt8: return { 2, 0, false };
+		case Add: case Sub: case Mul: case IMul: case Than: case Less: case More: case And: case Or: case Xor:
+		case LMov: case RMov: case ILMov: case IRMov: case ROL: case ROR: case SignF: return { 3, 0b1, false };
+		case IThan: case ILess: case IMore: return { 3, 0b10, false };
+		case SignT: return { 3, 0b110, false };
+		case ‌MOVS: return { 3, 0, false };
+		case Div: case IDiv: case BcdAdd: case BcdSub: return { 4, 0b11, false };
+		case BcdCmp: return { 3, 0b1, false };
+		case BcdFS: case BcdTS: return { 3, 0, false };
+		case ALLOC: return { 2, 0b1, false };
+		case FREE: return { 1, 0, false };
+		case REALLOC: return { 3, 0b1, false };
+		case LEA: case CMPS: case ‌SCAS‌1: case SCAS‌2: case SCAS‌4: case SCAS8: return { 4, 0b1, false };
+		case VADD: case VSUB: case VMUL: case VAND: case VOR: case VXOR: return { 5, 0, false };
+		case VSUM: case VMIN: case VMAX: return { 4, 0b10, false };
+		case VFILL: case VSCAN: return { 4, 0, false };
+		default: return { -1, 0, true };
+	}
+}
+
+// Whether the PshM/PopM operands at p, a first register and a mask over it and the seven
+// after it, take in register `reg`.
+inline bool InMask(SpaceT& Space, Index p, B1 reg) {
+	B1 k = B1(reg - Space[p]);
+	return k < 8 && (Space[p + 1] >> k & 1);
+}
+
+void NGramT::Note(FuncTag f) {
+	B1 op = B1(f);
+	if (run >= 1) pair[last & 0xff][op]++;
+	if (run >= 2) {
+		// Keys are stored plus one so that zero marks a free slot; a full table drops the sample.
+		B4 key = (last & 0xffff) << 8 | op;
+		for (Size k = key * 2654435761u % Slots, n = 0; n != Slots; k = (k + 1) % Slots, n++) {
+			if (tri[k].key == key + 1) { tri[k].cnt++; break; }
+			if (tri[k].key == 0) { tri[k].key = key + 1; tri[k].cnt = 1; break; }
+		}
+	}
+	last = last << 8 | op;
+	run = Shape(f).ctl ? 0 : run < 2 ? run + 1 : 2;
+}
+// `<image><ext>`, for the files written next to the image.
+inline char* VmContext::SidePath(const char* ext) {
+	size_t n = strlen(imagePath), m = strlen(ext);
+	char* path = new char[n + m + 1];
+	memcpy(path, imagePath, n); memcpy(path + n, ext, m + 1);
+	return path;
+}
+// One line per sequence: the count, then the opcodes in hex.
+void NGramT::Save(const char* path) {
+	FILE* pFile = fopen(path, "w");
+	if (pFile == NULL) return;
+	for (int a = 0; a != 256; a++) for (int b = 0; b != 256; b++)
+		if (pair[a][b]) fprintf(pFile, "%llu %02x %02x\n", (unsigned long long)pair[a][b], a, b);
+	for (auto& t : tri)
+		if (t.key) fprintf(pFile, "%llu %02x %02x %02x\n", (unsigned long long)t.cnt, (t.key - 1) >> 16 & 0xff, (t.key - 1) >> 8 & 0xff, (t.key - 1) & 0xff);
+	fclose(pFile);
+}
+bool NGramT::Load(const char* path) {
+	FILE* pFile = fopen(path, "r");
+	if (pFile == NULL) return false;
+	char line[128];
+	while (fgets(line, sizeof line, pFile)) {
+		unsigned long long cnt; unsigned a, b, c;
+		int n = sscanf(line, "%llu %x %x %x", &cnt, &a, &b, &c);
+		if (n == 3) pair[a & 0xff][b & 0xff] += cnt;
+		else if (n == 4) {
+			B4 key = (a & 0xff) << 16 | (b & 0xff) << 8 | (c & 0xff);
+			for (Size k = key * 2654435761u % Slots, m = 0; m != Slots; k = (k + 1) % Slots, m++) {
+				if (tri[k].key == key + 1 || tri[k].key == 0) { tri[k].key = key + 1; tri[k].cnt += cnt; break; }
+			}
+		}
+	}
+	fclose(pFile);
+	return true;
+}
+B8 NGramT::Count(const B1* ops, int n) {
+	if (n == 2) return pair[ops[0]][ops[1]];
+	B4 key = B4(ops[0]) << 16 | B4(ops[1]) << 8 | ops[2];
+	for (Size k = key * 2654435761u % Slots, m = 0; m != Slots; k = (k + 1) % Slots, m++) {
+		if (tri[k].key == key + 1) return tri[k].cnt;
+		if (tri[k].key == 0) return 0;
+	}
+	return 0;
+}
+
+inline const char* OpName(B1 f) {
+	#define N(x) case x: return #x;
+	switch (FuncTag(f)) {
+		N(NOP) N(Exit) N(Goto) N(IfGo) N(IfNG) N(SvIp) N(Loop) N(Call) N(Ret)
+		N(Add) N(Sub) N(Mul) N(Div) N(Inc) N(Dec) N(Than) N(Less) N(More) N(Not) N(And) N(Or) N(Xor) N(ToBool)
+		N(Mov1) N(Mov2) N(Mov4) N(Mov8) N(Set1) N(Set2) N(Set4) N(Set8)
+		N(Get1) N(Get2) N(Get4) N(Get8) N(LEA) N(Wrt1) N(Wrt2) N(Wrt4) N(Wrt8)
+		N(Psh1) N(Psh2) N(Psh4) N(Psh8) N(PshM) N(Pop1) N(Pop2) N(Pop4) N(Pop8) N(PopM)
+		N(XCHG1) N(XCHG2) N(XCHG4) N(XCHG8) N(Swap)
+		N(BcdT) N(BcdF) N(SignT) N(SignF) N(LMov) N(RMov) N(ROL) N(ROR)
+		N(Complement) N(IMul) N(IDiv) N(IThan) N(ILess) N(IMore) N(ILMov) N(IRMov)
+		N(CMPS) N(Data) N(SCAS8) N(FOPEN) N(FIN) N(FOUT) N(SNAP) N(AIN) N(AOUT) N(AWAIT) N(APOLL)
+		N(SPAWN) N(YIELD) N(JOIN) N(WAKE) N(AADD) N(ACAS)
+		N(VADD) N(VSUB) N(VMUL) N(VAND) N(VOR) N(VXOR) N(VSUM) N(VMIN) N(VMAX) N(VFILL) N(VSCAN)
+		N(BcdAdd) N(BcdSub) N(BcdCmp) N(BcdFS) N(BcdTS) N(ALLOC) N(FREE) N(REALLOC) N(HTL)
+		default: break;
+	}
+	#undef N
+	switch (f) {
+		case 0x70: return "MOVS";
+		case 0x78: return "SCAS1";
+		case 0x79: return "SCAS2";
+		case 0x7a: return "SCAS4";
+		default: return "?";
+	}
+}
+
+bool TraceT::Init(Size entries, Index begin_, Size size_) {
+	Size n = 1;
+	while (n < entries && n < (Size(1) << 40)) n <<= 1;
+	ring = new (std::nothrow) EntryT[n];
+	if (!ring) return false;
+	mask = n - 1;
+	begin = begin_; size = size_;
+	for (int f = 0; f != 256; f++) {
+		OutT& o = out[f];
+		auto Operand = [&](int at) { o.shift[o.n] = B1(56 - 8 * at); o.keep[o.n] = 0xff; o.n++; };
+		auto Register = [&](B1 r) { o.fixed[o.n] = r; o.n++; };
+		ShapeT s = Shape(FuncTag(f));
+		for (int b = 0; b != 8 && o.n != 2; b++) if (s.out >> b & 1) Operand(1 + b);
+		switch (FuncTag(f)) {
+			case Psh1: case Psh2: case Psh4: case Psh8: case Pop1: case Pop2: case Pop4: case Pop8:
+			case PshM: case PopM: case Call: case Ret: Register(_stack_top); break;
+			case FOPEN: Operand(1); Register(_error); break;
+			case FIN: case FOUT: Operand(6); break;
+			case SNAP: Register(_error); break;
+			case AIN: case AOUT: Operand(4); Register(_error); break;
+			case AWAIT: case APOLL: Operand(2); Register(_error); break;
+			case SPAWN: Operand(3); Register(_error); break;
+			case JOIN: Operand(2); Register(_error); break;
+			case WAKE: Register(_error); break;
+			case AADD: case ACAS: Operand(1); break;
+			case ALLOC: case REALLOC: Register(_error); break;
+			case Data: Operand(1); break;
+			default: break;
+		}
+	}
+	return true;
+}
+// Header, the final Vp, opcode lengths and names, the entries oldest first, then the
+// code bytes in guest order. Big-endian like the image.
+void TraceT::Save(VmContext& vm, int code) {
+	char* path = vm.SidePath(".trace");
+	FILE* pFile = fopen(path, "wb");
+	delete[] path;
+	if (pFile == NULL) return;
+	B8 total = head.load(std::memory_order_acquire), cnt = std::min(total, mask + 1);
+	Size bytes = begin < vm.Space.size ? std::min(size, vm.Space.size - begin) : 0;
+	FWrite(Magic, pFile);
+	const B1 fmt[4] = { 1, 1, 0, 0 };
+	fwrite(fmt, sizeof(B1), 4, pFile);
+	FWrite(B8(code), pFile); FWrite(total, pFile); FWrite(cnt, pFile); FWrite(B8(begin), pFile); FWrite(B8(bytes), pFile);
+	for (B8 v : vm.Vp) FWrite(v, pFile);
+	for (int f = 0; f != 256; f++) {
+		int n = Shape(FuncTag(f)).n;
+		switch (FuncTag(f)) {
+			case FOPEN: n = 5; break;
+			case FIN: case FOUT: n = 6; break;
+			case SNAP: case HTL: n = 0; break;
+			case AIN: case AOUT: n = 4; break;
+			case AWAIT: case APOLL: n = 2; break;
+			case SPAWN: case AADD: n = 3; break;
+			case YIELD: n = 0; break;
+			case JOIN: n = 2; break;
+			case WAKE: n = 1; break;
+			case ACAS: n = 4; break;
+			case Data: n = 1 + sizeof(B8); break;
+			default: break;
+		}
+		char name[16] = {};
+		strncpy(name, OpName(B1(f)), sizeof name - 1);
+		FWrite(B1(n < 0 ? 0xff : n), pFile);
+		fwrite(name, 1, sizeof name, pFile);
+	}
+	for (B8 k = total - cnt; k != total; k++) {
+		const EntryT& e = ring[k & mask];
+		FWrite(B8(e.ip), pFile); FWrite(e.old[0], pFile); FWrite(e.old[1], pFile);
+		const B1 rest[4] = { e.op, e.n, e.reg[0], e.reg[1] };
+		fwrite(rest, sizeof(B1), 4, pFile);
+	}
+	for (Size k = 0; k != bytes; k++) fputc(vm.Space[begin + k], pFile);
+	fclose(pFile);
+}
+
+#if Profiler
+// Opcode families are the high nibble of the opcode.
+const char* const FamilyName[16] = {
+	"control", "arith", "move", "memory", "stack", "exchange", "bcd/shift", "string",
+	"file", "thread", "vector", "bcd", "heap", "0xd0", "halt", "0xf0"
+};
+bool PerfT::Init(Index begin_, Size size_) {
+	begin = begin_; size = size_;
+	at = new (std::nothrow) B8[size ? size : 1]{};
+	nodes = new (std::nothrow) NodeT[MaxNodes];
+	slots = new (std::nothrow) B4[MaxNodes * 2]{};
+	sites = new (std::nothrow) SiteT[size ? size : 1];
+	if (!at || !nodes || !slots || !sites) return false;
+	for (Size k = 0; k != (size ? size : 1); k++) sites[k] = { ~Index(0), 0, 0, 0, 0 };
+	nodes[0] = { nullptr, nullptr, ~Index(0), 0, 0, 0, false }; nodeCnt = 1;
+	node = nodes;
+	return true;
+}
+// Enter() for a target other than the child entered last.
+void PerfT::Child(Index addr) {
+	const Size mask = MaxNodes * 2 - 1;
+	NodeT* child = nullptr;
+	for (Size k = (B8(node - nodes) * 0x9E3779B97F4A7C15ULL ^ addr) * 0x9E3779B97F4A7C15ULL >> 40 & mask;; k = (k + 1) & mask) {
+		if (slots[k] == 0) {
+			if (nodeCnt == MaxNodes) { lost++; return; }
+			bool nested = false;
+			for (NodeT* m = node; m != nodes && !nested; m = m->parent) nested = m->addr == addr;
+			child = nodes + nodeCnt++;
+			*child = { node, nullptr, addr, 0, 0, 0, nested };
+			slots[k] = B4(nodeCnt);
+			break;
+		}
+		NodeT* c = nodes + slots[k] - 1;
+		if (c->parent == node && c->addr == addr) { child = c; break; }
+	}
+	node->last = child;
+	node = child; child->calls++;
+}
+// The branch record at k now caches the record at `to`: its hits so far go to the old one.
+void PerfT::Cached(Size k, Size to) {
+	SiteT& s = sites[k];
+	if (s.hits) { s.taken += s.hits; at[s.cached] += s.hits; s.hits = 0; }
+	s.cached = to;
+}
+void PerfT::Flush() {
+	for (Size k = 0; k != size; k++) Cached(k, sites[k].cached);
+}
+// Charge() reached `due` at the branch at `at`. Once a sample is due the branch misses
+// the branch cache, so that where it goes is entered through Dispatch(); the first
+// branch of the timed run ends it.
+void PerfT::Tick(VmContext& vm, Index at) {
+	if (phase == Idle && vm.fuel != due) return;
+	if (phase == Done) { phase = Idle; return; }
+	if (phase == Timing) {
+		Timed(vm, at - begin < size ? vm.Code.table + (at - begin) : nullptr);
+		phase = Idle;
+		return;
+	}
+	phase = Due;
+	if (at - begin < size) vm.Code.table[at - begin].imm = ~B8(0);
+}
+// Dispatch() entered the record at k during a sample. A sample starts there, unless the
+// record is guarded and runs through Step(); an entry before the next branch ends it.
+void PerfT::Boundary(VmContext& vm, Size k) {
+	if (phase == Timing) { Timed(vm, nullptr); return; }
+	if (phase != Due || (vm.Code.info && (vm.Code.info[k] & CodeT::Guard))) return;
+	phase = Timing; head = k; headNode = node;
+	t0 = Ticks();
+}
+// The timed run went from `head` along `next` to the branch `through`, or to the end of
+// its chain.
+void PerfT::Timed(VmContext& vm, const InstT* through) {
+	B8 dt = Ticks() - t0;
+	phase = Done;
+	Rearm();
+	const CodeT& c = vm.Code;
+	B4 fam[16] = {};
+	Size len = 0;
+	for (const InstT* r = c.table + head;; r = r->next) {
+		fam[vm.Space[begin + (r - c.table)] >> 4]++;
+		if (++len == MaxRun || r == through || !(r->next >= c.table && r->next < c.table + c.size)) break;
+	}
+	for (int f = 0; f != 16; f++) if (fam[f]) { famSamples[f] += fam[f]; famCycles[f] += dt * fam[f] / len; }
+	headNode->samples += len; headNode->cycles += dt;
+}
+// A runtime error ended the run in the record whose instruction Vp[_ip] is past the
+// start of, or, for fuel and the deadline, in the branch Vp[_ip] is at.
+void PerfT::Failed(VmContext& vm, int code) {
+	Index ip = vm.Vp[_ip];
+	if (!threaded || ip - begin > size) return;
+	if (code == 0xc4 || code == 0xc5) { stop = ip - begin; return; }
+	for (Size k = ip - begin; k-- && ip - begin - k < CodeT::MaxLen;)
+		if (vm.Code.table[k].at >= ip) { stop = k; return; }
+}
+// Per-instruction counts from the entries in c, in place: in address order, a record
+// linked to the next one passes on what it ran less its taken branches and the run an
+// error stopped in it. Exit ends the run instead.
+void PerfT::Derive(VmContext& vm, B8* c) const {
+	const CodeT& code = vm.Code;
+	for (Size k = 0; k != size; k++) {
+		const InstT* n = code.table[k].next;
+		if (!c[k] || !(n >= code.table && n < code.table + code.size) || vm.Space[begin + k] == Exit) continue;
+		c[n - code.table] += c[k] - std::min(c[k], sites[k].taken + (k == stop));
+	}
+}
+B8 PerfT::Total(VmContext& vm) {
+	if (!scratch) scratch = new (std::nothrow) B8[size ? size : 1];
+	if (!scratch) return 0;
+	Flush();
+	memcpy(scratch, at, size * sizeof(B8));
+	Derive(vm, scratch);
+	B8 total = 0;
+	for (Size k = 0; k != size; k++) total += scratch[k];
+	// Instructions run outside the code are counted as they go.
+	for (B8 n : op) total += n;
+	return total;
+}
+// <image>.perf gets the binary profile, big-endian: magic, format version[3] and a zero
+// byte, Period, instructions, timed instructions, code begin and size, 256 opcode counts,
+// 16 family sample and cycle pairs, then counted lists of (address, count), (target,
+// calls, inclusive cycles), call tree nodes (parent, target, calls, samples, cycles) and
+// branch sites (address, taken, cache misses).
+// Cycles are the sampled ones; the report scales them up to the whole run.
+// <image>.perf.txt is the report and <image>.perf.folded the estimated cycles per call
+// stack, for flamegraph.pl. Opcode counts read the code as it is at the end of the run.
+void PerfT::Save(VmContext& vm) {
+	if (threaded) { Flush(); Derive(vm, at); }
+	for (Size k = 0; k != size; k++) if (at[k]) op[vm.Space[begin + k]] += at[k];
+	B8 total = 0, samples = 0, cycles = 0;
+	for (B8 c : op) total += c;
+	for (B8 c : famSamples) samples += c;
+	for (B8 c : famCycles) cycles += c;
+	// Sampled cycles scaled up to the whole run.
+	auto Scale = [&](B8 c) { return samples ? (unsigned long long)(double(c) * double(total) / double(samples)) : 0ULL; };
+	// Inclusive cycles of each subtree: children always come after their parent.
+	B8* incl = new B8[nodeCnt];
+	for (Size k = 0; k != nodeCnt; k++) incl[k] = nodes[k].cycles;
+	for (Size k = nodeCnt - 1; k; k--) incl[nodes[k].parent - nodes] += incl[k];
+	// Targets: nodes grouped by address, recursive calls already inside an outer one.
+	struct TargetT { Index addr; B8 calls, cycles; };
+	TargetT* targets = new TargetT[nodeCnt];
+	Size targetCnt = 0;
+	B4* order = new B4[nodeCnt];
+	for (Size k = 0; k != nodeCnt; k++) order[k] = B4(k);
+	std::sort(order + 1, order + nodeCnt, [&](B4 a, B4 b) { return nodes[a].addr < nodes[b].addr; });
+	for (Size k = 1; k != nodeCnt; k++) {
+		const NodeT& c = nodes[order[k]];
+		if (targetCnt == 0 || targets[targetCnt - 1].addr != c.addr) targets[targetCnt++] = { c.addr, 0, 0 };
+		targets[targetCnt - 1].calls += c.calls;
+		if (!c.nested) targets[targetCnt - 1].cycles += incl[order[k]];
+	}
+	std::sort(targets, targets + targetCnt, [](const TargetT& a, const TargetT& b) { return a.cycles > b.cycles; });
+	char* path = vm.SidePath(".perf");
+	size_t n = strlen(path);
+	char* side = new char[n + sizeof ".folded"];
+	memcpy(side, path, n);
+	FILE* pFile = fopen(path, "wb");
+	if (pFile) {
+		FWrite(Magic, pFile);
+		const B1 fmt[4] = { 1, 1, 0, 0 };
+		fwrite(fmt, sizeof(B1), 4, pFile);
+		FWrite(B8(period), pFile); FWrite(total, pFile); FWrite(samples, pFile); FWrite(B8(begin), pFile); FWrite(B8(size), pFile);
+		for (B8 c : op) FWrite(c, pFile);
+		for (int k = 0; k != 16; k++) { FWrite(famSamples[k], pFile); FWrite(famCycles[k], pFile); }
+		B8 used = 0;
+		for (Size k = 0; k != size; k++) used += at[k] != 0;
+		FWrite(used, pFile);
+		for (Size k = 0; k != size; k++) if (at[k]) { FWrite(B8(begin + k), pFile); FWrite(at[k], pFile); }
+		FWrite(B8(targetCnt), pFile);
+		for (Size k = 0; k != targetCnt; k++) { FWrite(B8(targets[k].addr), pFile); FWrite(targets[k].calls, pFile); FWrite(targets[k].cycles, pFile); }
+		FWrite(B8(nodeCnt), pFile);
+		for (Size k = 0; k != nodeCnt; k++) {
+			const NodeT& c = nodes[k];
+			FWrite(B8(c.parent ? c.parent - nodes : 0), pFile); FWrite(B8(c.addr), pFile); FWrite(c.calls, pFile); FWrite(c.samples, pFile); FWrite(c.cycles, pFile);
+		}
+		B8 branches = 0;
+		for (Size k = 0; k != size; k++) branches += sites[k].taken != 0;
+		FWrite(branches, pFile);
+		for (Size k = 0; k != size; k++) if (sites[k].taken) { FWrite(B8(begin + k), pFile); FWrite(sites[k].taken, pFile); FWrite(sites[k].misses, pFile); }
+		fclose(pFile);
+	}
+	memcpy(side + n, ".txt", sizeof ".txt");
+	pFile = fopen(side, "w");
+	if (pFile) {
+		auto Share = [](B8 a, B8 b) { return b ? 100.0 * double(a) / double(b) : 0.0; };
+		fprintf(pFile, "Profile of `%s`: %llu instructions, %llu timed.\n", vm.imagePath, (unsigned long long)total, (unsigned long long)samples);
+		fprintf(pFile, "\nopcode          count   share\n");
+		B1 order[256];
+		for (int k = 0; k != 256; k++) order[k] = B1(k);
+		std::sort(order, order + 256, [&](B1 a, B1 b) { return op[a] > op[b]; });
+		for (B1 f : order) if (op[f]) fprintf(pFile, "%-10s %10llu %6.2f%%\n", OpName(f), (unsigned long long)op[f], Share(op[f], total));
+		fprintf(pFile, "\nfamily       samples      cycles   share\n");
+		for (int k = 0; k != 16; k++) if (famSamples[k])
+			fprintf(pFile, "%-10s %9llu %11llu %6.2f%%\n", FamilyName[k], (unsigned long long)famSamples[k], Scale(famCycles[k]), Share(famCycles[k], cycles));
+		fprintf(pFile, "\nhottest addresses\n");
+		Size hot[20], hotCnt = 0;
+		for (Size k = 0; k != size; k++) {
+			if (!at[k] || (hotCnt == 20 && at[k] <= at[hot[19]])) continue;
+			Size j = hotCnt < 20 ? hotCnt++ : 19;
+			for (; j && at[hot[j - 1]] < at[k]; j--) hot[j] = hot[j - 1];
+			hot[j] = k;
+		}
+		for (Size k = 0; k != hotCnt; k++)
+			fprintf(pFile, "0x%08llx %10llu %6.2f%%\n", (unsigned long long)(begin + hot[k]), (unsigned long long)at[hot[k]], Share(at[hot[k]], total));
+		// The same for branch sites, by times taken.
+		B8 taken = 0, misses = 0;
+		hotCnt = 0;
+		for (Size k = 0; k != size; k++) {
+			taken += sites[k].taken; misses += sites[k].misses;
+			if (!sites[k].taken || (hotCnt == 20 && sites[k].taken <= sites[hot[19]].taken)) continue;
+			Size j = hotCnt < 20 ? hotCnt++ : 19;
+			for (; j && sites[hot[j - 1]].taken < sites[k].taken; j--) hot[j] = hot[j - 1];
+			hot[j] = k;
+		}
+		if (taken) {
+			fprintf(pFile, "\nbranch site      taken     misses   hits\n");
+			for (Size k = 0; k != hotCnt; k++) {
+				const SiteT& c = sites[hot[k]];
+				fprintf(pFile, "0x%08llx %10llu %10llu %6.2f%%\n", (unsigned long long)(begin + hot[k]), (unsigned long long)c.taken, (unsigned long long)c.misses, Share(c.taken - c.misses, c.taken));
+			}
+			fprintf(pFile, "all        %10llu %10llu %6.2f%%\n", (unsigned long long)taken, (unsigned long long)misses, Share(taken - misses, taken));
+		}
+		if (targetCnt) {
+			fprintf(pFile, "\ncall target      calls   inclusive cycles   share\n");
+			for (Size k = 0; k != targetCnt; k++)
+				fprintf(pFile, "0x%08llx %10llu %18llu %6.2f%%\n", (unsigned long long)targets[k].addr, (unsigned long long)targets[k].calls, Scale(targets[k].cycles), Share(targets[k].cycles, cycles));
+		}
+		fclose(pFile);
+	}
+	memcpy(side + n, ".folded", sizeof ".folded");
+	pFile = fopen(side, "w");
+	if (pFile) {
+		// `order` is reused for the path from the entry down to each node.
+		for (Size k = 0; k != nodeCnt; k++) {
+			if (!nodes[k].cycles) continue;
+			Size len = 0;
+			for (const NodeT* m = nodes + k; m != nodes; m = m->parent) order[len++] = B4(m - nodes);
+			fputs("main", pFile);
+			while (len) fprintf(pFile, ";0x%llx", (unsigned long long)nodes[order[--len]].addr);
+			fprintf(pFile, " %llu\n", Scale(nodes[k].cycles));
+		}
+		fclose(pFile);
+	}
+	delete[] incl; delete[] targets; delete[] order;
+	delete[] side; delete[] path;
+}
+#endif
+
+#if defined(__clang__)
+#define NEXT(n) do { InstT* n_ = (n); [[clang::musttail]] return n_->h(vm, n_); } while (0)
+#else
+#define NEXT(n) return (n)
+#endif
+// Continues with a handler known at compile time: a direct call the compiler can inline.
+#if defined(__clang__)
+#define JUMP(f, n) do { InstT* n_ = (n); [[clang::musttail]] return f(vm, n_); } while (0)
+#else
+#define JUMP(f, n) return f(vm, n)
+#endif
+#define OP(name) InstT* T_##name([[maybe_unused]] VmContext& vm, [[maybe_unused]] InstT* i)
+// The work of a straight-line handler without the dispatch, shared with fused handlers.
+#define BODY(name) inline void F_##name([[maybe_unused]] VmContext& vm, [[maybe_unused]] InstT* i)
+#define AT (vm.Vp[_ip] = i->at)
+
+OP(Halt) { return nullptr; }
+OP(Dispatch) { NEXT(vm.Dispatch()); }
+OP(Step) {
+	#if !Release
+	vm.lastIp = vm.Vp[_ip];
+	#endif
+	if (vm.Trace) vm.Trace->Note(vm, vm.Vp[_ip]);
+	#if Profiler
+	Index at = vm.Vp[_ip];
+	bool done = vm.Step(vm.Code.ret);
+	if (vm.Perf) vm.Perf->Ran(vm.lastFuncID, at, vm.Vp[_ip]);
+	if (done) return &vm.Code.halt;
+	#else
+	if (vm.Step(vm.Code.ret)) return &vm.Code.halt;
+	#endif
+	if (vm.Unchecked()) vm.CheckFrame();
+	NEXT(vm.Dispatch());
+}
+#if Profiler
+// -perf: an instruction that names Vp[_count] finds it up to date.
+OP(Count) {
+	if (vm.Perf) vm.Vp[_count] = vm.Perf->Total(vm);
+	JUMP(T_Step, i);
+}
+#endif
+OP(NOP) { AT; NEXT(i->next); }
+OP(Exit) { AT; vm.Code.ret = int(vm.Vp[_ExitWith]); return &vm.Code.halt; }
+OP(Goto) { vm.Charge(i->at - 2); AT; NEXT(vm.Branch(i, *i->a)); }
+OP(IfGo) { vm.Charge(i->at - 3); AT; if (*i->a) NEXT(vm.Branch(i, *i->b)); NEXT(i->next); }
+OP(IfNG) { vm.Charge(i->at - 3); AT; if (!(*i->a)) NEXT(vm.Branch(i, *i->b)); NEXT(i->next); }
+OP(SvIp) { AT; *i->a = vm.Vp[_ip]; NEXT(i->next); }
+OP(Loop) { vm.Charge(i->at - 3); AT; if (--(*i->a)) NEXT(vm.Branch(i, *i->b)); NEXT(i->next); }
+OP(Call) { vm.Charge(i->at - 2); AT; vm.Psh<B8>(vm.Vp[_ip]); B8 to = *i->a; vm.Called(to); NEXT(vm.Branch(i, to)); }
+OP(Ret) { vm.Charge(i->at - 1); AT; B8 to; vm.Pop<B8>(to); vm.Returned(); NEXT(vm.Branch(i, to)); }
+OP(CallU) { vm.Charge(i->at - 2); AT; vm.PshU<B8>(vm.Vp[_ip]); B8 to = *i->a; vm.Called(to); NEXT(vm.Branch(i, to)); }
+OP(RetU) { vm.Charge(i->at - 1); AT; B8 to; vm.PopU<B8>(to); vm.Returned(); NEXT(vm.Branch(i, to)); }
+BODY(Add) { *i->a = *i->b + *i->c; }
+OP(Add) { AT; F_Add(vm, i); NEXT(i->next); }
+BODY(Sub) { *i->a = *i->b - *i->c; }
+OP(Sub) { AT; F_Sub(vm, i); NEXT(i->next); }
+BODY(Mul) { *i->a = *i->b * *i->c; }
+OP(Mul) { AT; F_Mul(vm, i); NEXT(i->next); }
+OP(Div) { AT; Div_(vm.stdErr, *i->a, *i->b, *i->c, *i->d); NEXT(i->next); }
+OP(IMul) { AT; ToB8I(*i->a) = ToB8I(*i->b) * ToB8I(*i->c); NEXT(i->next); }
+OP(IDiv) { AT; Div_I(vm.stdErr, ToB8I(*i->a), ToB8I(*i->b), ToB8I(*i->c), ToB8I(*i->d)); NEXT(i->next); }
+BODY(Inc) { ++(*i->a); }
+OP(Inc) { AT; F_Inc(vm, i); NEXT(i->next); }
+BODY(Dec) { --(*i->a); }
+OP(Dec) { AT; F_Dec(vm, i); NEXT(i->next); }
+BODY(Than) { *i->a = Than_(*i->b, *i->c); }
+OP(Than) { AT; F_Than(vm, i); NEXT(i->next); }
+BODY(Less) { *i->a = *i->b < *i->c; }
+OP(Less) { AT; F_Less(vm, i); NEXT(i->next); }
+BODY(More) { *i->a = *i->b > *i->c; }
+OP(More) { AT; F_More(vm, i); NEXT(i->next); }
+OP(IThan) { AT; ToB8I(*i->a) = Than_I(ToB8I(*i->b), ToB8I(*i->c)); NEXT(i->next); }
+OP(ILess) { AT; ToB8I(*i->a) = ToB8I(*i->b) < ToB8I(*i->c); NEXT(i->next); }
+OP(IMore) { AT; ToB8I(*i->a) = ToB8I(*i->b) > ToB8I(*i->c); NEXT(i->next); }
+OP(Not) { AT; if (*i->b) *i->a = 0U; else *i->a = 1U; NEXT(i->next); }
+BODY(And) { *i->a = *i->b & *i->c; }
+OP(And) { AT; F_And(vm, i); NEXT(i->next); }
+BODY(Or) { *i->a = *i->b | *i->c; }
+OP(Or) { AT; F_Or(vm, i); NEXT(i->next); }
+BODY(Xor) { *i->a = *i->b ^ *i->c; }
+OP(Xor) { AT; F_Xor(vm, i); NEXT(i->next); }
+OP(LMov) { AT; *i->a = *i->b << *i->c; NEXT(i->next); }
+OP(RMov) { AT; *i->a = *i->b >> *i->c; NEXT(i->next); }
+OP(ILMov) { AT; ToB8I(*i->a) = ToB8I(*i->b) << ToB8I(*i->c); NEXT(i->next); }
+OP(IRMov) { AT; ToB8I(*i->a) = ToB8I(*i->b) >> ToB8I(*i->c); NEXT(i->next); }
+OP(ROL) { AT; *i->a = std::rotl(*i->b, (int)ToB8I(*i->c)); NEXT(i->next); }
+OP(ROR) { AT; *i->a = std::rotr(*i->b, (int)ToB8I(*i->c)); NEXT(i->next); }
+OP(ToBool) { AT; if (*i->b) *i->a = 1U; else *i->a = 0U; NEXT(i->next); }
+OP(Complement) { AT; *i->a = ~(*i->b); NEXT(i->next); }
+OP(Swap) { AT; std::swap(*i->a, *i->b); NEXT(i->next); }
+BODY(Set) { *i->a = i->imm; }
+OP(Set) { AT; F_Set(vm, i); NEXT(i->next); }
+OP(BcdF) { AT; *i->a = uint64_to_bcd64(*i->b); NEXT(i->next); }
+OP(BcdT) { AT; *i->a = bcd64_to_uint64(*i->b); NEXT(i->next); }
+OP(BcdAdd) { AT; B8 c = *i->b; B8 r = bcd64_add(*i->c, *i->d, c); *i->a = r; *i->b = c; NEXT(i->next); }
+OP(BcdSub) { AT; B8 c = *i->b; B8 r = bcd64_sub(*i->c, *i->d, c); *i->a = r; *i->b = c; NEXT(i->next); }
+OP(BcdCmp) { AT; BcdCmp_(*i->a, *i->b, *i->c); NEXT(i->next); }
+template<bool To> OP(BcdS) { AT; vm.BcdS_<To>(*i->a, *i->b, *i->c); NEXT(i->next); }
+OP(ALLOC) { AT; vm.ALLOC_(*i->a, *i->b); NEXT(i->next); }
+OP(FREE) { AT; vm.FREE_(*i->a); NEXT(i->next); }
+OP(REALLOC) { AT; vm.REALLOC_(*i->a, *i->b, *i->c); NEXT(i->next); }
+OP(SignF) { AT; ToB8I(*i->a) = uint64_to_int64(*i->b, *i->c); NEXT(i->next); }
+OP(SignT) { AT; int64_to_uint64(ToB8I(*i->a), *i->b, *i->c); NEXT(i->next); }
+OP(LEA) { AT; *i->a = vm.CheckSafe(*i->b + (*i->c * *i->d)); NEXT(i->next); }
+OP(MOVS) { AT; vm.MOVS_(*i->a, *i->b, *i->c); NEXT(i->next); }
+OP(CMPS) { AT; vm.CMPS_(*i->a, *i->b, *i->c, *i->d); NEXT(i->next); }
+template<typename Bn> BODY(Mov) { Mov<Bn>(*i->a, *i->b); }
+template<typename Bn> OP(Mov) { AT; F_Mov<Bn>(vm, i); NEXT(i->next); }
+template<typename Bn> BODY(Get) { vm.Get<Bn>(*i->a, i->imm); }
+template<typename Bn> OP(Get) { AT; F_Get<Bn>(vm, i); NEXT(i->next); }
+template<typename Bn> BODY(Wrt) { vm.Wrt<Bn>(*i->a, *i->b); }
+template<typename Bn> OP(Wrt) { AT; F_Wrt<Bn>(vm, i); NEXT(i->next); }
+template<typename Bn> BODY(GetU) { *i->a = vm.Space.GetN<Bn>(i->imm); }
+template<typename Bn> OP(GetU) { AT; F_GetU<Bn>(vm, i); NEXT(i->next); }
+template<typename Bn> BODY(WrtU) { vm.Space.PutN<Bn>(*i->a, (Bn)(*i->b)); }
+template<typename Bn> OP(WrtU) { AT; F_WrtU<Bn>(vm, i); NEXT(i->next); }
+template<typename Bn> BODY(Psh) { vm.Psh<Bn>(*i->a); }
+template<typename Bn> OP(Psh) { AT; F_Psh<Bn>(vm, i); NEXT(i->next); }
+template<typename Bn> BODY(Pop) { vm.Pop<Bn>(*i->a); }
+template<typename Bn> OP(Pop) { AT; F_Pop<Bn>(vm, i); NEXT(i->next); }
+template<typename Bn> BODY(PshU) { vm.PshU<Bn>(*i->a); }
+template<typename Bn> OP(PshU) { AT; F_PshU<Bn>(vm, i); NEXT(i->next); }
+template<typename Bn> BODY(PopU) { vm.PopU<Bn>(*i->a); }
+template<typename Bn> OP(PopU) { AT; F_PopU<Bn>(vm, i); NEXT(i->next); }
+// imm: the first register, the mask, and the bytes they take.
+template<bool Checked> OP(PshM) { AT; vm.PshM_<Checked>(B1(i->imm), B1(i->imm >> 8), i->imm >> 16); NEXT(i->next); }
+template<bool Checked> OP(PopM) { AT; vm.PopM_<Checked>(B1(i->imm), B1(i->imm >> 8), i->imm >> 16); NEXT(i->next); }
+template<typename Bn> OP(XCHG) { AT; vm.XCHG<Bn>(*i->a, i->imm, Bn(-1)); NEXT(i->next); }
+template<typename Bn> OP(SCAS) { AT; vm.SCAS<Bn>(*i->a, *i->b, *i->c, *i->d); NEXT(i->next); }
+template<FuncTag F> OP(VMAP) { AT; vm.VMAP_(F, B1(i->imm), *i->a, *i->b, *i->c, *i->d); NEXT(i->next); }
+template<FuncTag F> OP(VRED) { AT; vm.VRED_(F, B1(i->imm), *i->a, *i->b, *i->c); NEXT(i->next); }
+OP(VFILL) { AT; vm.VFILL_(B1(i->imm), *i->a, *i->b, *i->c); NEXT(i->next); }
+OP(VSCAN) { AT; vm.VSCAN_(B1(i->imm), *i->a, *i->b, *i->c); NEXT(i->next); }
+
+// Superinstructions: F does the work of record i, then the handler H of the record after
+// it runs as a direct call instead of a dispatch. vm.Vp[_ip] is set for each part as the
+// plain handlers set it, and a next record that has been re-decoded since is dispatched
+// normally.
+template<void (*F)(VmContext&, InstT*), Handler H> OP(Fuse) {
+	InstT* j = i->next;
+	AT; F(vm, i);
+	if (j->h != H) NEXT(j);
+	vm.Code.saved++;
+	JUMP(H, j);
+}
+template<Handler... Hs> struct FuseTailsT {
+	template<void (*F)(VmContext&, InstT*)> static Handler Find(Handler h) {
+		Handler r = nullptr;
+		((h == Hs ? (void)(r = T_Fuse<F, Hs>) : (void)0), ...);
+		return r;
+	}
+};
+// What a fused record may continue into: the plain handlers, control flow, and the fused
+// compare-and-branch and push-and-call forms, which make triples out of pairs.
+using FuseTails = FuseTailsT<
+	T_Set, T_Mov<B8>, T_Add, T_Sub, T_Mul, T_Inc, T_Dec, T_Less, T_More, T_Than, T_And, T_Or, T_Xor,
+	T_Get<B8>, T_GetU<B8>, T_Wrt<B8>, T_WrtU<B8>, T_Psh<B8>, T_Pop<B8>, T_PshU<B8>, T_PopU<B8>,
+	T_IfGo, T_IfNG, T_Loop, T_Goto, T_Call, T_Ret, T_CallU, T_RetU,
+	T_Fuse<F_Less, T_IfGo>, T_Fuse<F_Less, T_IfNG>, T_Fuse<F_More, T_IfGo>, T_Fuse<F_More, T_IfNG>,
+	T_Fuse<F_Than, T_IfGo>, T_Fuse<F_Than, T_IfNG>,
+	T_Fuse<F_Psh<B8>, T_Call>, T_Fuse<F_Psh<B8>, T_Fuse<F_Psh<B8>, T_Call>>,
+	T_Fuse<F_PshU<B8>, T_CallU>, T_Fuse<F_PshU<B8>, T_Fuse<F_PshU<B8>, T_CallU>>>;
+// The fused handler for a record running h followed by one running next, or nullptr.
+Handler FusePair(Handler h, Handler next) {
+	#define FIRST(name) if (h == T_##name) return FuseTails::Find<F_##name>(next)
+	FIRST(Set); FIRST(Mov<B8>); FIRST(Add); FIRST(Sub); FIRST(Mul); FIRST(Inc); FIRST(Dec);
+	FIRST(Less); FIRST(More); FIRST(Than); FIRST(And); FIRST(Or); FIRST(Xor);
+	FIRST(Get<B8>); FIRST(GetU<B8>); FIRST(Wrt<B8>); FIRST(WrtU<B8>); FIRST(Psh<B8>); FIRST(Pop<B8>);
+	FIRST(PshU<B8>); FIRST(PopU<B8>);
+	#undef FIRST
+	return nullptr;
+}
+
+// Fills in the record for the instruction at its own address. Anything Shape() does not
+// list, and anything too close to the end of Space for CheckIp to pass, is left to Step().
+// Whether the instruction at p - 1 writes _StackSp, _stack_base or _stack_top.
+bool VmContext::MovesStack(FuncTag f, Index p) {
+	ShapeT sh = Shape(f);
+	for (B1 r : { B1(_StackSp), B1(_stack_base), B1(_stack_top) }) {
+		for (int k = 0; k != sh.n; k++) if ((sh.out >> k & 1) && Space[p + k] == r) return true;
+		if (f == PopM && InMask(Space, p, r)) return true;
+	}
+	return false;
+}
+InstT* VmContext::Decode(InstT* i) {
+	Index o = Code.begin + Index(i - Code.table), p = o + 1;
+	auto R = [this](Index k) { return &Vp[Space[k]]; };
+	B1 info = Code.info ? Code.info[o - Code.begin] : 0;
+	*i = InstT{ T_Step, &Code.dispatch };
+	if (!(o + CodeT::MaxLen < Space.size)) return i;
+	FuncTag f = FuncTag(Space[o]);
+	if (Shape(f).n < 0) return i;
+	B1 n = B1(Shape(f).n);
+	// Branch targets are cached in imm, which starts out matching no address.
+	bool branch = f == Goto || f == IfGo || f == IfNG || f == Loop || f == Call || f == Ret;
+	if (branch) i->imm = ~B8(0);
+	switch (f) {
+		case NOP: i->h = T_NOP; break;
+		case Exit: i->h = T_Exit; break;
+		case Goto: i->h = T_Goto; i->a = R(p + 1); break;
+		case IfGo: i->h = T_IfGo; i->a = R(p); i->b = R(p + 1); break;
+		case IfNG: i->h = T_IfNG; i->a = R(p); i->b = R(p + 1); break;
+		case SvIp: i->h = T_SvIp; i->a = R(p); break;
+		case Loop: i->h = T_Loop; i->a = R(p); i->b = R(p + 1); break;
+		case Call: i->h = Unchecked() ? T_CallU : T_Call; i->a = R(p + 1); break;
+		case Ret: i->h = Unchecked() ? T_RetU : T_Ret; break;
+		case Inc: i->h = T_Inc; i->a = R(p); break;
+		case Dec: i->h = T_Dec; i->a = R(p); break;
+		case Add: i->h = T_Add; break;
+		case Sub: i->h = T_Sub; break;
+		case Mul: i->h = T_Mul; break;
+		case IMul: i->h = T_IMul; break;
+		case Than: i->h = T_Than; break;
+		case Less: i->h = T_Less; break;
+		case More: i->h = T_More; break;
+		case And: i->h = T_And; break;
+		case Or: i->h = T_Or; break;
+		case Xor: i->h = T_Xor; break;
+		case LMov: i->h = T_LMov; break;
+		case RMov: i->h = T_RMov; break;
+		case ILMov: i->h = T_ILMov; break;
+		case IRMov: i->h = T_IRMov; break;
+		case ROL: i->h = T_ROL; break;
+		case ROR: i->h = T_ROR; break;
+		case SignF: i->h = T_SignF; break;
+		case SignT: i->h = T_SignT; break;
+		case ‌MOVS: i->h = T_MOVS; break;
+		case Div: i->h = T_Div; break;
+		case IDiv: i->h = T_IDiv; break;
+		case LEA: i->h = T_LEA; break;
+		case CMPS: i->h = T_CMPS; break;
+		case ‌SCAS‌1: i->h = T_SCAS<B1>; break;
+		case SCAS‌2: i->h = T_SCAS<B2>; break;
+		case SCAS‌4: i->h = T_SCAS<B4>; break;
+		case SCAS8: i->h = T_SCAS<B8>; break;
+		case Not: i->h = T_Not; break;
+		case ToBool: i->h = T_ToBool; break;
+		case Complement: i->h = T_Complement; break;
+		case Swap: i->h = T_Swap; break;
+		case BcdF: i->h = T_BcdF; break;
+		case BcdT: i->h = T_BcdT; break;
+		case BcdAdd: i->h = T_BcdAdd; break;
+		case BcdSub: i->h = T_BcdSub; break;
+		case BcdCmp: i->h = T_BcdCmp; break;
+		case BcdFS: i->h = T_BcdS<false>; break;
+		case BcdTS: i->h = T_BcdS<true>; break;
+		case ALLOC: i->h = T_ALLOC; break;
+		case FREE: i->h = T_FREE; break;
+		case REALLOC: i->h = T_REALLOC; break;
+		case Mov1: i->h = T_Mov<B1>; break;
+		case Mov2: i->h = T_Mov<B2>; break;
+		case Mov4: i->h = T_Mov<B4>; break;
+		case Mov8: i->h = T_Mov<B8>; break;
+		case Wrt1: i->h = (info & CodeT::Known) ? T_WrtU<B1> : T_Wrt<B1>; break;
+		case Wrt2: i->h = (info & CodeT::Known) ? T_WrtU<B2> : T_Wrt<B2>; break;
+		case Wrt4: i->h = (info & CodeT::Known) ? T_WrtU<B4> : T_Wrt<B4>; break;
+		case Wrt8: i->h = (info & CodeT::Known) ? T_WrtU<B8> : T_Wrt<B8>; break;
+		case Psh1: i->h = Unchecked() ? T_PshU<B1> : T_Psh<B1>; break;
+		case Psh2: i->h = Unchecked() ? T_PshU<B2> : T_Psh<B2>; break;
+		case Psh4: i->h = Unchecked() ? T_PshU<B4> : T_Psh<B4>; break;
+		case Psh8: i->h = Unchecked() ? T_PshU<B8> : T_Psh<B8>; break;
+		case Pop1: i->h = Unchecked() ? T_PopU<B1> : T_Pop<B1>; break;
+		case Pop2: i->h = Unchecked() ? T_PopU<B2> : T_Pop<B2>; break;
+		case Pop4: i->h = Unchecked() ? T_PopU<B4> : T_Pop<B4>; break;
+		case Pop8: i->h = Unchecked() ? T_PopU<B8> : T_Pop<B8>; break;
+		case PshM: i->h = Unchecked() ? T_PshM<false> : T_PshM<true>; break;
+		case PopM: i->h = Unchecked() ? T_PopM<false> : T_PopM<true>; break;
+		case Set1: i->h = T_Set; i->a = R(p); i->imm = Space.GetN<B1>(p + 1); break;
+		case Set2: i->h = T_Set; i->a = R(p); i->imm = Space.GetN<B2>(p + 1); break;
+		case Set4: i->h = T_Set; i->a = R(p); i->imm = Space.GetN<B4>(p + 1); break;
+		case Set8: i->h = T_Set; i->a = R(p); i->imm = Space.GetN<B8>(p + 1); break;
+		case Get1: i->h = T_Get<B1>; i->a = R(p); i->imm = Space[p + 1]; if (i->imm + sizeof(B1) < Space.size) i->h = T_GetU<B1>; break;
+		case Get2: i->h = T_Get<B2>; i->a = R(p); i->imm = Space[p + 1]; if (i->imm + sizeof(B2) < Space.size) i->h = T_GetU<B2>; break;
+		case Get4: i->h = T_Get<B4>; i->a = R(p); i->imm = Space[p + 1]; if (i->imm + sizeof(B4) < Space.size) i->h = T_GetU<B4>; break;
+		case Get8: i->h = T_Get<B8>; i->a = R(p); i->imm = Space[p + 1]; if (i->imm + sizeof(B8) < Space.size) i->h = T_GetU<B8>; break;
+		case XCHG1: i->h = T_XCHG<B1>; i->a = R(p); i->imm = Space[p + 1]; break;
+		case XCHG2: i->h = T_XCHG<B2>; i->a = R(p); i->imm = Space[p + 1]; break;
+		case XCHG4: i->h = T_XCHG<B4>; i->a = R(p); i->imm = Space[p + 1]; break;
+		case XCHG8: i->h = T_XCHG<B8>; i->a = R(p); i->imm = Space[p + 1]; break;
+		case IThan: i->h = T_IThan; i->a = R(p + 1); i->b = R(p + 2); i->c = R(p + 3); break;
+		case ILess: i->h = T_ILess; i->a = R(p + 1); i->b = R(p + 2); i->c = R(p + 3); break;
+		case IMore: i->h = T_IMore; i->a = R(p + 1); i->b = R(p + 2); i->c = R(p + 3); break;
+		case VADD: i->h = T_VMAP<VADD>; break;
+		case VSUB: i->h = T_VMAP<VSUB>; break;
+		case VMUL: i->h = T_VMAP<VMUL>; break;
+		case VAND: i->h = T_VMAP<VAND>; break;
+		case VOR: i->h = T_VMAP<VOR>; break;
+		case VXOR: i->h = T_VMAP<VXOR>; break;
+		case VSUM: i->h = T_VRED<VSUM>; break;
+		case VMIN: i->h = T_VRED<VMIN>; break;
+		case VMAX: i->h = T_VRED<VMAX>; break;
+		case VFILL: i->h = T_VFILL; break;
+		case VSCAN: i->h = T_VSCAN; break;
+		default: return i;
+	}
+	// Under -guard, whatever may move the stack registers runs through Step(), and
+	// T_Step checks them after it for the handlers above.
+	if (Unchecked() && MovesStack(f, p)) { *i = InstT{ T_Step, &Code.dispatch }; return i; }
+	if (f == PshM || f == PopM) { i->a = R(p); i->imm = Space[p] | Space[p + 1] << 8 | 8 * std::popcount(Space[p + 1]) << 16; }
+	// The element opcodes: a kind byte, then registers.
+	if (f >= VADD && f <= VSCAN) {
+		i->imm = Space[p]; i->a = R(p + 1); i->b = R(p + 2); i->c = R(p + 3);
+		if (n == 5) i->d = R(p + 4);
+	}
+	// Plain register operands: Vp[Space[ip]], Vp[Space[ip+1]], ...
+	if (!i->a) {
+		B8** op[4] = { &i->a, &i->b, &i->c, &i->d };
+		for (B1 k = 0; k != n && k != 4; k++) *op[k] = R(p + k);
+	}
+	#if Profiler
+	if (Perf && (i->a == &Vp[_count] || i->b == &Vp[_count] || i->c == &Vp[_count] || i->d == &Vp[_count]
+		|| ((f == PshM || f == PopM) && InMask(Space, p, _count)))) { *i = InstT{ T_Count, &Code.dispatch }; return i; }
+	// Branches have no use for d: under -perf it points at the count of their cache hits.
+	if (Perf && branch) i->d = &Perf->sites[i - Code.table].hits;
+	#endif
+	i->at = p + n;
+	// Falling through is only valid while nothing can have moved Vp[_ip] or Vp[_Len].
+	for (B8* r : { i->a, i->b, i->c, i->d })
+		if (r == &Vp[_ip] || r == &Vp[_Len]) return i;
+	if (f == PopM && (InMask(Space, p, _ip) || InMask(Space, p, _Len))) return i;
+	if (!(i->at - Code.begin < Code.size && i->at < Vp[_Len])) return i;
+	// A guarded record relies on facts set up by its verified predecessor.
+	if (Code.info && (Code.info[i->at - Code.begin] & CodeT::Guard) && !(info & CodeT::Boundary)) return i;
+	i->next = &Code.table[i->at - Code.begin];
+	return i;
+}
+// -trace: the entry for the record's instruction, then its own handler. T_Step takes
+// its entries itself.
+OP(Traced) {
+	if (vm.Trace) vm.Trace->Note(vm, vm.Code.begin + Index(i - vm.Code.table));
+	JUMP(vm.Code.traced[i - vm.Code.table], i);
+}
+OP(Translate) {
+	i = vm.Decode(i);
+	if (vm.Code.traced && i->h != T_Step) { vm.Code.traced[i - vm.Code.table] = i->h; i->h = T_Traced; }
+	NEXT(i);
+}
+// A compiled block: the native code leaves vm.Vp[_ip] where the interpreter resumes.
+OP(Native) { reinterpret_cast<void (*)()>(i->imm)(); NEXT(vm.Dispatch()); }
+
+// Load-time verifier. It walks the code section in program order to prove instruction
+// boundaries and operand lengths, then follows register constants through each
+// straight-line run so that a Wrt through a known in-range address outside the code
+// drops CheckData and Touch. Records that rely on those facts are guarded: Dispatch()
+// runs them through Step(), so register-indirect jumps into a run stay checked.
+void CodeT::Verify(VmContext& vm) {
+	SpaceT& Space = vm.Space;
+	info = new (std::nothrow) B1[size]{};
+	if (!info) return;
+	Index end = begin + size;
+	// Instructions that end a run: control flow, Step() fallbacks, Vp[_ip]/Vp[_Len] writers.
+	auto Ends = [&](FuncTag f, Index p) {
+		ShapeT sh = Shape(f);
+		if (sh.ctl) return true;
+		for (int k = 0; k != sh.n; k++)
+			if ((sh.out >> k & 1) && (Space[p + k] == _ip || Space[p + k] == _Len)) return true;
+		return f == PopM && (InMask(Space, p, _ip) || InMask(Space, p, _Len));
+	};
+	auto Next = [&](Index o) -> Index {
+		FuncTag f = FuncTag(Space[o]);
+		if (Shape(f).n >= 0) return o + 1 + Shape(f).n;
+		if (f != Data) return o + 1;
+		B8 skip = Space.GetN<B8>(o + 2);
+		return skip < end - o ? o + 9 + skip : end;
+	};
+	auto Imm = [&](FuncTag f, Index p) -> B8 {
+		switch (f) {
+			case Set1: return Space.GetN<B1>(p);
+			case Set2: return Space.GetN<B2>(p);
+			case Set4: return Space.GetN<B4>(p);
+			default: return Space.GetN<B8>(p);
+		}
+	};
+	info[0] |= Leader;
+	for (Index o = begin; o < end && o + MaxLen < Space.size; o = Next(o)) {
+		FuncTag f = FuncTag(Space[o]);
+		info[o - begin] |= Boundary;
+		if (Ends(f, o + 1) && Next(o) < end) info[Next(o) - begin] |= Leader;
+		if (f != Set1 && f != Set2 && f != Set4 && f != Set8) continue;
+		B8 t = Imm(f, o + 2);
+		if (t - begin < size) info[t - begin] |= Leader;
+	}
+	for (Index k = 0; k != size; k++) if (!(info[k] & Boundary)) info[k] &= B1(~Leader);
+
+	B8 val[256] = {};
+	bool known[256] = {};
+	Index start = begin, last = begin;
+	auto Close = [&]() {
+		for (Index k = start + 1; k <= last; k++) if (info[k - begin] & Boundary) info[k - begin] |= Guard;
+		for (bool& k : known) k = false;
+		last = start;
+	};
+	for (Index o = begin; o < end && o + MaxLen < Space.size; o = Next(o)) {
+		if (info[o - begin] & Leader) { Close(); start = last = o; }
+		FuncTag f = FuncTag(Space[o]);
+		ShapeT sh = Shape(f);
+		if (sh.n < 0) continue;
+		Index p = o + 1;
+		auto K = [&](Index q) { return Space[q] != _ip && known[Space[q]]; };
+		verified++;
+		switch (f) {
+			case Get1: case Get2: case Get4: case Get8:
+				if (Space[p + 1] + (Size(1) << (f - Get1)) < Space.size) dataChecks++;
+				break;
+			case Wrt1: case Wrt2: case Wrt4: case Wrt8: {
+				if (!K(p)) break;
+				B8 at = val[Space[p]], w = Size(1) << (f - Wrt1);
+				if (!(at < Space.size && at + w < Space.size) || !(at >= limit || at + w <= begin)) break;
+				info[o - begin] |= Known; dataChecks++; last = o;
+			} break;
+			default: break;
+		}
+		bool has = true; B8 v = 0;
+		switch (f) {
+			case Set1: case Set2: case Set4: case Set8: v = Imm(f, p + 1); break;
+			case Mov1: has = K(p + 1); v = B1(val[Space[p + 1]]); break;
+			case Mov2: has = K(p + 1); v = B2(val[Space[p + 1]]); break;
+			case Mov4: has = K(p + 1); v = B4(val[Space[p + 1]]); break;
+			case Mov8: has = K(p + 1); v = val[Space[p + 1]]; break;
+			case Add: has = K(p + 1) && K(p + 2); v = val[Space[p + 1]] + val[Space[p + 2]]; break;
+			case Sub: has = K(p + 1) && K(p + 2); v = val[Space[p + 1]] - val[Space[p + 2]]; break;
+			case Inc: has = K(p); v = val[Space[p]] + 1; break;
+			case Dec: has = K(p); v = val[Space[p]] - 1; break;
+			case LEA: has = K(p + 1) && K(p + 2) && K(p + 3); v = vm.CheckSafe(val[Space[p + 1]] + val[Space[p + 2]] * val[Space[p + 3]]); break;
+			default: has = false;
+		}
+		for (int k = 0; k != sh.n; k++) if (sh.out >> k & 1) known[Space[p + k]] = false;
+		if (f >= Psh1 && f <= PopM) known[_stack_top] = false;
+		if (f == PopM) for (int k = 0; k != 8; k++) if (Space[p + 1] >> k & 1) known[B1(Space[p] + k)] = false;
+		if (f == ALLOC || f == REALLOC) known[_error] = false;
+		if (has) { known[Space[p]] = true; val[Space[p]] = v; }
+		if (Ends(f, p)) { Close(); start = last = Next(o); }
+	}
+	Close();
+}
+
+// Load-time fusion. Every verified record is decoded up front, then sites are walked from
+// the end so a record sees its successor already fused. With a profile from -profile only
+// the FuseTop hottest opcode sequences are fused; without one every supported one is.
+void CodeT::Fuse(VmContext& vm) {
+	if (!info) return;
+	SpaceT& Space = vm.Space;
+	NGramT* ng = new (std::nothrow) NGramT();
+	if (ng == nullptr) return;
+	char* path = vm.SidePath(".ngram");
+	bool prof = ng->Load(path);
+	delete[] path;
+	B8 floor = 1;
+	if (prof) {
+		B8 top[FuseTop] = {};
+		auto Offer = [&](B8 c) {
+			if (c <= top[FuseTop - 1]) return;
+			Size k = FuseTop - 1;
+			for (; k && top[k - 1] < c; k--) top[k] = top[k - 1];
+			top[k] = c;
+		};
+		for (auto& r : ng->pair) for (B8 c : r) Offer(c);
+		for (auto& t : ng->tri) Offer(t.cnt);
+		if (top[FuseTop - 1]) floor = top[FuseTop - 1];
+	}
+	auto Hot = [&](const B1* ops, int n) { return !prof || ng->Count(ops, n) >= floor; };
+	for (Index k = 0; k != size; k++)
+		if ((info[k] & Boundary) && table[k].h == T_Translate) vm.Decode(&table[k]);
+	for (Index k = size; k-- != 0;) {
+		InstT* i = &table[k];
+		if (!(info[k] & Boundary) || i->next == &dispatch) continue;
+		InstT* j = i->next;
+		B1 ops[3] = { Space[begin + k], Space[begin + Index(j - table)], 0 };
+		if (info[j - table] & Fused) {
+			ops[2] = Space[begin + Index(j->next - table)];
+			if (!Hot(ops, 3)) continue;
+		}
+		else if (!Hot(ops, 2)) continue;
+		Handler h = FusePair(i->h, j->h);
+		if (h == nullptr) continue;
+		i->h = h; info[k] |= Fused; fusedSites++;
+	}
+	delete ng;
+}
+
+#if JIT_X64
+// Emits into the arena. Only rax, rcx, rdx, r10 and r11 are used: volatile in both the
+// SysV and the Windows ABI, and the blocks are leaf code that never touches the stack.
+struct EmitT {
+	enum RegTag : B1 { rax = 0, rcx = 1, rdx = 2 };
+	Byte* p;
+	// Under -fuel or -deadline, VmContext::fuel and check as displacements from Vp. The
+	// fuel is kept in r10 while the block runs and stored back on every way out, into
+	// Vp[_fuel] as well when `shown`.
+	B4 fuel = 0, check = 0;
+	bool shown = false;
+	// The jump of Charge() to its exit, emitted after the block so that the loop falls
+	// through; a block has one branch at most.
+	Byte* owed = nullptr;
+	Index owedAt = 0;
+	inline void B(std::initializer_list<int> bs) { for (int b : bs) *p++ = Byte(b); }
+	inline void D4(B4 v) { ::memcpy(p, &v, 4); p += 4; }
+	inline void D8(B8 v) { ::memcpy(p, &v, 8); p += 8; }
+	// mov reg, [r11 + 8 * r] / mov [r11 + 8 * r], reg
+	inline void Load(RegTag reg, B1 r) { LoadAt(reg, B4(r) * 8); }
+	inline void Store(RegTag reg, B1 r) { StoreAt(reg, B4(r) * 8); }
+	// The same at any displacement from Vp, which reaches the other fields of the context.
+	inline void LoadAt(RegTag reg, B4 d) { B({ 0x49, 0x8b, 0x83 | reg << 3 }); D4(d); }
+	inline void StoreAt(RegTag reg, B4 d) { B({ 0x49, 0x89, 0x83 | reg << 3 }); D4(d); }
+	inline void Imm(RegTag reg, B8 v) { B({ 0x48, 0xb8 | reg }); D8(v); }
+	// setcc al; movzx eax, al
+	inline void Flag(int cc) { B({ 0x0f, 0x90 | cc, 0xc0, 0x0f, 0xb6, 0xc0 }); }
+	inline Byte* Jcc(int cc) { B({ 0x0f, 0x80 | cc }); D4(0); return p; }
+	inline void Patch(Byte* after, Byte* to) { B4 d = B4(to - after); ::memcpy(after - 4, &d, 4); }
+	// mov r10, [r11 + fuel] / mov [r11 + d], r10
+	inline void LoadFuel() { if (fuel) { B({ 0x4d, 0x8b, 0x93 }); D4(fuel); } }
+	inline void Return() {
+		if (fuel) { B({ 0x4d, 0x89, 0x93 }); D4(fuel); }
+		if (shown) { B({ 0x4d, 0x89, 0x93 }); D4(B4(_fuel) * 8); }
+		B({ 0xc3 });
+	}
+	inline void Exit(Index ip) { Imm(rax, ip); Store(rax, _ip); Return(); }
+	// VmContext::Charge() for the branch at `at`, which leaves Meter() to the interpreter.
+	inline void Charge(Index at) {
+		B({ 0x4d, 0x3b, 0x93 }); D4(check);
+		owed = Jcc(0x4); owedAt = at;
+		B({ 0x49, 0xff, 0xca });
+	}
+	// Vp[_ip] = rax, looping back to `top` when that is the head of this block.
+	inline void Branch(Index head, Byte* top) {
+		Imm(rcx, head); B({ 0x48, 0x39, 0xc8 });
+		Byte* j = Jcc(0x4); Patch(j, top);
+		Store(rax, _ip); Return();
+	}
+};
+enum CondTag { Below = 0x2, Equal = 0x4, NotEqual = 0x5, Above = 0x7, LessI = 0xc, GreaterI = 0xf };
+
+void JitT::Compile(VmContext& vm, Index head) {
+	B8* Vp = vm.Vp;
+	SpaceT& Space = vm.Space;
+	CodeT& Code = vm.Code;
+	if (ArenaSize - used < MaxBlockBytes) return;
+	if (blockCnt == blockCap) {
+		Size n = blockCap ? blockCap * 2 : 16;
+		BlockT* t = (BlockT*)::realloc(blocks, n * sizeof(BlockT));
+		if (!t) return;
+		blocks = t; blockCap = n;
+	}
+	Protect(true);
+	Byte* fn = arena + used;
+	EmitT e{ fn };
+	using R = EmitT::RegTag;
+	e.B({ 0x49, 0xbb }); e.D8(B8(Vp));
+	// Branches pay their fuel here too once there is a budget to keep.
+	bool metered = vm.fuelOp || vm.deadlineOp;
+	auto At = [&](const B8& field) { return B4(reinterpret_cast<const Byte*>(&field) - reinterpret_cast<const Byte*>(Vp)); };
+	if (metered) { e.fuel = At(vm.fuel); e.check = At(vm.check); e.shown = vm.fuelOp != 0; }
+	e.LoadFuel();
+	Byte* top = e.p;
+	Index o = head, end = Code.begin + Code.size;
+	Size n = 0;
+	bool open = true;
+	for (; open && n != MaxInst; n++) {
+		if (!(o - Code.begin < Code.size && o + CodeT::MaxLen < Space.size && o < Vp[_Len])) break;
+		FuncTag f = FuncTag(Space[o]);
+		ShapeT sh = Shape(f);
+		if (sh.n < 0) break;
+		Index p = o + 1, next = p + sh.n;
+		B1 r[4] = {};
+		bool ok = true;
+		for (int k = 0; k != 4; k++) {
+			r[k] = Space[p + k];
+			// Operands that are only padding or immediates may hold anything.
+			bool used = k < sh.n;
+			if (f >= Set1 && f <= Set8) used = k == 0;
+			if (f == Goto || f == Call) used = k == 1;
+			if (f == IThan || f == ILess || f == IMore) used = k >= 1 && k <= 3;
+			if (used && (r[k] == _ip || r[k] == _Len || (e.shown && r[k] == _fuel))) ok = false;
+		}
+		// Decode() leaves these to Step() under -guard.
+		if (vm.Unchecked() && vm.MovesStack(f, p)) ok = false;
+		// The branches compiled below. An exit to the head would come straight back here.
+		bool paid = metered && (f == Goto || f == IfGo || f == IfNG || f == Loop);
+		if (paid && o == head) ok = false;
+		if (!ok || next > end) break;
+		if (paid) e.Charge(o);
+		auto Bin = [&](B1 a, B1 b, B1 c, std::initializer_list<int> op) {
+			e.Load(R::rax, b); e.Load(R::rcx, c); e.B(op); e.Store(R::rax, a);
+		};
+		auto Cmp = [&](B1 a, B1 b, B1 c, int cc) {
+			e.Load(R::rax, b); e.Load(R::rcx, c); e.B({ 0x48, 0x39, 0xc8 }); e.Flag(cc); e.Store(R::rax, a);
+		};
+		// rdx = (b > c) - (b < c)
+		auto Three = [&](B1 a, B1 b, B1 c, int gt, int lt) {
+			e.Load(R::rax, b); e.Load(R::rcx, c); e.B({ 0x48, 0x39, 0xc8 });
+			e.B({ 0x0f, 0x90 | gt, 0xc2, 0x0f, 0x90 | lt, 0xc0, 0x0f, 0xb6, 0xd2, 0x0f, 0xb6, 0xc0, 0x48, 0x29, 0xc2 });
+			e.Store(R::rdx, a);
+		};
+		switch (f) {
+			case NOP: break;
+			case Add: Bin(r[0], r[1], r[2], { 0x48, 0x01, 0xc8 }); break;
+			case Sub: Bin(r[0], r[1], r[2], { 0x48, 0x29, 0xc8 }); break;
+			case And: Bin(r[0], r[1], r[2], { 0x48, 0x21, 0xc8 }); break;
+			case Or: Bin(r[0], r[1], r[2], { 0x48, 0x09, 0xc8 }); break;
+			case Xor: Bin(r[0], r[1], r[2], { 0x48, 0x31, 0xc8 }); break;
+			case Mul: case IMul: Bin(r[0], r[1], r[2], { 0x48, 0x0f, 0xaf, 0xc1 }); break;
+			case LMov: case ILMov: Bin(r[0], r[1], r[2], { 0x48, 0xd3, 0xe0 }); break;
+			case RMov: Bin(r[0], r[1], r[2], { 0x48, 0xd3, 0xe8 }); break;
+			case IRMov: Bin(r[0], r[1], r[2], { 0x48, 0xd3, 0xf8 }); break;
+			case ROL: Bin(r[0], r[1], r[2], { 0x48, 0xd3, 0xc0 }); break;
+			case ROR: Bin(r[0], r[1], r[2], { 0x48, 0xd3, 0xc8 }); break;
+			case Less: Cmp(r[0], r[1], r[2], Below); break;
+			case More: Cmp(r[0], r[1], r[2], Above); break;
+			case ILess: Cmp(r[1], r[2], r[3], LessI); break;
+			case IMore: Cmp(r[1], r[2], r[3], GreaterI); break;
+			case Than: Three(r[0], r[1], r[2], Above, Below); break;
+			case IThan: Three(r[1], r[2], r[3], GreaterI, LessI); break;
+			case Inc: e.B({ 0x49, 0xff, 0x83 }); e.D4(B4(r[0]) * 8); break;
+			case Dec: e.B({ 0x49, 0xff, 0x8b }); e.D4(B4(r[0]) * 8); break;
+			case Not: e.Load(R::rax, r[1]); e.B({ 0x48, 0x85, 0xc0 }); e.Flag(Equal); e.Store(R::rax, r[0]); break;
+			case ToBool: e.Load(R::rax, r[1]); e.B({ 0x48, 0x85, 0xc0 }); e.Flag(NotEqual); e.Store(R::rax, r[0]); break;
+			case Complement: e.Load(R::rax, r[1]); e.B({ 0x48, 0xf7, 0xd0 }); e.Store(R::rax, r[0]); break;
+			case Mov1: e.Load(R::rax, r[1]); e.B({ 0x0f, 0xb6, 0xc0 }); e.Store(R::rax, r[0]); break;
+			case Mov2: e.Load(R::rax, r[1]); e.B({ 0x0f, 0xb7, 0xc0 }); e.Store(R::rax, r[0]); break;
+			case Mov4: e.Load(R::rax, r[1]); e.B({ 0x89, 0xc0 }); e.Store(R::rax, r[0]); break;
+			case Mov8: e.Load(R::rax, r[1]); e.Store(R::rax, r[0]); break;
+			case Swap: e.Load(R::rax, r[0]); e.Load(R::rcx, r[1]); e.Store(R::rcx, r[0]); e.Store(R::rax, r[1]); break;
+			case Set1: e.Imm(R::rax, Space.GetN<B1>(p + 1)); e.Store(R::rax, r[0]); break;
+			case Set2: e.Imm(R::rax, Space.GetN<B2>(p + 1)); e.Store(R::rax, r[0]); break;
+			case Set4: e.Imm(R::rax, Space.GetN<B4>(p + 1)); e.Store(R::rax, r[0]); break;
+			case Set8: e.Imm(R::rax, Space.GetN<B8>(p + 1)); e.Store(R::rax, r[0]); break;
+			case Goto: e.Load(R::rax, r[1]); e.Branch(head, top); open = false; break;
+			case IfGo: case IfNG: {
+				e.Load(R::rax, r[0]); e.B({ 0x48, 0x85, 0xc0 });
+				Byte* j = e.Jcc(f == IfGo ? Equal : NotEqual);
+				e.Load(R::rax, r[1]); e.Branch(head, top);
+				e.Patch(j, e.p); e.Exit(next); open = false;
+			} break;
+			case Loop: {
+				e.B({ 0x49, 0xff, 0x8b }); e.D4(B4(r[0]) * 8);
+				Byte* j = e.Jcc(Equal);
+				e.Load(R::rax, r[1]); e.Branch(head, top);
+				e.Patch(j, e.p); e.Exit(next); open = false;
+			} break;
+			default: ok = false;
+		}
+		if (!ok) break;
+		if (open) o = next;
+	}
+	if (open) e.Exit(o);
+	if (e.owed) { e.Patch(e.owed, e.p); e.Exit(e.owedAt); }
+	// Nothing before the first unsupported instruction: leave the head interpreted.
+	if (n == 0) { Protect(false); return; }
+	used += Size(e.p - fn);
+	used = (used + 15) & ~Size(15);
+	Protect(false);
+	InstT* i = &Code.table[head - Code.begin];
+	*i = InstT{ T_Native, &Code.dispatch };
+	i->at = head; i->imm = B8(fn);
+	// IThan/ILess/IMore read one byte past their own length.
+	blocks[blockCnt++] = { head, o + CodeT::MaxLen };
+	compiled++; code += Size(e.p - fn);
+}
+#else
+void JitT::Compile(VmContext&, Index) {}
+#endif
+
+InstT* VmContext::Dispatch() {
+	if (snapRequest) SnapNow();
+	Index ip = Vp[_ip];
+	if (!(ip < Vp[_Len])) {
+		#if !Release
+		if (infoOp) fprintf(stdErr, "\033[32m[I]\033[0m Exit: %llu (0x%llx).\n", Vp[_ExitWith], Vp[_ExitWith]);
+		#endif
+		Code.ret = int(Vp[_ExitWith]); return &Code.halt;
+	}
+	if (Vp[_Len] != Code.lenAt) { Code.lenAt = Vp[_Len]; Code.Touch(Code.begin, Code.size); }
+	if (Threads) {
+		if (--slice == 0 && Preempt()) { Code.ret = 0; return &Code.halt; }
+		if (Code.shared && Code.shared->load(std::memory_order_acquire) != Code.seen) Code.Resync();
+	}
+	if (ip - Code.begin < Code.size) {
+		#if Profiler
+		if (Perf) Perf->Entered(*this, ip - Code.begin);
+		#endif
+		// Entering a guarded record mid-run: its checks were dropped on facts this path skipped.
+		if (Code.info && (Code.info[ip - Code.begin] & CodeT::Guard)) return &Code.step;
+		if (Jit.heat && ++Jit.heat[ip - Code.begin] == JitT::Hot) Jit.Compile(*this, ip);
+		return &Code.table[ip - Code.begin];
+	}
+	#if Profiler
+	if (Perf && Perf->phase == PerfT::Timing) Perf->Timed(*this, nullptr);
+	#endif
+	return &Code.step;
+}
+bool VmContext::Prepare() {
+	Code.begin = Vp[_CodeSp]; Code.size = Vp[_DataSp] - Vp[_CodeSp];
+	Code.table = new (std::nothrow) InstT[Code.size];
+	if (!Code.table) return false;
+	Code.limit = Code.begin + Code.size + CodeT::MaxLen - 1;
+	Code.lenAt = Vp[_Len];
+	// Fused records and compiled blocks would run instructions without an entry each,
+	// or outside the runs -perf counts.
+	#if Profiler
+	if (perfOp) fuseOp = jitOp = 0;
+	#endif
+	if (traceOp) {
+		fuseOp = jitOp = 0;
+		Code.traced = new (std::nothrow) Handler[Code.size];
+		if (!Code.traced) return false;
+	}
+	Code.Verify(*this);
+	if (fuseOp) Code.Fuse(*this);
+	if (jitOp && !Jit.Init(Code.size)) jitOp = 0;
+	if (jitOp) Code.jit = &Jit;
+	return true;
+}
+int VmContext::MainThreaded() {
+	InstT* i = Dispatch();
+	while (i) i = i->h(*this, i);
+	return Code.ret;
+}
+
+#ifndef _WIN32
+// -guard: a fault inside the guard page of the context running on this thread goes back
+// to its Run(); any other fault to the handler that was there before.
+struct GuardRunT { sigjmp_buf jb; Byte* at; B8 len; };
+static thread_local GuardRunT* guardRun = nullptr;
+static struct sigaction guardPrev[2];
+static void GuardFault(int sig, siginfo_t* info, void* ctx) {
+	GuardRunT* g = guardRun;
+	Byte* at = (Byte*)info->si_addr;
+	if (g && at >= g->at && at < g->at + g->len) siglongjmp(g->jb, 1);
+	const struct sigaction& prev = guardPrev[sig == SIGBUS];
+	if (prev.sa_flags & SA_SIGINFO) prev.sa_sigaction(sig, info, ctx);
+	else if (prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN) prev.sa_handler(sig);
+	// Returning runs the faulting access again, which now ends the process.
+	else signal(sig, SIG_DFL);
+}
+static void GuardInstall() {
+	static bool done = [] {
+		struct sigaction a = {};
+		a.sa_sigaction = GuardFault;
+		a.sa_flags = SA_SIGINFO | SA_NODEFER;
+		sigemptyset(&a.sa_mask);
+		sigaction(SIGSEGV, &a, &guardPrev[0]);
+		sigaction(SIGBUS, &a, &guardPrev[1]);
+		return true;
+	}();
+	(void)done;
+}
+#endif
+// Runs the code in the chosen engine. A push onto the guard page ends it as a Stack
+// Space overflow, like the check it replaces.
+int VmContext::Run() {
+	#ifndef _WIN32
+	if (Space.guard) {
+		GuardInstall();
+		GuardRunT g;
+		g.at = Space.guardAt; g.len = Space.guard;
+		GuardRunT* outer = guardRun;
+		if (sigsetjmp(g.jb, 0)) { guardRun = outer; StackError(0xb4); }
+		guardRun = &g;
+		int r;
+		try { r = engine == Switch ? MainSwitch() : MainThreaded(); }
+		catch (...) { guardRun = outer; throw; }
+		guardRun = outer;
+		return r;
+	}
+	#endif
+	return engine == Switch ? MainSwitch() : MainThreaded();
+}
+
+int VmContext::Main() {
+	int r;
+	bool error = false;
+	deadline = deadlineOp ? SteadyNs() + deadlineOp * 1000000 : 0;
+	stopped = false;
+	if (traceOp && Trace == nullptr) {
+		Trace = new (std::nothrow) TraceT();
+		if (Trace && !Trace->Init(traceOp, Vp[_CodeSp], Vp[_DataSp] - Vp[_CodeSp])) { delete Trace; Trace = nullptr; }
+	}
+	#if Profiler
+	if (perfOp && Perf == nullptr) {
+		Perf = new (std::nothrow) PerfT();
+		if (Perf && !Perf->Init(Vp[_CodeSp], Vp[_DataSp] - Vp[_CodeSp])) { delete Perf; Perf = nullptr; }
+		if (Perf && engine == Threaded) { Perf->threaded = true; Perf->period = Perf->countdown = PerfT::RunPeriod; }
+	}
+	#endif
+	Arm(fuelOp ? fuelOp : ~B8(0));
+	try { r = Run(); }
+	catch (const VmExit& e) {
+		r = e.code; error = true;
+		if (Trace) Trace->Save(*this, r);
+		#if Profiler
+		if (Perf) Perf->Failed(*this, r);
+		#endif
+	}
+	// A SPAWN or WAKE on the way: this slice was thread 1's, and the threads go on here
+	// as worker 0 until one of them ends the guest.
+	if (Threads) {
+		Threads->Settle(*this, r, error);
+		Threads->Loop(0);
+		r = Threads->code;
+		delete Threads; Threads = nullptr;
+	}
+	Streams.FlushAll();
+	if (NGram) { char* path = SidePath(".ngram"); NGram->Save(path); delete[] path; }
+	#if Profiler
+	if (Perf) Perf->Save(*this);
+	#endif
+	return r;
+}
+VmContext::~VmContext() {
+	#if !Release
+	if (memOp && Space.array) printMem("Space end");
+	#endif
+	delete Threads;
+	delete Aio;
+	Streams.FlushAll();
+	CloseFiles();
+	::free(files);
+	delete NGram;
+	delete Trace;
+	#if Profiler
+	delete Perf;
+	#endif
+}
+void VmContext::PrintStats() {
+	fprintf(stdErr, "\033[32m[I]\033[0m Engine: %s.\n", engine == Switch ? "switch" : "threaded");
+	if (engine == Threaded) fprintf(stdErr, "\033[32m[I]\033[0m Verifier: %llu instructions, %llu CheckData removed.\n", (unsigned long long)Code.verified, (unsigned long long)Code.dataChecks);
+	if (engine == Threaded && jitOp) fprintf(stdErr, "\033[32m[I]\033[0m JIT: %llu blocks, %llu bytes of code.\n", (unsigned long long)Jit.compiled, (unsigned long long)Jit.code);
+	if (engine == Threaded && fuseOp) fprintf(stdErr, "\033[32m[I]\033[0m Fusion: %llu sites, %llu dispatches saved.\n", (unsigned long long)Code.fusedSites, (unsigned long long)Code.saved);
+	if (engine == Threaded) fprintf(stdErr, "\033[32m[I]\033[0m Branch cache: %llu hits, %llu misses.\n", (unsigned long long)Code.branchHits, (unsigned long long)Code.branchMisses);
+}
+bool VmContext::AddFile(const FileT& f) {
+	if (fileCnt == fileCap) {
+		Size n = fileCap ? fileCap * 2 : 8;
+		FileT* t = (FileT*)::realloc(files, n * sizeof(FileT));
+		if (t == nullptr) return false;
+		files = t; fileCap = n;
+	}
+	files[fileCnt++] = f;
+	return true;
+}
+// Opens a file saved in a snapshot again at its saved position. Files the guest opened
+// for writing are not truncated a second time.
+bool VmContext::Reopen(FileT& f) {
+	const char* mode = f.mode;
+	if (strchr(mode, 'w')) mode = strchr(mode, 'b') ? "r+b" : "r+";
+	f.pFile = fopen(f.path, mode);
+	if (f.pFile == nullptr) return false;
+	if (!strchr(mode, 'a') && Seek(f.pFile, f.pos) != 0) { fclose(f.pFile); f.pFile = nullptr; return false; }
+	return true;
+}
+void VmContext::CloseFiles() {
+	for (Size k = 0; k != fileCnt; k++) {
+		if (files[k].pFile) fclose(files[k].pFile);
+		delete[] files[k].path; delete[] files[k].mode;
+	}
+	fileCnt = 0;
+}
+bool VmContext::CopyFiles(const VmContext& from) {
+	for (Size k = 0; k != from.fileCnt; k++) {
+		const FileT& o = from.files[k];
+		size_t n = strlen(o.path), m = strlen(o.mode);
+		FileT f{ o.handle, nullptr, new char[n + 1], new char[m + 1], o.pos };
+		::memcpy(f.path, o.path, n + 1); ::memcpy(f.mode, o.mode, m + 1);
+		if (!AddFile(f)) { delete[] f.path; delete[] f.mode; return false; }
+		if (!Reopen(files[fileCnt - 1])) return false;
+	}
+	return true;
+}
+
+// Header, big-endian: magic, format version[3], layout (bit 0: linear, bit 1: reversed),
+// image version[3], 5 reserved, Space size, file count, Vp[256], then per file its
+// handle, position, path and mode lengths (B4) and bytes. Space follows at SnapHead;
+// pages that hold only zeros are left as holes.
+int VmContext::Snapshot(const char* path) {
+	// Tickets do not survive a restore, but the bytes they moved are in the snapshot.
+	if (Aio) Aio->Drain();
+	Streams.FlushAll();
+	FILE* pFile = fopen(path, "wb");
+	if (pFile == nullptr) return errno ? errno : EIO;
+	FWrite(SnapMagic, pFile);
+	fwrite(SnapVersion, sizeof(B1), 3, pFile);
+	FWrite(B1(B1(Space.linear) | B1(Space.Reversed()) << 1), pFile);
+	fwrite(version, sizeof(B1), 3, pFile);
+	const B1 reserved[5] = {};
+	fwrite(reserved, sizeof(B1), 5, pFile);
+	FWrite(Space.size, pFile); FWrite(B8(fileCnt), pFile);
+	for (B8 v : Vp) FWrite(v, pFile);
+	for (Size k = 0; k != fileCnt; k++) {
+		FileT& f = files[k];
+		int fd = FileNo(f.pFile);
+		// Read-ahead is given back, so the position is the one the guest sees.
+		if (fd >= 0 && Size(fd) < Streams.cnt && Streams.table[fd].cap) {
+			StreamsT::Drop(fd, Streams.table[fd]);
+			f.pos = Tell(fd);
+		}
+		else { fflush(f.pFile); f.pos = Tell(f.pFile); }
+		B4 n = B4(strlen(f.path)), m = B4(strlen(f.mode));
+		FWrite(f.handle, pFile); FWrite(f.pos, pFile); FWrite(n, pFile); FWrite(m, pFile);
+		fwrite(f.path, 1, n, pFile); fwrite(f.mode, 1, m, pFile);
+	}
+	if (Tell(pFile) > SnapHead) { fclose(pFile); remove(path); return E2BIG; }
+	bool ok = true;
+	Space.ForUsed([&](B8 at, B8 n) {
+		ok = ok && Seek(pFile, SnapHead + at) == 0 && fwrite(Space.array + at, 1, size_t(n), pFile) == n;
+	});
+	// The file has to cover all of Space to be mapped back; the tail stays sparse.
+	ok = ok && Seek(pFile, SnapHead + Space.size - 1) == 0 && fwrite(Space.array + Space.size - 1, 1, 1, pFile) == 1;
+	ok = fclose(pFile) == 0 && ok;
+	if (!ok) { remove(path); return errno ? errno : EIO; }
+	return 0;
+}
+int VmContext::Restore(FILE* pFile) {
+	B1 fmt[3], layout, reserved[5];
+	fread(fmt, sizeof(B1), 3, pFile); FRead(layout, pFile);
+	fread(version, sizeof(B1), 3, pFile); fread(reserved, sizeof(B1), 5, pFile);
+	B8 size; FRead(size, pFile);
+	B8 cnt; FRead(cnt, pFile);
+	for (B8& v : Vp) FRead(v, pFile);
+	// Snapshots are taken without guest threads, so Stack runs to the end of Space.
+	Vp[_stack_limit] = size;
+	Space.linear = layout & 1;
+	bool bad = fmt[0] != SnapVersion[0] || bool(layout & 2) != Space.Reversed() || size == 0 || Vp[_Len] != size
+		|| FileSize(pFile) < SnapHead + size || cnt > SnapHead / 24;
+	for (B8 k = 0; !bad && k != cnt; k++) {
+		FileT f{};
+		B4 n, m;
+		FRead(f.handle, pFile); FRead(f.pos, pFile); FRead(n, pFile); FRead(m, pFile);
+		if (feof(pFile) || n >= SnapHead || m >= SnapHead) { bad = true; break; }
+		f.path = new char[n + 1]; f.mode = new char[m + 1];
+		fread(f.path, 1, n, pFile); fread(f.mode, 1, m, pFile);
+		f.path[n] = 0; f.mode[m] = 0;
+		if (!AddFile(f)) { delete[] f.path; delete[] f.mode; fclose(pFile); return 0xa4; }
+		if (!Reopen(files[fileCnt - 1])) {
+			fclose(pFile);
+			#if !Release
+			fprintf(stdErr, "\033[31m[E]\033[0m File not opened: \033[36m`%s`\033[0m. ", files[fileCnt - 1].path); fprintf(stdErr, "With: %s\n", strerror(errno));
+			#endif
+			return 0xa2;
+		}
+	}
+	if (bad || feof(pFile) || ferror(pFile)) {
+		fclose(pFile);
+		#if !Release
+		fprintf(stdErr, "\033[31m[E]\033[0m Invalid file format: Bad snapshot \033[36m`%s`\033[0m.\n", imagePath);
+		#endif
+		return 0xa3;
+	}
+	#if !Release
+	if (infoOp) fprintf(stdErr, "\033[32m[I]\033[0m Snapshot of version \033[33m[%u.%u.%u]\033[0m: Space{\033[35m%llu\033[0m}, %llu files, ip=\033[35m%llu\033[0m.\n", version[0], version[1], version[2], size, cnt, Vp[_ip]);
+	#endif
+	// Mapped copy-on-write, restoring costs the page faults the guest actually takes.
+	if (!Space.mapFile(pFile, SnapHead, size)) {
+		if (!Space.malloc(size)) {
+			fclose(pFile);
+			#if !Release
+			fprintf(stdErr, "\033[31m[E]\033[0m Memory error: malloc{%llu}. ", size); fprintf(stdErr, "With: %s\n", strerror(errno));
+			#endif
+			return 0xa4;
+		}
+		if (Seek(pFile, SnapHead) != 0 || ::fread(Space.array, 1, size_t(size), pFile) != size) { fclose(pFile); return 0xa5; }
+	}
+	fclose(pFile);
+	restored = true;
+	#if !Release
+	if (memOp) printMem("Space begin");
+	#endif
+	if (engine == Threaded && !Prepare()) engine = Switch;
+	return 0;
+}
+// Takes a snapshot asked for by the signal, next to the image.
+void VmContext::SnapNow() {
+	snapRequest = 0;
+	if (Threads) {
+		#if !Release
+		fprintf(stdErr, "\033[31m[E]\033[0m Snapshot skipped: the guest runs threads.\n");
+		#endif
+		return;
+	}
+	char* path = SidePath(".snap");
+	int e = Snapshot(path);
+	#if !Release
+	if (e) fprintf(stdErr, "\033[31m[E]\033[0m Snapshot \033[36m`%s`\033[0m failed: %s.\n", path, strerror(e));
+	else if (infoOp) fprintf(stdErr, "\033[32m[I]\033[0m Snapshot: \033[36m`%s`\033[0m.\n", path);
+	#else
+	(void)e;
+	#endif
+	delete[] path;
+}
+
+// A worker's context: the options of `from`, its Space without owning it, and the code
+// decoded so far, rebased onto these registers. Compiled blocks address the registers
+// of `from`, so they are translated again.
+bool VmContext::Carry(const VmContext& from, ThreadsT& threads, unsigned w) {
+	::memcpy(version, from.version, sizeof version);
+	#if !Release
+	argOp = from.argOp; infoOp = from.infoOp; memOp = from.memOp;
+	#endif
+	engine = from.engine;
+	fuseOp = from.fuseOp; jitOp = from.jitOp;
+	imagePath = from.imagePath; loadOp = from.loadOp; guardOp = from.guardOp;
+	fuelOp = from.fuelOp; deadlineOp = from.deadlineOp; deadline = from.deadline;
+	Arm(fuelOp ? 0 : ~B8(0));
+	Space.array = from.Space.array; Space.size = from.Space.size; Space.linear = from.Space.linear;
+	Space.guard = from.Space.guard; Space.guardAt = from.Space.guardAt;
+	Threads = &threads; worker = w; carrier = true;
+	if (engine == Switch) return true;
+	Code.begin = from.Code.begin; Code.size = from.Code.size;
+	Code.limit = from.Code.limit; Code.lenAt = from.Code.lenAt;
+	Code.table = new (std::nothrow) InstT[Code.size];
+	if (!Code.table) return false;
+	if (from.Code.info) {
+		Code.info = new (std::nothrow) B1[Code.size];
+		if (!Code.info) return false;
+		::memcpy(Code.info, from.Code.info, size_t(Code.size));
+	}
+	Code.Rebase(from.Code, from.Vp, Vp);
+	for (Index k = 0; k != Code.size; k++) if (Code.table[k].h == T_Native || Code.table[k].h == T_Traced) Code.table[k] = InstT{};
+	if (jitOp && !Jit.Init(Code.size)) jitOp = 0;
+	if (jitOp) Code.jit = &Jit;
+	Code.shared = &threads.epoch; Code.seen = threads.epoch.load();
+	return true;
+}
+// The code in vm becomes thread 1, running on worker 0.
+bool ThreadsT::Init(VmContext& vm, unsigned n) {
+	root = &vm;
+	workers = n ? n : std::thread::hardware_concurrency();
+	if (workers == 0) workers = 1;
+	if (workers > MaxWorkers) workers = MaxWorkers;
+	ThreadT* t = new (std::nothrow) ThreadT();
+	queues = new (std::nothrow) QueueT[workers];
+	carriers = new (std::nothrow) VmContext*[workers]{};
+	if (t == nullptr || queues == nullptr || carriers == nullptr) { delete t; return false; }
+	t->id = ++last; t->state = ThreadT::Running;
+	slots[t->id % MaxThreads] = t;
+	live = active = 1;
+	vm.thread = t;
+	low = (vm.Space.size - 1) & ~Index(15);
+	floor = std::min(low, (vm.Vp[_stack_top] + DefaultStack + 15) & ~Index(15));
+	vm.Vp[_stack_limit] = floor;
+	// The code decoded so far pushes without checks.
+	if (vm.Space.guard && vm.engine != Switch) vm.Code.Drop(vm.Code.begin, vm.Code.size);
+	if (vm.fuelOp) { fuel = vm.fuel; vm.Arm(0); }
+	if (vm.engine != Switch) { vm.Code.shared = &epoch; vm.Code.seen = 0; }
+	carriers[0] = &vm;
+	for (unsigned w = 1; w != workers; w++) {
+		VmContext* c = new (std::nothrow) VmContext();
+		if (c && c->Carry(vm, *this, w)) { carriers[w] = c; continue; }
+		if (c) c->Space.array = nullptr;
+		delete c;
+		workers = w;
+	}
+	pool = new (std::nothrow) std::thread[workers > 1 ? workers - 1 : 1];
+	if (pool == nullptr) return false;
+	for (unsigned w = 1; w < workers; w++) pool[w - 1] = std::thread(&ThreadsT::Loop, this, w);
+	return true;
+}
+// Under m. A stack of at least stackLen bytes (DefaultStack for 0), reused or carved.
+ThreadT* ThreadsT::Add(const B8* vp, Index entry, B8 arg, Size stackLen, int& error) {
+	if (live >= MaxThreads - 1) { error = EAGAIN; return nullptr; }
+	if (stackLen > root->Space.size) { error = ENOMEM; return nullptr; }
+	Size len = stackLen ? (stackLen + 15) & ~Size(15) : DefaultStack;
+	Index at = 0;
+	Size k = 0;
+	while (k != spareCnt && spare[k].len < len) k++;
+	if (k != spareCnt) { at = spare[k].at; len = spare[k].len; spare[k] = spare[--spareCnt]; }
+	else if (low >= floor + len) { low -= len; at = low; }
+	else { error = ENOMEM; return nullptr; }
+	ThreadT* t = new (std::nothrow) ThreadT();
+	if (t == nullptr) { spare[spareCnt++] = { at, len }; error = ENOMEM; return nullptr; }
+	B8 id;
+	do id = ++last; while (id == 0 || slots[id % MaxThreads]);
+	t->id = id; t->stack = at; t->stackLen = len;
+	::memcpy(t->Vp, vp, sizeof t->Vp);
+	t->Vp[_ip] = entry; t->Vp[_exp_arg] = arg; t->Vp[_thread] = id;
+	t->Vp[_stack_base] = at; t->Vp[_stack_top] = at + sizeof(B8); t->Vp[_stack_limit] = at + len;
+	root->Space.PutN<B8>(at, End);
+	slots[id % MaxThreads] = t;
+	live++; active++;
+	return t;
+}
+// Under m, like Wake() and Finish().
+void ThreadsT::Push(ThreadT& t, unsigned w) {
+	if (t.io) { held.fetch_add(1, std::memory_order_relaxed); pinned.Push(&t); }
+	else queues[w].Push(&t);
+	queued.fetch_add(1, std::memory_order_relaxed);
+	if (t.io) idle.notify_all();
+	else idle.notify_one();
+}
+void ThreadsT::Wake(ThreadT& t, unsigned w) {
+	if (t.state == ThreadT::Blocked) { t.state = ThreadT::Runnable; active++; Push(t, w); }
+	else if (t.state == ThreadT::Running) t.woken = true;
+}
+void ThreadsT::Finish(int r) {
+	if (!over.load()) { code = r; over.store(true); }
+	idle.notify_all();
+}
+ThreadT* ThreadsT::Take(unsigned w) {
+	ThreadT* t = w == 0 ? pinned.Front() : nullptr;
+	if (t) held.fetch_sub(1, std::memory_order_relaxed);
+	else t = queues[w].Front();
+	for (unsigned k = 1; t == nullptr && k < workers; k++) t = queues[(w + k) % workers].Back();
+	if (t == nullptr) return nullptr;
+	queued.fetch_sub(1, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> l(m);
+	t->state = ThreadT::Running;
+	if (w == 0) t->io = false;
+	return t;
+}
+void ThreadsT::Run(unsigned w, ThreadT& t) {
+	VmContext& c = *carriers[w];
+	::memcpy(c.Vp, t.Vp, sizeof c.Vp);
+	c.thread = &t; c.yielded = 0; c.slice = Slice;
+	int r = 0;
+	bool error = false;
+	try { r = c.Run(); }
+	catch (const VmExit& e) { r = e.code; error = true; if (c.Trace) c.Trace->Save(c, r); }
+	Settle(c, r, error);
+}
+// After a slice of c.thread: it waits, goes back in a queue, has ended, or the guest
+// has. Thread 1 ending, an Exit in any thread and a runtime error end the guest.
+void ThreadsT::Settle(VmContext& c, int r, bool error) {
+	ThreadT& t = *c.thread;
+	::memcpy(t.Vp, c.Vp, sizeof t.Vp);
+	c.thread = nullptr;
+	if (c.fuelOp) { fuel.fetch_add(c.fuel, std::memory_order_relaxed); c.Arm(0); }
+	std::lock_guard<std::mutex> l(m);
+	if (error) { Finish(r); return; }
+	if (over.load()) return;
+	if (c.yielded) {
+		c.yielded = 0;
+		if (t.block && !t.woken) { t.state = ThreadT::Blocked; active--; }
+		else { t.state = ThreadT::Runnable; Push(t, c.worker); }
+		t.block = t.woken = false;
+	}
+	else if (t.id != 1 && t.Vp[_ip] == End) {
+		t.state = ThreadT::Done; active--;
+		t.result = t.Vp[_exp_res];
+		spare[spareCnt++] = { t.stack, t.stackLen };
+		for (ThreadT* j : slots) if (j && j->waitFor == t.id) Wake(*j, c.worker);
+	}
+	else { Finish(r); return; }
+	if (active == 0) {
+		#if !Release
+		fprintf(c.stdErr, "\033[31m[E]\033[0m Deadlock: every thread waits in JOIN or HTL.\n");
+		#endif
+		Finish(0xc3);
+	}
+}
+void ThreadsT::Loop(unsigned w) {
+	while (!over.load()) {
+		ThreadT* t = Take(w);
+		if (t) { Run(w, *t); continue; }
+		std::unique_lock<std::mutex> l(m);
+		if (!over.load() && queued.load() == (w ? held.load() : 0)) idle.wait(l);
+	}
+}
+ThreadsT::~ThreadsT() {
+	{
+		std::lock_guard<std::mutex> l(m);
+		over.store(true);
+		idle.notify_all();
+	}
+	if (pool) for (unsigned w = 1; w < workers; w++) if (pool[w - 1].joinable()) pool[w - 1].join();
+	delete[] pool;
+	if (carriers) {
+		for (unsigned w = 1; w < workers; w++) if (carriers[w]) { carriers[w]->Space.array = nullptr; carriers[w]->Threads = nullptr; delete carriers[w]; }
+		delete[] carriers;
+	}
+	delete[] queues;
+	for (ThreadT* t : slots) delete t;
+	if (root) { root->thread = nullptr; root->Code.shared = nullptr; root->yielded = 0; }
+}
+
+// Embedding. The image keeps the context Init() produced, which never runs, plus a copy
+// of its Space in a shared memory object. Only the pages that hold anything are written;
+// after a plain Init() that is Pre and Code, and the rest stays sparse.
+struct VmImage {
+	VmContext proto;
+	char* path = nullptr;
+	SpaceT::SharedT shared{};
+	bool hasShared = false;
+	B8 pad = 0;
+	bool Share() {
+		SpaceT& s = proto.Space;
+		if (s.base == nullptr) return false;
+		pad = B8(s.array - s.base);
+		#ifdef _WIN32
+		shared = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, DWORD(s.mapLen >> 32), DWORD(s.mapLen), nullptr);
+		if (shared == nullptr) return false;
+		hasShared = true;
+		Byte* v = (Byte*)MapViewOfFile(shared, FILE_MAP_WRITE, 0, 0, SIZE_T(s.mapLen));
+		if (v == nullptr) return false;
+		s.ForUsed([&](B8 at, B8 n) { ::memcpy(v + pad + at, s.array + at, size_t(n)); });
+		UnmapViewOfFile(v);
+		#else
+		#ifdef __linux__
+		shared = memfd_create("fnh", MFD_CLOEXEC);
+		#else
+		char name[64];
+		snprintf(name, sizeof name, "/fnh-%ld-%p", long(getpid()), (void*)this);
+		shared = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (shared >= 0) shm_unlink(name);
+		#endif
+		if (shared < 0) return false;
+		hasShared = true;
+		if (ftruncate(shared, off_t(s.mapLen)) != 0) return false;
+		bool ok = true;
+		s.ForUsed([&](B8 at, B8 n) {
+			for (B8 done = 0; ok && done < n;) {
+				ssize_t w = pwrite(shared, s.array + at + done, size_t(n - done), off_t(pad + at + done));
+				if (w < 0 && errno == EINTR) continue;
+				if (w <= 0) ok = false;
+				else done += B8(w);
+			}
+		});
+		if (!ok) return false;
+		#endif
+		return true;
+	}
+	~VmImage() {
+		if (hasShared) {
+			#ifdef _WIN32
+			CloseHandle(shared);
+			#else
+			close(shared);
+			#endif
+		}
+		delete[] path;
+	}
+};
+
+bool VmContext::Spawn(const VmImage& img) {
+	const VmContext& p = img.proto;
+	image = &img;
+	::memcpy(version, p.version, sizeof version);
+	#if !Release
+	argOp = p.argOp; infoOp = p.infoOp; memOp = p.memOp;
+	#endif
+	::memcpy(Vp, p.Vp, sizeof Vp);
+	engine = p.engine;
+	statsOp = p.statsOp; profOp = p.profOp; fuseOp = p.fuseOp; jitOp = p.jitOp;
+	traceOp = p.traceOp; aioOp = p.aioOp; threadOp = p.threadOp;
+	#if Profiler
+	perfOp = p.perfOp;
+	#endif
+	imagePath = p.imagePath; loadOp = p.loadOp; guardOp = p.guardOp;
+	fuelOp = p.fuelOp; deadlineOp = p.deadlineOp;
+	restored = p.restored;
+	if (!CopyFiles(p)) return false;
+	Space.linear = p.Space.linear;
+	if (!Space.mapShared(img.shared, p.Space.mapLen, img.pad, p.Space.size, p.Space.guard != 0)) return false;
+	if (engine == Switch) return true;
+	Code.begin = p.Code.begin; Code.size = p.Code.size;
+	Code.limit = p.Code.limit; Code.lenAt = Vp[_Len];
+	Code.verified = p.Code.verified; Code.dataChecks = p.Code.dataChecks;
+	Code.fusedSites = p.Code.fusedSites;
+	Code.table = new (std::nothrow) InstT[Code.size];
+	if (!Code.table) return false;
+	if (p.Code.traced) {
+		Code.traced = new (std::nothrow) Handler[Code.size];
+		if (!Code.traced) return false;
+	}
+	Code.info = p.Code.info; Code.ownInfo = false;
+	Code.Rebase(p.Code, p.Vp, Vp);
+	if (jitOp && !Jit.Init(Code.size)) jitOp = 0;
+	if (jitOp) Code.jit = &Jit;
+	return true;
+}
+// Remapping Space drops the pages the guest wrote. Decoded records and compiled blocks
+// only depend on the code bytes, so they are kept unless the guest wrote to the code.
+bool VmContext::Reset() {
+	if (image == nullptr) return false;
+	const VmContext& p = image->proto;
+	// Transfers in flight still point into the old space.
+	delete Aio; Aio = nullptr;
+	Streams.FlushAll();
+	Streams.Forget();
+	CloseFiles();
+	if (!CopyFiles(p)) return false;
+	if (!Space.mapShared(image->shared, p.Space.mapLen, image->pad, p.Space.size)) return false;
+	::memcpy(Vp, p.Vp, sizeof Vp);
+	if (engine == Switch) return true;
+	if (Code.dirty) {
+		if (Code.jit) Code.jit->Touch(Code.table, Code.begin, Code.begin, Code.limit - Code.begin);
+		if (Code.ownInfo) delete[] Code.info;
+		Code.info = p.Code.info; Code.ownInfo = false;
+		Code.Rebase(p.Code, p.Vp, Vp);
+		Code.dirty = false;
+	}
+	Code.lenAt = Vp[_Len];
+	Code.ret = 0;
+	return true;
+}
+
+// FnhLoad() with the diagnostics of the load written to err.
+VmImage* LoadImage(const char* path, const char* const* opts, int optCnt, int* status, FILE* err) {
+	int r = 0xa4;
+	VmImage* img = new (std::nothrow) VmImage();
+	char** argv = img ? new (std::nothrow) char*[optCnt + 3] : nullptr;
+	if (argv) {
+		size_t n = strlen(path);
+		img->path = new char[n + 1];
+		::memcpy(img->path, path, n + 1);
+		argv[0] = img->path; argv[1] = img->path;
+		for (int k = 0; k != optCnt; k++) argv[k + 2] = (char*)opts[k];
+		argv[optCnt + 2] = nullptr;
+		// Spawned instances map the image's Space, so it is loaded as a mapping too.
+		if (img->proto.loadOp == Heap) img->proto.loadOp = Mapped;
+		img->proto.stdErr = err;
+		r = img->proto.Init(optCnt + 2, argv);
+		img->proto.stdErr = stderr;
+		if (r == 0 && !img->Share()) r = 0xa4;
+		delete[] argv;
+	}
+	if (status) *status = r;
+	if (r == 0) return img;
+	delete img;
+	return nullptr;
+}
+VmImage* FnhLoad(const char* path, const char* const* opts, int optCnt, int* status) {
+	return LoadImage(path, opts, optCnt, status, stderr);
+}
+void FnhFree(VmImage* image) { delete image; }
+VmContext* FnhSpawn(const VmImage* image) {
+	VmContext* vm = new (std::nothrow) VmContext();
+	if (vm && !vm->Spawn(*image)) { delete vm; vm = nullptr; }
+	return vm;
+}
+int FnhRun(VmContext* vm, FILE* in, FILE* out) {
+	if (in) vm->stdIn = in;
+	if (out) vm->stdOut = out;
+	return vm->Main();
+}
+bool FnhReset(VmContext* vm) { return vm->Reset(); }
+void FnhDrop(VmContext* vm) { delete vm; }
+int FnhExec(int argc, char** argv) {
+	VmContext vm;
+	if (int r = vm.Init(argc, argv)) return r;
+	int r = vm.Main();
+	// Stopped by -fuel or -deadline: `app <image>.snap` with a new budget goes on.
+	if (vm.stopped) vm.SnapNow();
+	if (vm.statsOp) vm.PrintStats();
+	return r;
+}
+
+// Batch mode: `app -batch [-j threads] [-o dir] image[=input]... [options]` runs every
+// image in a VmContext of its own on a pool of worker threads; the options apply to
+// every job. A job reads `input` (or nothing) through handle 1 and writes handle 2 to
+// `dir/<job>.out`, or to the shared stdout without -o. The exit code is the first
+// nonzero one in job order.
+#ifdef _WIN32
+const char* const NullDevice = "NUL";
+#else
+const char* const NullDevice = "/dev/null";
+#endif
+struct BatchT {
+	struct JobT { char* image; const char* input; int ret; };
+	// A worker's share of the jobs. The owner takes from the front; a worker that runs
+	// dry steals the back half of another worker's share.
+	struct RangeT { std::mutex m; Size lo = 0, hi = 0; };
+	JobT* jobs = nullptr;
+	Size jobCnt = 0;
+	RangeT* ranges = nullptr;
+	unsigned threads = 0;
+	char* prog = nullptr;
+	char** opts = nullptr;
+	int optCnt = 0;
+	const char* dir = nullptr;
+	bool Take(unsigned w, Size& job) {
+		{
+			std::lock_guard<std::mutex> l(ranges[w].m);
+			if (ranges[w].lo != ranges[w].hi) { job = ranges[w].lo++; return true; }
+		}
+		for (unsigned k = 1; k < threads; k++) {
+			RangeT& v = ranges[(w + k) % threads];
+			Size lo, hi;
+			{
+				std::lock_guard<std::mutex> l(v.m);
+				if (v.lo == v.hi) continue;
+				lo = v.lo + (v.hi - v.lo) / 2; hi = v.hi; v.hi = lo;
+			}
+			std::lock_guard<std::mutex> l(ranges[w].m);
+			job = lo; ranges[w].lo = lo + 1; ranges[w].hi = hi;
+			return true;
+		}
+		return false;
+	}
+	void Run(Size n) {
+		JobT& job = jobs[n];
+		FILE* in = fopen(job.input ? job.input : NullDevice, "rb");
+		FILE* out = nullptr;
+		if (dir) {
+			char path[4096];
+			snprintf(path, sizeof path, "%s/%llu.out", dir, (unsigned long long)n);
+			out = fopen(path, "wb");
+		}
+		if (in == nullptr || (dir && out == nullptr)) job.ret = 0xa2;
+		else {
+			// Init() sees the usual command line: program, image, options.
+			char** argv = new char*[optCnt + 3];
+			argv[0] = prog; argv[1] = job.image;
+			for (int k = 0; k != optCnt; k++) argv[k + 2] = opts[k];
+			argv[optCnt + 2] = nullptr;
+			VmContext* vm = new (std::nothrow) VmContext();
+			if (vm == nullptr) job.ret = 0xa4;
+			else {
+				vm->stdIn = in;
+				if (out) vm->stdOut = out;
+				job.ret = vm->Init(optCnt + 2, argv);
+				if (job.ret == 0) {
+					job.ret = vm->Main();
+					if (vm->statsOp) vm->PrintStats();
+				}
+				delete vm;
+			}
+			delete[] argv;
+		}
+		if (in) fclose(in);
+		if (out) fclose(out);
+	}
+	void Work(unsigned w) {
+		Size n;
+		while (Take(w, n)) Run(n);
+	}
+};
+int Batch(int argc, char** argv) {
+	BatchT b;
+	b.threads = std::thread::hardware_concurrency();
+	b.prog = argv[0];
+	b.jobs = new BatchT::JobT[argc];
+	b.opts = new char*[argc];
+	for (int k = 2; k < argc; k++) {
+		if (!strcmp(argv[k], "-j") || !strcmp(argv[k], "-o")) {
+			if (k + 1 == argc) {
+				#if !Release
+				fprintf(stderr, "\033[31m[E]\033[0m Missing value for \033[36m`%s`\033[0m.\n", argv[k]);
+				#endif
+				delete[] b.jobs; delete[] b.opts;
+				return 0xa6;
+			}
+			if (argv[k][1] == 'j') b.threads = unsigned(strtoul(argv[k + 1], nullptr, 10));
+			else b.dir = argv[k + 1];
+			k++;
+		}
+		else if (argv[k][0] == '-') b.opts[b.optCnt++] = argv[k];
+		else {
+			char* eq = strchr(argv[k], '=');
+			if (eq) *eq = '\0';
+			b.jobs[b.jobCnt++] = { argv[k], eq ? eq + 1 : nullptr, 0 };
+		}
+	}
+	if (b.jobCnt == 0) {
+		#if !Release
+		fprintf(stderr, "\033[31m[E]\033[0m Missing input file.\n");
+		#endif
+		delete[] b.jobs; delete[] b.opts;
+		return 0xa1;
+	}
+	if (b.threads == 0) b.threads = 1;
+	if (b.threads > b.jobCnt) b.threads = unsigned(b.jobCnt);
+	b.ranges = new BatchT::RangeT[b.threads];
+	for (unsigned w = 0; w != b.threads; w++) {
+		b.ranges[w].lo = b.jobCnt * w / b.threads;
+		b.ranges[w].hi = b.jobCnt * (w + 1) / b.threads;
+	}
+	auto t0 = std::chrono::steady_clock::now();
+	std::thread* pool = new std::thread[b.threads - 1];
+	for (unsigned w = 1; w < b.threads; w++) pool[w - 1] = std::thread(&BatchT::Work, &b, w);
+	b.Work(0);
+	for (unsigned w = 1; w < b.threads; w++) pool[w - 1].join();
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	int r = 0;
+	Size failed = 0;
+	for (Size k = 0; k != b.jobCnt; k++) {
+		if (b.jobs[k].ret == 0) continue;
+		if (r == 0) r = b.jobs[k].ret;
+		failed++;
+	}
+	fprintf(stderr, "\033[32m[I]\033[0m Batch: %llu jobs (%llu nonzero) on %u threads in %.3f s, %.1f jobs/s.\n",
+		(unsigned long long)b.jobCnt, (unsigned long long)failed, b.threads, s, s > 0 ? double(b.jobCnt) / s : 0.0);
+	delete[] pool; delete[] b.ranges; delete[] b.jobs; delete[] b.opts;
+	return r;
+}
+
+// Server mode: `app -serve [-j threads] [socket]` keeps images and warm instances between
+// runs and takes requests on a Unix socket, ServeSocket unless one is given. A request is
+// the command line app would get, image and options, with the client's stdin, stdout and
+// stderr passed along; the reply is the exit code app would have returned. Images are
+// cached by the hash of their bytes plus their options, so -fuel and -deadline, which
+// belong to the request, are kept out of the key. tools/fnh_client.cpp is the client.
+//
+// On the socket, in native byte order: a request is a B4 length and that many bytes of
+// NUL-terminated strings, the client's working directory and then the arguments, with
+// the three descriptors sent as SCM_RIGHTS along with the length; the reply is a B4 exit
+// code. Relative paths, the image's and those the guest opens, are taken from that
+// directory. A request without arguments asks for the counters
+// and latencies instead, answered as a B4 length and that much text.
+const char* const ServeSocket = "/tmp/fnh.sock";
+#ifdef _WIN32
+int Serve(int argc, char** argv) {
+	#if !Release
+	fprintf(stderr, "\033[31m[E]\033[0m Server mode needs Unix domain sockets.\n");
+	#endif
+	return 0xa6;
+}
+#else
+inline volatile std::sig_atomic_t serveStop = 0;
+static void ServeSignal(int) { serveStop = 1; }
+inline B8 Mix(B8 h, B8 v) { h = (h ^ v) * 0x9E3779B97F4A7C15ULL; return h ^ h >> 29; }
+inline B8 Mix(B8 h, const char* s) {
+	for (; *s; s++) h = Mix(h, B8(Byte(*s)));
+	return Mix(h, B8(0x100));
+}
+struct ServerT {
+	// An image loaded with one set of options and the instances it has ready. `image` is
+	// null while the request that missed loads it; `busy` counts the requests using it.
+	struct EntryT { B8 key = 0; VmImage* image = nullptr; VmContext** idle = nullptr; Size idleCnt = 0, busy = 0, used = 0; };
+	// The content hash of the file at `path` as of the stat() fields kept with it.
+	struct PathT { char* path = nullptr; B8 dev = 0, ino = 0, size = 0, mtime = 0, hash = 0; };
+	static constexpr Size PathCnt = 1024, Samples = 1 << 16, MaxRequest = 1 << 20, ConnCap = 256;
+	std::mutex m;
+	std::condition_variable loaded, queued, room;
+	// threads + 64 entries: a request that misses always finds one nobody is using.
+	EntryT* entries = nullptr;
+	Size entryCnt = 0, tick = 0;
+	PathT paths[PathCnt];
+	unsigned threads = 0;
+	// Accepted connections that no worker has taken yet.
+	int conns[ConnCap];
+	Size connHead = 0, connCnt = 0;
+	bool done = false;
+	B8 requests = 0, failed = 0, hits = 0, misses = 0, evicted = 0, warm = 0, cold = 0;
+	// Latencies of the last Samples runs in ns, from reading the request to the reply.
+	B8* samples = nullptr;
+	B8 sampleCnt = 0;
+
+	bool Init() {
+		entryCnt = threads + 64;
+		entries = new (std::nothrow) EntryT[entryCnt];
+		samples = new (std::nothrow) B8[Samples];
+		if (entries == nullptr || samples == nullptr) return false;
+		for (Size k = 0; k != entryCnt; k++) {
+			entries[k].idle = new (std::nothrow) VmContext*[threads];
+			if (entries[k].idle == nullptr) return false;
+		}
+		return true;
+	}
+	~ServerT() {
+		for (Size k = 0; entries && k != entryCnt; k++) {
+			for (Size i = 0; i != entries[k].idleCnt; i++) delete entries[k].idle[i];
+			delete[] entries[k].idle;
+			FnhFree(entries[k].image);
+		}
+		for (PathT& p : paths) delete[] p.path;
+		delete[] entries; delete[] samples;
+	}
+	static bool ReadAll(int fd, void* to, Size n) {
+		for (Byte* p = (Byte*)to; n;) {
+			ssize_t got = read(fd, p, size_t(n));
+			if (got < 0 && errno == EINTR) continue;
+			if (got <= 0) return false;
+			p += got; n -= Size(got);
+		}
+		return true;
+	}
+	static bool WriteAll(int fd, const void* from, Size n) {
+		for (const Byte* p = (const Byte*)from; n;) {
+			ssize_t put = send(fd, p, size_t(n), MSG_NOSIGNAL);
+			if (put < 0 && errno == EINTR) continue;
+			if (put <= 0) return false;
+			p += put; n -= Size(put);
+		}
+		return true;
+	}
+	// Reads the length of a request and the descriptors that came with it. Returns how
+	// many descriptors there were (at most 3 are kept), or -1 if the client went away.
+	static int Receive(int fd, B4& n, int* fds) {
+		alignas(cmsghdr) char ctl[CMSG_SPACE(4 * sizeof(int))];
+		iovec v{ &n, sizeof n };
+		msghdr h{};
+		h.msg_iov = &v; h.msg_iovlen = 1;
+		h.msg_control = ctl; h.msg_controllen = sizeof ctl;
+		#ifdef MSG_CMSG_CLOEXEC
+		const int flags = MSG_CMSG_CLOEXEC;
+		#else
+		const int flags = 0;
+		#endif
+		ssize_t got;
+		do got = recvmsg(fd, &h, flags); while (got < 0 && errno == EINTR);
+		if (got <= 0) return -1;
+		int cnt = 0;
+		for (cmsghdr* c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c)) {
+			if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+			Size k = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (Size i = 0; i != k; i++) {
+				int d;
+				::memcpy(&d, CMSG_DATA(c) + i * sizeof(int), sizeof d);
+				if (cnt < 3) fds[cnt++] = d;
+				else close(d);
+			}
+		}
+		if (Size(got) < sizeof n && !ReadAll(fd, (Byte*)&n + got, sizeof n - Size(got))) {
+			for (int k = 0; k != cnt; k++) close(fds[k]);
+			return -1;
+		}
+		return cnt;
+	}
+	// Hash of the bytes of the file at path, or 0 if it cannot be read.
+	static B8 HashFile(const char* path) {
+		FILE* pFile = fopen(path, "rb");
+		if (pFile == nullptr) return 0;
+		const size_t Piece = 1 << 16;
+		Byte* buf = new (std::nothrow) Byte[Piece];
+		B8 h = 0, len = 0;
+		size_t n;
+		// Only the last piece can be short, so the words line up the same every time.
+		while (buf && (n = fread(buf, 1, Piece, pFile)) > 0) {
+			size_t k = 0;
+			for (; k + 8 <= n; k += 8) { B8 v; ::memcpy(&v, buf + k, 8); h = Mix(h, v); }
+			for (; k != n; k++) h = Mix(h, B8(buf[k]));
+			len += n;
+		}
+		bool ok = buf && !ferror(pFile);
+		delete[] buf;
+		fclose(pFile);
+		h = Mix(h, len);
+		return ok ? (h ? h : 1) : 0;
+	}
+	// The content hash of the file at path, hashed again only when stat() tells it changed.
+	B8 ContentHash(const char* path, const struct stat& st) {
+		#ifdef __APPLE__
+		const timespec& t = st.st_mtimespec;
+		#else
+		const timespec& t = st.st_mtim;
+		#endif
+		B8 mtime = B8(t.tv_sec) * 1000000000 + B8(t.tv_nsec);
+		PathT& p = paths[Mix(0, path) % PathCnt];
+		{
+			std::lock_guard<std::mutex> l(m);
+			if (p.path && !strcmp(p.path, path) && p.dev == B8(st.st_dev) && p.ino == B8(st.st_ino)
+				&& p.size == B8(st.st_size) && p.mtime == mtime) return p.hash;
+		}
+		B8 h = HashFile(path);
+		if (h == 0) return 0;
+		size_t n = strlen(path);
+		char* copy = new (std::nothrow) char[n + 1];
+		if (copy == nullptr) return h;
+		::memcpy(copy, path, n + 1);
+		std::lock_guard<std::mutex> l(m);
+		delete[] p.path;
+		p = { copy, B8(st.st_dev), B8(st.st_ino), B8(st.st_size), mtime, h };
+		return h;
+	}
+	EntryT* Find(B8 key) {
+		for (Size k = 0; k != entryCnt; k++) if (entries[k].key == key) return entries + k;
+		return nullptr;
+	}
+	// A free entry, or else the least recently used one that no request is using, emptied.
+	EntryT* Victim() {
+		EntryT* v = nullptr;
+		for (Size k = 0; k != entryCnt; k++) {
+			EntryT& e = entries[k];
+			if (e.key == 0) return &e;
+			if (e.busy == 0 && (v == nullptr || e.used < v->used)) v = &e;
+		}
+		for (Size i = 0; i != v->idleCnt; i++) delete v->idle[i];
+		FnhFree(v->image);
+		v->key = 0; v->image = nullptr; v->idleCnt = 0;
+		evicted++;
+		return v;
+	}
+	// The entry of key, loaded from path with opts on a miss, and marked busy. Null with
+	// status set, and why on err, if the image does not load; a request for the same key
+	// waits for the load in progress instead of starting its own.
+	EntryT* Acquire(B8 key, const char* path, const char* const* opts, int optCnt, int& status, FILE* err) {
+		std::unique_lock<std::mutex> l(m);
+		for (;;) {
+			EntryT* e = Find(key);
+			if (e == nullptr) break;
+			if (e->image) { hits++; e->busy++; e->used = ++tick; return e; }
+			loaded.wait(l);
+		}
+		misses++;
+		EntryT* e = Victim();
+		e->key = key; e->busy = 1; e->used = ++tick;
+		l.unlock();
+		VmImage* img = LoadImage(path, opts, optCnt, &status, err);
+		l.lock();
+		if (img == nullptr) { e->key = 0; e->busy = 0; failed++; }
+		e->image = img;
+		loaded.notify_all();
+		return img ? e : nullptr;
+	}
+	VmContext* Instance(EntryT* e) {
+		{
+			std::lock_guard<std::mutex> l(m);
+			if (e->idleCnt) { warm++; return e->idle[--e->idleCnt]; }
+			cold++;
+		}
+		return FnhSpawn(e->image);
+	}
+	// Gives the instance back for the next request if it resets and there is room.
+	void GiveBack(EntryT* e, VmContext* vm, bool keep) {
+		keep = keep && vm && vm->Reset();
+		{
+			std::lock_guard<std::mutex> l(m);
+			e->busy--;
+			if (keep && e->idleCnt != threads) { e->idle[e->idleCnt++] = vm; return; }
+		}
+		delete vm;
+	}
+	// Runs the request in args[0, n), the client's directory and then its command line,
+	// with the client's descriptors, which it closes; the exit code app would have returned.
+	int Run(char* args, B4 n, int* fds) {
+		const char* cwd = args;
+		char* arg = args + strlen(args) + 1;
+		if (arg >= args + n) { for (int k = 0; k != 3; k++) close(fds[k]); return 0xa1; }
+		// Relative paths, the image's and the guest's, are the client's.
+		char* full = *cwd && arg[0] != '/' ? JoinPath(cwd, arg) : nullptr;
+		const char* path = full ? full : arg;
+		const char** opts = new const char*[n];
+		int optCnt = 0;
+		B8 fuel = 0, deadline = 0, key = 0;
+		for (char* a = arg + strlen(arg) + 1; a < args + n; a += strlen(a) + 1) {
+			if (!strncmp(a, "-fuel=", 6) && strtoull(a + 6, nullptr, 10)) fuel = strtoull(a + 6, nullptr, 10);
+			else if (!strncmp(a, "-deadline=", 10) && strtoull(a + 10, nullptr, 10)) deadline = strtoull(a + 10, nullptr, 10);
+			else { opts[optCnt++] = a; key = Mix(key, a); }
+		}
+		FILE* io[3] = { fdopen(fds[0], "rb"), fdopen(fds[1], "wb"), fdopen(fds[2], "wb") };
+		for (int k = 0; k != 3; k++) if (io[k] == nullptr) close(fds[k]);
+		FILE* err = io[2] ? io[2] : stderr;
+		struct stat st;
+		B8 hash = stat(path, &st) == 0 ? ContentHash(path, st) : 0;
+		int r = 0;
+		EntryT* e = nullptr;
+		// Nothing to hash: the load fails, and says why the way app would.
+		if (hash == 0) {
+			FnhFree(LoadImage(path, opts, optCnt, &r, err));
+			if (r == 0) r = 0xa2;
+		}
+		else e = Acquire(Mix(key, hash) | 1, path, opts, optCnt, r, err);
+		delete[] opts;
+		VmContext* vm = e ? Instance(e) : nullptr;
+		if (e && (vm == nullptr || !io[0] || !io[1] || !io[2])) r = 0xa4;
+		else if (e) {
+			vm->stdIn = io[0]; vm->stdOut = io[1]; vm->stdErr = io[2];
+			if (*cwd) vm->cwd = cwd;
+			// Side files (.snap, .trace, .ngram, .perf) go next to the path asked for.
+			vm->imagePath = path;
+			vm->fuelOp = fuel; vm->deadlineOp = deadline;
+			r = vm->Main();
+			if (vm->stopped) vm->SnapNow();
+			if (vm->statsOp) vm->PrintStats();
+			vm->stdIn = stdin; vm->stdOut = stdout; vm->stdErr = stderr;
+			vm->cwd = nullptr;
+			vm->imagePath = e->image->path;
+		}
+		for (FILE* f : io) if (f) fclose(f);
+		delete[] full;
+		if (e == nullptr) return r;
+		// What -profile, -trace and -perf collected would carry over into the next run.
+		bool keep = vm && vm->NGram == nullptr && vm->Trace == nullptr;
+		#if Profiler
+		keep = keep && vm->Perf == nullptr;
+		#endif
+		GiveBack(e, vm, keep);
+		return r;
+	}
+	void Status(int fd) {
+		B8 c[7], m50 = 0, m99 = 0, cnt;
+		Size cached = 0;
+		B8* v = nullptr;
+		{
+			std::lock_guard<std::mutex> l(m);
+			B8 all[7] = { requests, failed, hits, misses, evicted, warm, cold };
+			::memcpy(c, all, sizeof c);
+			for (Size k = 0; k != entryCnt; k++) cached += entries[k].image != nullptr;
+			cnt = sampleCnt < Samples ? sampleCnt : Samples;
+			v = cnt ? new (std::nothrow) B8[cnt] : nullptr;
+			if (v) ::memcpy(v, samples, size_t(cnt) * sizeof(B8));
+		}
+		if (v) {
+			std::nth_element(v, v + (cnt - 1) / 2, v + cnt); m50 = v[(cnt - 1) / 2];
+			std::nth_element(v, v + (cnt - 1) * 99 / 100, v + cnt); m99 = v[(cnt - 1) * 99 / 100];
+			delete[] v;
+		}
+		char text[512];
+		int len = snprintf(text, sizeof text,
+			"requests: %llu (%llu images failed to load)\nimages: %llu cached, %llu hits, %llu misses, %llu evicted\n"
+			"instances: %llu warm, %llu cold\nlatency over the last %llu runs: p50 %.1f us, p99 %.1f us\n",
+			(unsigned long long)c[0], (unsigned long long)c[1], (unsigned long long)cached, (unsigned long long)c[2],
+			(unsigned long long)c[3], (unsigned long long)c[4], (unsigned long long)c[5], (unsigned long long)c[6],
+			(unsigned long long)(v ? cnt : 0), double(m50) / 1e3, double(m99) / 1e3);
+		B4 n = B4(len);
+		if (WriteAll(fd, &n, sizeof n)) WriteAll(fd, text, n);
+	}
+	void Handle(int fd) {
+		auto t0 = std::chrono::steady_clock::now();
+		B4 n = 0;
+		int fds[3];
+		int fdCnt = Receive(fd, n, fds);
+		char* args = fdCnt < 0 || n == 0 || n > MaxRequest ? nullptr : new (std::nothrow) char[n + 1];
+		if (args && ReadAll(fd, args, n)) {
+			args[n] = '\0';
+			B4 r = fdCnt == 3 ? B4(Run(args, n, fds)) : 0xa2;
+			if (fdCnt == 3) fdCnt = 0;
+			WriteAll(fd, &r, sizeof r);
+			B8 ns = B8(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+			std::lock_guard<std::mutex> l(m);
+			requests++;
+			samples[sampleCnt++ % Samples] = ns;
+		}
+		else if (fdCnt >= 0 && n == 0) Status(fd);
+		delete[] args;
+		for (int k = 0; k < fdCnt; k++) close(fds[k]);
+		close(fd);
+	}
+	void Push(int fd) {
+		{
+			std::unique_lock<std::mutex> l(m);
+			room.wait(l, [&] { return connCnt != ConnCap; });
+			conns[(connHead + connCnt++) % ConnCap] = fd;
+		}
+		queued.notify_one();
+	}
+	void Work() {
+		for (;;) {
+			int fd;
+			{
+				std::unique_lock<std::mutex> l(m);
+				queued.wait(l, [&] { return connCnt || done; });
+				if (connCnt == 0) return;
+				fd = conns[connHead]; connHead = (connHead + 1) % ConnCap; connCnt--;
+			}
+			room.notify_one();
+			Handle(fd);
+		}
+	}
+};
+int Serve(int argc, char** argv) {
+	ServerT s;
+	s.threads = std::thread::hardware_concurrency();
+	const char* path = ServeSocket;
+	for (int k = 2; k < argc; k++) {
+		if (!strcmp(argv[k], "-j")) {
+			if (k + 1 == argc) {
+				#if !Release
+				fprintf(stderr, "\033[31m[E]\033[0m Missing value for \033[36m`%s`\033[0m.\n", argv[k]);
+				#endif
+				return 0xa6;
+			}
+			s.threads = unsigned(strtoul(argv[++k], nullptr, 10));
+		}
+		else if (argv[k][0] == '-') {
+			#if !Release
+			fprintf(stderr, "\033[31m[E]\033[0m Unknown option: \033[36m`%s`\033[0m.\n", argv[k]);
+			#endif
+			return 0xa6;
+		}
+		else path = argv[k];
+	}
+	if (s.threads == 0) s.threads = 1;
+	if (!s.Init()) return 0xa4;
+	sockaddr_un a{};
+	a.sun_family = AF_UNIX;
+	int ls = strlen(path) < sizeof a.sun_path ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+	bool ok = ls >= 0;
+	if (ok) {
+		::memcpy(a.sun_path, path, strlen(path) + 1);
+		// A socket left behind by a server that is gone is replaced; a live one is not.
+		struct stat st;
+		if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+			int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (probe >= 0 && connect(probe, (sockaddr*)&a, sizeof a) != 0) unlink(path);
+			if (probe >= 0) close(probe);
+		}
+		ok = bind(ls, (sockaddr*)&a, sizeof a) == 0 && listen(ls, 128) == 0;
+	}
+	if (!ok) {
+		#if !Release
+		fprintf(stderr, "\033[31m[E]\033[0m Socket not opened: \033[36m`%s`\033[0m. ", path); perror("With");
+		#endif
+		if (ls >= 0) close(ls);
+		return 0xa2;
+	}
+	fcntl(ls, F_SETFD, FD_CLOEXEC);
+	// A client that goes away leaves pipes and sockets without a reader.
+	signal(SIGPIPE, SIG_IGN);
+	struct sigaction sa{};
+	sa.sa_handler = ServeSignal;
+	sigaction(SIGINT, &sa, nullptr); sigaction(SIGTERM, &sa, nullptr);
+	// The workers leave SIGINT and SIGTERM to this thread, so they interrupt accept().
+	sigset_t stop, old;
+	sigemptyset(&stop); sigaddset(&stop, SIGINT); sigaddset(&stop, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop, &old);
+	std::thread* pool = new std::thread[s.threads];
+	for (unsigned w = 0; w != s.threads; w++) pool[w] = std::thread(&ServerT::Work, &s);
+	pthread_sigmask(SIG_SETMASK, &old, nullptr);
+	fprintf(stderr, "\033[32m[I]\033[0m Serving on \033[36m`%s`\033[0m with %u threads.\n", path, s.threads);
+	while (!serveStop) {
+		int c = accept(ls, nullptr, nullptr);
+		if (c < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			break;
+		}
+		fcntl(c, F_SETFD, FD_CLOEXEC);
+		s.Push(c);
+	}
+	close(ls);
+	unlink(path);
+	{
+		std::lock_guard<std::mutex> l(s.m);
+		s.done = true;
+	}
+	s.queued.notify_all();
+	for (unsigned w = 0; w != s.threads; w++) pool[w].join();
+	delete[] pool;
+	fprintf(stderr, "\033[32m[I]\033[0m Server: %llu requests, %llu image hits, %llu misses.\n",
+		(unsigned long long)s.requests, (unsigned long long)s.hits, (unsigned long long)s.misses);
+	return 0;
+}
+#endif
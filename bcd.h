@@ -0,0 +1,53 @@
+﻿#pragma once
+#include <cstdint>
+
+// Packed BCD: 16 decimal digits in a uint64_t, the lowest digit in the lowest nibble.
+// The only divisions are by constants, which compilers turn into multiplies.
+using bcd64_t = uint64_t;
+
+// The four BCD digits of each k < 10000, built at compile time (20 KB).
+struct Bcd4Table {
+	uint16_t v[10000];
+	constexpr Bcd4Table() : v() {
+		for (int k = 0; k != 10000; k++) v[k] = uint16_t(k / 1000 << 12 | k / 100 % 10 << 8 | k / 10 % 10 << 4 | k % 10);
+	}
+};
+inline constexpr Bcd4Table Bcd4{};
+
+// Eight digits of v < 10^8 in the low 32 bits.
+inline uint64_t bcd8(uint64_t v) {
+	return uint64_t(Bcd4.v[v / 10000]) << 16 | Bcd4.v[v % 10000];
+}
+// The lowest 16 digits of num.
+inline bcd64_t uint64_to_bcd64(uint64_t num) {
+	num %= 10000000000000000ULL;
+	return bcd8(num / 100000000) << 32 | bcd8(num % 100000000);
+}
+// Sum of nibble k times 10^k, also for nibbles above 9: neighbouring lanes are merged
+// as lo + hi * 10^width, and no lane can outgrow its width (15 * 11...1 < 2^64).
+inline uint64_t bcd64_to_uint64(bcd64_t bcd) {
+	uint64_t x = (bcd & 0x0f0f0f0f0f0f0f0fULL) + (bcd >> 4 & 0x0f0f0f0f0f0f0f0fULL) * 10;
+	x = (x & 0x00ff00ff00ff00ffULL) + (x >> 8 & 0x00ff00ff00ff00ffULL) * 100;
+	x = (x & 0x0000ffff0000ffffULL) + (x >> 16 & 0x0000ffff0000ffffULL) * 10000;
+	return (x & 0xffffffffULL) + (x >> 32) * 100000000;
+}
+// a + b + carry for valid digits; carry (0 or 1) becomes the carry out of the 16th digit.
+// Every digit of a is biased by 6 so that a decimal carry is a binary one; the digits
+// that did not carry have the 6 taken back.
+inline bcd64_t bcd64_add(bcd64_t a, bcd64_t b, uint64_t& carry) {
+	uint64_t t1 = a + 0x6666666666666666ULL, t2 = t1 + b + (carry & 1);
+	uint64_t into = t2 ^ t1 ^ b;
+	uint64_t out = ((t1 & b) | ((t1 | b) & ~t2)) >> 63;
+	// Carries into nibbles 1..15, and out of nibble 15 in bit 64.
+	uint64_t kept = ~into & 0x1111111111111110ULL;
+	uint64_t fix = (kept >> 2 | kept >> 3) | (out ? 0 : 0x6000000000000000ULL);
+	carry = out;
+	return t2 - fix;
+}
+// a - b - borrow as a + (10^16 - 1 - b) + (1 - borrow); borrow becomes the borrow out.
+inline bcd64_t bcd64_sub(bcd64_t a, bcd64_t b, uint64_t& borrow) {
+	uint64_t carry = 1 - (borrow & 1);
+	bcd64_t r = bcd64_add(a, 0x9999999999999999ULL - b, carry);
+	borrow = 1 - carry;
+	return r;
+}
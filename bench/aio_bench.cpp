@@ -0,0 +1,96 @@
+﻿// Reading a file through FIN against double-buffered AIN/AWAIT, with the same amount of
+// guest work per chunk. The synchronous guest reads a chunk and then works on it; the
+// asynchronous one starts the read of the next chunk before it works on the current one.
+//   g++ -std=c++23 -O2 -DFNH_LIBRARY bench/aio_bench.cpp app.cpp -o aio_bench
+//   cl /std:c++latest /O2 /EHsc /DFNH_LIBRARY bench\aio_bench.cpp app.cpp
+//   aio_bench [megabytes] [work] [chunk] [input] [options...]
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include "bench_asm.h"
+
+// r60 handle, r62 buffer, r63 chunk, r64 ticket, r65 bytes, r69 work counter, r6b sum.
+void Work(Asm& a, uint64_t work) {
+	a.Set(0x69, work);
+	a.Mark("work");
+	if (work) a.I({ 0x10, 0x6b, 0x6b, 0x6a, 0x06, 0x69, 0x68 });
+	a.I({ 0x02, 0x00, 0x67 });
+}
+void Head(Asm& a, uint64_t chunk) {
+	a.Set(0x60, 1); a.Set(0x62, "end"); a.Set(0x63, chunk); a.Set(0x64, 1);
+	a.Set(0x66, "done"); a.Set(0x67, "lp"); a.Set(0x68, "work"); a.Set(0x6a, 1);
+}
+bool Sync(const char* path, uint64_t chunk, uint64_t work) {
+	Asm a;
+	Head(a, chunk);
+	a.Mark("lp");
+	a.I({ 0x81, 0x60, 0x62, 0x63, 0x64, 0x63, 0x65 });
+	a.I({ 0x04, 0x65, 0x66 });
+	Work(a, work);
+	a.Mark("done"); a.I({ 0x01 });
+	return a.Save(path, 2, { chunk, 256 });
+}
+bool Async(const char* path, uint64_t chunk, uint64_t work) {
+	Asm a;
+	Head(a, chunk);
+	a.Set(0x70, "buf2");
+	a.I({ 0x84, 0x60, 0x62, 0x63, 0x64 });
+	a.Mark("lp");
+	// Stops at the end of the input or on Failed.
+	a.I({ 0x86, 0x64, 0x65, 0x10, 0x71, 0x65, 0x6a, 0x04, 0x65, 0x66, 0x04, 0x71, 0x66 });
+	a.I({ 0x1c, 0x62, 0x62, 0x70, 0x84, 0x60, 0x62, 0x63, 0x64 });
+	Work(a, work);
+	a.Mark("done"); a.I({ 0x01 });
+	// r70 flips r62 between the two buffers in Data.
+	a.labels["buf2"] = a.Here() ^ (a.Here() + chunk);
+	return a.Save(path, 2, { chunk * 2, 256 });
+}
+
+// Best MB/s of `runs` runs of `image` reading `input`; 0 if a run failed.
+double Rate(const char* image, const char* input, const std::vector<const char*>& opts, int runs, double mb, FILE* out) {
+	double s = Measure(image, opts, runs, input, out);
+	return s ? mb / s : 0;
+}
+
+int main(int argc, char** argv) {
+	uint64_t megabytes = argc > 1 ? strtoull(argv[1], nullptr, 0) : 256;
+	uint64_t work = argc > 2 ? strtoull(argv[2], nullptr, 0) : 4096;
+	uint64_t chunk = argc > 3 ? strtoull(argv[3], nullptr, 0) : uint64_t(1) << 16;
+	const char* input = argc > 4 ? argv[4] : "aio_bench.in";
+	std::vector<const char*> opts;
+	for (int k = 5; k < argc; k++) opts.push_back(argv[k]);
+	const int runs = 5;
+	if (argc <= 4) {
+		FILE* pFile = fopen(input, "wb");
+		std::vector<Byte> b(1 << 20);
+		for (size_t k = 0; k != b.size(); k++) b[k] = Byte(k * 131 >> 3);
+		for (uint64_t k = 0; pFile && k != megabytes; k++) fwrite(b.data(), 1, b.size(), pFile);
+		if (pFile == nullptr || fclose(pFile) != 0) { fprintf(stderr, "cannot write %s\n", input); return 1; }
+	}
+	FILE* in = fopen(input, "rb");
+	if (in == nullptr) { perror(input); return 1; }
+	fseek(in, 0, SEEK_END);
+	double mb = double(ftell(in)) / (1 << 20);
+	fclose(in);
+	if (!Sync("aio_bench_sync.fnh", chunk, work) || !Async("aio_bench_async.fnh", chunk, work)) {
+		fprintf(stderr, "cannot write the images\n"); return 1;
+	}
+#ifdef _WIN32
+	FILE* out = fopen("NUL", "wb");
+#else
+	FILE* out = fopen("/dev/null", "wb");
+#endif
+	std::vector<const char*> pool = opts;
+	pool.push_back("-aio=pool");
+	double sync = Rate("aio_bench_sync.fnh", input, opts, runs, mb, out);
+	double async = Rate("aio_bench_async.fnh", input, opts, runs, mb, out);
+	double threads = Rate("aio_bench_async.fnh", input, pool, runs, mb, out);
+	printf("%.0f MB in %llu-byte chunks, %llu work iterations per chunk, best of %d, MB/s\n",
+		mb, (unsigned long long)chunk, (unsigned long long)work, runs);
+	printf("  FIN          %10.1f\n  AIN          %10.1f\n  AIN -aio=pool%10.1f\n", sync, async, threads);
+	if (out) fclose(out);
+	remove("aio_bench_sync.fnh"); remove("aio_bench_async.fnh");
+	if (argc <= 4) remove(input);
+	return sync && async && threads ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+﻿// Nanoseconds per BcdF/BcdT conversion: the digit loops they used to run against the
+// table and SWAR versions in bcd.h, on full 16-digit values and on short ones, plus BcdAdd.
+//   g++ -std=c++23 -O2 bench/bcd_bench.cpp -o bcd_bench
+//   cl /std:c++latest /O2 /EHsc bench\bcd_bench.cpp
+//   bcd_bench [count]
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "../bcd.h"
+
+const int Rounds = 10;
+
+// The loops BcdF and BcdT ran before bcd.h.
+uint64_t LoopToBcd(uint64_t num) {
+	bcd64_t result = 0;
+	int shift = 0;
+	while (num > 0 && shift < 64) {
+		result |= bcd64_t(num % 10) << shift;
+		num /= 10;
+		shift += 4;
+	}
+	return result;
+}
+uint64_t LoopFromBcd(bcd64_t bcd) {
+	uint64_t result = 0, multiplier = 1;
+	for (int i = 0; i < 16; ++i) {
+		result += (bcd >> (i * 4) & 0xF) * multiplier;
+		multiplier *= 10;
+	}
+	return result;
+}
+
+volatile uint64_t sink;
+// Best ns per element of f over v.
+template<typename F> double Measure(const std::vector<uint64_t>& v, F f) {
+	double best = 0;
+	for (int k = 0; k != Rounds; k++) {
+		uint64_t s = 0;
+		auto t = std::chrono::steady_clock::now();
+		for (uint64_t x : v) s += f(x);
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t).count() / double(v.size());
+		sink = s;
+		if (k == 0 || ns < best) best = ns;
+	}
+	return best;
+}
+
+int main(int argc, char** argv) {
+	size_t count = argc > 1 ? strtoull(argv[1], nullptr, 0) : 1 << 20;
+	std::mt19937_64 g(1);
+	std::vector<uint64_t> full(count), small(count), bcdFull(count), bcdSmall(count);
+	for (size_t k = 0; k != count; k++) {
+		full[k] = g() % 10000000000000000ULL;
+		small[k] = g() % 100000;
+		bcdFull[k] = uint64_to_bcd64(full[k]);
+		bcdSmall[k] = uint64_to_bcd64(small[k]);
+		if (LoopToBcd(full[k]) != bcdFull[k] || LoopFromBcd(bcdFull[k]) != bcd64_to_uint64(bcdFull[k])) {
+			fprintf(stderr, "mismatch at %llu\n", (unsigned long long)full[k]); return 1;
+		}
+	}
+	printf("%zu values, best of %d, ns per value\n", count, Rounds);
+	printf("               loop     bcd.h\n");
+	printf("  BcdF 16   %8.2f %8.2f\n", Measure(full, LoopToBcd), Measure(full, uint64_to_bcd64));
+	printf("  BcdF 5    %8.2f %8.2f\n", Measure(small, LoopToBcd), Measure(small, uint64_to_bcd64));
+	printf("  BcdT 16   %8.2f %8.2f\n", Measure(bcdFull, LoopFromBcd), Measure(bcdFull, bcd64_to_uint64));
+	printf("  BcdT 5    %8.2f %8.2f\n", Measure(bcdSmall, LoopFromBcd), Measure(bcdSmall, bcd64_to_uint64));
+	uint64_t carry = 0;
+	printf("  BcdAdd             %8.2f\n", Measure(bcdFull, [&](uint64_t x) { return bcd64_add(x, 0x0000000123456789ULL, carry); }));
+	return 0;
+}
@@ -0,0 +1,80 @@
+﻿#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <vector>
+#include "../fnh.h"
+
+// What the benches share: an assembler for the guests they generate, the image writer,
+// and the timing loop over the embedding API.
+using Byte = uint8_t;
+
+// The n low bytes of v, most significant first, as image headers and immediates hold them.
+inline void Put(std::vector<Byte>& b, uint64_t v, int n) {
+	for (int k = n - 1; k >= 0; k--) b.push_back(Byte(v >> (8 * k)));
+}
+inline bool Write(const char* path, const std::vector<Byte>& image) {
+	FILE* pFile = fopen(path, "wb");
+	if (pFile == nullptr) return false;
+	bool ok = fwrite(image.data(), 1, image.size(), pFile) == image.size();
+	return fclose(pFile) == 0 && ok;
+}
+// An image header up to the fields `sizes` gives after the size of Code: Data and Stack,
+// then Heap from version 3 and the section fields of version 4.
+inline std::vector<Byte> Header(int version, uint64_t code, std::initializer_list<uint64_t> sizes) {
+	std::vector<Byte> h = { 0x00, 0x01, 0xBF, 0x52, Byte(version), 0, 0, 0 };
+	Put(h, code, 8);
+	for (uint64_t v : sizes) Put(h, v, 8);
+	return h;
+}
+
+// Guest code placed after the 16-byte Pre region. Labels name addresses in it; Set()
+// with a label is patched when the image is made, and "end", the start of Data, is
+// always there.
+struct Asm {
+	static constexpr uint64_t PreSize = 16;
+	std::vector<Byte> c;
+	std::map<std::string, uint64_t> labels;
+	std::vector<std::pair<size_t, std::string>> fix;
+	uint64_t Here() const { return PreSize + c.size(); }
+	void I(std::initializer_list<Byte> b) { c.insert(c.end(), b); }
+	// Set8 r, v; returns where the immediate is.
+	size_t Set(Byte r, uint64_t v) { c.push_back(0x2b); c.push_back(r); size_t at = c.size(); Put(c, v, 8); return at; }
+	void Set(Byte r, const std::string& label) { fix.push_back({ Set(r, uint64_t(0)), label }); }
+	void Mark(const std::string& label) { labels[label] = Here(); }
+	std::vector<Byte> Image(int version, std::initializer_list<uint64_t> sizes) {
+		labels["end"] = Here();
+		for (auto& [at, name] : fix)
+			for (int k = 0; k != 8; k++) c[at + k] = Byte(labels[name] >> (8 * (7 - k)));
+		std::vector<Byte> h = Header(version, c.size(), sizes);
+		h.insert(h.end(), c.begin(), c.end());
+		return h;
+	}
+	bool Save(const char* path, int version, std::initializer_list<uint64_t> sizes) { return Write(path, Image(version, sizes)); }
+};
+
+// Best seconds of `runs` runs of `image`, each in an instance of its own that reads
+// `input` (stdin if null) and writes `out`; 0 if one failed.
+inline double Measure(const char* image, const std::vector<const char*>& opts, int runs, const char* input = nullptr, FILE* out = stdout) {
+	int status = 0;
+	VmImage* img = FnhLoad(image, opts.data(), int(opts.size()), &status);
+	if (img == nullptr) { fprintf(stderr, "%s: load failed: 0x%x\n", image, status); return 0; }
+	double best = 0;
+	for (int k = 0; k != runs; k++) {
+		VmContext* vm = FnhSpawn(img);
+		FILE* in = input ? fopen(input, "rb") : stdin;
+		if (vm == nullptr || in == nullptr) { fprintf(stderr, "cannot start a run\n"); FnhDrop(vm); best = 0; break; }
+		auto t = std::chrono::steady_clock::now();
+		int r = FnhRun(vm, in, out);
+		double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t).count();
+		if (input) fclose(in);
+		FnhDrop(vm);
+		if (r) { fprintf(stderr, "%s: exit 0x%x\n", image, r); best = 0; break; }
+		if (best == 0 || s < best) best = s;
+	}
+	FnhFree(img);
+	return best;
+}
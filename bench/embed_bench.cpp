@@ -0,0 +1,56 @@
+﻿// Cost per run of one image: loading it cold every time, as app does, against spawning
+// instances from an image loaded once, and against resetting a single instance.
+//   g++ -std=c++23 -O2 -DFNH_LIBRARY bench/embed_bench.cpp app.cpp -o embed_bench
+//   cl /std:c++latest /O2 /EHsc /DFNH_LIBRARY bench\embed_bench.cpp app.cpp
+//   embed_bench image.fnh [runs] [options...]
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "../fnh.h"
+
+#ifdef _WIN32
+const char* const Null = "NUL";
+#else
+const char* const Null = "/dev/null";
+#endif
+
+template<typename F> double Measure(int runs, F f) {
+	auto t = std::chrono::steady_clock::now();
+	for (int k = 0; k != runs; k++) f();
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count() / runs;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) { fprintf(stderr, "usage: embed_bench image.fnh [runs] [options...]\n"); return 1; }
+	int runs = argc > 2 ? atoi(argv[2]) : 1000;
+	const char* const* opts = argv + 3;
+	int optCnt = argc > 3 ? argc - 3 : 0;
+	FILE* in = fopen(Null, "rb");
+	FILE* out = fopen(Null, "wb");
+	int status = 0;
+	VmImage* image = FnhLoad(argv[1], opts, optCnt, &status);
+	if (image == nullptr) { fprintf(stderr, "load failed: 0x%x\n", status); return status; }
+	int ret = 0;
+	double cold = Measure(runs, [&] {
+		VmImage* i = FnhLoad(argv[1], opts, optCnt);
+		VmContext* vm = FnhSpawn(i);
+		ret = FnhRun(vm, in, out);
+		FnhDrop(vm); FnhFree(i);
+	});
+	double spawn = Measure(runs, [&] {
+		VmContext* vm = FnhSpawn(image);
+		ret = FnhRun(vm, in, out);
+		FnhDrop(vm);
+	});
+	VmContext* vm = FnhSpawn(image);
+	double reset = Measure(runs, [&] {
+		ret = FnhRun(vm, in, out);
+		FnhReset(vm);
+	});
+	FnhDrop(vm);
+	printf("%s, %d runs, exit %d, microseconds per run\n", argv[1], runs, ret);
+	printf("  cold  %10.2f\n  spawn %10.2f\n  reset %10.2f\n", cold, spawn, reset);
+	FnhFree(image);
+	fclose(in); fclose(out);
+	return 0;
+}
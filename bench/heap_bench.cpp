@@ -0,0 +1,103 @@
+﻿// ALLOC/FREE against the allocator a guest writes for itself: a free list of fixed
+// 32-byte blocks in guest code, reached with Call, which has to read a block's link
+// through MOVS and Get8. Both run the same loops:
+//   pair   ALLOC, store, FREE, over and over
+//   batch  `batch` ALLOCs onto the stack, then as many FREEs
+// plus, native only, a block grown from 8 to 10000 bytes by REALLOC and freed. Prints
+// ns per ALLOC/FREE pair (per grown block for realloc).
+//   g++ -std=c++23 -O2 -DFNH_LIBRARY bench/heap_bench.cpp app.cpp -o heap_bench
+//   cl /std:c++latest /O2 /EHsc /DFNH_LIBRARY bench\heap_bench.cpp app.cpp
+//   heap_bench [pairs] [batch] [options...]
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <vector>
+#include "bench_asm.h"
+
+enum : Byte {
+	NOP = 0x00, IfNG = 0x04, Loop = 0x06, Call = 0x08, Ret = 0x09, Add = 0x10, Mov8 = 0x23,
+	Get8 = 0x33, Wrt8 = 0x3b, Psh8 = 0x43, Pop8 = 0x4b, MOVS = 0x70, Exit = 0x01,
+	ALLOC = 0xc0, FREE = 0xc1, REALLOC = 0xc2,
+};
+// Loop counters, the block, the guest allocator's free list and bump pointer, constants.
+enum : Byte { N = 0x60, K = 0x61, P = 0x62, X = 0x63, Head = 0x70, Bump = 0x71, Block = 0x72, Eight = 0x73, At = 0x74, Size = 0x75 };
+
+// The byte after a Call names its target register and runs as the first instruction
+// after the return; register 0 is also a NOP, so calls go through Vp[0].
+void CallTo(Asm& a, Byte target) { a.I({ Mov8, 0x00, target, Call, 0x00, NOP }); }
+// The guest allocator: galloc leaves a block in P, gfree takes it back from P. Blocks are
+// carved from Data after the code; the link of a free block is copied to address 8 of
+// the Pre region to be read with Get8.
+void Allocator(Asm& a) {
+	a.Mark("galloc");
+	a.Set(X, "carve");
+	a.I({ IfNG, Head, X });
+	a.I({ Mov8, P, Head, MOVS, Head, At, Eight, Get8, Head, 8, Ret });
+	a.Mark("carve");
+	a.I({ Mov8, P, Bump, Add, Bump, Bump, Block, Ret });
+	a.Mark("gfree");
+	a.I({ Wrt8, P, Head, Mov8, Head, P, Ret });
+}
+void Prologue(Asm& a, uint64_t pairs, uint64_t batch) {
+	a.Set(N, pairs / batch); a.Set(Head, uint64_t(0)); a.Set(Bump, "end"); a.Set(Block, 32);
+	a.Set(Eight, 8); a.Set(At, 8); a.Set(Size, 24); a.Set(0x76, "galloc"); a.Set(0x77, "gfree");
+}
+enum KindTag { Native, Guest, Grow };
+// `batch` 1 is the pair loop.
+bool Image(const char* path, KindTag kind, uint64_t pairs, uint64_t batch) {
+	Asm a;
+	Prologue(a, pairs, batch);
+	a.Set(0x78, "outer"); a.Set(0x79, "in"); a.Set(0x7a, "out");
+	a.Mark("outer");
+	a.Set(K, batch);
+	a.Mark("in");
+	if (kind == Native) a.I({ ALLOC, P, Size });
+	else if (kind == Guest) CallTo(a, 0x76);
+	else {
+		a.Set(X, 8); a.I({ ALLOC, P, X });
+		for (uint64_t n : { 100, 1000, 10000 }) { a.Set(X, n); a.I({ REALLOC, P, P, X }); }
+	}
+	a.I({ Wrt8, P, N });
+	if (batch != 1) a.I({ Psh8, P });
+	else if (kind == Guest) CallTo(a, 0x77);
+	else a.I({ FREE, P });
+	a.I({ Loop, K, 0x79 });
+	if (batch != 1) {
+		a.Set(K, batch);
+		a.Mark("out");
+		a.I({ Pop8, P });
+		if (kind == Guest) CallTo(a, 0x77);
+		else a.I({ FREE, P });
+		a.I({ Loop, K, 0x7a });
+	}
+	a.I({ Loop, N, 0x78, Exit });
+	Allocator(a);
+	// Version 3, for the Heap region.
+	return a.Save(path, 3, { 32 * batch + 64, 8 * batch + 4096, 32 * batch + (1 << 20) });
+}
+
+int main(int argc, char** argv) {
+	uint64_t pairs = argc > 1 ? strtoull(argv[1], nullptr, 0) : 1 << 22;
+	uint64_t batch = argc > 2 ? strtoull(argv[2], nullptr, 0) : 1 << 10;
+	std::vector<const char*> opts;
+	for (int k = 3; k < argc; k++) opts.push_back(argv[k]);
+	const int runs = 3;
+	if (batch < 2 || pairs < batch) { fprintf(stderr, "batch is at least 2 and at most pairs\n"); return 1; }
+	struct Row { const char* name; KindTag kind; uint64_t batch; } rows[] = {
+		{ "pair", Native, 1 }, { "pair", Guest, 1 }, { "batch", Native, batch }, { "batch", Guest, batch }, { "realloc", Grow, 1 },
+	};
+	double s[5];
+	for (int k = 0; k != 5; k++) {
+		if (!Image("heap_bench.fnh", rows[k].kind, pairs, rows[k].batch)) { fprintf(stderr, "cannot write the image\n"); return 1; }
+		s[k] = Measure("heap_bench.fnh", opts, runs);
+	}
+	remove("heap_bench.fnh");
+	double n = double(pairs / batch * batch), n1 = double(pairs);
+	printf("%llu pairs, batches of %llu, best of %d, ns per pair\n", (unsigned long long)pairs, (unsigned long long)batch, runs);
+	printf("              ALLOC    guest\n");
+	printf("  pair     %8.1f %8.1f\n", s[0] * 1e9 / n1, s[1] * 1e9 / n1);
+	printf("  batch    %8.1f %8.1f\n", s[2] * 1e9 / n, s[3] * 1e9 / n);
+	printf("  realloc  %8.1f\n", s[4] * 1e9 / n1);
+	for (double x : s) if (x == 0) return 1;
+	return 0;
+}
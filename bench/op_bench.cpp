@@ -0,0 +1,267 @@
+﻿// Nanoseconds per guest instruction for each opcode family and a few mixed kernels. Every
+// kernel is generated as a version 2 .fnh image whose loop body is repeated until it has
+// run about `instructions` instructions; the exact count is known from the code, so the
+// result does not depend on the engine's own counters. -b compares against a baseline
+// written earlier with -s and flags every kernel that got slower than the threshold.
+//   g++ -std=c++23 -O2 -DFNH_LIBRARY bench/op_bench.cpp app.cpp -o op_bench
+//   cl /std:c++latest /O2 /EHsc /DFNH_LIBRARY bench\op_bench.cpp app.cpp
+//   op_bench [-n instructions] [-r rounds] [-b baseline.json] [-s save.json] [-t percent] [-k]
+//            [kernel...] [options...]
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <concepts>
+#include <string>
+#include <vector>
+#include "bench_asm.h"
+
+#ifdef _WIN32
+const char* const Null = "NUL";
+#else
+const char* const Null = "/dev/null";
+#endif
+
+using B8 = uint64_t;
+
+enum Op : Byte {
+	NOP = 0x00, Exit = 0x01, Goto = 0x02, IfGo = 0x03, IfNG = 0x04, SvIp = 0x05, Loop = 0x06, Call = 0x08, Ret = 0x09,
+	Add = 0x10, Sub = 0x11, Mul = 0x12, Div = 0x13, Inc = 0x14, Dec = 0x15, Than = 0x16, Less = 0x17, More = 0x18,
+	Not = 0x19, And = 0x1a, Or = 0x1b, Xor = 0x1c, ToBool = 0x1d,
+	Mov1 = 0x20, Mov2 = 0x21, Mov4 = 0x22, Mov8 = 0x23, Set1 = 0x28, Set2 = 0x29, Set4 = 0x2a, Set8 = 0x2b,
+	Get1 = 0x30, Get2 = 0x31, Get4 = 0x32, Get8 = 0x33, LEA = 0x37, Wrt1 = 0x38, Wrt2 = 0x39, Wrt4 = 0x3a, Wrt8 = 0x3b,
+	Psh1 = 0x40, Psh2 = 0x41, Psh4 = 0x42, Psh8 = 0x43, PshM = 0x44, Pop1 = 0x48, Pop2 = 0x49, Pop4 = 0x4a, Pop8 = 0x4b, PopM = 0x4c,
+	Swap = 0x57, BcdT = 0x60, BcdF = 0x61, SignT = 0x62, SignF = 0x63, LMov = 0x64, RMov = 0x65, ROL = 0x66,
+	Complement = 0x68, IMul = 0x69, IDiv = 0x6a, IThan = 0x6b, ILess = 0x6c, IMore = 0x6d,
+	MOVS = 0x70, CMPS = 0x71, SCAS8 = 0x7b, FOUT = 0x82, VADD = 0xa0, VSUM = 0xa8
+};
+// Registers: the loop counter and target, then scratch. Vp[0] holds call targets, because
+// the byte after a Call names its target register and is executed as the first
+// instruction after the return, and only register 0 is also a NOP.
+enum : Byte { Cnt = 0x60, Top = 0x61, R0 = 0x62 };
+const B8 PreSize = Asm::PreSize;
+
+// Counts the instructions it emits, so a kernel's total is known from the code. Labels
+// are numbered; label 0 is the start of Data.
+struct Counted : Asm {
+	B8 n = 0;
+	void I(Op op, std::initializer_list<Byte> rest = {}) { c.push_back(op); c.insert(c.end(), rest); n++; }
+	void Set(Byte r, B8 v) { Asm::Set(r, v); n++; }
+	// Sets r to the address of `label`.
+	void Ref(Byte r, int label) { Asm::Set(r, Name(label)); n++; }
+	void Mark(int label) { Asm::Mark(Name(label)); }
+	// Call through Vp[0]; the landing NOP runs as its own instruction.
+	void CallR0() { I(Call, { 0x00, 0x00 }); n++; }
+	static std::string Name(int label) { return label ? std::to_string(label) : "end"; }
+};
+
+struct Kernel {
+	const char* name;
+	std::vector<Byte> image;
+	B8 count;
+};
+
+// `init` loads the constants, `body` is run `iters` times under Loop, and `extra` is the
+// number of instructions each iteration runs outside the body (in code after Exit).
+template<typename I, typename B, std::invocable<Counted&> T>
+Kernel Looped(const char* name, B8 target, I init, B body, T tail, B8 extra = 0, B8 data = 64, B8 stack = 256) {
+	Counted probe;
+	body(probe);
+	B8 per = probe.n + 1 + extra, iters = target / per ? target / per : 1;
+	Counted a;
+	init(a);
+	a.Set(Cnt, iters); a.Ref(Top, 7);
+	B8 pro = a.n;
+	a.Mark(7);
+	body(a);
+	a.I(Loop, { Cnt, Top });
+	a.I(Exit);
+	tail(a);
+	return { name, a.Image(2, { data, stack }), pro + iters * per + 1 };
+}
+template<typename I, typename B> Kernel Looped(const char* name, B8 target, I init, B body, B8 data = 64) {
+	return Looped(name, target, init, body, [](Counted&) {}, 0, data);
+}
+
+std::vector<Kernel> Kernels(B8 target) {
+	const Byte A = R0, B = R0 + 1, C = R0 + 2, D = R0 + 3, E = R0 + 4, F = R0 + 5, One = R0 + 8, Three = R0 + 9, Seven = R0 + 10, Zero = R0 + 11;
+	auto consts = [=](Counted& a) {
+		a.Set(One, 1); a.Set(Three, 3); a.Set(Seven, 7); a.Set(Zero, 0);
+		a.Set(A, 0x0123456789abcdefULL); a.Set(B, 0xfedcba9876543210ULL); a.Set(C, 12345); a.Set(D, 1234567890123ULL);
+	};
+	std::vector<Kernel> k;
+	k.push_back(Looped("nop", target, consts, [](Counted& a) { for (int j = 0; j != 8; j++) a.I(NOP); }));
+	k.push_back(Looped("alu", target, consts, [=](Counted& a) {
+		a.I(Add, { A, A, One }); a.I(Sub, { B, B, One }); a.I(Xor, { C, C, A }); a.I(And, { E, A, B });
+		a.I(Or, { E, E, C }); a.I(LMov, { F, A, Three }); a.I(RMov, { F, F, Three }); a.I(ROL, { C, C, Three });
+	}));
+	k.push_back(Looped("muldiv", target, consts, [=](Counted& a) {
+		a.I(Mul, { E, A, Seven }); a.I(IMul, { F, B, Seven }); a.I(Div, { E, F, A, Seven }); a.I(IDiv, { E, F, B, Seven });
+	}));
+	k.push_back(Looped("compare", target, consts, [=](Counted& a) {
+		// IThan/ILess/IMore are three bytes long and take their second source register
+		// from the next opcode byte.
+		a.I(Than, { E, A, B }); a.I(Less, { E, A, B }); a.I(More, { E, A, B }); a.I(IThan, { 0, E, A });
+		a.I(ILess, { 0, E, A }); a.I(IMore, { 0, E, A }); a.I(Not, { F, E }); a.I(ToBool, { F, C });
+	}));
+	k.push_back(Looped("mov", target, consts, [=](Counted& a) {
+		a.I(Mov1, { E, A }); a.I(Mov2, { E, A }); a.I(Mov4, { F, B }); a.I(Mov8, { F, B });
+		a.I(Swap, { E, F }); a.I(Complement, { E, F }); a.I(Inc, { C }); a.I(Dec, { D });
+	}));
+	k.push_back(Looped("set", target, consts, [=](Counted& a) {
+		a.I(Set1, { E, 0x12 }); a.I(Set2, { E, 0x12, 0x34 }); a.I(Set4, { F, 0x12, 0x34, 0x56, 0x78 }); a.Set(F, 0x0123456789abcdefULL);
+	}));
+	k.push_back(Looped("getwrt", target, [=](Counted& a) { consts(a); a.Ref(E, 0); a.Ref(F, 0); a.Set(C, 32); }, [=](Counted& a) {
+		a.I(Get8, { A, Byte(PreSize) }); a.I(Get4, { B, Byte(PreSize + 4) }); a.I(Get2, { B, Byte(PreSize + 8) }); a.I(Get1, { B, Byte(PreSize + 9) });
+		a.I(Wrt8, { E, A }); a.I(Wrt4, { E, B }); a.I(Wrt1, { E, B }); a.I(LEA, { F, E, C, One });
+	}));
+	k.push_back(Looped("stack", target, consts, [=](Counted& a) {
+		a.I(Psh8, { A }); a.I(Psh4, { B }); a.I(Psh2, { C }); a.I(Psh1, { D });
+		a.I(Pop1, { E }); a.I(Pop2, { E }); a.I(Pop4, { F }); a.I(Pop8, { F });
+	}));
+	// Each PshM/PopM pair saves and restores four registers: eight Psh8/Pop8 in one go.
+	k.push_back(Looped("pshm", target, consts, [=](Counted& a) {
+		for (int j = 0; j != 4; j++) { a.I(PshM, { A, 0x0f }); a.I(PopM, { A, 0x0f }); }
+	}));
+	k.push_back(Looped("branch", target, [=](Counted& a) { consts(a); for (int j = 1; j != 7; j++) a.Ref(Byte(R0 + 11 + j), j); }, [=](Counted& a) {
+		for (int j = 0; j != 2; j++) {
+			a.I(Goto, { 0, Byte(R0 + 12 + 3 * j) }); a.Mark(1 + 3 * j);
+			a.I(IfGo, { One, Byte(R0 + 13 + 3 * j) }); a.Mark(2 + 3 * j);
+			a.I(IfNG, { Zero, Byte(R0 + 14 + 3 * j) }); a.Mark(3 + 3 * j);
+			a.I(SvIp, { E });
+		}
+	}));
+	k.push_back(Looped("bcd", target, consts, [=](Counted& a) {
+		a.I(Inc, { D }); a.I(BcdF, { E, D }); a.I(BcdT, { F, E }); a.I(Add, { C, C, F });
+		a.I(SignF, { E, D, One }); a.I(SignT, { E, A, B });
+	}));
+	k.push_back(Looped("loop", target, consts, [=](Counted& a) { a.I(Add, { C, C, Seven }); a.I(Xor, { C, C, Cnt }); }));
+	// Fills a 64 KiB array one word at a time, wrapping around.
+	k.push_back(Looped("fill", target, [=](Counted& a) { consts(a); a.Ref(E, 0); a.Set(F, 0); a.Set(Seven, 8); a.Set(Three, 0xfff8); a.Ref(B, 0); }, [=](Counted& a) {
+		a.I(Wrt8, { B, C }); a.I(Add, { F, F, Seven }); a.I(And, { F, F, Three }); a.I(Add, { B, E, F }); a.I(Inc, { C });
+	}, 1 << 16));
+	k.push_back(Looped("movs", target, [=](Counted& a) { a.Ref(A, 0); a.Ref(B, 0); a.Set(C, 4096); a.I(Add, { B, B, C }); }, [=](Counted& a) {
+		a.I(MOVS, { A, B, C });
+	}, 8192));
+	k.push_back(Looped("cmps_scas", target, [=](Counted& a) { consts(a); a.Ref(A, 0); a.Ref(B, 0); a.Set(C, 4096); a.I(Add, { B, B, C }); a.Set(D, 512); }, [=](Counted& a) {
+		a.I(CMPS, { E, A, B, C }); a.I(SCAS8, { F, One, A, D });
+	}, 8192));
+	// 1024 four-byte elements: an add into the first array, then a signed sum of it.
+	k.push_back(Looped("vector", target, [=](Counted& a) { a.Ref(A, 0); a.Ref(B, 0); a.Set(C, 1024); a.Set(D, 4096); a.I(Add, { B, B, D }); }, [=](Counted& a) {
+		a.I(VADD, { 2, A, A, B, C }); a.I(VSUM, { 6, E, A, C });
+	}, 8192));
+	k.push_back(Looped("fout", target, [=](Counted& a) { consts(a); a.Set(E, 2); a.Ref(A, 0); a.Set(C, 64); }, [=](Counted& a) {
+		a.I(FOUT, { E, A, C, One, C, F });
+	}, 64));
+	// Recursion `Depth` calls deep per iteration: IfNG, Dec, Call, NOP and Ret per level,
+	// IfNG and Ret at the bottom.
+	const B8 Depth = 16;
+	k.push_back(Looped("calls", target, [=](Counted& a) { a.Ref(0, 1); a.Ref(F, 2); }, [=](Counted& a) {
+		a.Set(E, Depth); a.CallR0();
+	}, [=](Counted& a) {
+		a.Mark(1); a.I(IfNG, { E, F }); a.I(Dec, { E }); a.CallR0(); a.I(Ret);
+		a.Mark(2); a.I(Ret);
+	}, 5 * Depth + 2, 64, 1024));
+	return k;
+}
+
+// Reads "ns_per_instruction" of `name` from a file written with -s; negative if absent.
+double Baseline(const std::string& json, const char* name) {
+	size_t at = json.find("\"" + std::string(name) + "\":");
+	if (at == std::string::npos) return -1;
+	at = json.find("\"ns_per_instruction\":", at);
+	if (at == std::string::npos) return -1;
+	return strtod(json.c_str() + at + 21, nullptr);
+}
+
+int main(int argc, char** argv) {
+	B8 target = B8(1) << 24;
+	int rounds = 5;
+	double threshold = 10;
+	const char* base = nullptr, * save = nullptr;
+	bool keep = false;
+	std::vector<const char*> only, opts;
+	for (int k = 1; k < argc; k++) {
+		const char* a = argv[k];
+		if (!strcmp(a, "-n") && k + 1 < argc) target = strtoull(argv[++k], nullptr, 0);
+		else if (!strcmp(a, "-r") && k + 1 < argc) rounds = atoi(argv[++k]);
+		else if (!strcmp(a, "-b") && k + 1 < argc) base = argv[++k];
+		else if (!strcmp(a, "-s") && k + 1 < argc) save = argv[++k];
+		else if (!strcmp(a, "-t") && k + 1 < argc) threshold = atof(argv[++k]);
+		else if (!strcmp(a, "-k")) keep = true;
+		else if (a[0] == '-') opts.push_back(a);
+		else only.push_back(a);
+	}
+	if (rounds < 1) rounds = 1;
+	std::string json, options;
+	for (const char* o : opts) options += options.empty() ? o : std::string(" ") + o;
+	if (base) {
+		FILE* pFile = fopen(base, "rb");
+		if (pFile == nullptr) { fprintf(stderr, "cannot read %s\n", base); return 1; }
+		char buf[4096];
+		for (size_t got; (got = fread(buf, 1, sizeof buf, pFile)) != 0;) json.append(buf, got);
+		fclose(pFile);
+		size_t at = json.find("\"options\":");
+		if (at != std::string::npos) {
+			size_t from = json.find('"', at + 10) + 1, to = json.find('"', from);
+			if (json.compare(from, to - from, options)) fprintf(stderr, "baseline was taken with options \"%s\"\n", json.substr(from, to - from).c_str());
+		}
+	}
+	FILE* in = fopen(Null, "rb");
+	FILE* out = fopen(Null, "wb");
+	std::string report = "{\n  \"options\": \"" + options + "\",\n  \"kernels\": {";
+	int slower = 0, failed = 0;
+	printf("%s, best of %d\n", options.empty() ? "threaded" : options.c_str(), rounds);
+	printf("  %-10s %12s %9s %12s%s\n", "kernel", "instructions", "ns/inst", "inst/s", base ? "  baseline    change" : "");
+	for (Kernel& kernel : Kernels(target)) {
+		if (!only.empty()) {
+			bool want = false;
+			for (const char* o : only) want |= !strcmp(o, kernel.name);
+			if (!want) continue;
+		}
+		std::string path = std::string("op_bench_") + kernel.name + ".fnh";
+		FILE* pFile = fopen(path.c_str(), "wb");
+		if (pFile == nullptr || fwrite(kernel.image.data(), 1, kernel.image.size(), pFile) != kernel.image.size() || fclose(pFile)) {
+			fprintf(stderr, "cannot write %s\n", path.c_str()); return 1;
+		}
+		int status = 0;
+		VmImage* image = FnhLoad(path.c_str(), opts.data(), int(opts.size()), &status);
+		VmContext* vm = image ? FnhSpawn(image) : nullptr;
+		if (vm == nullptr) { fprintf(stderr, "  %-10s load failed: 0x%x\n", kernel.name, status); failed++; FnhFree(image); continue; }
+		// The first run warms caches and lets -jit compile; it is not timed.
+		int ret = FnhRun(vm, in, out);
+		double best = 0;
+		for (int r = 0; r != rounds && ret == 0 && FnhReset(vm); r++) {
+			auto t = std::chrono::steady_clock::now();
+			ret = FnhRun(vm, in, out);
+			double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t).count();
+			if (r == 0 || ns < best) best = ns;
+		}
+		FnhDrop(vm); FnhFree(image);
+		if (!keep) remove(path.c_str());
+		if (ret != 0) { fprintf(stderr, "  %-10s exit 0x%x\n", kernel.name, ret); failed++; continue; }
+		double per = best / double(kernel.count);
+		printf("  %-10s %12llu %9.3f %12.4g", kernel.name, (unsigned long long)kernel.count, per, 1e9 / per);
+		if (double was = base ? Baseline(json, kernel.name) : -1; was > 0) {
+			double change = (per / was - 1) * 100;
+			printf("  %8.3f  %+7.1f%%%s", was, change, change > threshold ? "  SLOWER" : "");
+			slower += change > threshold;
+		}
+		printf("\n");
+		char line[256];
+		snprintf(line, sizeof line, "%s\n    \"%s\": { \"instructions\": %llu, \"ns_per_instruction\": %.4f, \"instructions_per_second\": %.6g }",
+			report.back() == '{' ? "" : ",", kernel.name, (unsigned long long)kernel.count, per, 1e9 / per);
+		report += line;
+	}
+	fclose(in); fclose(out);
+	report += "\n  }\n}\n";
+	if (save) {
+		FILE* pFile = fopen(save, "wb");
+		if (pFile == nullptr || fwrite(report.data(), 1, report.size(), pFile) != report.size() || fclose(pFile)) {
+			fprintf(stderr, "cannot write %s\n", save); return 1;
+		}
+	}
+	if (base) printf("%d kernel(s) more than %.1f%% slower than %s\n", slower, threshold, base);
+	return failed ? 1 : slower ? 2 : 0;
+}
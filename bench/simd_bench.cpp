@@ -0,0 +1,76 @@
+﻿// Bytes per cycle of the MOVS/CMPS/SCAS kernels and the element kernels behind VADD..VSCAN
+// at every SIMD level the CPU supports; the element kernels also on byte-swapped data, as
+// linear images store it.
+//   g++ -std=c++23 -O2 bench/simd_bench.cpp -o simd_bench
+//   cl /std:c++latest /O2 /EHsc bench\simd_bench.cpp
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include "../simd.h"
+#if SIMD_X86 && !defined(_MSC_VER)
+#include <x86intrin.h>
+#endif
+
+const Size Bytes = Size(1) << 24;
+const int Rounds = 20;
+
+inline uint64_t Ticks() {
+#if SIMD_X86
+	return __rdtsc();
+#else
+	return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+template<typename F> double Measure(F f) {
+	uint64_t best = ~uint64_t(0);
+	for (int k = 0; k != Rounds; k++) {
+		uint64_t t = Ticks();
+		f();
+		t = Ticks() - t;
+		if (t < best) best = t;
+	}
+	return double(Bytes) / double(best);
+}
+
+volatile Size sink;
+template<typename Bn> void Scas(const char* name, const Byte* p) {
+	// The needle never occurs, so every kernel scans the whole buffer.
+	double first = Measure([&] { sink = FindFirst<Bn>(p, Bytes / sizeof(Bn), Bn(0x5a5a5a5a5a5a5a5aULL)); });
+	double last = Measure([&] { sink = FindLast<Bn>(p, Bytes / sizeof(Bn), Bn(0x5a5a5a5a5a5a5a5aULL)); });
+	printf("  %-6s %8.2f %8.2f\n", name, first, last);
+}
+
+template<typename F> void Vec(const char* name, F f) {
+	double native = Measure([&] { f(false); }), swapped = Measure([&] { f(true); });
+	printf("  %-6s %8.2f %8.2f\n", name, native, swapped);
+}
+
+int main() {
+	std::vector<Byte> a(Bytes), b(Bytes), c(Bytes);
+	for (Size i = 0; i != Bytes; i++) a[i] = b[i] = Byte(i % 89);
+	const char* names[] = { "scalar", "sse2", "avx2" };
+	printf("%llu bytes, best of %d, %s\n", (unsigned long long)Bytes, Rounds, SIMD_X86 ? "bytes per cycle" : "bytes per tick");
+	for (int level = Scalar; level <= DetectSimd(); level++) {
+		SetSimd(SimdTag(level));
+		printf("[%s]     first     last\n", names[level]);
+		Scas<uint8_t>("SCAS1", a.data());
+		Scas<uint16_t>("SCAS2", a.data());
+		Scas<uint32_t>("SCAS4", a.data());
+		Scas<uint64_t>("SCAS8", a.data());
+		double first = Measure([&] { sink = MismatchFirst(a.data(), b.data(), Bytes); });
+		double last = Measure([&] { sink = MismatchLast(a.data(), b.data(), Bytes); });
+		printf("  %-6s %8.2f %8.2f\n", "CMPS", first, last);
+		printf("           native  swapped\n");
+		Vec("VADD4", [&](bool s) { VecMap<uint32_t>(VecAdd, c.data(), a.data(), b.data(), Bytes / 4, s); });
+		Vec("VMUL8", [&](bool s) { VecMap<uint64_t>(VecMul, c.data(), a.data(), b.data(), Bytes / 8, s); });
+		Vec("VSUM1", [&](bool s) { sink = VecSum<uint8_t, true>(a.data(), Bytes, s); });
+		Vec("VMAX4", [&](bool s) { sink = VecBest<uint32_t, true, true>(a.data(), Bytes / 4, s); });
+		Vec("VFILL8", [&](bool) { VecFill<uint64_t>(c.data(), Bytes / 8, 0x0123456789abcdefULL); });
+		Vec("VSCAN8", [&](bool s) { VecScan<uint64_t>(c.data(), a.data(), Bytes / 8, s, false); });
+	}
+	double fwd = Measure([&] { ::memmove(b.data(), a.data(), Bytes); });
+	double ovl = Measure([&] { ::memmove(a.data() + 1, a.data(), Bytes - 1); });
+	printf("[memmove]  apart  overlap\n  %-6s %8.2f %8.2f\n", "MOVS", fwd, ovl);
+	return 0;
+}
@@ -0,0 +1,51 @@
+﻿// Starting a guest from a snapshot against starting it cold and running its warm-up. The
+// generated guest fills `words` words of Data and then either takes a snapshot (SNAP) or
+// does nothing (NOP) before it exits.
+//   g++ -std=c++23 -O2 -DFNH_LIBRARY bench/snap_bench.cpp app.cpp -o snap_bench
+//   cl /std:c++latest /O2 /EHsc /DFNH_LIBRARY bench\snap_bench.cpp app.cpp
+//   snap_bench [words] [runs] [options...]
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include "bench_asm.h"
+
+// Version 2 image: Pre is 16 bytes, the code below is 52, so Data starts at 68.
+bool Generate(const char* path, uint64_t words, Byte last) {
+	const uint64_t data = 16 + 52, fill = 16 + 40;
+	std::vector<Byte> c;
+	Byte set[4][2] = { { 0x90, 0 }, { 0x91, 0 }, { 0x92, 0 }, { 0x93, 0 } };
+	uint64_t imm[4] = { data, words, fill, 8 };
+	for (int k = 0; k != 4; k++) { c.push_back(0x2b); c.push_back(set[k][0]); Put(c, imm[k], 8); }
+	for (Byte x : { 0x3b, 0x90, 0x91, 0x10, 0x90, 0x90, 0x93, 0x06, 0x91, 0x92 }) c.push_back(x);
+	c.push_back(last); c.push_back(0x01);
+	std::vector<Byte> h = Header(2, c.size(), { words * 8 + 8, 256 });
+	h.insert(h.end(), c.begin(), c.end());
+	return Write(path, h);
+}
+
+template<typename F> double Measure(int runs, F f) {
+	auto t = std::chrono::steady_clock::now();
+	for (int k = 0; k != runs; k++) f();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count() / runs;
+}
+
+int main(int argc, char** argv) {
+	uint64_t words = argc > 1 ? strtoull(argv[1], nullptr, 0) : uint64_t(1) << 20;
+	int runs = argc > 2 ? atoi(argv[2]) : 20;
+	if (!Generate("snap_bench_warm.fnh", words, 0x00) || !Generate("snap_bench.fnh", words, 0x83)) {
+		fprintf(stderr, "cannot write the images\n"); return 1;
+	}
+	std::vector<char*> cold = { argv[0], (char*)"snap_bench_warm.fnh" }, snap = { argv[0], (char*)"snap_bench.fnh" };
+	for (int k = 3; k < argc; k++) { cold.push_back(argv[k]); snap.push_back(argv[k]); }
+	if (int r = FnhExec(int(snap.size()), snap.data())) { fprintf(stderr, "snapshot run failed: 0x%x\n", r); return r; }
+	snap[1] = (char*)"snap_bench.fnh.snap";
+	int ret = 0;
+	double warm = Measure(runs, [&] { ret |= FnhExec(int(cold.size()), cold.data()); });
+	double restore = Measure(runs, [&] { ret |= FnhExec(int(snap.size()), snap.data()); });
+	printf("%llu words of warm-up, %d runs, exit %d, milliseconds per run\n", (unsigned long long)words, runs, ret);
+	printf("  cold + warm-up %10.3f\n  restore        %10.3f\n", warm, restore);
+	remove("snap_bench_warm.fnh"); remove("snap_bench.fnh"); remove("snap_bench.fnh.snap");
+	return 0;
+}
@@ -0,0 +1,70 @@
+﻿// Green threads on one host worker against several: K guest threads each run a work loop,
+// then YIELD a number of times, then add 1 to a shared counter with AADD; thread 1 joins
+// them all. Prints the time of each part and the cost of a YIELD that switches threads.
+//   g++ -std=c++23 -O2 -DFNH_LIBRARY bench/threads_bench.cpp app.cpp -o threads_bench
+//   cl /std:c++latest /O2 /EHsc /DFNH_LIBRARY bench\threads_bench.cpp app.cpp
+//   threads_bench [threads] [work] [yields] [workers] [options...]
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bench_asm.h"
+
+// Work and yields are at least 1: Loop on a zero counter goes round 2^64 times.
+bool Image(const char* path, uint64_t threads, uint64_t work, uint64_t yields) {
+	Asm a;
+	a.Set(0x60, "worker"); a.Set(0x61, threads); a.Set(0x64, uint64_t(0)); a.Set(0x68, "spawn"); a.Set(0x69, "join");
+	a.Set(0x70, "end"); a.Set(0x82, 1); a.Set(0x83, "work"); a.Set(0x84, work); a.Set(0x85, yields); a.Set(0x86, "yield");
+	a.Mark("spawn");
+	// Inc r64; SPAWN r60,r64 -> r65; Psh8 r65; Loop r61
+	a.I({ 0x14, 0x64, 0x90, 0x60, 0x64, 0x65, 0x43, 0x65, 0x06, 0x61, 0x68 });
+	a.Set(0x61, threads);
+	a.Mark("join");
+	// Pop8 r65; JOIN r65 -> r66; Loop r61; Exit
+	a.I({ 0x4b, 0x65, 0x92, 0x65, 0x66, 0x06, 0x61, 0x69, 0x01 });
+	a.Mark("worker");
+	a.I({ 0x23, 0x80, 0x84 });
+	a.Mark("work");
+	a.I({ 0x10, 0x81, 0x81, 0x82, 0x06, 0x80, 0x83 });
+	a.I({ 0x23, 0x87, 0x85 });
+	a.Mark("yield");
+	a.I({ 0x91, 0x06, 0x87, 0x86 });
+	// AADD r88 = [r70] += r82; Ret
+	a.I({ 0x94, 0x88, 0x70, 0x82, 0x09 });
+	// Version 2: the counter follows the code in Data, and the stack has room for the threads.
+	return a.Save(path, 2, { 16, threads * 4096 + (1 << 16) });
+}
+
+int main(int argc, char** argv) {
+	uint64_t threads = argc > 1 ? strtoull(argv[1], nullptr, 0) : 64;
+	uint64_t work = argc > 2 ? strtoull(argv[2], nullptr, 0) : 1 << 20;
+	uint64_t yields = argc > 3 ? strtoull(argv[3], nullptr, 0) : 1 << 12;
+	unsigned workers = argc > 4 ? unsigned(strtoul(argv[4], nullptr, 0)) : std::thread::hardware_concurrency();
+	std::vector<const char*> opts;
+	for (int k = 5; k < argc; k++) opts.push_back(argv[k]);
+	const int runs = 3;
+	if (threads == 0 || work == 0 || yields == 0) { fprintf(stderr, "threads, work and yields are at least 1\n"); return 1; }
+	if (workers == 0) workers = 1;
+	// The work alone, then the yields alone (one work iteration), on each worker count.
+	if (!Image("threads_bench_work.fnh", threads, work, 1) || !Image("threads_bench_yield.fnh", threads, 1, yields)) {
+		fprintf(stderr, "cannot write the images\n"); return 1;
+	}
+	std::string many = "-threads=" + std::to_string(workers);
+	std::vector<const char*> one = opts, all = opts;
+	one.push_back("-threads=1"); all.push_back(many.c_str());
+	double work1 = Measure("threads_bench_work.fnh", one, runs);
+	double workN = Measure("threads_bench_work.fnh", all, runs);
+	double yield1 = Measure("threads_bench_yield.fnh", one, runs);
+	double yieldN = Measure("threads_bench_yield.fnh", all, runs);
+	double switches = double(threads) * double(yields);
+	printf("%llu threads, %llu work iterations and %llu yields each, best of %d\n",
+		(unsigned long long)threads, (unsigned long long)work, (unsigned long long)yields, runs);
+	printf("             work s   ns/yield\n");
+	printf("  1 worker %8.3f %10.1f\n", work1, yield1 * 1e9 / switches);
+	printf("  %u workers%8.3f %10.1f\n", workers, workN, yieldN * 1e9 / switches);
+	if (work1 && workN) printf("  speedup  %8.2f\n", work1 / workN);
+	remove("threads_bench_work.fnh"); remove("threads_bench_yield.fnh");
+	return work1 && workN && yield1 && yieldN ? 0 : 1;
+}
@@ -0,0 +1,43 @@
+﻿#pragma once
+#include <cstdio>
+
+// Embedding API. Build app.cpp with FNH_LIBRARY defined to leave out main() and link it
+// into the host program.
+//
+// An image is loaded, checked and verified once and is read-only from then on. Instances
+// spawned from it map its memory copy-on-write, so an instance costs a mapping plus the
+// pages it writes, and FnhReset() brings it back by dropping just those pages. Any
+// number of instances may run at once on different threads; the image must outlive
+// them all.
+struct VmImage;
+struct VmContext;
+
+// Loads the image at `path` with command-line options such as "-ref", "-fuse" or "-jit".
+// On failure returns nullptr and, if status is not null, the exit code app would have
+// returned (0xa1-0xa6).
+VmImage* FnhLoad(const char* path, const char* const* opts = nullptr, int optCnt = 0, int* status = nullptr);
+void FnhFree(VmImage* image);
+
+// A new instance in the state the image was loaded into, or nullptr when out of memory.
+VmContext* FnhSpawn(const VmImage* image);
+// Runs the instance with guest handle 1 reading `in` and handle 2 writing `out`; null
+// keeps stdin/stdout. Returns the guest's exit code. Run it again only after a reset,
+// or after 0xc4 (out of -fuel) or 0xc5 (past -deadline): those stop the guest before a
+// branch, and the next run goes on from there with a fresh budget. Under -threads they
+// end the guest for good, like an Exit: its threads are not kept, so reset before the
+// next run.
+// With -guard (POSIX only), the first run installs process-wide SIGSEGV and SIGBUS
+// handlers with sigaction(). They catch a push onto the guard page past the top of an
+// instance's stack and pass every other fault on to the handler that was there before.
+// A host that installs its own handler for either signal afterwards replaces them, and
+// a guest stack overflow then crashes the process instead of returning 0xb4. Such a
+// host installs its handlers first or leaves -guard out.
+int FnhRun(VmContext* vm, FILE* in = nullptr, FILE* out = nullptr);
+// Puts the instance back to the state FnhSpawn() returned; false if that failed, after
+// which the instance may only be dropped.
+bool FnhReset(VmContext* vm);
+void FnhDrop(VmContext* vm);
+
+// Runs argv[1], an image or a snapshot, with the options in argv[2..] the way app does
+// and returns its exit code.
+int FnhExec(int argc, char** argv);
@@ -0,0 +1,138 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// The LZ4 block format, written out here rather than vendored: a block is a run of
+// sequences, each a token (literal count in the high nibble, match length - 4 in the low
+// one, 15 meaning more length bytes follow, 255 at a time), the literals, and a 2-byte
+// little-endian distance back into the output to copy the match from. The last sequence
+// has literals only. Blocks from the reference lz4 unpack here and the other way round.
+
+// The most Lz4Compress() writes for n bytes.
+inline size_t Lz4Bound(size_t n) { return n + n / 255 + 16; }
+
+// Packs src[0, n) into dst, which holds Lz4Bound(n) bytes, and returns the packed size.
+// Greedy with one hash probe per position: meant for packing images ahead of time.
+inline size_t Lz4Compress(const uint8_t* src, size_t n, uint8_t* dst) {
+	const int HashBits = 16;
+	// A match starts at least 12 bytes before the end and leaves the last 5 as literals.
+	const size_t MinMatch = 4, MatchLimit = 12, LastLiterals = 5, MaxDistance = 65535;
+	uint32_t* table = new uint32_t[size_t(1) << HashBits]();
+	uint8_t* out = dst;
+	auto Read32 = [&](size_t at) { uint32_t v; ::memcpy(&v, src + at, 4); return v; };
+	auto Length = [&](size_t v) {
+		for (; v >= 255; v -= 255) *out++ = 255;
+		*out++ = uint8_t(v);
+	};
+	auto Literals = [&](size_t from, size_t lit, size_t low) {
+		*out++ = uint8_t((lit < 15 ? lit : 15) << 4 | low);
+		if (lit >= 15) Length(lit - 15);
+		if (lit) ::memcpy(out, src + from, lit);
+		out += lit;
+	};
+	size_t anchor = 0, pos = 0;
+	while (n >= MatchLimit && pos <= n - MatchLimit) {
+		uint32_t v = Read32(pos), h = v * 2654435761u >> (32 - HashBits);
+		size_t cand = table[h];
+		table[h] = uint32_t(pos);
+		if (cand >= pos || pos - cand > MaxDistance || Read32(cand) != v) { pos++; continue; }
+		size_t len = MinMatch;
+		while (pos + len < n - LastLiterals && src[cand + len] == src[pos + len]) len++;
+		size_t ml = len - MinMatch, dist = pos - cand;
+		Literals(anchor, pos - anchor, ml < 15 ? ml : 15);
+		*out++ = uint8_t(dist); *out++ = uint8_t(dist >> 8);
+		if (ml >= 15) Length(ml - 15);
+		pos += len;
+		anchor = pos;
+	}
+	Literals(anchor, n - anchor, 0);
+	delete[] table;
+	return size_t(out - dst);
+}
+
+// Unpacks the block src[0, n) into dst, which has room for cap bytes, and returns the
+// unpacked size, or SIZE_MAX if the block is malformed or does not fit. It reads and
+// writes nothing outside the two buffers; bytes of dst past the returned size may have
+// been written over.
+inline size_t Lz4Decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap) {
+	const size_t Bad = SIZE_MAX;
+	const uint8_t* ip = src;
+	const uint8_t* const end = src + n;
+	uint8_t* op = dst;
+	uint8_t* const oend = dst + cap;
+	auto Length = [&](size_t& v) {
+		uint8_t b;
+		do {
+			if (ip == end) return false;
+			b = *ip++;
+			v += b;
+		} while (b == 255);
+		return true;
+	};
+	for (;;) {
+		if (ip == end) return Bad;
+		uint8_t token = *ip++;
+		size_t lit = token >> 4;
+		if (lit == 15 && !Length(lit)) return Bad;
+		if (size_t(end - ip) < lit || size_t(oend - op) < lit) return Bad;
+		// Short runs go as one 16-byte copy when both buffers have the room.
+		if (lit <= 16 && end - ip >= 16 && oend - op >= 16) ::memcpy(op, ip, 16);
+		else ::memcpy(op, ip, lit);
+		op += lit; ip += lit;
+		if (ip == end) return size_t(op - dst);
+		if (end - ip < 2) return Bad;
+		size_t dist = size_t(ip[0]) | size_t(ip[1]) << 8;
+		ip += 2;
+		if (dist == 0 || dist > size_t(op - dst)) return Bad;
+		size_t len = token & 15;
+		if (len == 15 && !Length(len)) return Bad;
+		len += 4;
+		if (size_t(oend - op) < len) return Bad;
+		const uint8_t* m = op - dist;
+		// 16 or 8 bytes at a time when the source stays that far behind; overlapping runs
+		// that repeat a shorter pattern go byte by byte.
+		if (dist >= 16 && size_t(oend - op) >= len + 16)
+			for (size_t k = 0; k < len; k += 16) ::memcpy(op + k, m + k, 16);
+		else if (dist >= 8 && size_t(oend - op) >= len + 8)
+			for (size_t k = 0; k < len; k += 8) ::memcpy(op + k, m + k, 8);
+		else
+			for (size_t k = 0; k != len; k++) op[k] = m[k];
+		op += len;
+	}
+}
+
+// Image sections (version 4) are packed as chunks of PackChunk bytes, the last one
+// shorter: each a big-endian 4-byte word holding its stored size in the low 31 bits and
+// then the bytes, an LZ4 block, or the chunk as it is when bit 31 is set.
+const size_t PackChunk = 1 << 18;
+
+// Appends src[0, n) to out as chunks; a chunk that does not shrink is stored as it is.
+inline void Lz4PackSection(const uint8_t* src, size_t n, std::vector<uint8_t>& out) {
+	std::vector<uint8_t> buf(Lz4Bound(PackChunk));
+	for (size_t at = 0; at < n; at += PackChunk) {
+		size_t len = n - at < PackChunk ? n - at : PackChunk;
+		size_t m = Lz4Compress(src + at, len, buf.data());
+		bool keep = m >= len;
+		uint32_t w = keep ? uint32_t(len) | 0x80000000u : uint32_t(m);
+		for (int k = 24; k >= 0; k -= 8) out.push_back(uint8_t(w >> k));
+		if (keep) out.insert(out.end(), src + at, src + at + len);
+		else out.insert(out.end(), buf.begin(), buf.begin() + m);
+	}
+}
+// The bytes that follow the size word of the chunk at h.
+inline size_t Lz4ChunkStored(const uint8_t* h) {
+	return size_t(h[0] & 0x7f) << 24 | size_t(h[1]) << 16 | size_t(h[2]) << 8 | h[3];
+}
+// Unpacks the chunk at h, all 4 + Lz4ChunkStored(h) bytes of it at hand, into the want
+// bytes at dst; false if it does not hold exactly them.
+inline bool Lz4UnpackChunk(const uint8_t* h, uint8_t* dst, size_t want) {
+	size_t n = Lz4ChunkStored(h);
+	if (h[0] >> 7) {
+		if (n != want) return false;
+		::memcpy(dst, h + 4, n);
+		return true;
+	}
+	return Lz4Decompress(h + 4, n, dst, want) == want;
+}
@@ -0,0 +1,642 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstring>
+#include <bit>
+#include <limits>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define SIMD_X86 0
+#endif
+
+#if SIMD_X86 && !defined(_MSC_VER)
+#define SIMD_AVX2 __attribute__((target("avx2")))
+#else
+#define SIMD_AVX2
+#endif
+
+// Raw kernels behind MOVS/CMPS/SCAS and the element opcodes. They work on host memory
+// and know nothing about Space: element values are compared in host byte order, and the
+// caller picks the scan direction that matches the layout.
+using Byte = uint8_t;
+using Size = uint64_t;
+
+enum SimdTag : uint8_t { Scalar = 0, SSE2 = 1, AVX2 = 2 };
+
+inline SimdTag DetectSimd() {
+#if SIMD_X86
+	#if defined(_MSC_VER) && !defined(__clang__)
+	int r[4]; __cpuid(r, 0);
+	if (r[0] < 7) return SSE2;
+	__cpuid(r, 1);
+	if (!(r[2] & (1 << 27)) || !(r[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6) return SSE2;
+	__cpuidex(r, 7, 0);
+	return (r[1] & (1 << 5)) ? AVX2 : SSE2;
+	#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? AVX2 : SSE2;
+	#endif
+#else
+	return Scalar;
+#endif
+}
+inline SimdTag& SimdLevel() {
+	static SimdTag level = DetectSimd();
+	return level;
+}
+// Caps the kernels at `level`; never raises them above what the CPU supports.
+inline void SetSimd(SimdTag level) {
+	SimdTag best = DetectSimd();
+	SimdLevel() = level < best ? level : best;
+}
+
+template<typename Bn> inline Bn LoadRaw(const Byte* p) {
+	Bn v; ::memcpy(&v, p, sizeof(Bn)); return v;
+}
+
+// Index of the first / last `Bn` element equal to x in p[0..n), or n when there is none.
+template<typename Bn> inline Size FindFirstScalar(const Byte* p, Size n, Bn x) {
+	for (Size k = 0; k != n; k++) if (LoadRaw<Bn>(p + k * sizeof(Bn)) == x) return k;
+	return n;
+}
+template<typename Bn> inline Size FindLastScalar(const Byte* p, Size n, Bn x) {
+	for (Size k = n; k != 0; k--) if (LoadRaw<Bn>(p + (k - 1) * sizeof(Bn)) == x) return k - 1;
+	return n;
+}
+// Index of the first / last byte where a and b differ, or n when they are equal.
+inline Size MismatchFirstScalar(const Byte* a, const Byte* b, Size n) {
+	for (Size i = 0; i != n; i++) if (a[i] != b[i]) return i;
+	return n;
+}
+inline Size MismatchLastScalar(const Byte* a, const Byte* b, Size n) {
+	for (Size i = n; i != 0; i--) if (a[i - 1] != b[i - 1]) return i - 1;
+	return n;
+}
+
+#if SIMD_X86
+template<typename Bn> inline __m128i Splat128(Bn x) {
+	if constexpr (sizeof(Bn) == 1) return _mm_set1_epi8(char(x));
+	else if constexpr (sizeof(Bn) == 2) return _mm_set1_epi16(short(x));
+	else if constexpr (sizeof(Bn) == 4) return _mm_set1_epi32(int(x));
+	else return _mm_set1_epi64x((long long)(x));
+}
+template<typename Bn> inline __m128i CmpEq128(__m128i a, __m128i b) {
+	if constexpr (sizeof(Bn) == 1) return _mm_cmpeq_epi8(a, b);
+	else if constexpr (sizeof(Bn) == 2) return _mm_cmpeq_epi16(a, b);
+	else if constexpr (sizeof(Bn) == 4) return _mm_cmpeq_epi32(a, b);
+	else {
+		// SSE2 has no 64-bit compare: both 32-bit halves must match.
+		__m128i e = _mm_cmpeq_epi32(a, b);
+		return _mm_and_si128(e, _mm_shuffle_epi32(e, _MM_SHUFFLE(2, 3, 0, 1)));
+	}
+}
+template<typename Bn> SIMD_AVX2 inline __m256i Splat256(Bn x) {
+	if constexpr (sizeof(Bn) == 1) return _mm256_set1_epi8(char(x));
+	else if constexpr (sizeof(Bn) == 2) return _mm256_set1_epi16(short(x));
+	else if constexpr (sizeof(Bn) == 4) return _mm256_set1_epi32(int(x));
+	else return _mm256_set1_epi64x((long long)(x));
+}
+template<typename Bn> SIMD_AVX2 inline __m256i CmpEq256(__m256i a, __m256i b) {
+	if constexpr (sizeof(Bn) == 1) return _mm256_cmpeq_epi8(a, b);
+	else if constexpr (sizeof(Bn) == 2) return _mm256_cmpeq_epi16(a, b);
+	else if constexpr (sizeof(Bn) == 4) return _mm256_cmpeq_epi32(a, b);
+	else return _mm256_cmpeq_epi64(a, b);
+}
+
+// The byte masks below set every bit of a matching element, so the element index is
+// the first (or last) set bit divided by the element width.
+template<typename Bn> inline Size FindFirstSSE2(const Byte* p, Size n, Bn x) {
+	constexpr Size lanes = 16 / sizeof(Bn);
+	__m128i v = Splat128<Bn>(x);
+	Size k = 0;
+	for (; k + lanes <= n; k += lanes) {
+		uint32_t m = uint32_t(_mm_movemask_epi8(CmpEq128<Bn>(_mm_loadu_si128((const __m128i*)(p + k * sizeof(Bn))), v)));
+		if (m) return k + std::countr_zero(m) / sizeof(Bn);
+	}
+	return k + FindFirstScalar<Bn>(p + k * sizeof(Bn), n - k, x);
+}
+template<typename Bn> inline Size FindLastSSE2(const Byte* p, Size n, Bn x) {
+	constexpr Size lanes = 16 / sizeof(Bn);
+	__m128i v = Splat128<Bn>(x);
+	Size k = n;
+	while (k >= lanes) {
+		k -= lanes;
+		uint32_t m = uint32_t(_mm_movemask_epi8(CmpEq128<Bn>(_mm_loadu_si128((const __m128i*)(p + k * sizeof(Bn))), v)));
+		if (m) return k + (31 - std::countl_zero(m)) / sizeof(Bn);
+	}
+	Size r = FindLastScalar<Bn>(p, k, x);
+	return r == k ? n : r;
+}
+inline Size MismatchFirstSSE2(const Byte* a, const Byte* b, Size n) {
+	Size i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint32_t m = ~uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))))) & 0xffff;
+		if (m) return i + std::countr_zero(m);
+	}
+	return i + MismatchFirstScalar(a + i, b + i, n - i);
+}
+inline Size MismatchLastSSE2(const Byte* a, const Byte* b, Size n) {
+	Size i = n;
+	while (i >= 16) {
+		i -= 16;
+		uint32_t m = ~uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))))) & 0xffff;
+		if (m) return i + (31 - std::countl_zero(m));
+	}
+	Size r = MismatchLastScalar(a, b, i);
+	return r == i ? n : r;
+}
+
+template<typename Bn> SIMD_AVX2 inline Size FindFirstAVX2(const Byte* p, Size n, Bn x) {
+	constexpr Size lanes = 32 / sizeof(Bn);
+	__m256i v = Splat256<Bn>(x);
+	Size k = 0;
+	for (; k + lanes <= n; k += lanes) {
+		uint32_t m = uint32_t(_mm256_movemask_epi8(CmpEq256<Bn>(_mm256_loadu_si256((const __m256i*)(p + k * sizeof(Bn))), v)));
+		if (m) return k + std::countr_zero(m) / sizeof(Bn);
+	}
+	return k + FindFirstScalar<Bn>(p + k * sizeof(Bn), n - k, x);
+}
+template<typename Bn> SIMD_AVX2 inline Size FindLastAVX2(const Byte* p, Size n, Bn x) {
+	constexpr Size lanes = 32 / sizeof(Bn);
+	__m256i v = Splat256<Bn>(x);
+	Size k = n;
+	while (k >= lanes) {
+		k -= lanes;
+		uint32_t m = uint32_t(_mm256_movemask_epi8(CmpEq256<Bn>(_mm256_loadu_si256((const __m256i*)(p + k * sizeof(Bn))), v)));
+		if (m) return k + (31 - std::countl_zero(m)) / sizeof(Bn);
+	}
+	Size r = FindLastScalar<Bn>(p, k, x);
+	return r == k ? n : r;
+}
+SIMD_AVX2 inline Size MismatchFirstAVX2(const Byte* a, const Byte* b, Size n) {
+	Size i = 0;
+	for (; i + 32 <= n; i += 32) {
+		uint32_t m = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)))));
+		if (m) return i + std::countr_zero(m);
+	}
+	return i + MismatchFirstScalar(a + i, b + i, n - i);
+}
+SIMD_AVX2 inline Size MismatchLastAVX2(const Byte* a, const Byte* b, Size n) {
+	Size i = n;
+	while (i >= 32) {
+		i -= 32;
+		uint32_t m = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)))));
+		if (m) return i + (31 - std::countl_zero(m));
+	}
+	Size r = MismatchLastScalar(a, b, i);
+	return r == i ? n : r;
+}
+#endif
+
+template<typename Bn> inline Size FindFirst(const Byte* p, Size n, Bn x) {
+#if SIMD_X86
+	if (SimdLevel() >= AVX2) return FindFirstAVX2<Bn>(p, n, x);
+	if (SimdLevel() >= SSE2) return FindFirstSSE2<Bn>(p, n, x);
+#endif
+	return FindFirstScalar<Bn>(p, n, x);
+}
+template<typename Bn> inline Size FindLast(const Byte* p, Size n, Bn x) {
+#if SIMD_X86
+	if (SimdLevel() >= AVX2) return FindLastAVX2<Bn>(p, n, x);
+	if (SimdLevel() >= SSE2) return FindLastSSE2<Bn>(p, n, x);
+#endif
+	return FindLastScalar<Bn>(p, n, x);
+}
+inline Size MismatchFirst(const Byte* a, const Byte* b, Size n) {
+#if SIMD_X86
+	if (SimdLevel() >= AVX2) return MismatchFirstAVX2(a, b, n);
+	if (SimdLevel() >= SSE2) return MismatchFirstSSE2(a, b, n);
+#endif
+	return MismatchFirstScalar(a, b, n);
+}
+inline Size MismatchLast(const Byte* a, const Byte* b, Size n) {
+#if SIMD_X86
+	if (SimdLevel() >= AVX2) return MismatchLastAVX2(a, b, n);
+	if (SimdLevel() >= SSE2) return MismatchLastSSE2(a, b, n);
+#endif
+	return MismatchLastScalar(a, b, n);
+}
+
+// Kernels behind the element opcodes VADD..VSCAN. An array is n elements of Bn in host
+// memory; with `swap` each element is stored byte-swapped, as linear images keep them.
+// Elementwise ops and reductions do not care which way guest order runs through memory;
+// the scan does, and takes `back` when it runs from the end of the buffer to the start.
+enum VecTag : uint8_t { VecAdd, VecSub, VecMul, VecAnd, VecOr, VecXor };
+
+template<typename Bn> inline Bn ByteSwap(Bn v) {
+	if constexpr (sizeof(Bn) == 1) return v;
+	else return std::byteswap(v);
+}
+template<typename Bn, bool Swap> inline Bn LoadAs(const Byte* p) {
+	Bn v = LoadRaw<Bn>(p);
+	return Swap ? ByteSwap(v) : v;
+}
+template<typename Bn, bool Swap> inline void StoreAs(Byte* p, Bn v) {
+	if (Swap) v = ByteSwap(v);
+	::memcpy(p, &v, sizeof(Bn));
+}
+// The value of an element widened to 64 bits.
+template<typename Bn, bool Signed> inline uint64_t Widen(Bn v) {
+	if constexpr (Signed) return uint64_t(int64_t(std::make_signed_t<Bn>(v)));
+	else return uint64_t(v);
+}
+template<VecTag Op, typename Bn> inline Bn Apply(Bn x, Bn y) {
+	// Through 64 bits: B1 and B2 operands would otherwise be promoted to int.
+	if constexpr (Op == VecAdd) return Bn(uint64_t(x) + y);
+	else if constexpr (Op == VecSub) return Bn(uint64_t(x) - y);
+	else if constexpr (Op == VecMul) return Bn(uint64_t(x) * y);
+	else if constexpr (Op == VecAnd) return Bn(x & y);
+	else if constexpr (Op == VecOr) return Bn(x | y);
+	else return Bn(x ^ y);
+}
+
+template<VecTag Op, typename Bn, bool Swap> inline void VecMapScalar(Byte* d, const Byte* a, const Byte* b, Size n) {
+	for (Size k = 0; k != n; k++)
+		StoreAs<Bn, Swap>(d + k * sizeof(Bn), Apply<Op, Bn>(LoadAs<Bn, Swap>(a + k * sizeof(Bn)), LoadAs<Bn, Swap>(b + k * sizeof(Bn))));
+}
+template<typename Bn, bool Signed, bool Swap> inline uint64_t VecSumScalar(const Byte* p, Size n) {
+	uint64_t s = 0;
+	for (Size k = 0; k != n; k++) s += Widen<Bn, Signed>(LoadAs<Bn, Swap>(p + k * sizeof(Bn)));
+	return s;
+}
+// The smallest (largest with Max) element widened to 64 bits, or `best` when it wins.
+template<typename Bn, bool Signed, bool Max, bool Swap> inline uint64_t VecBestScalar(const Byte* p, Size n, uint64_t best) {
+	for (Size k = 0; k != n; k++) {
+		uint64_t v = Widen<Bn, Signed>(LoadAs<Bn, Swap>(p + k * sizeof(Bn)));
+		bool less = Signed ? int64_t(v) < int64_t(best) : v < best;
+		if (Max ? !less && v != best : less) best = v;
+	}
+	return best;
+}
+template<typename Bn> inline void VecFillScalar(Byte* d, Size n, Bn x) {
+	for (Size k = 0; k != n; k++) ::memcpy(d + k * sizeof(Bn), &x, sizeof(Bn));
+}
+// Inclusive prefix sums of a into d, carrying on from `c`; returns the last sum.
+template<typename Bn, bool Swap, bool Back> inline Bn VecScanScalar(Byte* d, const Byte* a, Size n, Bn c) {
+	for (Size j = 0; j != n; j++) {
+		Size k = Back ? n - 1 - j : j;
+		c = Bn(uint64_t(c) + LoadAs<Bn, Swap>(a + k * sizeof(Bn)));
+		StoreAs<Bn, Swap>(d + k * sizeof(Bn), c);
+	}
+	return c;
+}
+
+#if SIMD_X86
+// SSE2 has no byte shuffle: words are reordered first, then the bytes of each word.
+template<typename Bn> inline __m128i Swap128(__m128i x) {
+	if constexpr (sizeof(Bn) == 1) return x;
+	else {
+		if constexpr (sizeof(Bn) == 4) x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+		if constexpr (sizeof(Bn) == 8) x = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3)), _MM_SHUFFLE(0, 1, 2, 3));
+		return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+	}
+}
+template<typename Bn> inline __m128i Add128(__m128i x, __m128i y) {
+	if constexpr (sizeof(Bn) == 1) return _mm_add_epi8(x, y);
+	else if constexpr (sizeof(Bn) == 2) return _mm_add_epi16(x, y);
+	else if constexpr (sizeof(Bn) == 4) return _mm_add_epi32(x, y);
+	else return _mm_add_epi64(x, y);
+}
+template<typename Bn> inline __m128i Sub128(__m128i x, __m128i y) {
+	if constexpr (sizeof(Bn) == 1) return _mm_sub_epi8(x, y);
+	else if constexpr (sizeof(Bn) == 2) return _mm_sub_epi16(x, y);
+	else if constexpr (sizeof(Bn) == 4) return _mm_sub_epi32(x, y);
+	else return _mm_sub_epi64(x, y);
+}
+// Only 16-bit lanes have a low-half multiply; the others are built from it or from the
+// 32x32->64 _mm_mul_epu32.
+template<typename Bn> inline __m128i Mul128(__m128i x, __m128i y) {
+	if constexpr (sizeof(Bn) == 1) {
+		__m128i even = _mm_mullo_epi16(x, y), odd = _mm_mullo_epi16(_mm_srli_epi16(x, 8), _mm_srli_epi16(y, 8));
+		return _mm_or_si128(_mm_and_si128(even, _mm_set1_epi16(0xff)), _mm_slli_epi16(odd, 8));
+	}
+	else if constexpr (sizeof(Bn) == 2) return _mm_mullo_epi16(x, y);
+	else if constexpr (sizeof(Bn) == 4) {
+		__m128i even = _mm_mul_epu32(x, y), odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32));
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+	else {
+		__m128i cross = _mm_add_epi64(_mm_mul_epu32(x, _mm_srli_epi64(y, 32)), _mm_mul_epu32(_mm_srli_epi64(x, 32), y));
+		return _mm_add_epi64(_mm_mul_epu32(x, y), _mm_slli_epi64(cross, 32));
+	}
+}
+template<VecTag Op, typename Bn> inline __m128i Apply128(__m128i x, __m128i y) {
+	if constexpr (Op == VecAdd) return Add128<Bn>(x, y);
+	else if constexpr (Op == VecSub) return Sub128<Bn>(x, y);
+	else if constexpr (Op == VecMul) return Mul128<Bn>(x, y);
+	else if constexpr (Op == VecAnd) return _mm_and_si128(x, y);
+	else if constexpr (Op == VecOr) return _mm_or_si128(x, y);
+	else return _mm_xor_si128(x, y);
+}
+// Partial sums in 64-bit lanes whose total is the sum of x's elements widened to 64 bits.
+template<typename Bn, bool Signed> inline __m128i Widen128(__m128i x) {
+	const __m128i zero = _mm_setzero_si128();
+	if constexpr (sizeof(Bn) == 1) {
+		// _mm_sad_epu8 adds eight unsigned bytes; signed ones are biased by 128 first.
+		if constexpr (Signed) return _mm_sub_epi64(_mm_sad_epu8(_mm_xor_si128(x, _mm_set1_epi8(char(0x80))), zero), _mm_set1_epi64x(8 * 128));
+		else return _mm_sad_epu8(x, zero);
+	}
+	else if constexpr (sizeof(Bn) == 2) {
+		// _mm_madd_epi16 adds signed pairs; unsigned ones are biased by -32768 first.
+		__m128i s = _mm_madd_epi16(Signed ? x : _mm_xor_si128(x, _mm_set1_epi16(short(0x8000))), _mm_set1_epi16(1));
+		__m128i sign = _mm_srai_epi32(s, 31);
+		__m128i r = _mm_add_epi64(_mm_unpacklo_epi32(s, sign), _mm_unpackhi_epi32(s, sign));
+		return Signed ? r : _mm_add_epi64(r, _mm_set1_epi64x(4 * 32768));
+	}
+	else if constexpr (sizeof(Bn) == 4) {
+		__m128i sign = Signed ? _mm_srai_epi32(x, 31) : zero;
+		return _mm_add_epi64(_mm_unpacklo_epi32(x, sign), _mm_unpackhi_epi32(x, sign));
+	}
+	else return x;
+}
+template<typename Bn> inline __m128i CmpGt128(__m128i a, __m128i b) {
+	if constexpr (sizeof(Bn) == 1) return _mm_cmpgt_epi8(a, b);
+	else if constexpr (sizeof(Bn) == 2) return _mm_cmpgt_epi16(a, b);
+	else if constexpr (sizeof(Bn) == 4) return _mm_cmpgt_epi32(a, b);
+	else {
+		// SSE2 has no 64-bit compare: the high halves decide unless they are equal, and
+		// then the low halves compare unsigned.
+		__m128i low = _mm_set_epi32(0, int(0x80000000), 0, int(0x80000000));
+		__m128i gt = _mm_cmpgt_epi32(_mm_xor_si128(a, low), _mm_xor_si128(b, low));
+		__m128i r = _mm_or_si128(gt, _mm_and_si128(_mm_cmpeq_epi32(a, b), _mm_shuffle_epi32(gt, _MM_SHUFFLE(2, 2, 0, 0))));
+		return _mm_shuffle_epi32(r, _MM_SHUFFLE(3, 3, 1, 1));
+	}
+}
+// Lanewise min (max with Max). Compares are signed; flipping the top bit orders unsigned lanes.
+template<typename Bn, bool Signed, bool Max> inline __m128i Best128(__m128i a, __m128i b) {
+	__m128i bias = Signed ? _mm_setzero_si128() : Splat128<Bn>(Bn(Bn(1) << (8 * sizeof(Bn) - 1)));
+	__m128i gt = CmpGt128<Bn>(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+	if (Max) return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+	return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+template<VecTag Op, typename Bn, bool Swap> inline void VecMapSSE2(Byte* d, const Byte* a, const Byte* b, Size n) {
+	constexpr Size lanes = 16 / sizeof(Bn);
+	Size k = 0;
+	for (; k + lanes <= n; k += lanes) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + k * sizeof(Bn))), y = _mm_loadu_si128((const __m128i*)(b + k * sizeof(Bn)));
+		if (Swap) { x = Swap128<Bn>(x); y = Swap128<Bn>(y); }
+		__m128i r = Apply128<Op, Bn>(x, y);
+		_mm_storeu_si128((__m128i*)(d + k * sizeof(Bn)), Swap ? Swap128<Bn>(r) : r);
+	}
+	VecMapScalar<Op, Bn, Swap>(d + k * sizeof(Bn), a + k * sizeof(Bn), b + k * sizeof(Bn), n - k);
+}
+template<typename Bn, bool Signed, bool Swap> inline uint64_t VecSumSSE2(const Byte* p, Size n) {
+	constexpr Size lanes = 16 / sizeof(Bn);
+	__m128i acc = _mm_setzero_si128();
+	Size k = 0;
+	for (; k + lanes <= n; k += lanes) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(p + k * sizeof(Bn)));
+		acc = _mm_add_epi64(acc, Widen128<Bn, Signed>(Swap ? Swap128<Bn>(x) : x));
+	}
+	uint64_t s[2];
+	_mm_storeu_si128((__m128i*)s, acc);
+	return s[0] + s[1] + VecSumScalar<Bn, Signed, Swap>(p + k * sizeof(Bn), n - k);
+}
+template<typename Bn, bool Signed, bool Max, bool Swap> inline uint64_t VecBestSSE2(const Byte* p, Size n, uint64_t best) {
+	constexpr Size lanes = 16 / sizeof(Bn);
+	if (n < lanes) return VecBestScalar<Bn, Signed, Max, Swap>(p, n, best);
+	__m128i acc = _mm_loadu_si128((const __m128i*)p);
+	if (Swap) acc = Swap128<Bn>(acc);
+	Size k = lanes;
+	for (; k + lanes <= n; k += lanes) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(p + k * sizeof(Bn)));
+		acc = Best128<Bn, Signed, Max>(acc, Swap ? Swap128<Bn>(x) : x);
+	}
+	Byte lane[16];
+	_mm_storeu_si128((__m128i*)lane, acc);
+	best = VecBestScalar<Bn, Signed, Max, false>(lane, lanes, best);
+	return VecBestScalar<Bn, Signed, Max, Swap>(p + k * sizeof(Bn), n - k, best);
+}
+template<typename Bn> inline void VecFillSSE2(Byte* d, Size n, Bn x) {
+	constexpr Size lanes = 16 / sizeof(Bn);
+	__m128i v = Splat128<Bn>(x);
+	Size k = 0;
+	for (; k + lanes <= n; k += lanes) _mm_storeu_si128((__m128i*)(d + k * sizeof(Bn)), v);
+	VecFillScalar<Bn>(d + k * sizeof(Bn), n - k, x);
+}
+// A scan within one register takes log2(lanes) shifted adds; the carry from the previous
+// register is added to every lane. Backwards the shifts run the other way and the carry
+// leaves from the lowest lane.
+template<typename Bn, bool Swap, bool Back> inline void VecScanSSE2(Byte* d, const Byte* a, Size n) {
+	constexpr Size lanes = 16 / sizeof(Bn);
+	Bn c = 0;
+	Size j = 0;
+	for (; j + lanes <= n; j += lanes) {
+		Size k = Back ? n - j - lanes : j;
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + k * sizeof(Bn)));
+		if (Swap) x = Swap128<Bn>(x);
+		if constexpr (Back) {
+			x = Add128<Bn>(x, _mm_srli_si128(x, sizeof(Bn)));
+			if constexpr (lanes > 2) x = Add128<Bn>(x, _mm_srli_si128(x, 2 * sizeof(Bn)));
+			if constexpr (lanes > 4) x = Add128<Bn>(x, _mm_srli_si128(x, 4 * sizeof(Bn)));
+			if constexpr (lanes > 8) x = Add128<Bn>(x, _mm_srli_si128(x, 8 * sizeof(Bn)));
+		}
+		else {
+			x = Add128<Bn>(x, _mm_slli_si128(x, sizeof(Bn)));
+			if constexpr (lanes > 2) x = Add128<Bn>(x, _mm_slli_si128(x, 2 * sizeof(Bn)));
+			if constexpr (lanes > 4) x = Add128<Bn>(x, _mm_slli_si128(x, 4 * sizeof(Bn)));
+			if constexpr (lanes > 8) x = Add128<Bn>(x, _mm_slli_si128(x, 8 * sizeof(Bn)));
+		}
+		x = Add128<Bn>(x, Splat128<Bn>(c));
+		Byte lane[16];
+		_mm_storeu_si128((__m128i*)lane, x);
+		c = LoadRaw<Bn>(lane + (Back ? 0 : 16 - sizeof(Bn)));
+		_mm_storeu_si128((__m128i*)(d + k * sizeof(Bn)), Swap ? Swap128<Bn>(x) : x);
+	}
+	VecScanScalar<Bn, Swap, Back>(Back ? d : d + j * sizeof(Bn), Back ? a : a + j * sizeof(Bn), n - j, c);
+}
+
+template<typename Bn> SIMD_AVX2 inline __m256i SwapMask256() {
+	alignas(32) Byte m[32];
+	for (int k = 0; k != 32; k++) m[k] = Byte((k & 15 & ~int(sizeof(Bn) - 1)) + int(sizeof(Bn)) - 1 - (k & int(sizeof(Bn) - 1)));
+	return _mm256_load_si256((const __m256i*)m);
+}
+template<typename Bn> SIMD_AVX2 inline __m256i Add256(__m256i x, __m256i y) {
+	if constexpr (sizeof(Bn) == 1) return _mm256_add_epi8(x, y);
+	else if constexpr (sizeof(Bn) == 2) return _mm256_add_epi16(x, y);
+	else if constexpr (sizeof(Bn) == 4) return _mm256_add_epi32(x, y);
+	else return _mm256_add_epi64(x, y);
+}
+template<typename Bn> SIMD_AVX2 inline __m256i Sub256(__m256i x, __m256i y) {
+	if constexpr (sizeof(Bn) == 1) return _mm256_sub_epi8(x, y);
+	else if constexpr (sizeof(Bn) == 2) return _mm256_sub_epi16(x, y);
+	else if constexpr (sizeof(Bn) == 4) return _mm256_sub_epi32(x, y);
+	else return _mm256_sub_epi64(x, y);
+}
+template<typename Bn> SIMD_AVX2 inline __m256i Mul256(__m256i x, __m256i y) {
+	if constexpr (sizeof(Bn) == 1) {
+		__m256i even = _mm256_mullo_epi16(x, y), odd = _mm256_mullo_epi16(_mm256_srli_epi16(x, 8), _mm256_srli_epi16(y, 8));
+		return _mm256_or_si256(_mm256_and_si256(even, _mm256_set1_epi16(0xff)), _mm256_slli_epi16(odd, 8));
+	}
+	else if constexpr (sizeof(Bn) == 2) return _mm256_mullo_epi16(x, y);
+	else if constexpr (sizeof(Bn) == 4) return _mm256_mullo_epi32(x, y);
+	else {
+		__m256i cross = _mm256_add_epi64(_mm256_mul_epu32(x, _mm256_srli_epi64(y, 32)), _mm256_mul_epu32(_mm256_srli_epi64(x, 32), y));
+		return _mm256_add_epi64(_mm256_mul_epu32(x, y), _mm256_slli_epi64(cross, 32));
+	}
+}
+template<VecTag Op, typename Bn> SIMD_AVX2 inline __m256i Apply256(__m256i x, __m256i y) {
+	if constexpr (Op == VecAdd) return Add256<Bn>(x, y);
+	else if constexpr (Op == VecSub) return Sub256<Bn>(x, y);
+	else if constexpr (Op == VecMul) return Mul256<Bn>(x, y);
+	else if constexpr (Op == VecAnd) return _mm256_and_si256(x, y);
+	else if constexpr (Op == VecOr) return _mm256_or_si256(x, y);
+	else return _mm256_xor_si256(x, y);
+}
+template<typename Bn, bool Signed> SIMD_AVX2 inline __m256i Widen256(__m256i x) {
+	const __m256i zero = _mm256_setzero_si256();
+	if constexpr (sizeof(Bn) == 1) {
+		if constexpr (Signed) return _mm256_sub_epi64(_mm256_sad_epu8(_mm256_xor_si256(x, _mm256_set1_epi8(char(0x80))), zero), _mm256_set1_epi64x(8 * 128));
+		else return _mm256_sad_epu8(x, zero);
+	}
+	else if constexpr (sizeof(Bn) == 2) {
+		__m256i s = _mm256_madd_epi16(Signed ? x : _mm256_xor_si256(x, _mm256_set1_epi16(short(0x8000))), _mm256_set1_epi16(1));
+		__m256i sign = _mm256_srai_epi32(s, 31);
+		__m256i r = _mm256_add_epi64(_mm256_unpacklo_epi32(s, sign), _mm256_unpackhi_epi32(s, sign));
+		return Signed ? r : _mm256_add_epi64(r, _mm256_set1_epi64x(4 * 32768));
+	}
+	else if constexpr (sizeof(Bn) == 4) {
+		__m256i sign = Signed ? _mm256_srai_epi32(x, 31) : zero;
+		return _mm256_add_epi64(_mm256_unpacklo_epi32(x, sign), _mm256_unpackhi_epi32(x, sign));
+	}
+	else return x;
+}
+template<typename Bn, bool Signed, bool Max> SIMD_AVX2 inline __m256i Best256(__m256i a, __m256i b) {
+	if constexpr (sizeof(Bn) == 1) return Max ? (Signed ? _mm256_max_epi8(a, b) : _mm256_max_epu8(a, b)) : (Signed ? _mm256_min_epi8(a, b) : _mm256_min_epu8(a, b));
+	else if constexpr (sizeof(Bn) == 2) return Max ? (Signed ? _mm256_max_epi16(a, b) : _mm256_max_epu16(a, b)) : (Signed ? _mm256_min_epi16(a, b) : _mm256_min_epu16(a, b));
+	else if constexpr (sizeof(Bn) == 4) return Max ? (Signed ? _mm256_max_epi32(a, b) : _mm256_max_epu32(a, b)) : (Signed ? _mm256_min_epi32(a, b) : _mm256_min_epu32(a, b));
+	else {
+		__m256i bias = Signed ? _mm256_setzero_si256() : _mm256_set1_epi64x((long long)(1ULL << 63));
+		__m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(a, bias), _mm256_xor_si256(b, bias));
+		return Max ? _mm256_blendv_epi8(b, a, gt) : _mm256_blendv_epi8(a, b, gt);
+	}
+}
+
+template<VecTag Op, typename Bn, bool Swap> SIMD_AVX2 inline void VecMapAVX2(Byte* d, const Byte* a, const Byte* b, Size n) {
+	constexpr Size lanes = 32 / sizeof(Bn);
+	const __m256i mask = SwapMask256<Bn>();
+	Size k = 0;
+	for (; k + lanes <= n; k += lanes) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(a + k * sizeof(Bn))), y = _mm256_loadu_si256((const __m256i*)(b + k * sizeof(Bn)));
+		if (Swap) { x = _mm256_shuffle_epi8(x, mask); y = _mm256_shuffle_epi8(y, mask); }
+		__m256i r = Apply256<Op, Bn>(x, y);
+		_mm256_storeu_si256((__m256i*)(d + k * sizeof(Bn)), Swap ? _mm256_shuffle_epi8(r, mask) : r);
+	}
+	VecMapScalar<Op, Bn, Swap>(d + k * sizeof(Bn), a + k * sizeof(Bn), b + k * sizeof(Bn), n - k);
+}
+template<typename Bn, bool Signed, bool Swap> SIMD_AVX2 inline uint64_t VecSumAVX2(const Byte* p, Size n) {
+	constexpr Size lanes = 32 / sizeof(Bn);
+	const __m256i mask = SwapMask256<Bn>();
+	__m256i acc = _mm256_setzero_si256();
+	Size k = 0;
+	for (; k + lanes <= n; k += lanes) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(p + k * sizeof(Bn)));
+		acc = _mm256_add_epi64(acc, Widen256<Bn, Signed>(Swap ? _mm256_shuffle_epi8(x, mask) : x));
+	}
+	uint64_t s[4];
+	_mm256_storeu_si256((__m256i*)s, acc);
+	return s[0] + s[1] + s[2] + s[3] + VecSumScalar<Bn, Signed, Swap>(p + k * sizeof(Bn), n - k);
+}
+template<typename Bn, bool Signed, bool Max, bool Swap> SIMD_AVX2 inline uint64_t VecBestAVX2(const Byte* p, Size n, uint64_t best) {
+	constexpr Size lanes = 32 / sizeof(Bn);
+	if (n < lanes) return VecBestScalar<Bn, Signed, Max, Swap>(p, n, best);
+	const __m256i mask = SwapMask256<Bn>();
+	__m256i acc = _mm256_loadu_si256((const __m256i*)p);
+	if (Swap) acc = _mm256_shuffle_epi8(acc, mask);
+	Size k = lanes;
+	for (; k + lanes <= n; k += lanes) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(p + k * sizeof(Bn)));
+		acc = Best256<Bn, Signed, Max>(acc, Swap ? _mm256_shuffle_epi8(x, mask) : x);
+	}
+	Byte lane[32];
+	_mm256_storeu_si256((__m256i*)lane, acc);
+	best = VecBestScalar<Bn, Signed, Max, false>(lane, lanes, best);
+	return VecBestScalar<Bn, Signed, Max, Swap>(p + k * sizeof(Bn), n - k, best);
+}
+template<typename Bn> SIMD_AVX2 inline void VecFillAVX2(Byte* d, Size n, Bn x) {
+	constexpr Size lanes = 32 / sizeof(Bn);
+	__m256i v = Splat256<Bn>(x);
+	Size k = 0;
+	for (; k + lanes <= n; k += lanes) _mm256_storeu_si256((__m256i*)(d + k * sizeof(Bn)), v);
+	VecFillScalar<Bn>(d + k * sizeof(Bn), n - k, x);
+}
+#endif
+
+template<VecTag Op, typename Bn, bool Swap> inline void VecMapAt(Byte* d, const Byte* a, const Byte* b, Size n) {
+#if SIMD_X86
+	if (SimdLevel() >= AVX2) return VecMapAVX2<Op, Bn, Swap>(d, a, b, n);
+	if (SimdLevel() >= SSE2) return VecMapSSE2<Op, Bn, Swap>(d, a, b, n);
+#endif
+	VecMapScalar<Op, Bn, Swap>(d, a, b, n);
+}
+template<VecTag Op, typename Bn> inline void VecMapOp(Byte* d, const Byte* a, const Byte* b, Size n, bool swap) {
+	// Bitwise ops see neither the element width nor the byte order.
+	if constexpr (Op == VecAnd || Op == VecOr || Op == VecXor) VecMapAt<Op, Byte, false>(d, a, b, n * sizeof(Bn));
+	else if (swap) VecMapAt<Op, Bn, true>(d, a, b, n);
+	else VecMapAt<Op, Bn, false>(d, a, b, n);
+}
+// d[k] = a[k] op b[k] for k < n, wrapping at the element width.
+template<typename Bn> inline void VecMap(VecTag op, Byte* d, const Byte* a, const Byte* b, Size n, bool swap) {
+	switch (op) {
+		case VecAdd: return VecMapOp<VecAdd, Bn>(d, a, b, n, swap);
+		case VecSub: return VecMapOp<VecSub, Bn>(d, a, b, n, swap);
+		case VecMul: return VecMapOp<VecMul, Bn>(d, a, b, n, swap);
+		case VecAnd: return VecMapOp<VecAnd, Bn>(d, a, b, n, swap);
+		case VecOr: return VecMapOp<VecOr, Bn>(d, a, b, n, swap);
+		default: return VecMapOp<VecXor, Bn>(d, a, b, n, swap);
+	}
+}
+template<typename Bn, bool Signed, bool Swap> inline uint64_t VecSumAt(const Byte* p, Size n) {
+#if SIMD_X86
+	if (SimdLevel() >= AVX2) return VecSumAVX2<Bn, Signed, Swap>(p, n);
+	if (SimdLevel() >= SSE2) return VecSumSSE2<Bn, Signed, Swap>(p, n);
+#endif
+	return VecSumScalar<Bn, Signed, Swap>(p, n);
+}
+// The sum of the n elements at p widened to 64 bits, modulo 2^64.
+template<typename Bn, bool Signed> inline uint64_t VecSum(const Byte* p, Size n, bool swap) {
+	return swap ? VecSumAt<Bn, Signed, true>(p, n) : VecSumAt<Bn, Signed, false>(p, n);
+}
+template<typename Bn, bool Signed, bool Max, bool Swap> inline uint64_t VecBestAt(const Byte* p, Size n, uint64_t best) {
+#if SIMD_X86
+	if (SimdLevel() >= AVX2) return VecBestAVX2<Bn, Signed, Max, Swap>(p, n, best);
+	if (SimdLevel() >= SSE2) return VecBestSSE2<Bn, Signed, Max, Swap>(p, n, best);
+#endif
+	return VecBestScalar<Bn, Signed, Max, Swap>(p, n, best);
+}
+// The smallest (largest with Max) of the n elements at p widened to 64 bits; for n == 0
+// the largest (smallest) value the element can hold.
+template<typename Bn, bool Signed, bool Max> inline uint64_t VecBest(const Byte* p, Size n, bool swap) {
+	using Sn = std::make_signed_t<Bn>;
+	uint64_t best = Signed ? Widen<Bn, true>(Bn(Max ? std::numeric_limits<Sn>::min() : std::numeric_limits<Sn>::max()))
+		: Widen<Bn, false>(Max ? Bn(0) : Bn(~Bn(0)));
+	return swap ? VecBestAt<Bn, Signed, Max, true>(p, n, best) : VecBestAt<Bn, Signed, Max, false>(p, n, best);
+}
+// Stores x, already in storage byte order, into n elements at d.
+template<typename Bn> inline void VecFill(Byte* d, Size n, Bn x) {
+	if constexpr (sizeof(Bn) == 1) { ::memset(d, x, n); return; }
+#if SIMD_X86
+	if (SimdLevel() >= AVX2) return VecFillAVX2<Bn>(d, n, x);
+	if (SimdLevel() >= SSE2) return VecFillSSE2<Bn>(d, n, x);
+#endif
+	VecFillScalar<Bn>(d, n, x);
+}
+template<typename Bn, bool Swap, bool Back> inline void VecScanAt(Byte* d, const Byte* a, Size n) {
+	// AVX2 byte shifts stay inside each 128-bit half, so both levels scan with SSE2.
+#if SIMD_X86
+	if (SimdLevel() >= SSE2) return VecScanSSE2<Bn, Swap, Back>(d, a, n);
+#endif
+	VecScanScalar<Bn, Swap, Back>(d, a, n, Bn(0));
+}
+// Inclusive prefix sums of a into d, wrapping at the element width; d may be a itself.
+template<typename Bn> inline void VecScan(Byte* d, const Byte* a, Size n, bool swap, bool back) {
+	if (swap) back ? VecScanAt<Bn, true, true>(d, a, n) : VecScanAt<Bn, true, false>(d, a, n);
+	else back ? VecScanAt<Bn, false, true>(d, a, n) : VecScanAt<Bn, false, false>(d, a, n);
+}
@@ -0,0 +1,84 @@
+﻿// Runs an image on `app -serve` instead of starting app: the same arguments, the same
+// exit code, relative paths found from the same directory, and this process's stdin,
+// stdout and stderr handed over for the guest to use, while the server keeps the image
+// loaded and instances of it warm. FNH_SOCKET names the server's socket, /tmp/fnh.sock
+// by default. `-status` prints the server's cache counters and its p50/p99 latency
+// instead.
+//   g++ -std=c++23 -O2 tools/fnh_client.cpp -o fnh_client
+//   fnh_client image.fnh [options...]
+//   fnh_client -status
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// app's code for a file it cannot open, returned when the server cannot be reached.
+const int NoServer = 0xa2;
+
+bool ReadAll(int fd, void* to, size_t n) {
+	for (char* p = (char*)to; n;) {
+		ssize_t got = read(fd, p, n);
+		if (got <= 0) return false;
+		p += got; n -= size_t(got);
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	// Missing input file.
+	if (argc <= 1) return 0xa1;
+	const char* sock = getenv("FNH_SOCKET");
+	if (sock == nullptr || *sock == '\0') sock = "/tmp/fnh.sock";
+	bool status = !strcmp(argv[1], "-status");
+	// Length, this directory and then the arguments: the server runs in a directory of
+	// its own, and takes relative paths, the image's and the guest's, from this one.
+	std::string msg(4, '\0');
+	if (!status) {
+		char cwd[4096];
+		if (getcwd(cwd, sizeof cwd)) msg += cwd;
+		msg += '\0';
+		for (int k = 1; k < argc; k++) { msg += argv[k]; msg += '\0'; }
+	}
+	uint32_t n = uint32_t(msg.size() - 4);
+	memcpy(msg.data(), &n, 4);
+	sockaddr_un a{};
+	a.sun_family = AF_UNIX;
+	int fd = strlen(sock) < sizeof a.sun_path ? socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+	if (fd >= 0) memcpy(a.sun_path, sock, strlen(sock) + 1);
+	if (fd < 0 || connect(fd, (sockaddr*)&a, sizeof a) != 0) {
+		fprintf(stderr, "cannot reach the server at `%s`\n", sock);
+		return NoServer;
+	}
+	// stdin, stdout and stderr go with the first bytes.
+	int fds[3] = { 0, 1, 2 };
+	alignas(cmsghdr) char ctl[CMSG_SPACE(sizeof fds)] = {};
+	iovec v{ msg.data(), msg.size() };
+	msghdr h{};
+	h.msg_iov = &v; h.msg_iovlen = 1;
+	if (!status) {
+		h.msg_control = ctl; h.msg_controllen = sizeof ctl;
+		cmsghdr* c = CMSG_FIRSTHDR(&h);
+		c->cmsg_level = SOL_SOCKET; c->cmsg_type = SCM_RIGHTS; c->cmsg_len = CMSG_LEN(sizeof fds);
+		memcpy(CMSG_DATA(c), fds, sizeof fds);
+	}
+	size_t done = 0;
+	ssize_t put = sendmsg(fd, &h, MSG_NOSIGNAL);
+	while (put > 0 && (done += size_t(put)) != msg.size()) put = send(fd, msg.data() + done, msg.size() - done, MSG_NOSIGNAL);
+	uint32_t r;
+	if (put <= 0 || !ReadAll(fd, &r, 4)) {
+		fprintf(stderr, "the server at `%s` went away\n", sock);
+		return NoServer;
+	}
+	if (status) {
+		std::string text(r, '\0');
+		if (!ReadAll(fd, text.data(), r)) return NoServer;
+		fwrite(text.data(), 1, r, stdout);
+		r = 0;
+	}
+	close(fd);
+	return int(r);
+}
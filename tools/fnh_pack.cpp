@@ -0,0 +1,111 @@
+﻿// Writes a version 4 image: Code, and the start of Data from a file if one is given,
+// packed into LZ4 chunks the way app unpacks them, with chunks that do not shrink stored
+// as they are. Trailing zeros of Data are left to the zeros Data starts with. The input
+// is a version 2, 3 or 4 image; -raw stores both sections unpacked, which also turns a
+// packed image back into a plain one.
+//   g++ -std=c++23 -O2 tools/fnh_pack.cpp -o fnh_pack
+//   cl /std:c++latest /O2 /EHsc tools\fnh_pack.cpp
+//   fnh_pack in.fnh out.fnh [data.bin] [-raw]
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "../lz4.h"
+
+using Byte = uint8_t;
+using B8 = uint64_t;
+
+const uint32_t Magic = 0x1BF52;
+
+B8 Get(const Byte* p, int n) {
+	B8 v = 0;
+	for (int k = 0; k != n; k++) v = v << 8 | p[k];
+	return v;
+}
+void Put(std::vector<Byte>& v, B8 x, int n) {
+	for (int k = n - 1; k >= 0; k--) v.push_back(Byte(x >> (8 * k)));
+}
+bool Load(const char* path, std::vector<Byte>& v) {
+	FILE* pFile = fopen(path, "rb");
+	if (pFile == nullptr) return false;
+	Byte buf[1 << 16];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof buf, pFile)) > 0) v.insert(v.end(), buf, buf + n);
+	bool ok = !ferror(pFile);
+	fclose(pFile);
+	return ok;
+}
+
+// The size bytes a packed section of `stored` bytes holds; false if it is damaged.
+bool Unpack(const Byte* p, size_t stored, size_t size, std::vector<Byte>& out) {
+	out.resize(size);
+	size_t at = 0, done = 0;
+	while (done != size) {
+		if (stored - at < 4) return false;
+		size_t n = Lz4ChunkStored(p + at), want = size - done < PackChunk ? size - done : PackChunk;
+		if (stored - at - 4 < n || !Lz4UnpackChunk(p + at, out.data() + done, want)) return false;
+		at += 4 + n; done += want;
+	}
+	return at == stored;
+}
+
+int main(int argc, char** argv) {
+	const char* paths[3] = {};
+	int pathCnt = 0;
+	bool raw = false;
+	for (int k = 1; k < argc; k++) {
+		if (!strcmp(argv[k], "-raw")) raw = true;
+		else if (pathCnt < 3) paths[pathCnt++] = argv[k];
+	}
+	if (pathCnt < 2) { fprintf(stderr, "usage: fnh_pack in.fnh out.fnh [data.bin] [-raw]\n"); return 1; }
+	std::vector<Byte> in;
+	if (!Load(paths[0], in)) { fprintf(stderr, "cannot read `%s`\n", paths[0]); return 1; }
+	if (in.size() < 32 || Get(in.data(), 4) != Magic) { fprintf(stderr, "`%s` is not an image\n", paths[0]); return 1; }
+	int version = in[4];
+	// Version 1 keeps Space backwards; app reads it, but there is nothing to pack it into.
+	if (version < 2) { fprintf(stderr, "`%s` is a version 1 image\n", paths[0]); return 1; }
+	size_t head = version >= 4 ? 72 : version >= 3 ? 40 : 32;
+	if (in.size() < head) { fprintf(stderr, "`%s` is cut short\n", paths[0]); return 1; }
+	B8 codeSize = Get(&in[8], 8), dataSize = Get(&in[16], 8), stackSize = Get(&in[24], 8);
+	B8 heapSize = version >= 3 ? Get(&in[32], 8) : 0;
+	B8 initSize = 0, codeStored = codeSize, initStored = 0;
+	bool codePack = false, initPack = false;
+	if (version >= 4) {
+		initSize = Get(&in[40], 8); codeStored = Get(&in[48], 8); initStored = Get(&in[56], 8);
+		codePack = in[64]; initPack = in[65];
+	}
+	std::vector<Byte> code, init;
+	const Byte* body = in.data() + head;
+	size_t left = in.size() - head;
+	bool ok = codeStored <= left && initStored <= left - codeStored && (codePack || codeStored == codeSize) && (initPack || initStored == initSize);
+	if (ok && codePack) ok = Unpack(body, codeStored, codeSize, code);
+	else if (ok) code.assign(body, body + codeSize);
+	if (ok && initPack) ok = Unpack(body + codeStored, initStored, initSize, init);
+	else if (ok) init.assign(body + codeStored, body + codeStored + initSize);
+	if (!ok) { fprintf(stderr, "`%s` is damaged\n", paths[0]); return 1; }
+	if (pathCnt == 3) {
+		init.clear();
+		if (!Load(paths[2], init)) { fprintf(stderr, "cannot read `%s`\n", paths[2]); return 1; }
+	}
+	while (!init.empty() && init.back() == 0) init.pop_back();
+	if (init.size() > dataSize) dataSize = init.size();
+	std::vector<Byte> codeOut = raw ? code : std::vector<Byte>(), initOut = raw ? init : std::vector<Byte>();
+	if (!raw) { Lz4PackSection(code.data(), code.size(), codeOut); Lz4PackSection(init.data(), init.size(), initOut); }
+	std::vector<Byte> out;
+	Put(out, Magic, 4);
+	out.push_back(4); out.push_back(0); out.push_back(0);
+	out.push_back(in[7]);
+	for (B8 v : { B8(code.size()), dataSize, stackSize, heapSize, B8(init.size()), B8(codeOut.size()), B8(initOut.size()) }) Put(out, v, 8);
+	out.push_back(raw ? 0 : 1); out.push_back(raw ? 0 : 1);
+	out.insert(out.end(), 6, 0);
+	out.insert(out.end(), codeOut.begin(), codeOut.end());
+	out.insert(out.end(), initOut.begin(), initOut.end());
+	FILE* pFile = fopen(paths[1], "wb");
+	if (pFile == nullptr || fwrite(out.data(), 1, out.size(), pFile) != out.size() || fclose(pFile) != 0) {
+		fprintf(stderr, "cannot write `%s`\n", paths[1]); return 1;
+	}
+	printf("Code %llu -> %llu bytes, Data %llu -> %llu bytes, image %zu bytes\n",
+		(unsigned long long)code.size(), (unsigned long long)codeOut.size(), (unsigned long long)init.size(), (unsigned long long)initOut.size(), out.size());
+	return 0;
+}
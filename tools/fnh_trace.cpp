@@ -0,0 +1,124 @@
+﻿// Decodes the `<image>.trace` that app -trace writes when a guest stops on a runtime
+// error: the last instructions it ran, each with the registers it read and wrote.
+// Register values are rebuilt backwards from the final Vp, using the old value every
+// entry kept of the registers it was about to write. Entries with n | 0x80 continue the
+// one before them, for instructions that write more than two registers (PopM).
+//   g++ -std=c++23 -O2 tools/fnh_trace.cpp -o fnh_trace
+//   cl /std:c++latest /O2 /EHsc tools\fnh_trace.cpp
+//   fnh_trace image.fnh.trace [last]
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using Byte = uint8_t;
+using B8 = uint64_t;
+
+const uint32_t Magic = 0x1BF55;
+const size_t EntrySize = 28;
+
+struct Reader {
+	const std::vector<Byte>& b;
+	size_t at = 0;
+	bool ok = true;
+	B8 Get(int n) {
+		if (at + n > b.size()) { ok = false; return 0; }
+		B8 v = 0;
+		for (int k = 0; k != n; k++) v = v << 8 | b[at++];
+		return v;
+	}
+	const Byte* Skip(size_t n) {
+		if (at + n > b.size()) { ok = false; return nullptr; }
+		at += n;
+		return b.data() + at - n;
+	}
+};
+
+struct Entry { B8 ip, old[2]; Byte op, n, reg[2]; };
+// An instruction: its first entry and the registers of any that continue it.
+struct Inst { B8 ip; Byte op; std::vector<std::pair<Byte, B8>> w; };
+
+int main(int argc, char** argv) {
+	if (argc < 2) { fprintf(stderr, "usage: fnh_trace image.fnh.trace [last]\n"); return 1; }
+	size_t last = argc > 2 ? strtoull(argv[2], nullptr, 10) : 32;
+	FILE* pFile = fopen(argv[1], "rb");
+	if (pFile == nullptr) { perror(argv[1]); return 1; }
+	std::vector<Byte> b;
+	Byte buf[1 << 16];
+	for (size_t got; (got = fread(buf, 1, sizeof buf, pFile)) != 0;) b.insert(b.end(), buf, buf + got);
+	fclose(pFile);
+
+	Reader r{ b };
+	if (r.Get(4) != Magic) { fprintf(stderr, "%s: not a trace\n", argv[1]); return 1; }
+	const Byte* fmt = r.Skip(4);
+	if (!fmt || fmt[0] != 1) { fprintf(stderr, "%s: unknown trace format\n", argv[1]); return 1; }
+	B8 code = r.Get(8), total = r.Get(8), cnt = r.Get(8), begin = r.Get(8), bytes = r.Get(8);
+	B8 vp[256];
+	for (B8& v : vp) v = r.Get(8);
+	Byte len[256]; char name[256][17] = {};
+	for (int f = 0; f != 256; f++) {
+		len[f] = Byte(r.Get(1));
+		if (const Byte* p = r.Skip(16)) memcpy(name[f], p, 16);
+	}
+	std::vector<Entry> e(r.ok && cnt <= (b.size() - r.at) / EntrySize ? cnt : 0);
+	for (Entry& x : e) {
+		x.ip = r.Get(8); x.old[0] = r.Get(8); x.old[1] = r.Get(8);
+		x.op = Byte(r.Get(1)); x.n = Byte(r.Get(1)); x.reg[0] = Byte(r.Get(1)); x.reg[1] = Byte(r.Get(1));
+	}
+	const Byte* codeBytes = r.Skip(bytes);
+	if (!r.ok || e.size() != cnt) { fprintf(stderr, "%s: truncated\n", argv[1]); return 1; }
+
+	// Continuations the ring cut off from their first entry are dropped.
+	std::vector<Inst> ins;
+	for (const Entry& x : e) {
+		if (x.n & 0x80) { if (ins.empty()) continue; }
+		else ins.push_back({ x.ip, x.op, {} });
+		for (int j = 0; j != (x.n & 0x7f) && j != 2; j++) ins.back().w.push_back({ x.reg[j], x.old[j] });
+	}
+	size_t insCnt = ins.size();
+	printf("exit 0x%llx after %llu entries, %llu in the ring, ip 0x%llx\n",
+		(unsigned long long)code, (unsigned long long)total, (unsigned long long)cnt, (unsigned long long)vp[0x10]);
+	if (last > insCnt) last = insCnt;
+	// before[k]: Vp as the k-th shown instruction found it; the one after it is what it left.
+	std::vector<std::vector<B8>> before(last + 1);
+	before[last].assign(vp, vp + 256);
+	std::vector<B8> state(vp, vp + 256);
+	for (size_t k = insCnt; k-- != insCnt - last;) {
+		for (size_t j = ins[k].w.size(); j-- != 0;) state[ins[k].w[j].first] = ins[k].w[j].second;
+		before[k - (insCnt - last)] = state;
+	}
+	for (size_t k = 0; k != last; k++) {
+		const Inst& x = ins[insCnt - last + k];
+		const std::vector<B8>& in = before[k], & out = before[k + 1];
+		printf("%6lld  0x%08llx  %-10s", (long long)k - (long long)last, (unsigned long long)x.ip, name[x.op]);
+		int n = len[x.op];
+		bool have = n != 0xff && x.ip >= begin && x.ip - begin + 1 + n <= bytes;
+		if (have) {
+			const Byte* p = codeBytes + (x.ip - begin);
+			if (p[0] != x.op) printf(" (code changed since)");
+			bool set = !strncmp(name[x.op], "Set", 3), get = !strncmp(name[x.op], "Get", 3);
+			// PshM/PopM: a first register and a mask.
+			bool mask = !strcmp(name[x.op], "PshM") || !strcmp(name[x.op], "PopM");
+			// The element opcodes (VADD...) start with a kind byte.
+			bool vec = name[x.op][0] == 'V';
+			for (int j = 1; j <= n; j++) {
+				if (set && j > 1) {
+					B8 imm = 0;
+					for (; j <= n; j++) imm = imm << 8 | p[j];
+					printf(" #0x%llx", (unsigned long long)imm);
+				}
+				else if (get && j == 2) printf(" @0x%x", p[j]);
+				else if (vec && j == 1) printf(" #0x%x", p[j]);
+				else if (mask && j == 1) printf(" r%02x", p[j]);
+				else if (mask && j == 2) printf(" #0x%02x", p[j]);
+				else printf(" r%02x=0x%llx", p[j], (unsigned long long)in[p[j]]);
+			}
+		}
+		else if (n != 0) printf(" (operands not in the code)");
+		for (size_t j = 0; j != x.w.size(); j++)
+			printf("%s r%02x=0x%llx", j ? "," : "  ->", x.w[j].first, (unsigned long long)out[x.w[j].first]);
+		printf("\n");
+	}
+	return 0;
+}